@@ -0,0 +1,99 @@
+/***************************************************************************
+ * Module:	aosl benchmark header file
+ *
+ * Copyright © 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+#ifndef __AOSL_BENCH_H__
+#define __AOSL_BENCH_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "api/aosl_types.h"
+#include "api/aosl_atomic.h"
+
+#define UNUSED(expr) (void)(expr)
+#define BENCH_LOG(fmt, ...) fprintf(stderr, "[%s:%u] " fmt "\n", __FUNCTION__, __LINE__, ##__VA_ARGS__)
+
+/**
+ * @brief The benchmark suite entry, returns 0 on success.
+ **/
+typedef int (*bench_suite_t)(void);
+
+/**
+ * @brief Report one result of the running suite, all the results are
+ * written as a JSON document after all the suites finished.
+ * Parameters:
+ *    name: the metric name, unique in the suite
+ *   value: the measured value
+ *    unit: the value unit, such as "ns", "bytes", "ops/s"
+ **/
+extern void bench_report(const char *name, double value, const char *unit);
+
+/**
+ * @brief Report the average, p50, p99 and max of the latency samples in ns
+ * as the results "<name>_avg", "<name>_p50", "<name>_p99", "<name>_max".
+ * The samples array is sorted.
+ **/
+extern void bench_report_latency(const char *name, uint64_t *samples, size_t count);
+
+/* monotonic time in nanoseconds */
+extern uint64_t bench_now_ns(void);
+
+/**
+ * @brief Get the virtual and resident memory size of the process in bytes.
+ * Return value:
+ *    0 on success, <0 when not supported on this platform.
+ **/
+extern int bench_mem_usage(size_t *vm_bytes, size_t *rss_bytes);
+
+/**
+ * @brief Raise the fds limit as possible.
+ * Return value:
+ *    the fds count limit after raising.
+ **/
+extern size_t bench_raise_fd_limit(void);
+
+/* online cpu count, at least 1 */
+extern int bench_cpu_count(void);
+
+/**
+ * @brief Wait until the counter reaches the target.
+ * Return value:
+ *    0 on success, <0 when timed out.
+ **/
+extern int bench_wait_count(aosl_atomic_t *count, intptr_t target, int timeo_ms);
+
+/**
+ * @brief Get the count of aosl_hal_malloc calls so far.
+ * Return value:
+ *    the calls count, always 0 when the counting is not supported.
+ **/
+extern uint64_t bench_alloc_count(void);
+
+/* suites */
+extern int bench_mpq(void);
+extern int bench_mpq_pri(void);
+extern int bench_mpq_call(void);
+extern int bench_mpq_create(void);
+extern int bench_mpqp(void);
+extern int bench_timer(void);
+extern int bench_ref(void);
+extern int bench_udp_pps(void);
+extern int bench_tcp_pps(void);
+extern int bench_marshal(void);
+extern int bench_marshal_nested(void);
+extern int bench_psb_fanout(void);
+extern int bench_iofd_mem(void);
+extern int bench_wq_congestion(void);
+extern int bench_tls(void);
+extern int bench_log(void);
+extern int bench_accept(void);
+extern int bench_flow(void);
+extern int bench_hash(void);
+extern int bench_rbtree(void);
+
+#endif /* __AOSL_BENCH_H__ */
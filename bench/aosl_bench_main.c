@@ -0,0 +1,294 @@
+/***************************************************************************
+ * Module:	aosl benchmark
+ *
+ * Copyright © 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "api/aosl.h"
+#include "api/aosl_time.h"
+#include "api/aosl_version.h"
+#include "aosl_bench.h"
+
+static const struct {
+  const char *name;
+  bench_suite_t run;
+} bench_suites[] = {
+  { "mpq", bench_mpq },
+  { "mpq_pri", bench_mpq_pri },
+  { "mpq_call", bench_mpq_call },
+  { "mpq_create", bench_mpq_create },
+  { "mpqp", bench_mpqp },
+  { "timer", bench_timer },
+  { "ref", bench_ref },
+  { "udp_pps", bench_udp_pps },
+  { "tcp_pps", bench_tcp_pps },
+  { "marshal", bench_marshal },
+  { "marshal_nested", bench_marshal_nested },
+  { "psb_fanout", bench_psb_fanout },
+  { "iofd_mem", bench_iofd_mem },
+  { "wq_congestion", bench_wq_congestion },
+  { "tls", bench_tls },
+  { "log", bench_log },
+  { "accept", bench_accept },
+  { "flow", bench_flow },
+  { "hash", bench_hash },
+  { "rbtree", bench_rbtree },
+};
+
+#define BENCH_RESULTS_MAX 512
+
+static struct {
+  const char *suite;
+  char name[64];
+  double value;
+  const char *unit;
+} bench_results[BENCH_RESULTS_MAX];
+
+static size_t bench_result_count = 0;
+static const char *running_suite = "";
+
+void bench_report(const char *name, double value, const char *unit)
+{
+  if (bench_result_count < BENCH_RESULTS_MAX) {
+    bench_results[bench_result_count].suite = running_suite;
+    snprintf(bench_results[bench_result_count].name, sizeof bench_results[0].name, "%s", name);
+    bench_results[bench_result_count].value = value;
+    bench_results[bench_result_count].unit = unit;
+    bench_result_count++;
+  }
+
+  BENCH_LOG("%s.%s: %.3f %s", running_suite, name, value, unit);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+void bench_report_latency(const char *name, uint64_t *samples, size_t count)
+{
+  char metric[64];
+  double sum = 0;
+  size_t i;
+
+  if (count == 0)
+    return;
+
+  qsort(samples, count, sizeof samples[0], cmp_u64);
+  for (i = 0; i < count; i++)
+    sum += (double)samples[i];
+
+  snprintf(metric, sizeof metric, "%s_avg", name);
+  bench_report(metric, sum / count, "ns");
+  snprintf(metric, sizeof metric, "%s_p50", name);
+  bench_report(metric, (double)samples[count / 2], "ns");
+  snprintf(metric, sizeof metric, "%s_p99", name);
+  bench_report(metric, (double)samples[count * 99 / 100], "ns");
+  snprintf(metric, sizeof metric, "%s_max", name);
+  bench_report(metric, (double)samples[count - 1], "ns");
+}
+
+int bench_cpu_count(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+int bench_wait_count(aosl_atomic_t *count, intptr_t target, int timeo_ms)
+{
+  uint64_t start = bench_now_ns();
+
+  while (aosl_atomic_read(count) < target) {
+    if (bench_now_ns() - start > (uint64_t)timeo_ms * 1000000ull)
+      return -1;
+
+    aosl_msleep(1);
+  }
+
+  return 0;
+}
+
+static void write_json(FILE *fp, int failed)
+{
+  size_t i;
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"branch\": \"%s\",\n", aosl_get_git_branch());
+  fprintf(fp, "  \"commit\": \"%s\",\n", aosl_get_git_commit());
+  fprintf(fp, "  \"time\": %lld,\n", (long long)time(NULL));
+  fprintf(fp, "  \"cpus\": %d,\n", bench_cpu_count());
+  fprintf(fp, "  \"failed_suites\": %d,\n", failed);
+  fprintf(fp, "  \"results\": [");
+  for (i = 0; i < bench_result_count; i++) {
+    fprintf(fp, "%s\n    { \"suite\": \"%s\", \"name\": \"%s\", \"value\": %.3f, \"unit\": \"%s\" }",
+            i > 0 ? "," : "", bench_results[i].suite, bench_results[i].name, bench_results[i].value,
+            bench_results[i].unit);
+  }
+  fprintf(fp, "\n  ]\n}\n");
+}
+
+uint64_t bench_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int bench_mem_usage(size_t *vm_bytes, size_t *rss_bytes)
+{
+#if defined(__linux__)
+  unsigned long vm_pages, rss_pages;
+  FILE *fp = fopen("/proc/self/statm", "r");
+  int n;
+
+  if (fp == NULL)
+    return -1;
+
+  n = fscanf(fp, "%lu %lu", &vm_pages, &rss_pages);
+  fclose(fp);
+  if (n != 2)
+    return -1;
+
+  *vm_bytes = (size_t)vm_pages * (size_t)sysconf(_SC_PAGESIZE);
+  *rss_bytes = (size_t)rss_pages * (size_t)sysconf(_SC_PAGESIZE);
+  return 0;
+#else
+  UNUSED(vm_bytes);
+  UNUSED(rss_bytes);
+  return -1;
+#endif
+}
+
+size_t bench_raise_fd_limit(void)
+{
+  struct rlimit rl;
+
+  if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+    return 1024;
+
+  if (rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    getrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  return (size_t)rl.rlim_cur;
+}
+
+#if defined(BENCH_WRAP_MALLOC)
+static aosl_atomic_t malloc_calls;
+
+/* linked with --wrap=aosl_hal_malloc */
+extern void *__real_aosl_hal_malloc(size_t size);
+
+void *__wrap_aosl_hal_malloc(size_t size)
+{
+  aosl_atomic_inc(&malloc_calls);
+  return __real_aosl_hal_malloc(size);
+}
+
+uint64_t bench_alloc_count(void)
+{
+  return (uint64_t)aosl_atomic_read(&malloc_calls);
+}
+#else
+uint64_t bench_alloc_count(void)
+{
+  return 0;
+}
+#endif
+
+static int suite_selected(const char *name, int argc, char *argv[])
+{
+  int selected = 0;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0) {
+      i++;
+      continue;
+    }
+
+    selected = -1;
+    if (strcmp(argv[i], name) == 0)
+      return 1;
+  }
+
+  /* all suites when none is specified */
+  return selected == 0;
+}
+
+static void usage(const char *prog)
+{
+  size_t i;
+
+  fprintf(stderr, "usage: %s [-o result.json] [suite ...]\nsuites:", prog);
+  for (i = 0; i < sizeof bench_suites / sizeof bench_suites[0]; i++)
+    fprintf(stderr, " %s", bench_suites[i].name);
+
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+  const char *output = NULL;
+  FILE *fp = stdout;
+  size_t i;
+  int failed = 0;
+  int j;
+
+  for (j = 1; j < argc; j++) {
+    if (strcmp(argv[j], "-o") == 0) {
+      if (++j >= argc) {
+        usage(argv[0]);
+        return 2;
+      }
+      output = argv[j];
+    } else if (argv[j][0] == '-') {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  aosl_ctor();
+
+  for (i = 0; i < sizeof bench_suites / sizeof bench_suites[0]; i++) {
+    if (!suite_selected(bench_suites[i].name, argc, argv))
+      continue;
+
+    running_suite = bench_suites[i].name;
+    BENCH_LOG("running suite %s", running_suite);
+    if (bench_suites[i].run() != 0) {
+      BENCH_LOG("suite %s failed", bench_suites[i].name);
+      failed++;
+    }
+  }
+
+  aosl_dtor();
+
+  if (output != NULL) {
+    fp = fopen(output, "w");
+    if (fp == NULL) {
+      BENCH_LOG("open %s failed", output);
+      return 1;
+    }
+  }
+
+  write_json(fp, failed);
+  if (fp != stdout)
+    fclose(fp);
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,328 @@
+/***************************************************************************
+ * Module:	aosl connection accepting benchmark
+ *
+ * Copyright © 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+#include <string.h>
+
+#include "api/aosl_mpq.h"
+#include "api/aosl_mpqp.h"
+#include "api/aosl_mpq_net.h"
+#include "api/aosl_socket.h"
+#include "api/aosl_atomic.h"
+#include "api/aosl_time.h"
+#include "hal/aosl_hal_socket.h"
+#include "aosl_bench.h"
+
+/**
+ * Loopback connection storm: the client queues connect and close as fast
+ * as they can, the server spends ACCEPT_SESSION_US on setting up each new
+ * session in the accepted callback. The single listener accepts all the
+ * connections on one queue, the sharded listeners accept them on all the
+ * queues of a pool. The batched listener accepts up to ACCEPT_BATCH
+ * connections per wakeup on one queue, the placing listener also adds them
+ * as stream sockets onto the least loaded queues of a pool, where the
+ * session setup runs. The backlog is big enough for all the connections,
+ * so no SYN retransmission gets into the result.
+ **/
+#define ACCEPT_CONNS 4000
+#define ACCEPT_CLIENTS 4
+#define ACCEPT_SESSION_US 20
+#define ACCEPT_BACKLOG 4096
+#define ACCEPT_MAX_QS 16
+#define ACCEPT_BATCH 64
+
+struct accept_bench {
+  aosl_sockaddr_t addr;
+  aosl_atomic_t started;
+  aosl_atomic_t accepted;
+  aosl_atomic_t failed;
+  uint64_t last_accept_ns;
+};
+
+static void accept_on_event(aosl_fd_t fd, int event, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(fd);
+  UNUSED(event);
+  UNUSED(argc);
+  UNUSED(argv);
+}
+
+/* the session setup */
+static void accept_session_setup(void)
+{
+  uint64_t start = bench_now_ns();
+
+  while (bench_now_ns() - start < ACCEPT_SESSION_US * 1000)
+    ;
+}
+
+static void accept_on_accepted(aosl_accept_data_t *accept_data, size_t len, uintptr_t argc, uintptr_t argv[])
+{
+  struct accept_bench *b = (struct accept_bench *)argv[0];
+  UNUSED(len);
+  UNUSED(argc);
+
+  accept_session_setup();
+
+  aosl_hal_sk_close(accept_data->newsk);
+  b->last_accept_ns = bench_now_ns();
+  aosl_atomic_inc(&b->accepted);
+}
+
+static void accept_on_placed(aosl_accept_data_t *accept_data, size_t len, uintptr_t argc, uintptr_t argv[])
+{
+  struct accept_bench *b = (struct accept_bench *)argv[0];
+  UNUSED(len);
+  UNUSED(argc);
+
+  accept_session_setup();
+
+  /* the socket was added onto this queue */
+  aosl_close(accept_data->newsk);
+  b->last_accept_ns = bench_now_ns();
+  aosl_atomic_inc(&b->accepted);
+}
+
+static void accept_on_data(void *data, size_t len, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(data);
+  UNUSED(len);
+  UNUSED(argc);
+  UNUSED(argv);
+}
+
+static void accept_client_func(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  struct accept_bench *b = (struct accept_bench *)argv[0];
+  aosl_fd_t fd;
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+
+  while (aosl_atomic_add_return(1, &b->started) <= ACCEPT_CONNS) {
+    fd = aosl_socket(AOSL_AF_INET, AOSL_SOCK_STREAM, AOSL_IPPROTO_TCP);
+    if (aosl_fd_invalid(fd)) {
+      aosl_atomic_inc(&b->failed);
+      continue;
+    }
+
+    if (aosl_hal_sk_connect(fd, &b->addr) < 0)
+      aosl_atomic_inc(&b->failed);
+
+    aosl_hal_sk_close(fd);
+  }
+}
+
+/* run the clients against the listening address, returns the connections per second */
+static double accept_run(struct accept_bench *b)
+{
+  aosl_mpq_t qs[ACCEPT_CLIENTS];
+  uint64_t start;
+  double rate = -1;
+  int i;
+
+  for (i = 0; i < ACCEPT_CLIENTS; i++)
+    qs[i] = AOSL_MPQ_INVALID;
+
+  for (i = 0; i < ACCEPT_CLIENTS; i++) {
+    qs[i] = aosl_mpq_create(0, 0, 10, "bench-conn", NULL, NULL, NULL);
+    if (aosl_mpq_invalid(qs[i]))
+      goto __out;
+  }
+
+  start = bench_now_ns();
+  for (i = 0; i < ACCEPT_CLIENTS; i++) {
+    if (aosl_mpq_queue(qs[i], AOSL_MPQ_INVALID, AOSL_REF_INVALID, "accept_client_func", accept_client_func, 1, b) < 0)
+      goto __out;
+  }
+
+  if (bench_wait_count(&b->accepted, ACCEPT_CONNS, 30000) < 0) {
+    BENCH_LOG("%d connections failed, %d accepted", (int)aosl_atomic_read(&b->failed), (int)aosl_atomic_read(&b->accepted));
+    goto __out;
+  }
+
+  rate = ACCEPT_CONNS / ((double)(b->last_accept_ns - start) / 1e9);
+
+__out:
+  for (i = 0; i < ACCEPT_CLIENTS; i++) {
+    if (!aosl_mpq_invalid(qs[i]))
+      aosl_mpq_destroy_wait(qs[i]);
+  }
+
+  return rate;
+}
+
+static void accept_bench_init(struct accept_bench *b)
+{
+  memset(b, 0, sizeof *b);
+  b->addr.sa_family = AOSL_AF_INET;
+  aosl_inet_addr_from_string(&b->addr.sin_addr, "127.0.0.1");
+}
+
+static double accept_single(void)
+{
+  static struct accept_bench b;
+  aosl_mpq_t srv_q;
+  aosl_fd_t listen_fd;
+  double rate = -1;
+
+  accept_bench_init(&b);
+  srv_q = aosl_mpq_create(0, 0, 1000, "accept-srv", NULL, NULL, NULL);
+  if (aosl_mpq_invalid(srv_q))
+    return -1;
+
+  listen_fd = aosl_socket(AOSL_AF_INET, AOSL_SOCK_STREAM, AOSL_IPPROTO_TCP);
+  if (aosl_fd_invalid(listen_fd) || aosl_bind(listen_fd, &b.addr) < 0 ||
+      aosl_hal_sk_get_sockname(listen_fd, &b.addr) < 0 ||
+      aosl_mpq_listen_on_q(srv_q, listen_fd, ACCEPT_BACKLOG, accept_on_accepted, accept_on_event, 1, &b) < 0)
+    goto __out;
+
+  rate = accept_run(&b);
+
+__out:
+  /* the listening fd is closed with the server queue */
+  aosl_mpq_destroy_wait(srv_q);
+  return rate;
+}
+
+static double accept_sharded(int qs, int *listeners_p)
+{
+  static struct accept_bench b;
+  aosl_fd_t fds[ACCEPT_MAX_QS];
+  aosl_mpqp_t qp;
+  double rate = -1;
+  int count;
+
+  accept_bench_init(&b);
+  qp = aosl_mpqp_create(qs, 0, 0, 1000, -1, 0, "accept-srv", NULL, NULL, NULL);
+  if (qp == NULL)
+    return -1;
+
+  count = aosl_mpqp_listen(qp, &b.addr, ACCEPT_BACKLOG, fds, qs, accept_on_accepted, accept_on_event, 1, &b);
+  if (count < 0 || aosl_hal_sk_get_sockname(fds[0], &b.addr) < 0)
+    goto __out;
+
+  *listeners_p = count;
+  rate = accept_run(&b);
+  aosl_mpqp_listen_close(qp, fds, count);
+
+__out:
+  aosl_mpqp_destroy(qp, 1);
+  return rate;
+}
+
+static double accept_batched(void)
+{
+  static struct accept_bench b;
+  aosl_listen_opts_t opts = { 0 };
+  aosl_mpq_t srv_q;
+  aosl_fd_t listen_fd;
+  double rate = -1;
+
+  accept_bench_init(&b);
+  srv_q = aosl_mpq_create(0, 0, 1000, "accept-srv", NULL, NULL, NULL);
+  if (aosl_mpq_invalid(srv_q))
+    return -1;
+
+  opts.batch = ACCEPT_BATCH;
+  listen_fd = aosl_socket(AOSL_AF_INET, AOSL_SOCK_STREAM, AOSL_IPPROTO_TCP);
+  if (aosl_fd_invalid(listen_fd) || aosl_bind(listen_fd, &b.addr) < 0 ||
+      aosl_hal_sk_get_sockname(listen_fd, &b.addr) < 0 ||
+      aosl_mpq_listen_opts_on_q(srv_q, listen_fd, ACCEPT_BACKLOG, &opts, accept_on_accepted, accept_on_event, 1, &b) < 0)
+    goto __out;
+
+  rate = accept_run(&b);
+
+__out:
+  aosl_mpq_destroy_wait(srv_q);
+  return rate;
+}
+
+static double accept_placed(int qs)
+{
+  static struct accept_bench b;
+  aosl_listen_opts_t opts = { 0 };
+  aosl_mpq_t srv_q;
+  aosl_mpqp_t qp;
+  aosl_fd_t listen_fd;
+  double rate = -1;
+
+  accept_bench_init(&b);
+  qp = aosl_mpqp_create(qs, 0, 0, 1000, -1, 0, "accept-placed", NULL, NULL, NULL);
+  if (qp == NULL)
+    return -1;
+
+  srv_q = aosl_mpq_create(0, 0, 1000, "accept-srv", NULL, NULL, NULL);
+  if (aosl_mpq_invalid(srv_q)) {
+    aosl_mpqp_destroy(qp, 1);
+    return -1;
+  }
+
+  opts.batch = ACCEPT_BATCH;
+  opts.place_qp = qp;
+  opts.max_pkt_size = 1024;
+  opts.data_f = accept_on_data;
+  listen_fd = aosl_socket(AOSL_AF_INET, AOSL_SOCK_STREAM, AOSL_IPPROTO_TCP);
+  if (aosl_fd_invalid(listen_fd) || aosl_bind(listen_fd, &b.addr) < 0 ||
+      aosl_hal_sk_get_sockname(listen_fd, &b.addr) < 0 ||
+      aosl_mpq_listen_opts_on_q(srv_q, listen_fd, ACCEPT_BACKLOG, &opts, accept_on_placed, accept_on_event, 1, &b) < 0)
+    goto __out;
+
+  rate = accept_run(&b);
+
+__out:
+  aosl_mpq_destroy_wait(srv_q);
+  aosl_mpqp_destroy(qp, 1);
+  return rate;
+}
+
+int bench_accept(void)
+{
+  double single_rate, sharded_rate, batched_rate, placed_rate;
+  int qs = bench_cpu_count();
+  int listeners = 0;
+
+  /* at least 2 queues to exercise the sharding */
+  if (qs < 2)
+    qs = 2;
+  if (qs > ACCEPT_MAX_QS)
+    qs = ACCEPT_MAX_QS;
+
+  single_rate = accept_single();
+  if (single_rate < 0) {
+    BENCH_LOG("single listener failed");
+    return -1;
+  }
+
+  sharded_rate = accept_sharded(qs, &listeners);
+  if (sharded_rate < 0) {
+    BENCH_LOG("sharded listeners failed");
+    return -1;
+  }
+
+  batched_rate = accept_batched();
+  if (batched_rate < 0) {
+    BENCH_LOG("batched listener failed");
+    return -1;
+  }
+
+  placed_rate = accept_placed(qs);
+  if (placed_rate < 0) {
+    BENCH_LOG("placing listener failed");
+    return -1;
+  }
+
+  bench_report("connections", ACCEPT_CONNS, "count");
+  bench_report("session_setup_us", ACCEPT_SESSION_US, "us");
+  bench_report("single_conn_rate", single_rate, "conns/s");
+  bench_report("sharded_listeners", listeners, "count");
+  bench_report("sharded_conn_rate", sharded_rate, "conns/s");
+  bench_report("batched_conn_rate", batched_rate, "conns/s");
+  bench_report("placed_queues", qs, "count");
+  bench_report("placed_conn_rate", placed_rate, "conns/s");
+  return 0;
+}
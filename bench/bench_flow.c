@@ -0,0 +1,155 @@
+/***************************************************************************
+ * Module:	aosl peer address flow table benchmark
+ *
+ * Copyright © 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+
+#include "api/aosl_mpq_net.h"
+#include "api/aosl_socket.h"
+#include "aosl_bench.h"
+
+/**
+ * The flows are IPv4 peers with random ports, added and looked up in a
+ * shuffled order so that the result is not helped by walking the slots
+ * sequentially. The shuffled addresses are read sequentially, like the
+ * source address of a just received packet, which is hot in the cache.
+ * The small table fits in the caches, the big one shows the cost of the
+ * cache and TLB misses.
+ **/
+#define FLOW_SMALL 1000
+#define FLOW_BIG (1024 * 1024)
+#define FLOW_LOOKUPS (4 * 1024 * 1024)
+
+struct flow_bench_data {
+  uint64_t pkts;
+  uint64_t bytes;
+};
+
+static uint32_t flow_rand_seed = 0x12345678;
+
+static uint32_t flow_rand(void)
+{
+  /* xorshift32 */
+  flow_rand_seed ^= flow_rand_seed << 13;
+  flow_rand_seed ^= flow_rand_seed >> 17;
+  flow_rand_seed ^= flow_rand_seed << 5;
+  return flow_rand_seed;
+}
+
+static void flow_addr_init(aosl_sk_addr_t *addr, uint32_t ip, uint16_t port)
+{
+  memset(addr, 0, sizeof *addr);
+  addr->in.sin_family = AOSL_AF_INET;
+  addr->in.sin_port = aosl_htons(port);
+  addr->in.sin_addr.s_addr = ip;
+}
+
+/* run the lookups over the shuffled order, returns the ns per lookup */
+static double flow_lookup_run(aosl_flow_table_t ft, const aosl_sk_addr_t *addrs, size_t n, int *missed_p)
+{
+  uint64_t start;
+  size_t i;
+  int missed = 0;
+
+  start = bench_now_ns();
+  for (i = 0; i < FLOW_LOOKUPS; i++) {
+    struct flow_bench_data *d = aosl_flow_find(ft, &addrs[i % n]);
+    if (d != NULL)
+      d->pkts++;
+    else
+      missed++;
+  }
+
+  *missed_p = missed;
+  return (double)(bench_now_ns() - start) / FLOW_LOOKUPS;
+}
+
+static int flow_run(size_t n, const char *prefix)
+{
+  char name[64];
+  aosl_flow_table_t ft;
+  aosl_sk_addr_t *addrs = NULL;
+  aosl_sk_addr_t *misses = NULL;
+  uint64_t start;
+  double insert_ns, hit_ns, miss_ns;
+  int created, missed;
+  size_t i;
+  int err = -1;
+
+  ft = aosl_flow_table_create(sizeof(struct flow_bench_data), n, 0, NULL, NULL);
+  if (ft == NULL) {
+    BENCH_LOG("create flow table failed");
+    return -1;
+  }
+
+  addrs = malloc(n * sizeof *addrs);
+  misses = malloc(n * sizeof *misses);
+  if (addrs == NULL || misses == NULL)
+    goto __out;
+
+  for (i = 0; i < n; i++) {
+    /* unique peers: the index goes into the address, the port is random */
+    flow_addr_init(&addrs[i], (uint32_t)i * 2654435761u, (uint16_t)(1024 + flow_rand() % 60000));
+    flow_addr_init(&misses[i], (uint32_t)i * 2654435761u, 0);
+  }
+
+  for (i = n - 1; i > 0; i--) {
+    size_t j = flow_rand() % (i + 1);
+    aosl_sk_addr_t tmp = addrs[i];
+    addrs[i] = addrs[j];
+    addrs[j] = tmp;
+    tmp = misses[i];
+    misses[i] = misses[j];
+    misses[j] = tmp;
+  }
+
+  start = bench_now_ns();
+  for (i = 0; i < n; i++) {
+    if (aosl_flow_get(ft, &addrs[i], &created) == NULL || !created) {
+      BENCH_LOG("add flow %u failed", (unsigned)i);
+      goto __out;
+    }
+  }
+  insert_ns = (double)(bench_now_ns() - start) / n;
+
+  hit_ns = flow_lookup_run(ft, addrs, n, &missed);
+  if (missed != 0) {
+    BENCH_LOG("%d flows missed", missed);
+    goto __out;
+  }
+
+  miss_ns = flow_lookup_run(ft, misses, n, &missed);
+  if (missed != FLOW_LOOKUPS) {
+    BENCH_LOG("%d lookups hit unexpectedly", FLOW_LOOKUPS - missed);
+    goto __out;
+  }
+
+  snprintf(name, sizeof name, "%s_flows", prefix);
+  bench_report(name, (double)aosl_flow_count(ft), "count");
+  snprintf(name, sizeof name, "%s_insert", prefix);
+  bench_report(name, insert_ns, "ns/op");
+  snprintf(name, sizeof name, "%s_hit", prefix);
+  bench_report(name, hit_ns, "ns/op");
+  snprintf(name, sizeof name, "%s_miss", prefix);
+  bench_report(name, miss_ns, "ns/op");
+  err = 0;
+
+__out:
+  aosl_flow_table_destroy(ft);
+  free(misses);
+  free(addrs);
+  return err;
+}
+
+int bench_flow(void)
+{
+  if (flow_run(FLOW_SMALL, "small") < 0)
+    return -1;
+
+  return flow_run(FLOW_BIG, "big");
+}
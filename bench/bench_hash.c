@@ -0,0 +1,163 @@
+/***************************************************************************
+ * Module:	aosl hash table benchmark
+ *
+ * Copyright © 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+
+#include "api/aosl_hash.h"
+#include "api/aosl_rbtree.h"
+#include "aosl_bench.h"
+
+/**
+ * Point lookups of the integer keys, like the fds and the thread ids, in
+ * the hash table and in the red-black tree with its va_list comparator.
+ * The keys are looked up in a shuffled order, the insertions are timed
+ * too, which include the incremental resizing of the hash table.
+ **/
+#define HASH_SMALL 64
+#define HASH_MEDIUM 4096
+#define HASH_BIG (256 * 1024)
+#define HASH_LOOKUPS (2 * 1024 * 1024)
+
+struct hash_bench_entry {
+  struct aosl_hash_node hash_node;
+  struct aosl_rb_node rb_node;
+  uintptr_t key;
+};
+
+static uint32_t hash_rand_seed = 0x2545f491;
+
+static uint32_t hash_rand(void)
+{
+  /* xorshift32 */
+  hash_rand_seed ^= hash_rand_seed << 13;
+  hash_rand_seed ^= hash_rand_seed >> 17;
+  hash_rand_seed ^= hash_rand_seed << 5;
+  return hash_rand_seed;
+}
+
+static int hash_bench_rb_cmp(struct aosl_rb_node *rb_node, struct aosl_rb_node *node, va_list args)
+{
+  struct hash_bench_entry *e = aosl_rb_entry(rb_node, struct hash_bench_entry, rb_node);
+  uintptr_t key;
+
+  if (node != NULL)
+    key = aosl_rb_entry(node, struct hash_bench_entry, rb_node)->key;
+  else
+    key = va_arg(args, uintptr_t);
+
+  if (e->key > key)
+    return 1;
+
+  if (e->key < key)
+    return -1;
+
+  return 0;
+}
+
+static struct hash_bench_entry *hash_bench_find(struct aosl_hash_table *ht, uintptr_t key)
+{
+  struct aosl_hash_node *node;
+  struct hash_bench_entry *e;
+
+  aosl_hash_for_each_possible(ht, node, aosl_hash_uintptr(key)) {
+    e = aosl_hash_entry(node, struct hash_bench_entry, hash_node);
+    if (e->key == key)
+      return e;
+  }
+
+  return NULL;
+}
+
+static int hash_run(size_t n, const char *prefix)
+{
+  char name[64];
+  struct aosl_hash_table ht;
+  struct aosl_rb_root root;
+  struct hash_bench_entry *entries;
+  uintptr_t *keys;
+  uint64_t start;
+  double hash_insert_ns, rb_insert_ns, hash_ns, rb_ns;
+  size_t i;
+  int found = 0;
+
+  entries = malloc(n * sizeof *entries);
+  keys = malloc(n * sizeof *keys);
+  if (entries == NULL || keys == NULL) {
+    free(keys);
+    free(entries);
+    return -1;
+  }
+
+  for (i = 0; i < n; i++) {
+    /* sparse keys, the tree gets no help from a sequential insertion */
+    entries[i].key = (uintptr_t)i * 2654435761u;
+    keys[i] = entries[i].key;
+  }
+
+  for (i = n - 1; i > 0; i--) {
+    size_t j = hash_rand() % (i + 1);
+    uintptr_t tmp = keys[i];
+    keys[i] = keys[j];
+    keys[j] = tmp;
+  }
+
+  aosl_hash_init(&ht, AOSL_HASH_F_CONCURRENT_READ);
+  start = bench_now_ns();
+  for (i = 0; i < n; i++)
+    aosl_hash_add(&ht, &entries[i].hash_node, aosl_hash_uintptr(entries[i].key));
+  hash_insert_ns = (double)(bench_now_ns() - start) / n;
+
+  aosl_rb_root_init(&root, hash_bench_rb_cmp);
+  start = bench_now_ns();
+  for (i = 0; i < n; i++)
+    aosl_rb_insert_node(&root, &entries[i].rb_node);
+  rb_insert_ns = (double)(bench_now_ns() - start) / n;
+
+  start = bench_now_ns();
+  for (i = 0; i < HASH_LOOKUPS; i++)
+    found += hash_bench_find(&ht, keys[i % n]) != NULL;
+  hash_ns = (double)(bench_now_ns() - start) / HASH_LOOKUPS;
+
+  start = bench_now_ns();
+  for (i = 0; i < HASH_LOOKUPS; i++)
+    found += aosl_find_rb_node(&root, NULL, keys[i % n]) != NULL;
+  rb_ns = (double)(bench_now_ns() - start) / HASH_LOOKUPS;
+
+  aosl_hash_fini(&ht, NULL, NULL);
+  free(keys);
+  free(entries);
+
+  if (found != 2 * HASH_LOOKUPS) {
+    BENCH_LOG("%d lookups missed", 2 * HASH_LOOKUPS - found);
+    return -1;
+  }
+
+  snprintf(name, sizeof name, "%s_count", prefix);
+  bench_report(name, (double)n, "count");
+  snprintf(name, sizeof name, "%s_hash_insert", prefix);
+  bench_report(name, hash_insert_ns, "ns/op");
+  snprintf(name, sizeof name, "%s_rb_insert", prefix);
+  bench_report(name, rb_insert_ns, "ns/op");
+  snprintf(name, sizeof name, "%s_hash_lookup", prefix);
+  bench_report(name, hash_ns, "ns/op");
+  snprintf(name, sizeof name, "%s_rb_lookup", prefix);
+  bench_report(name, rb_ns, "ns/op");
+  return 0;
+}
+
+int bench_hash(void)
+{
+  if (hash_run(HASH_SMALL, "small") < 0)
+    return -1;
+
+  if (hash_run(HASH_MEDIUM, "medium") < 0)
+    return -1;
+
+  return hash_run(HASH_BIG, "big");
+}
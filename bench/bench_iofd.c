@@ -0,0 +1,181 @@
+/***************************************************************************
+ * Module:	aosl iofd benchmark
+ *
+ * Copyright © 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+#include <string.h>
+
+#include "api/aosl_mm.h"
+#include "api/aosl_mpq.h"
+#include "api/aosl_mpq_net.h"
+#include "api/aosl_socket.h"
+#include "api/aosl_atomic.h"
+#include "api/aosl_time.h"
+#include "hal/aosl_hal_socket.h"
+#include "aosl_bench.h"
+
+/**
+ * Memory footprint of many idle stream connections with a big max packet
+ * size, both the connecting and the accepted sides are added to mpqs, so
+ * each connection counts 2 iofds.
+ **/
+#define IDLE_CONNS 10000
+#define IDLE_MAX_PKT_SIZE (64 << 10)
+
+static aosl_atomic_t accepted_count;
+
+static isize_t idle_chk_pkt(const void *data, size_t len, uintptr_t argc, uintptr_t argv[])
+{
+  uint32_t pkt_len;
+  UNUSED(argc);
+  UNUSED(argv);
+
+  if (len < sizeof pkt_len)
+    return 0;
+
+  memcpy(&pkt_len, data, sizeof pkt_len);
+  pkt_len = aosl_ntohl(pkt_len);
+  if (pkt_len > len)
+    return 0;
+
+  return (isize_t)pkt_len;
+}
+
+static void idle_on_data(void *data, size_t len, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(data);
+  UNUSED(len);
+  UNUSED(argc);
+  UNUSED(argv);
+}
+
+static void idle_on_event(aosl_fd_t fd, int event, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(fd);
+  UNUSED(event);
+  UNUSED(argc);
+  UNUSED(argv);
+}
+
+static void idle_on_accepted(aosl_accept_data_t *accept_data, size_t len, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(len);
+  UNUSED(argc);
+  UNUSED(argv);
+
+  if (aosl_mpq_add_stream_socket(accept_data->newsk, IDLE_MAX_PKT_SIZE, idle_chk_pkt, idle_on_data, idle_on_event, 0) < 0) {
+    aosl_close(accept_data->newsk);
+    return;
+  }
+
+  aosl_atomic_inc(&accepted_count);
+}
+
+static int wait_accepted(intptr_t count, int timeo_ms)
+{
+  aosl_ts_t start = aosl_tick_ms();
+
+  while (aosl_atomic_read(&accepted_count) < count) {
+    if ((int)(aosl_tick_ms() - start) > timeo_ms)
+      return -1;
+
+    aosl_msleep(1);
+  }
+
+  return 0;
+}
+
+int bench_iofd_mem(void)
+{
+  size_t conns = IDLE_CONNS;
+  size_t fd_limit = bench_raise_fd_limit();
+  size_t vm0, rss0, vm1, rss1, vm2, rss2;
+  aosl_fd_t *fds;
+  aosl_fd_t listen_fd;
+  aosl_sockaddr_t addr;
+  aosl_mpq_t srv_q, cli_q;
+  size_t i;
+  int err = -1;
+
+  /* 2 fds for each connection, and keep some spare fds */
+  if (fd_limit < 256 + conns * 2)
+    conns = fd_limit > 512 ? (fd_limit - 256) / 2 : 128;
+
+  fds = (aosl_fd_t *)aosl_malloc(sizeof(aosl_fd_t) * conns);
+  if (fds == NULL)
+    return -1;
+
+  aosl_atomic_set(&accepted_count, 0);
+  srv_q = aosl_mpq_create(0, 0, 100000, "bench-srv", NULL, NULL, NULL);
+  cli_q = aosl_mpq_create(0, 0, 100000, "bench-cli", NULL, NULL, NULL);
+  if (aosl_mpq_invalid(srv_q) || aosl_mpq_invalid(cli_q))
+    goto __out;
+
+  listen_fd = aosl_socket(AOSL_AF_INET, AOSL_SOCK_STREAM, AOSL_IPPROTO_TCP);
+  memset(&addr, 0, sizeof addr);
+  addr.sa_family = AOSL_AF_INET;
+  aosl_inet_addr_from_string(&addr.sin_addr, "127.0.0.1");
+  if (aosl_bind(listen_fd, &addr) < 0 || aosl_hal_sk_get_sockname(listen_fd, &addr) < 0)
+    goto __out;
+
+  if (aosl_mpq_listen_on_q(srv_q, listen_fd, 4096, idle_on_accepted, idle_on_event, 0) < 0)
+    goto __out;
+
+  if (bench_mem_usage(&vm0, &rss0) < 0) {
+    BENCH_LOG("memory usage not supported");
+    goto __out;
+  }
+
+  for (i = 0; i < conns; i++) {
+    fds[i] = aosl_socket(AOSL_AF_INET, AOSL_SOCK_STREAM, AOSL_IPPROTO_TCP);
+    if (aosl_fd_invalid(fds[i]) || aosl_mpq_connect_on_q(cli_q, fds[i], &addr, 10000, IDLE_MAX_PKT_SIZE, idle_chk_pkt,
+                                                          idle_on_data, idle_on_event, 0) < 0) {
+      BENCH_LOG("connect #%u failed", (unsigned)i);
+      conns = i;
+      break;
+    }
+
+    /* do not overflow the listen backlog */
+    if (i % 256 == 255 && wait_accepted((intptr_t)i - 1024, 10000) < 0)
+      break;
+  }
+
+  if (wait_accepted((intptr_t)conns, 30000) < 0) {
+    BENCH_LOG("only %d of %u connections accepted", (int)aosl_atomic_read(&accepted_count), (unsigned)conns);
+    goto __out;
+  }
+
+  bench_mem_usage(&vm1, &rss1);
+  bench_report("idle_conns", (double)conns, "conns");
+  bench_report("idle_vm_per_conn", (double)(vm1 - vm0) / conns, "bytes");
+  bench_report("idle_rss_per_conn", (double)(rss1 - rss0) / conns, "bytes");
+
+  /* every accepted side holds a buffer for a pending partial packet now */
+  for (i = 0; i < conns; i++) {
+    char partial[64];
+    uint32_t pkt_len = aosl_htonl(1024);
+
+    memset(partial, 0, sizeof partial);
+    memcpy(partial, &pkt_len, sizeof pkt_len);
+    aosl_send(fds[i], partial, sizeof partial, 0);
+  }
+
+  aosl_msleep(1000);
+  bench_mem_usage(&vm2, &rss2);
+  bench_report("partial_vm_per_conn", (double)(vm2 - vm0) / conns, "bytes");
+  bench_report("partial_rss_per_conn", (double)(rss2 - rss0) / conns, "bytes");
+  err = 0;
+
+__out:
+  if (!aosl_mpq_invalid(cli_q))
+    aosl_mpq_destroy_wait(cli_q);
+
+  if (!aosl_mpq_invalid(srv_q))
+    aosl_mpq_destroy_wait(srv_q);
+
+  aosl_free(fds);
+  return err;
+}
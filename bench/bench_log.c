@@ -0,0 +1,85 @@
+/***************************************************************************
+ * Module:	aosl logging benchmark
+ *
+ * Copyright © 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "api/aosl_log.h"
+#include "api/aosl_time.h"
+#include "aosl_bench.h"
+
+/**
+ * The cost of an AOSL_LOG_CRT like message on the logging thread with a
+ * slow log function, which takes LOG_SINK_US to write a message, in the
+ * sync mode and in the async mode.
+ **/
+#define LOG_MSGS 2000
+#define LOG_SINK_US 5
+
+static volatile uint64_t log_sink_count;
+
+static void slow_sink(int level, const char *fmt, va_list args)
+{
+  char buf[256];
+  uint64_t start = bench_now_ns();
+  UNUSED(level);
+
+  vsnprintf(buf, sizeof buf, fmt, args);
+  while (bench_now_ns() - start < LOG_SINK_US * 1000)
+    ;
+  log_sink_count++;
+}
+
+static uint64_t log_run(uint64_t *samples)
+{
+  uint64_t total = 0;
+  int i;
+
+  for (i = 0; i < LOG_MSGS; i++) {
+    uint64_t start = bench_now_ns();
+    aosl_log(AOSL_LOG_CRIT, "[%d][aosl][%s:%u]host %s resolved %d addrs in %u ms\n", AOSL_LOG_CRIT, __FUNCTION__,
+             __LINE__, "www.example.com", i & 7, (unsigned)i);
+    samples[i] = bench_now_ns() - start;
+    total += samples[i];
+  }
+
+  return total;
+}
+
+int bench_log(void)
+{
+  static uint64_t samples[LOG_MSGS];
+  aosl_log_stats_t stats;
+  int old_level = aosl_get_log_level();
+
+  aosl_set_log_level(AOSL_LOG_CRIT);
+  aosl_set_vlog_func(slow_sink);
+
+  log_run(samples);
+  bench_report_latency("sync_log", samples, LOG_MSGS);
+
+  if (aosl_log_set_async(1) < 0) {
+    aosl_set_vlog_func(NULL);
+    aosl_set_log_level(old_level);
+    BENCH_LOG("enable async log failed");
+    return -1;
+  }
+
+  log_sink_count = 0;
+  log_run(samples);
+  aosl_log_set_async(0);
+  bench_report_latency("async_log", samples, LOG_MSGS);
+
+  aosl_log_get_stats(&stats);
+  bench_report("async_written", (double)log_sink_count, "count");
+  bench_report("async_dropped", (double)stats.dropped, "count");
+
+  aosl_set_vlog_func(NULL);
+  aosl_set_log_level(old_level);
+  return 0;
+}
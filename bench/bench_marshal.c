@@ -0,0 +1,389 @@
+/***************************************************************************
+ * Module:	aosl marshalling benchmark
+ *
+ * Copyright © 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "api/aosl_mm.h"
+#include "api/aosl_psb.h"
+#include "api/aosl_marshalling.h"
+#include "aosl_bench.h"
+
+/**
+ * Marshal and unmarshal a typical message: some numbers, a 1KB dynamic
+ * bytes payload and a dynamic string.
+ **/
+#define MARSHAL_LOOPS 200000
+#define MARSHAL_PAYLOAD 1024
+#define MARSHAL_BUF_SIZE 4096
+
+typedef struct {
+  int32_t seq;
+  int64_t ts;
+  double ratio;
+  aosl_dynamic_bytes_t payload;
+  aosl_dynamic_string_t name;
+} bench_msg_t;
+
+static const aosl_type_info_t bench_msg_fields[] = {
+  { .type_id = AOSL_TYPE_INT32, .obj_addr = aosl_rela_addr(bench_msg_t, seq) },
+  { .type_id = AOSL_TYPE_INT64, .obj_addr = aosl_rela_addr(bench_msg_t, ts) },
+  { .type_id = AOSL_TYPE_DOUBLE, .obj_addr = aosl_rela_addr(bench_msg_t, ratio) },
+  { .type_id = AOSL_TYPE_DYNAMIC_BYTES, .obj_addr = aosl_rela_addr(bench_msg_t, payload) },
+  { .type_id = AOSL_TYPE_DYNAMIC_STRING, .obj_addr = aosl_rela_addr(bench_msg_t, name) },
+  AOSL_TYPE_STRUCT_END,
+};
+
+static const aosl_type_info_t bench_msg_type = {
+  .type_id = AOSL_TYPE_STRUCT,
+  .obj_size = sizeof(bench_msg_t),
+  .obj_addr = NULL,
+  .child = bench_msg_fields,
+};
+
+int bench_marshal(void)
+{
+  char payload[MARSHAL_PAYLOAD];
+  bench_msg_t msg, out;
+  aosl_psb_t *psb = NULL;
+  void *buf;
+  uint64_t start, ns;
+  isize_t len = 0;
+  int err = -1;
+  int i;
+
+  buf = aosl_malloc(MARSHAL_BUF_SIZE);
+  if (buf == NULL)
+    return -1;
+
+  memset(payload, 'm', sizeof payload);
+  aosl_init_typed_obj(&bench_msg_type, &msg);
+  msg.seq = 1;
+  msg.ts = 1234567890123ll;
+  msg.ratio = 0.5;
+  if (aosl_dynamic_bytes_copy_data(&msg.payload, payload, sizeof payload) < 0 ||
+      aosl_dynamic_string_strcpy(&msg.name, "aosl.bench.marshal") < 0)
+    goto __out;
+
+  psb = aosl_alloc_user_psb(buf, MARSHAL_BUF_SIZE);
+  if (psb == NULL)
+    goto __out;
+
+  start = bench_now_ns();
+  for (i = 0; i < MARSHAL_LOOPS; i++) {
+    aosl_psb_reset(psb);
+    len = aosl_marshal(&bench_msg_type, &msg, psb);
+    if (len < 0) {
+      BENCH_LOG("marshal failed %d", (int)len);
+      goto __out;
+    }
+  }
+
+  ns = bench_now_ns() - start;
+  bench_report("msg_size", (double)len, "bytes");
+  bench_report("marshal_ns", (double)ns / MARSHAL_LOOPS, "ns");
+  bench_report("marshal_mb_s", (double)len * MARSHAL_LOOPS * 1e3 / ns, "MB/s");
+
+  start = bench_now_ns();
+  for (i = 0; i < MARSHAL_LOOPS; i++) {
+    aosl_init_typed_obj(&bench_msg_type, &out);
+    if (aosl_unmarshal(&bench_msg_type, &out, psb) < 0) {
+      BENCH_LOG("unmarshal failed");
+      goto __out;
+    }
+
+    aosl_fini_typed_obj(&bench_msg_type, &out);
+    /* unmarshalling consumes the data, give it back */
+    aosl_psb_push(psb, (size_t)len);
+  }
+
+  ns = bench_now_ns() - start;
+  bench_report("unmarshal_ns", (double)ns / MARSHAL_LOOPS, "ns");
+  bench_report("unmarshal_mb_s", (double)len * MARSHAL_LOOPS * 1e3 / ns, "MB/s");
+  err = 0;
+
+__out:
+  aosl_fini_typed_obj(&bench_msg_type, &msg);
+  if (psb != NULL)
+    aosl_free_psb_list(psb);
+
+  aosl_free(buf);
+  return err;
+}
+
+/**
+ * A realistic nested message: a header struct, a fixed array of stats
+ * structs, a dynamic array of sample structs, a dynamic array of users
+ * with their names and a dynamic string, run with the descriptor
+ * interpreter first and then with the compiled plan.
+ **/
+#define NESTED_STATS 8
+#define NESTED_SAMPLES 64
+#define NESTED_USERS 16
+
+typedef struct {
+  uint8_t kind;
+  int32_t seq;
+  int64_t ts;
+} bench_hdr_t;
+
+typedef struct {
+  int32_t ssrc;
+  int32_t lost;
+  int32_t jitter;
+  int16_t rtt;
+  int64_t bytes;
+} bench_stats_t;
+
+typedef struct {
+  int16_t x;
+  int16_t y;
+  int32_t ts_delta;
+} bench_sample_t;
+
+typedef struct {
+  int32_t uid;
+  aosl_dynamic_string_t name;
+} bench_user_t;
+
+typedef struct {
+  bench_hdr_t hdr;
+  bench_stats_t stats[NESTED_STATS];
+  aosl_dynamic_array_t samples;
+  aosl_dynamic_array_t users;
+  aosl_dynamic_string_t note;
+} bench_nested_t;
+
+static const aosl_type_info_t bench_hdr_fields[] = {
+  { .type_id = AOSL_TYPE_INT8, .obj_addr = aosl_rela_addr(bench_hdr_t, kind) },
+  { .type_id = AOSL_TYPE_INT32, .obj_addr = aosl_rela_addr(bench_hdr_t, seq) },
+  { .type_id = AOSL_TYPE_INT64, .obj_addr = aosl_rela_addr(bench_hdr_t, ts) },
+  AOSL_TYPE_STRUCT_END,
+};
+
+static const aosl_type_info_t bench_stats_fields[] = {
+  { .type_id = AOSL_TYPE_INT32, .obj_addr = aosl_rela_addr(bench_stats_t, ssrc) },
+  { .type_id = AOSL_TYPE_INT32, .obj_addr = aosl_rela_addr(bench_stats_t, lost) },
+  { .type_id = AOSL_TYPE_INT32, .obj_addr = aosl_rela_addr(bench_stats_t, jitter) },
+  { .type_id = AOSL_TYPE_INT16, .obj_addr = aosl_rela_addr(bench_stats_t, rtt) },
+  { .type_id = AOSL_TYPE_INT64, .obj_addr = aosl_rela_addr(bench_stats_t, bytes) },
+  AOSL_TYPE_STRUCT_END,
+};
+
+static const aosl_type_info_t bench_stats_type = {
+  .type_id = AOSL_TYPE_STRUCT,
+  .obj_size = sizeof(bench_stats_t),
+  .child = bench_stats_fields,
+};
+
+static const aosl_type_info_t bench_sample_fields[] = {
+  { .type_id = AOSL_TYPE_INT16, .obj_addr = aosl_rela_addr(bench_sample_t, x) },
+  { .type_id = AOSL_TYPE_INT16, .obj_addr = aosl_rela_addr(bench_sample_t, y) },
+  { .type_id = AOSL_TYPE_INT32, .obj_addr = aosl_rela_addr(bench_sample_t, ts_delta) },
+  AOSL_TYPE_STRUCT_END,
+};
+
+static const aosl_type_info_t bench_sample_type = {
+  .type_id = AOSL_TYPE_STRUCT,
+  .obj_size = sizeof(bench_sample_t),
+  .child = bench_sample_fields,
+};
+
+static const aosl_type_info_t bench_user_fields[] = {
+  { .type_id = AOSL_TYPE_INT32, .obj_addr = aosl_rela_addr(bench_user_t, uid) },
+  { .type_id = AOSL_TYPE_DYNAMIC_STRING, .obj_addr = aosl_rela_addr(bench_user_t, name) },
+  AOSL_TYPE_STRUCT_END,
+};
+
+static const aosl_type_info_t bench_user_type = {
+  .type_id = AOSL_TYPE_STRUCT,
+  .obj_size = sizeof(bench_user_t),
+  .child = bench_user_fields,
+};
+
+static const aosl_type_info_t bench_nested_fields[] = {
+  { .type_id = AOSL_TYPE_STRUCT, .obj_addr = aosl_rela_addr(bench_nested_t, hdr), .obj_size = sizeof(bench_hdr_t),
+    .child = bench_hdr_fields },
+  { .type_id = AOSL_TYPE_FIXED_ARRAY, .obj_addr = aosl_rela_addr(bench_nested_t, stats), .array_size = NESTED_STATS,
+    .child = &bench_stats_type },
+  { .type_id = AOSL_TYPE_DYNAMIC_ARRAY, .obj_addr = aosl_rela_addr(bench_nested_t, samples),
+    .child = &bench_sample_type },
+  { .type_id = AOSL_TYPE_DYNAMIC_ARRAY, .obj_addr = aosl_rela_addr(bench_nested_t, users),
+    .child = &bench_user_type },
+  { .type_id = AOSL_TYPE_DYNAMIC_STRING, .obj_addr = aosl_rela_addr(bench_nested_t, note) },
+  AOSL_TYPE_STRUCT_END,
+};
+
+static const aosl_type_info_t bench_nested_type = {
+  .type_id = AOSL_TYPE_STRUCT,
+  .obj_size = sizeof(bench_nested_t),
+  .child = bench_nested_fields,
+};
+
+static int bench_nested_run(const char *tag, const bench_nested_t *msg, aosl_psb_t *psb)
+{
+  bench_nested_t out;
+  char metric[64];
+  uint64_t start, ns;
+  isize_t len = 0;
+  int i;
+
+  start = bench_now_ns();
+  for (i = 0; i < MARSHAL_LOOPS; i++) {
+    aosl_psb_reset(psb);
+    len = aosl_marshal(&bench_nested_type, msg, psb);
+    if (len < 0) {
+      BENCH_LOG("marshal failed %d", (int)len);
+      return -1;
+    }
+  }
+
+  ns = bench_now_ns() - start;
+  snprintf(metric, sizeof metric, "%s_marshal_ns", tag);
+  bench_report(metric, (double)ns / MARSHAL_LOOPS, "ns");
+  snprintf(metric, sizeof metric, "%s_marshal_mb_s", tag);
+  bench_report(metric, (double)len * MARSHAL_LOOPS * 1e3 / ns, "MB/s");
+
+  start = bench_now_ns();
+  for (i = 0; i < MARSHAL_LOOPS; i++) {
+    aosl_init_typed_obj(&bench_nested_type, &out);
+    if (aosl_unmarshal(&bench_nested_type, &out, psb) < 0) {
+      BENCH_LOG("unmarshal failed");
+      return -1;
+    }
+
+    aosl_fini_typed_obj(&bench_nested_type, &out);
+    aosl_psb_push(psb, (size_t)len);
+  }
+
+  ns = bench_now_ns() - start;
+  snprintf(metric, sizeof metric, "%s_unmarshal_ns", tag);
+  bench_report(metric, (double)ns / MARSHAL_LOOPS, "ns");
+  snprintf(metric, sizeof metric, "%s_unmarshal_mb_s", tag);
+  bench_report(metric, (double)len * MARSHAL_LOOPS * 1e3 / ns, "MB/s");
+  return (int)len;
+}
+
+/* unmarshal with all the variable size data in an arena, freed at once */
+static int bench_nested_arena(const bench_nested_t *msg, aosl_psb_t *psb)
+{
+  uint64_t arena_buf[MARSHAL_BUF_SIZE / sizeof(uint64_t)];
+  aosl_unmarshal_arena_t arena;
+  bench_nested_t out;
+  uint64_t start, ns;
+  isize_t len;
+  int i;
+
+  aosl_psb_reset(psb);
+  len = aosl_marshal(&bench_nested_type, msg, psb);
+  if (len < 0)
+    return -1;
+
+  aosl_unmarshal_arena_init(&arena, arena_buf, sizeof arena_buf);
+  start = bench_now_ns();
+  for (i = 0; i < MARSHAL_LOOPS; i++) {
+    aosl_init_typed_obj(&bench_nested_type, &out);
+    if (aosl_unmarshal_arena(&bench_nested_type, &out, psb, &arena) < 0) {
+      BENCH_LOG("arena unmarshal failed");
+      aosl_unmarshal_arena_fini(&arena);
+      return -1;
+    }
+
+    aosl_unmarshal_arena_fini(&arena);
+    aosl_psb_push(psb, (size_t)len);
+  }
+
+  ns = bench_now_ns() - start;
+  bench_report("arena_unmarshal_ns", (double)ns / MARSHAL_LOOPS, "ns");
+  bench_report("arena_unmarshal_mb_s", (double)len * MARSHAL_LOOPS * 1e3 / ns, "MB/s");
+  return 0;
+}
+
+int bench_marshal_nested(void)
+{
+  bench_sample_t samples[NESTED_SAMPLES];
+  bench_user_t users[NESTED_USERS];
+  char name[32];
+  bench_nested_t msg;
+  aosl_psb_t *psb = NULL;
+  void *buf;
+  int len;
+  int err = -1;
+  int i;
+
+  buf = aosl_malloc(MARSHAL_BUF_SIZE);
+  if (buf == NULL)
+    return -1;
+
+  memset(&msg, 0, sizeof msg);
+  msg.hdr.kind = 2;
+  msg.hdr.seq = 1;
+  msg.hdr.ts = 1234567890123ll;
+  for (i = 0; i < NESTED_STATS; i++) {
+    msg.stats[i].ssrc = 0x1000 + i;
+    msg.stats[i].lost = i;
+    msg.stats[i].jitter = 30 * i;
+    msg.stats[i].rtt = (int16_t)(100 + i);
+    msg.stats[i].bytes = 1000000ll * i;
+  }
+
+  for (i = 0; i < NESTED_SAMPLES; i++) {
+    samples[i].x = (int16_t)i;
+    samples[i].y = (int16_t)-i;
+    samples[i].ts_delta = 20 * i;
+  }
+
+  aosl_dynamic_array_init_with(&msg.samples, samples, NESTED_SAMPLES);
+  for (i = 0; i < NESTED_USERS; i++)
+    aosl_dynamic_string_init(&users[i].name);
+
+  aosl_dynamic_array_init_with(&msg.users, users, NESTED_USERS);
+  for (i = 0; i < NESTED_USERS; i++) {
+    users[i].uid = 10000 + i;
+    snprintf(name, sizeof name, "user-%d", 10000 + i);
+    if (aosl_dynamic_string_strcpy(&users[i].name, name) < 0)
+      goto __out;
+  }
+
+  aosl_dynamic_string_init(&msg.note);
+  if (aosl_dynamic_string_strcpy(&msg.note, "aosl.bench.marshal.nested") < 0)
+    goto __out;
+
+  psb = aosl_alloc_user_psb(buf, MARSHAL_BUF_SIZE);
+  if (psb == NULL)
+    goto __out;
+
+  len = bench_nested_run("interp", &msg, psb);
+  if (len < 0)
+    goto __out;
+
+  bench_report("msg_size", (double)len, "bytes");
+  if (aosl_type_compile(&bench_nested_type) < 0) {
+    BENCH_LOG("compile failed");
+    goto __out;
+  }
+
+  if (bench_nested_run("compiled", &msg, psb) < 0)
+    goto __out;
+
+  if (bench_nested_arena(&msg, psb) < 0)
+    goto __out;
+
+  err = 0;
+
+__out:
+  for (i = 0; i < NESTED_USERS; i++)
+    aosl_dynamic_string_fini(&users[i].name);
+
+  aosl_dynamic_string_fini(&msg.note);
+  if (psb != NULL)
+    aosl_free_psb_list(psb);
+
+  aosl_free(buf);
+  return err;
+}
@@ -0,0 +1,747 @@
+/***************************************************************************
+ * Module:	aosl mpq benchmark
+ *
+ * Copyright © 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "api/aosl_mm.h"
+#include "api/aosl_mpq.h"
+#include "api/aosl_mpqp.h"
+#include "api/aosl_mpq_timer.h"
+#include "api/aosl_ref.h"
+#include "api/aosl_atomic.h"
+#include "api/aosl_time.h"
+#include "aosl_bench.h"
+
+#define MPQ_ITEMS 400000
+#define MPQ_CALLS 20000
+#define MPQ_MAX_PRODUCERS 8
+#define MPQP_ITEMS 200000
+#define TIMER_COUNT 10000
+#define REF_READS 200000
+#define FLOOD_ITEMS 200000
+#define FLOOD_WORK_NS 1000
+#define CTRL_CALLS 200
+#define CREATE_QS 500
+
+#define BENCH_WAIT_MS 60000
+
+static int max_producers(void)
+{
+  int n = bench_cpu_count();
+
+  if (n < 2)
+    n = 2;
+
+  if (n > MPQ_MAX_PRODUCERS)
+    n = MPQ_MAX_PRODUCERS;
+
+  return n;
+}
+
+static void noop_func(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+  UNUSED(argv);
+}
+
+static void count_func(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+  aosl_atomic_inc((aosl_atomic_t *)argv[0]);
+}
+
+/**
+ * Queue throughput and latency: P producer queues push timestamped
+ * functions to one consumer queue as fast as they can, the consumer
+ * records the enqueue to invoke latency of every function.
+ **/
+static uint64_t *mpq_samples;
+static aosl_atomic_t mpq_consumed;
+
+static void mpq_consume(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  intptr_t i = aosl_atomic_read(&mpq_consumed);
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+
+  /* only the consumer queue thread writes the samples */
+  mpq_samples[i] = bench_now_ns() - (uint64_t)argv[0];
+  aosl_atomic_set(&mpq_consumed, i + 1);
+}
+
+static void mpq_produce(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  aosl_mpq_t cons_q = (aosl_mpq_t)argv[0];
+  uintptr_t count = argv[1];
+  uintptr_t i;
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+
+  for (i = 0; i < count; i++) {
+    while (aosl_mpq_queue(cons_q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, "mpq_consume", mpq_consume, 1,
+                          (uintptr_t)bench_now_ns()) < 0)
+      aosl_msleep(1);
+  }
+}
+
+static void mpq_call_loop(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  aosl_mpq_t target_q = (aosl_mpq_t)argv[0];
+  uintptr_t count = argv[1];
+  uintptr_t i;
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+
+  for (i = 0; i < count; i++)
+    aosl_mpq_call(target_q, AOSL_REF_INVALID, "noop_func", noop_func, 0);
+
+  aosl_atomic_inc((aosl_atomic_t *)argv[2]);
+}
+
+static int mpq_run_producers(aosl_mpq_t cons_q, aosl_mpq_t *prod_qs, int producers)
+{
+  char name[64];
+  uint64_t start, ns;
+  int per_producer = MPQ_ITEMS / producers;
+  int total = per_producer * producers;
+  int i;
+
+  aosl_atomic_set(&mpq_consumed, 0);
+  start = bench_now_ns();
+  for (i = 0; i < producers; i++) {
+    if (aosl_mpq_queue(prod_qs[i], AOSL_MPQ_INVALID, AOSL_REF_INVALID, "mpq_produce", mpq_produce, 2,
+                       (uintptr_t)cons_q, (uintptr_t)per_producer) < 0)
+      return -1;
+  }
+
+  if (bench_wait_count(&mpq_consumed, total, BENCH_WAIT_MS) < 0) {
+    BENCH_LOG("%d producers: only %d of %d consumed", producers, (int)aosl_atomic_read(&mpq_consumed), total);
+    return -1;
+  }
+
+  ns = bench_now_ns() - start;
+  snprintf(name, sizeof name, "queue_%dp_ops", producers);
+  bench_report(name, (double)total * 1e9 / ns, "ops/s");
+  snprintf(name, sizeof name, "queue_%dp_lat", producers);
+  bench_report_latency(name, mpq_samples, total);
+  return 0;
+}
+
+static int mpq_run_callers(aosl_mpq_t cons_q, aosl_mpq_t *prod_qs, int producers)
+{
+  aosl_atomic_t done;
+  char name[64];
+  uint64_t start, ns;
+  int per_producer = MPQ_CALLS / producers;
+  int i;
+
+  aosl_atomic_set(&done, 0);
+  start = bench_now_ns();
+  for (i = 0; i < producers; i++) {
+    if (aosl_mpq_queue(prod_qs[i], AOSL_MPQ_INVALID, AOSL_REF_INVALID, "mpq_call_loop", mpq_call_loop, 3,
+                       (uintptr_t)cons_q, (uintptr_t)per_producer, &done) < 0)
+      return -1;
+  }
+
+  if (bench_wait_count(&done, producers, BENCH_WAIT_MS) < 0)
+    return -1;
+
+  ns = bench_now_ns() - start;
+  snprintf(name, sizeof name, "call_%dp_ops", producers);
+  bench_report(name, (double)per_producer * producers * 1e9 / ns, "ops/s");
+  return 0;
+}
+
+int bench_mpq(void)
+{
+  aosl_mpq_t prod_qs[MPQ_MAX_PRODUCERS];
+  aosl_mpq_t cons_q;
+  uint64_t *samples;
+  int nprod = max_producers();
+  int producers;
+  int err = -1;
+  int i;
+
+  for (i = 0; i < MPQ_MAX_PRODUCERS; i++)
+    prod_qs[i] = AOSL_MPQ_INVALID;
+
+  samples = aosl_malloc(sizeof(uint64_t) * MPQ_ITEMS);
+  cons_q = aosl_mpq_create(0, 0, MPQ_MAX_SIZE, "mpq-cons", NULL, NULL, NULL);
+  if (samples == NULL || aosl_mpq_invalid(cons_q))
+    goto __out;
+
+  for (i = 0; i < nprod; i++) {
+    prod_qs[i] = aosl_mpq_create(0, 0, 1000, "mpq-prod", NULL, NULL, NULL);
+    if (aosl_mpq_invalid(prod_qs[i]))
+      goto __out;
+  }
+
+  mpq_samples = samples;
+  for (producers = 1; producers <= nprod; producers <<= 1) {
+    if (mpq_run_producers(cons_q, prod_qs, producers) < 0)
+      goto __out;
+  }
+
+  /* sync call round trip from a none mpq thread */
+  for (i = 0; i < MPQ_CALLS; i++) {
+    uint64_t start = bench_now_ns();
+    if (aosl_mpq_call(cons_q, AOSL_REF_INVALID, "noop_func", noop_func, 0) < 0)
+      goto __out;
+
+    samples[i] = bench_now_ns() - start;
+  }
+
+  bench_report_latency("call_lat", samples, MPQ_CALLS);
+  for (producers = 1; producers <= nprod; producers <<= 1) {
+    if (mpq_run_callers(cons_q, prod_qs, producers) < 0)
+      goto __out;
+  }
+
+  err = 0;
+
+__out:
+  for (i = 0; i < MPQ_MAX_PRODUCERS; i++) {
+    if (!aosl_mpq_invalid(prod_qs[i]))
+      aosl_mpq_destroy_wait(prod_qs[i]);
+  }
+
+  if (!aosl_mpq_invalid(cons_q))
+    aosl_mpq_destroy_wait(cons_q);
+
+  mpq_samples = NULL;
+  if (samples != NULL)
+    aosl_free(samples);
+
+  return err;
+}
+
+/**
+ * Sync call round trip: an idle target queue, so the latency is all
+ * about the queuing, the wakeups and the completion of the caller,
+ * both from a none mpq thread and from an mpq thread.
+ **/
+static void mpq_call_lat_loop(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  aosl_mpq_t target_q = (aosl_mpq_t)argv[0];
+  uint64_t *samples = (uint64_t *)argv[1];
+  uintptr_t i;
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+
+  for (i = 0; i < MPQ_CALLS; i++) {
+    uint64_t start = bench_now_ns();
+    if (aosl_mpq_call(target_q, AOSL_REF_INVALID, "noop_func", noop_func, 0) < 0)
+      break;
+
+    samples[i] = bench_now_ns() - start;
+  }
+
+  aosl_atomic_set((aosl_atomic_t *)argv[2], (intptr_t)i);
+}
+
+int bench_mpq_call(void)
+{
+  aosl_atomic_t done;
+  aosl_mpq_t target_q;
+  aosl_mpq_t caller_q;
+  uint64_t *samples;
+  uint64_t start;
+  int err = -1;
+  int i;
+
+  samples = aosl_malloc(sizeof(uint64_t) * MPQ_CALLS);
+  target_q = aosl_mpq_create(0, 0, 1000, "call-target", NULL, NULL, NULL);
+  caller_q = aosl_mpq_create(0, 0, 1000, "call-caller", NULL, NULL, NULL);
+  if (samples == NULL || aosl_mpq_invalid(target_q) || aosl_mpq_invalid(caller_q))
+    goto __out;
+
+  for (i = 0; i < MPQ_CALLS; i++) {
+    start = bench_now_ns();
+    if (aosl_mpq_call(target_q, AOSL_REF_INVALID, "noop_func", noop_func, 0) < 0)
+      goto __out;
+
+    samples[i] = bench_now_ns() - start;
+  }
+
+  bench_report_latency("call_rtt_thread", samples, MPQ_CALLS);
+
+  aosl_atomic_set(&done, 0);
+  if (aosl_mpq_queue(caller_q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, "mpq_call_lat_loop", mpq_call_lat_loop, 3,
+                     (uintptr_t)target_q, samples, &done) < 0)
+    goto __out;
+
+  if (bench_wait_count(&done, MPQ_CALLS, BENCH_WAIT_MS) < 0)
+    goto __out;
+
+  bench_report_latency("call_rtt_mpq", samples, MPQ_CALLS);
+  err = 0;
+
+__out:
+  if (!aosl_mpq_invalid(caller_q))
+    aosl_mpq_destroy_wait(caller_q);
+
+  if (!aosl_mpq_invalid(target_q))
+    aosl_mpq_destroy_wait(target_q);
+
+  if (samples != NULL)
+    aosl_free(samples);
+
+  return err;
+}
+
+/**
+ * Control message latency under a data flood: a producer queue floods
+ * the consumer with short data functions in the normal lane, and the
+ * sync control calls are issued to the normal and the urgent lane.
+ **/
+static aosl_atomic_t flood_done;
+
+static void flood_work(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  uint64_t end = bench_now_ns() + FLOOD_WORK_NS;
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+  UNUSED(argv);
+
+  while (bench_now_ns() < end)
+    ;
+
+  aosl_atomic_inc(&flood_done);
+}
+
+static void flood_produce(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  aosl_mpq_t cons_q = (aosl_mpq_t)argv[0];
+  int i;
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+
+  for (i = 0; i < FLOOD_ITEMS; i++) {
+    while (aosl_mpq_queue(cons_q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, "flood_work", flood_work, 0) < 0)
+      aosl_msleep(1);
+  }
+}
+
+static int mpq_pri_run(aosl_mpq_t cons_q, aosl_mpq_t prod_q, int pri, const char *name, uint64_t *samples)
+{
+  int n = 0;
+
+  aosl_atomic_set(&flood_done, 0);
+  if (aosl_mpq_queue(prod_q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, "flood_produce", flood_produce, 1,
+                     (uintptr_t)cons_q) < 0)
+    return -1;
+
+  /* let the backlog build up */
+  aosl_msleep(5);
+  while (n < CTRL_CALLS && aosl_atomic_read(&flood_done) < FLOOD_ITEMS) {
+    uint64_t start = bench_now_ns();
+    if (aosl_mpq_call_pri(cons_q, AOSL_REF_INVALID, pri, "noop_func", noop_func, 0) < 0)
+      return -1;
+
+    samples[n++] = bench_now_ns() - start;
+    aosl_msleep(1);
+  }
+
+  if (bench_wait_count(&flood_done, FLOOD_ITEMS, BENCH_WAIT_MS) < 0)
+    return -1;
+
+  bench_report_latency(name, samples, n);
+  return 0;
+}
+
+int bench_mpq_pri(void)
+{
+  uint64_t samples[CTRL_CALLS];
+  aosl_mpq_t cons_q;
+  aosl_mpq_t prod_q;
+  int err = -1;
+
+  cons_q = aosl_mpq_create(0, 0, MPQ_MAX_SIZE, "pri-cons", NULL, NULL, NULL);
+  prod_q = aosl_mpq_create(0, 0, 1000, "pri-prod", NULL, NULL, NULL);
+  if (aosl_mpq_invalid(cons_q) || aosl_mpq_invalid(prod_q))
+    goto __out;
+
+  if (mpq_pri_run(cons_q, prod_q, AOSL_MPQ_PRI_NORMAL, "ctrl_normal_lat", samples) < 0)
+    goto __out;
+
+  if (mpq_pri_run(cons_q, prod_q, AOSL_MPQ_PRI_URGENT, "ctrl_urgent_lat", samples) < 0)
+    goto __out;
+
+  err = 0;
+
+__out:
+  if (!aosl_mpq_invalid(prod_q))
+    aosl_mpq_destroy_wait(prod_q);
+
+  if (!aosl_mpq_invalid(cons_q))
+    aosl_mpq_destroy_wait(cons_q);
+
+  return err;
+}
+
+int bench_mpqp(void)
+{
+  aosl_atomic_t done;
+  uint64_t *samples;
+  aosl_mpqp_t qp;
+  uint64_t start, ns;
+  int pool_size = bench_cpu_count() < 4 ? bench_cpu_count() : 4;
+  int err = -1;
+  int i;
+
+  samples = aosl_malloc(sizeof(uint64_t) * MPQ_CALLS);
+  qp = aosl_mpqp_create(pool_size, 0, 0, MPQP_MAX_SIZE, -1, 0, "bench-pool", NULL, NULL, NULL);
+  if (samples == NULL || qp == NULL)
+    goto __out;
+
+  aosl_atomic_set(&done, 0);
+  start = bench_now_ns();
+  for (i = 0; i < MPQP_ITEMS; i++) {
+    while (aosl_mpq_invalid(aosl_mpqp_queue(qp, AOSL_MPQ_INVALID, AOSL_REF_INVALID, "count_func", count_func, 1, &done)))
+      aosl_msleep(1);
+  }
+
+  if (bench_wait_count(&done, MPQP_ITEMS, BENCH_WAIT_MS) < 0)
+    goto __out;
+
+  ns = bench_now_ns() - start;
+  bench_report("pool_size", pool_size, "queues");
+  bench_report("dispatch_ops", (double)MPQP_ITEMS * 1e9 / ns, "ops/s");
+
+  for (i = 0; i < MPQ_CALLS; i++) {
+    start = bench_now_ns();
+    if (aosl_mpq_invalid(aosl_mpqp_call(qp, AOSL_REF_INVALID, "noop_func", noop_func, 0)))
+      goto __out;
+
+    samples[i] = bench_now_ns() - start;
+  }
+
+  bench_report_latency("call_lat", samples, MPQ_CALLS);
+  err = 0;
+
+__out:
+  if (qp != NULL)
+    aosl_mpqp_destroy(qp, 1);
+
+  if (samples != NULL)
+    aosl_free(samples);
+
+  return err;
+}
+
+/**
+ * Short-lived queues: create a queue, run one call on it and destroy it
+ * with waiting, without the recycling cache and with it. The create and
+ * the destroy latencies are reported separately.
+ **/
+static int mpq_create_run(const char *name, uint64_t *create_samples, uint64_t *destroy_samples)
+{
+  char metric[32];
+  uint64_t start;
+  aosl_mpq_t q;
+  int i;
+
+  for (i = 0; i < CREATE_QS; i++) {
+    start = bench_now_ns();
+    q = aosl_mpq_create(0, 0, 100, "bench-short", NULL, NULL, NULL);
+    if (aosl_mpq_invalid(q))
+      return -1;
+
+    create_samples[i] = bench_now_ns() - start;
+    if (aosl_mpq_call(q, AOSL_REF_INVALID, "noop_func", noop_func, 0) < 0) {
+      aosl_mpq_destroy_wait(q);
+      return -1;
+    }
+
+    start = bench_now_ns();
+    aosl_mpq_destroy_wait(q);
+    destroy_samples[i] = bench_now_ns() - start;
+  }
+
+  snprintf(metric, sizeof metric, "%s_create", name);
+  bench_report_latency(metric, create_samples, CREATE_QS);
+  snprintf(metric, sizeof metric, "%s_destroy", name);
+  bench_report_latency(metric, destroy_samples, CREATE_QS);
+  return 0;
+}
+
+int bench_mpq_create(void)
+{
+  static uint64_t create_samples[CREATE_QS];
+  static uint64_t destroy_samples[CREATE_QS];
+  int park_max = aosl_mpq_set_park_max(-1);
+  int err;
+
+  aosl_mpq_set_park_max(0);
+  err = mpq_create_run("fresh", create_samples, destroy_samples);
+  aosl_mpq_set_park_max(park_max > 0 ? park_max : 1);
+  if (err == 0)
+    err = mpq_create_run("parked", create_samples, destroy_samples);
+
+  aosl_mpq_set_park_max(park_max);
+  return err;
+}
+
+/**
+ * Timers at scale, all the operations run on the timer queue itself:
+ * create oneshot timers expiring at the same time, measure how fast they
+ * fire, then kill them; create periodic timers, cancel and kill them.
+ * The creating stops at the first failure, the timer id pool may not
+ * hold TIMER_COUNT timers.
+ **/
+static int timer_count;
+static aosl_atomic_t timer_fired;
+static uint64_t timer_first_fire_ns;
+static uint64_t timer_last_fire_ns;
+
+static void timer_on_fire(aosl_timer_t timer_id, const aosl_ts_t *now_p, uintptr_t argc, uintptr_t argv[])
+{
+  uint64_t now = bench_now_ns();
+  UNUSED(timer_id);
+  UNUSED(now_p);
+  UNUSED(argc);
+  UNUSED(argv);
+
+  if (aosl_atomic_read(&timer_fired) == 0)
+    timer_first_fire_ns = now;
+
+  timer_last_fire_ns = now;
+  aosl_atomic_inc(&timer_fired);
+}
+
+static void timer_create_oneshot(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  aosl_timer_t *timers = (aosl_timer_t *)argv[0];
+  aosl_ts_t expire = aosl_tick_now() + 100;
+  uint64_t start = bench_now_ns();
+  int i;
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+
+  for (i = 0; i < TIMER_COUNT; i++) {
+    timers[i] = aosl_mpq_set_oneshot_timer(expire, timer_on_fire, NULL, 0);
+    if (aosl_mpq_timer_invalid(timers[i]))
+      break;
+  }
+
+  timer_count = i;
+  *(uint64_t *)argv[1] = bench_now_ns() - start;
+}
+
+static void timer_create_periodic(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  aosl_timer_t *timers = (aosl_timer_t *)argv[0];
+  uint64_t start = bench_now_ns();
+  int i;
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+
+  /* spread the expire time, but never fire during the benchmark */
+  for (i = 0; i < TIMER_COUNT; i++) {
+    timers[i] = aosl_mpq_set_timer(3600000 + i, timer_on_fire, NULL, 0);
+    if (aosl_mpq_timer_invalid(timers[i]))
+      break;
+  }
+
+  timer_count = i;
+  *(uint64_t *)argv[1] = bench_now_ns() - start;
+}
+
+static void timer_cancel_all(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  aosl_timer_t *timers = (aosl_timer_t *)argv[0];
+  uint64_t start = bench_now_ns();
+  int i;
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+
+  for (i = 0; i < timer_count; i++)
+    aosl_mpq_cancel_timer(timers[i]);
+
+  *(uint64_t *)argv[1] = bench_now_ns() - start;
+}
+
+static void timer_kill_all(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  aosl_timer_t *timers = (aosl_timer_t *)argv[0];
+  uint64_t start = bench_now_ns();
+  int i;
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+
+  for (i = 0; i < TIMER_COUNT; i++) {
+    if (!aosl_mpq_timer_invalid(timers[i]))
+      aosl_mpq_kill_timer(timers[i]);
+
+    timers[i] = AOSL_MPQ_TIMER_INVALID;
+  }
+
+  *(uint64_t *)argv[1] = bench_now_ns() - start;
+}
+
+int bench_timer(void)
+{
+  aosl_timer_t *timers;
+  aosl_mpq_t q;
+  uint64_t ns = 0;
+  int err = -1;
+  int i;
+
+  timers = aosl_malloc(sizeof(aosl_timer_t) * TIMER_COUNT);
+  q = aosl_mpq_create(0, 0, 1000, "timer-q", NULL, NULL, NULL);
+  if (timers == NULL || aosl_mpq_invalid(q))
+    goto __out;
+
+  for (i = 0; i < TIMER_COUNT; i++)
+    timers[i] = AOSL_MPQ_TIMER_INVALID;
+
+  aosl_atomic_set(&timer_fired, 0);
+  aosl_mpq_call(q, AOSL_REF_INVALID, "timer_create_oneshot", timer_create_oneshot, 2, timers, &ns);
+  if (timer_count == 0)
+    goto __out;
+
+  bench_report("oneshot_timers", timer_count, "timers");
+  bench_report("oneshot_create_ns", (double)ns / timer_count, "ns");
+  if (bench_wait_count(&timer_fired, timer_count, BENCH_WAIT_MS) < 0)
+    goto __out;
+
+  if (timer_last_fire_ns > timer_first_fire_ns)
+    bench_report("fire_rate", (double)(timer_count - 1) * 1e9 / (timer_last_fire_ns - timer_first_fire_ns), "timers/s");
+
+  aosl_mpq_call(q, AOSL_REF_INVALID, "timer_kill_all", timer_kill_all, 2, timers, &ns);
+  bench_report("oneshot_kill_ns", (double)ns / timer_count, "ns");
+
+  aosl_mpq_call(q, AOSL_REF_INVALID, "timer_create_periodic", timer_create_periodic, 2, timers, &ns);
+  if (timer_count == 0)
+    goto __out;
+
+  bench_report("periodic_timers", timer_count, "timers");
+  bench_report("periodic_create_ns", (double)ns / timer_count, "ns");
+  aosl_mpq_call(q, AOSL_REF_INVALID, "timer_cancel_all", timer_cancel_all, 2, timers, &ns);
+  bench_report("periodic_cancel_ns", (double)ns / timer_count, "ns");
+  aosl_mpq_call(q, AOSL_REF_INVALID, "timer_kill_all", timer_kill_all, 2, timers, &ns);
+  bench_report("periodic_kill_ns", (double)ns / timer_count, "ns");
+  err = 0;
+
+__out:
+  if (!aosl_mpq_invalid(q)) {
+    if (timers != NULL)
+      aosl_mpq_call(q, AOSL_REF_INVALID, "timer_kill_all", timer_kill_all, 2, timers, &ns);
+
+    aosl_mpq_destroy_wait(q);
+  }
+
+  if (timers != NULL)
+    aosl_free(timers);
+
+  return err;
+}
+
+/**
+ * Read lock contention on one ref object from P queues.
+ **/
+static aosl_atomic_t ref_start;
+
+static void ref_noop(void *arg, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(arg);
+  UNUSED(argc);
+  UNUSED(argv);
+}
+
+static void ref_reader(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  aosl_ref_t ref = (aosl_ref_t)argv[0];
+  int i;
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+
+  while (aosl_atomic_read(&ref_start) == 0)
+    ;
+
+  for (i = 0; i < REF_READS; i++)
+    aosl_ref_read(ref, ref_noop, 0);
+
+  aosl_atomic_inc((aosl_atomic_t *)argv[1]);
+}
+
+int bench_ref(void)
+{
+  aosl_mpq_t readers[MPQ_MAX_PRODUCERS];
+  aosl_atomic_t done;
+  aosl_ref_t ref;
+  char name[64];
+  uint64_t start, ns;
+  int nreaders = max_producers();
+  int count;
+  int err = -1;
+  int i;
+
+  for (i = 0; i < MPQ_MAX_PRODUCERS; i++)
+    readers[i] = AOSL_MPQ_INVALID;
+
+  ref = aosl_ref_create(NULL, NULL, 0, 0, 0);
+  if (aosl_ref_invalid(ref))
+    goto __out;
+
+  for (i = 0; i < nreaders; i++) {
+    readers[i] = aosl_mpq_create(0, 0, 1000, "ref-reader", NULL, NULL, NULL);
+    if (aosl_mpq_invalid(readers[i]))
+      goto __out;
+  }
+
+  for (count = 1; count <= nreaders; count <<= 1) {
+    aosl_atomic_set(&ref_start, 0);
+    aosl_atomic_set(&done, 0);
+    for (i = 0; i < count; i++) {
+      if (aosl_mpq_queue(readers[i], AOSL_MPQ_INVALID, AOSL_REF_INVALID, "ref_reader", ref_reader, 2,
+                         (uintptr_t)ref, &done) < 0)
+        goto __out;
+    }
+
+    start = bench_now_ns();
+    aosl_atomic_set(&ref_start, 1);
+    if (bench_wait_count(&done, count, BENCH_WAIT_MS) < 0)
+      goto __out;
+
+    ns = bench_now_ns() - start;
+    snprintf(name, sizeof name, "read_%dp_ops", count);
+    bench_report(name, (double)REF_READS * count * 1e9 / ns, "ops/s");
+  }
+
+  err = 0;
+
+__out:
+  /* release the readers still spinning when failed */
+  aosl_atomic_set(&ref_start, 1);
+  for (i = 0; i < MPQ_MAX_PRODUCERS; i++) {
+    if (!aosl_mpq_invalid(readers[i]))
+      aosl_mpq_destroy_wait(readers[i]);
+  }
+
+  if (!aosl_ref_invalid(ref))
+    aosl_ref_destroy(ref, 1);
+
+  return err;
+}
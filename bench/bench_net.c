@@ -0,0 +1,288 @@
+/***************************************************************************
+ * Module:	aosl network benchmark
+ *
+ * Copyright © 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+#include <string.h>
+
+#include "api/aosl_mm.h"
+#include "api/aosl_mpq.h"
+#include "api/aosl_mpq_net.h"
+#include "api/aosl_socket.h"
+#include "api/aosl_atomic.h"
+#include "api/aosl_time.h"
+#include "hal/aosl_hal_socket.h"
+#include "aosl_bench.h"
+
+/**
+ * Loopback packets per second: the sender queue sends small packets in
+ * batches for a fixed duration, requeuing itself between the batches so
+ * the queue can still process its fd events, the receiver counts them.
+ **/
+#define NET_PKT_SIZE 64
+#define NET_BATCH 256
+#define NET_SEND_MS 1000
+
+static aosl_atomic_t net_sent;
+static aosl_atomic_t net_received;
+static uint64_t net_send_start_ns;
+static uint64_t net_last_recv_ns;
+static aosl_fd_t net_peer_fd = AOSL_INVALID_FD;
+
+static void net_on_event(aosl_fd_t fd, int event, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(fd);
+  UNUSED(event);
+  UNUSED(argc);
+  UNUSED(argv);
+}
+
+static void net_count(void)
+{
+  net_last_recv_ns = bench_now_ns();
+  aosl_atomic_inc(&net_received);
+}
+
+static int net_send_done(void)
+{
+  return bench_now_ns() - net_send_start_ns >= (uint64_t)NET_SEND_MS * 1000000ull;
+}
+
+static int net_bind_loopback(aosl_fd_t fd, aosl_sockaddr_t *addr)
+{
+  memset(addr, 0, sizeof *addr);
+  addr->sa_family = AOSL_AF_INET;
+  aosl_inet_addr_from_string(&addr->sin_addr, "127.0.0.1");
+  if (aosl_bind(fd, addr) < 0 || aosl_hal_sk_get_sockname(fd, addr) < 0)
+    return -1;
+
+  return 0;
+}
+
+static void net_report(int timeo_ms)
+{
+  uint64_t ns;
+
+  /* let the receiver drain, datagrams may be dropped so do not wait forever */
+  bench_wait_count(&net_received, aosl_atomic_read(&net_sent), timeo_ms);
+  ns = net_last_recv_ns - net_send_start_ns;
+  bench_report("sent", (double)aosl_atomic_read(&net_sent), "pkts");
+  bench_report("received", (double)aosl_atomic_read(&net_received), "pkts");
+  if (ns > 0)
+    bench_report("recv_pps", (double)aosl_atomic_read(&net_received) * 1e9 / ns, "pkts/s");
+
+  if (aosl_atomic_read(&net_sent) > 0)
+    bench_report("loss", 100.0 - (double)aosl_atomic_read(&net_received) * 100 / aosl_atomic_read(&net_sent), "%");
+}
+
+static void udp_on_data(void *data, size_t len, uintptr_t argc, uintptr_t argv[], const aosl_sk_addr_t *addr)
+{
+  UNUSED(data);
+  UNUSED(len);
+  UNUSED(argc);
+  UNUSED(argv);
+  UNUSED(addr);
+  net_count();
+}
+
+static void udp_send_batch(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  aosl_fd_t fd = (aosl_fd_t)argv[0];
+  const aosl_sockaddr_t *dest = (const aosl_sockaddr_t *)argv[1];
+  char pkt[NET_PKT_SIZE];
+  int i;
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+
+  if (net_send_done())
+    return;
+
+  memset(pkt, 'u', sizeof pkt);
+  for (i = 0; i < NET_BATCH; i++) {
+    if (aosl_sendto(fd, pkt, sizeof pkt, 0, dest) < 0)
+      break;
+
+    aosl_atomic_inc(&net_sent);
+  }
+
+  aosl_mpq_queue_argv(aosl_mpq_this(), AOSL_MPQ_INVALID, AOSL_REF_INVALID, "udp_send_batch", udp_send_batch, argc, argv);
+}
+
+int bench_udp_pps(void)
+{
+  aosl_mpq_t srv_q, cli_q;
+  aosl_sockaddr_t srv_addr, cli_addr;
+  aosl_fd_t srv_fd, cli_fd;
+  int err = -1;
+
+  aosl_atomic_set(&net_sent, 0);
+  aosl_atomic_set(&net_received, 0);
+  srv_q = aosl_mpq_create(0, 0, 1000, "udp-srv", NULL, NULL, NULL);
+  cli_q = aosl_mpq_create(0, 0, 1000, "udp-cli", NULL, NULL, NULL);
+  if (aosl_mpq_invalid(srv_q) || aosl_mpq_invalid(cli_q))
+    goto __out;
+
+  srv_fd = aosl_socket(AOSL_AF_INET, AOSL_SOCK_DGRAM, AOSL_IPPROTO_UDP);
+  if (aosl_fd_invalid(srv_fd) || net_bind_loopback(srv_fd, &srv_addr) < 0 ||
+      aosl_mpq_add_dgram_socket_on_q(srv_q, srv_fd, 2048, udp_on_data, net_on_event, 0) < 0)
+    goto __out;
+
+  cli_fd = aosl_socket(AOSL_AF_INET, AOSL_SOCK_DGRAM, AOSL_IPPROTO_UDP);
+  if (aosl_fd_invalid(cli_fd) || net_bind_loopback(cli_fd, &cli_addr) < 0 ||
+      aosl_mpq_add_dgram_socket_on_q(cli_q, cli_fd, 2048, udp_on_data, net_on_event, 0) < 0)
+    goto __out;
+
+  net_send_start_ns = bench_now_ns();
+  net_last_recv_ns = net_send_start_ns;
+  if (aosl_mpq_queue(cli_q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, "udp_send_batch", udp_send_batch, 2,
+                     (uintptr_t)cli_fd, &srv_addr) < 0)
+    goto __out;
+
+  aosl_msleep(NET_SEND_MS);
+  /* make sure the sender stopped */
+  aosl_mpq_call(cli_q, AOSL_REF_INVALID, "udp_send_batch", udp_send_batch, 2, (uintptr_t)cli_fd, &srv_addr);
+  net_report(1000);
+  err = 0;
+
+__out:
+  if (!aosl_mpq_invalid(cli_q))
+    aosl_mpq_destroy_wait(cli_q);
+
+  if (!aosl_mpq_invalid(srv_q))
+    aosl_mpq_destroy_wait(srv_q);
+
+  return err;
+}
+
+/* 4 bytes network order length, including the length itself */
+static isize_t tcp_chk_pkt(const void *data, size_t len, uintptr_t argc, uintptr_t argv[])
+{
+  uint32_t pkt_len;
+  UNUSED(argc);
+  UNUSED(argv);
+
+  if (len < sizeof pkt_len)
+    return 0;
+
+  memcpy(&pkt_len, data, sizeof pkt_len);
+  pkt_len = aosl_ntohl(pkt_len);
+  if (pkt_len > len)
+    return 0;
+
+  return (isize_t)pkt_len;
+}
+
+static void tcp_on_data(void *data, size_t len, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(data);
+  UNUSED(len);
+  UNUSED(argc);
+  UNUSED(argv);
+  net_count();
+}
+
+static void tcp_on_accepted(aosl_accept_data_t *accept_data, size_t len, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(len);
+  UNUSED(argc);
+  UNUSED(argv);
+
+  if (aosl_mpq_add_stream_socket(accept_data->newsk, 2048, tcp_chk_pkt, tcp_on_data, net_on_event, 0) < 0) {
+    aosl_close(accept_data->newsk);
+    return;
+  }
+
+  net_peer_fd = accept_data->newsk;
+}
+
+static void tcp_send_batch(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  aosl_fd_t fd = (aosl_fd_t)argv[0];
+  char pkt[NET_PKT_SIZE];
+  uint32_t pkt_len = aosl_htonl(NET_PKT_SIZE);
+  int i;
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+
+  if (net_send_done())
+    return;
+
+  memset(pkt, 't', sizeof pkt);
+  memcpy(pkt, &pkt_len, sizeof pkt_len);
+  for (i = 0; i < NET_BATCH; i++) {
+    /* the write queue is full, retry after the queue flushed some */
+    if (aosl_send(fd, pkt, sizeof pkt, 0) < 0)
+      break;
+
+    aosl_atomic_inc(&net_sent);
+  }
+
+  aosl_mpq_queue_argv(aosl_mpq_this(), AOSL_MPQ_INVALID, AOSL_REF_INVALID, "tcp_send_batch", tcp_send_batch, argc, argv);
+}
+
+int bench_tcp_pps(void)
+{
+  aosl_mpq_t srv_q, cli_q;
+  aosl_sockaddr_t addr;
+  aosl_fd_t listen_fd, fd;
+  aosl_ts_t start;
+  int err = -1;
+
+  aosl_atomic_set(&net_sent, 0);
+  aosl_atomic_set(&net_received, 0);
+  srv_q = aosl_mpq_create(0, 0, 1000, "tcp-srv", NULL, NULL, NULL);
+  cli_q = aosl_mpq_create(0, 0, 1000, "tcp-cli", NULL, NULL, NULL);
+  if (aosl_mpq_invalid(srv_q) || aosl_mpq_invalid(cli_q))
+    goto __out;
+
+  listen_fd = aosl_socket(AOSL_AF_INET, AOSL_SOCK_STREAM, AOSL_IPPROTO_TCP);
+  if (aosl_fd_invalid(listen_fd) || net_bind_loopback(listen_fd, &addr) < 0 ||
+      aosl_mpq_listen_on_q(srv_q, listen_fd, 16, tcp_on_accepted, net_on_event, 0) < 0)
+    goto __out;
+
+  fd = aosl_socket(AOSL_AF_INET, AOSL_SOCK_STREAM, AOSL_IPPROTO_TCP);
+  if (aosl_fd_invalid(fd) ||
+      aosl_mpq_connect_on_q(cli_q, fd, &addr, 5000, 2048, tcp_chk_pkt, tcp_on_data, net_on_event, 0) < 0)
+    goto __out;
+
+  start = aosl_tick_ms();
+  while (aosl_fd_invalid(net_peer_fd)) {
+    if ((int)(aosl_tick_ms() - start) > 5000) {
+      BENCH_LOG("connection not accepted");
+      goto __out;
+    }
+
+    aosl_msleep(1);
+  }
+
+  /* let the connecting side get ready */
+  aosl_msleep(100);
+  net_send_start_ns = bench_now_ns();
+  net_last_recv_ns = net_send_start_ns;
+  if (aosl_mpq_queue(cli_q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, "tcp_send_batch", tcp_send_batch, 1, (uintptr_t)fd) < 0)
+    goto __out;
+
+  aosl_msleep(NET_SEND_MS);
+  aosl_mpq_call(cli_q, AOSL_REF_INVALID, "tcp_send_batch", tcp_send_batch, 1, (uintptr_t)fd);
+  net_report(10000);
+  if (aosl_atomic_read(&net_received) != aosl_atomic_read(&net_sent)) {
+    BENCH_LOG("tcp packets lost");
+    goto __out;
+  }
+
+  err = 0;
+
+__out:
+  if (!aosl_mpq_invalid(cli_q))
+    aosl_mpq_destroy_wait(cli_q);
+
+  if (!aosl_mpq_invalid(srv_q))
+    aosl_mpq_destroy_wait(srv_q);
+
+  /* closed with the server queue */
+  net_peer_fd = AOSL_INVALID_FD;
+  return err;
+}
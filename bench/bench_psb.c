@@ -0,0 +1,152 @@
+/***************************************************************************
+ * Module:	aosl psb benchmark
+ *
+ * Copyright © 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "api/aosl_mm.h"
+#include "api/aosl_mpq.h"
+#include "api/aosl_psb.h"
+#include "aosl_bench.h"
+
+/**
+ * Fan one packet out to several receivers, by copying the data into a new
+ * psb for each receiver as before, and by cloning the psb which shares the
+ * data. Both run in a queue thread, where the psb blocks are recycled by
+ * the queue buffer pool.
+ **/
+#define FANOUT_LOOPS 100000
+#define FANOUT_RECEIVERS 8
+#define FANOUT_SIZES 2
+
+/* an mtu sized packet and a big video frame */
+static const size_t fanout_pkt_sizes[FANOUT_SIZES] = { 1200, 16000 };
+
+struct fanout_result {
+  uint64_t copy_ns[FANOUT_SIZES];
+  uint64_t clone_ns[FANOUT_SIZES];
+  uint64_t copy_allocs[FANOUT_SIZES];
+  uint64_t clone_allocs[FANOUT_SIZES];
+  int err;
+};
+
+static int fanout_copy(const aosl_psb_t *pkt, aosl_psb_t *out[])
+{
+  int i;
+
+  for (i = 0; i < FANOUT_RECEIVERS; i++) {
+    out[i] = aosl_alloc_psb(pkt->len);
+    if (out[i] == NULL)
+      return -1;
+
+    memcpy(aosl_psb_put(out[i], pkt->len), pkt->data, pkt->len);
+  }
+
+  return 0;
+}
+
+static int fanout_clone(const aosl_psb_t *pkt, aosl_psb_t *out[])
+{
+  int i;
+
+  for (i = 0; i < FANOUT_RECEIVERS; i++) {
+    out[i] = aosl_psb_clone(pkt);
+    if (out[i] == NULL)
+      return -1;
+  }
+
+  return 0;
+}
+
+static void fanout_free(aosl_psb_t *out[])
+{
+  int i;
+
+  for (i = 0; i < FANOUT_RECEIVERS; i++)
+    aosl_free_psb_list(out[i]);
+}
+
+static uint64_t fanout_run(int (*fanout)(const aosl_psb_t *, aosl_psb_t *[]), size_t pkt_size, uint64_t *allocs_p, int *err_p)
+{
+  aosl_psb_t *out[FANOUT_RECEIVERS];
+  aosl_psb_t *pkt;
+  uint64_t start, allocs;
+  int i;
+
+  allocs = bench_alloc_count();
+  start = bench_now_ns();
+  for (i = 0; i < FANOUT_LOOPS; i++) {
+    /* a new packet arrives, goes to all the receivers, and they are done */
+    pkt = aosl_alloc_psb(pkt_size);
+    if (pkt == NULL) {
+      *err_p = -1;
+      return 0;
+    }
+
+    memset(aosl_psb_put(pkt, pkt_size), 'p', pkt_size);
+    if (fanout(pkt, out) < 0) {
+      *err_p = -1;
+      return 0;
+    }
+
+    aosl_free_psb_list(pkt);
+    fanout_free(out);
+  }
+
+  *allocs_p = bench_alloc_count() - allocs;
+  return bench_now_ns() - start;
+}
+
+static void fanout_func(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  struct fanout_result *res = (struct fanout_result *)argv[0];
+  int i;
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+
+  for (i = 0; i < FANOUT_SIZES; i++) {
+    res->copy_ns[i] = fanout_run(fanout_copy, fanout_pkt_sizes[i], &res->copy_allocs[i], &res->err);
+    res->clone_ns[i] = fanout_run(fanout_clone, fanout_pkt_sizes[i], &res->clone_allocs[i], &res->err);
+  }
+}
+
+int bench_psb_fanout(void)
+{
+  struct fanout_result res;
+  char name[64];
+  aosl_mpq_t q;
+  int i;
+
+  memset(&res, 0, sizeof res);
+  q = aosl_mpq_create(0, 0, 100, "bench-psb", NULL, NULL, NULL);
+  if (aosl_mpq_invalid(q))
+    return -1;
+
+  if (aosl_mpq_call(q, AOSL_REF_INVALID, "fanout_func", fanout_func, 1, &res) < 0)
+    res.err = -1;
+
+  aosl_mpq_destroy_wait(q);
+  if (res.err < 0) {
+    BENCH_LOG("psb fanout failed");
+    return -1;
+  }
+
+  bench_report("receivers", FANOUT_RECEIVERS, "count");
+  for (i = 0; i < FANOUT_SIZES; i++) {
+    snprintf(name, sizeof name, "copy_fanout_%u_ns", (unsigned)fanout_pkt_sizes[i]);
+    bench_report(name, (double)res.copy_ns[i] / FANOUT_LOOPS, "ns");
+    snprintf(name, sizeof name, "clone_fanout_%u_ns", (unsigned)fanout_pkt_sizes[i]);
+    bench_report(name, (double)res.clone_ns[i] / FANOUT_LOOPS, "ns");
+    snprintf(name, sizeof name, "copy_fanout_%u_allocs", (unsigned)fanout_pkt_sizes[i]);
+    bench_report(name, (double)res.copy_allocs[i] / FANOUT_LOOPS, "count");
+    snprintf(name, sizeof name, "clone_fanout_%u_allocs", (unsigned)fanout_pkt_sizes[i]);
+    bench_report(name, (double)res.clone_allocs[i] / FANOUT_LOOPS, "count");
+  }
+  return 0;
+}
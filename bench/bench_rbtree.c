@@ -0,0 +1,196 @@
+/***************************************************************************
+ * Module:	aosl red-black tree benchmark
+ *
+ * Copyright © 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+
+#include "api/aosl_rbtree.h"
+#include "aosl_bench.h"
+
+/**
+ * The generic tree functions calling the rb_cmp of the root with the key
+ * in a va_list at every level, against the functions generated for the
+ * entry type with AOSL_RB_DEFINE. The keys are inserted and looked up in
+ * a shuffled order. The churn takes the first entry and adds it back with
+ * a later key like a periodic timer, on the plain tree with aosl_rb_first
+ * and on the leftmost cached one.
+ **/
+#define RB_MEDIUM 4096
+#define RB_BIG (256 * 1024)
+#define RB_LOOKUPS (2 * 1024 * 1024)
+#define RB_CHURNS (1024 * 1024)
+
+struct rb_bench_entry {
+  struct aosl_rb_node node;
+  uint64_t key;
+};
+
+#define rb_bench_key(e) ((e)->key)
+
+AOSL_RB_DEFINE(rb_bench, struct rb_bench_entry, node, uint64_t, rb_bench_key, AOSL_RB_CMP)
+
+static uint32_t rb_rand_seed = 0x6b43a9b5;
+
+static uint32_t rb_rand(void)
+{
+  /* xorshift32 */
+  rb_rand_seed ^= rb_rand_seed << 13;
+  rb_rand_seed ^= rb_rand_seed >> 17;
+  rb_rand_seed ^= rb_rand_seed << 5;
+  return rb_rand_seed;
+}
+
+static int rb_bench_cmp(struct aosl_rb_node *rb_node, struct aosl_rb_node *node, va_list args)
+{
+  struct rb_bench_entry *e = aosl_rb_entry(rb_node, struct rb_bench_entry, node);
+  uint64_t key;
+
+  if (node != NULL)
+    key = aosl_rb_entry(node, struct rb_bench_entry, node)->key;
+  else
+    key = va_arg(args, uint64_t);
+
+  if (e->key > key)
+    return 1;
+
+  if (e->key < key)
+    return -1;
+
+  return 0;
+}
+
+static void rb_bench_fill(struct rb_bench_entry *entries, uint64_t *keys, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    keys[i] = (uint64_t)i * 2654435761u;
+    entries[i].key = keys[i];
+  }
+
+  for (i = n - 1; i > 0; i--) {
+    size_t j = rb_rand() % (i + 1);
+    uint64_t tmp = keys[i];
+    keys[i] = keys[j];
+    keys[j] = tmp;
+    entries[i].key = keys[i];
+    entries[j].key = keys[j];
+  }
+}
+
+static int rb_run(size_t n, const char *prefix)
+{
+  char name[64];
+  struct aosl_rb_root root;
+  struct aosl_rb_root_cached croot;
+  struct rb_bench_entry *entries;
+  struct rb_bench_entry *e;
+  struct aosl_rb_node *node;
+  uint64_t *keys;
+  uint64_t start, key;
+  double generic_insert_ns, typed_insert_ns, generic_find_ns, typed_find_ns, generic_churn_ns, cached_churn_ns;
+  size_t i;
+  int found = 0;
+
+  entries = malloc(n * sizeof *entries);
+  keys = malloc(n * sizeof *keys);
+  if (entries == NULL || keys == NULL) {
+    free(keys);
+    free(entries);
+    return -1;
+  }
+
+  rb_bench_fill(entries, keys, n);
+
+  aosl_rb_root_init(&root, rb_bench_cmp);
+  start = bench_now_ns();
+  for (i = 0; i < n; i++)
+    aosl_rb_insert_node(&root, &entries[i].node);
+  generic_insert_ns = (double)(bench_now_ns() - start) / n;
+
+  start = bench_now_ns();
+  for (i = 0; i < RB_LOOKUPS; i++)
+    found += aosl_find_rb_node(&root, NULL, keys[i % n]) != NULL;
+  generic_find_ns = (double)(bench_now_ns() - start) / RB_LOOKUPS;
+
+  /* the same entries again for the generated functions */
+  aosl_rb_root_init(&root, NULL);
+  start = bench_now_ns();
+  for (i = 0; i < n; i++)
+    rb_bench_add(&root, &entries[i]);
+  typed_insert_ns = (double)(bench_now_ns() - start) / n;
+
+  start = bench_now_ns();
+  for (i = 0; i < RB_LOOKUPS; i++)
+    found += rb_bench_find(&root, keys[i % n]) != NULL;
+  typed_find_ns = (double)(bench_now_ns() - start) / RB_LOOKUPS;
+
+  /* the churn on the generic tree, the keys keep growing */
+  key = (uint64_t)n * 2654435761u;
+  aosl_rb_root_init(&root, rb_bench_cmp);
+  for (i = 0; i < n; i++)
+    aosl_rb_insert_node(&root, &entries[i].node);
+  start = bench_now_ns();
+  for (i = 0; i < RB_CHURNS; i++) {
+    node = aosl_rb_first(&root);
+    aosl_rb_erase(&root, node);
+    e = aosl_rb_entry(node, struct rb_bench_entry, node);
+    e->key = key + (rb_rand() & 0xffff);
+    aosl_rb_insert_node(&root, node);
+    key += 64;
+  }
+  generic_churn_ns = (double)(bench_now_ns() - start) / RB_CHURNS;
+
+  rb_bench_fill(entries, keys, n);
+  key = (uint64_t)n * 2654435761u;
+  aosl_rb_root_cached_init(&croot);
+  for (i = 0; i < n; i++)
+    rb_bench_add_cached(&croot, &entries[i]);
+  start = bench_now_ns();
+  for (i = 0; i < RB_CHURNS; i++) {
+    node = aosl_rb_first_cached(&croot);
+    aosl_rb_erase_cached(&croot, node);
+    e = aosl_rb_entry(node, struct rb_bench_entry, node);
+    e->key = key + (rb_rand() & 0xffff);
+    rb_bench_add_cached(&croot, e);
+    key += 64;
+  }
+  cached_churn_ns = (double)(bench_now_ns() - start) / RB_CHURNS;
+
+  free(keys);
+  free(entries);
+
+  if (found != 2 * RB_LOOKUPS) {
+    BENCH_LOG("%d lookups missed", 2 * RB_LOOKUPS - found);
+    return -1;
+  }
+
+  snprintf(name, sizeof name, "%s_count", prefix);
+  bench_report(name, (double)n, "count");
+  snprintf(name, sizeof name, "%s_generic_insert", prefix);
+  bench_report(name, generic_insert_ns, "ns/op");
+  snprintf(name, sizeof name, "%s_typed_insert", prefix);
+  bench_report(name, typed_insert_ns, "ns/op");
+  snprintf(name, sizeof name, "%s_generic_find", prefix);
+  bench_report(name, generic_find_ns, "ns/op");
+  snprintf(name, sizeof name, "%s_typed_find", prefix);
+  bench_report(name, typed_find_ns, "ns/op");
+  snprintf(name, sizeof name, "%s_generic_churn", prefix);
+  bench_report(name, generic_churn_ns, "ns/op");
+  snprintf(name, sizeof name, "%s_cached_churn", prefix);
+  bench_report(name, cached_churn_ns, "ns/op");
+  return 0;
+}
+
+int bench_rbtree(void)
+{
+  if (rb_run(RB_MEDIUM, "medium") < 0)
+    return -1;
+
+  return rb_run(RB_BIG, "big");
+}
@@ -0,0 +1,142 @@
+/***************************************************************************
+ * Module:	aosl thread local storage benchmark
+ *
+ * Copyright © 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "api/aosl_mm.h"
+#include "api/aosl_mpq.h"
+#include "api/aosl_errno.h"
+#include "api/aosl_thread.h"
+#include "api/aosl_time.h"
+#include "aosl_bench.h"
+
+/**
+ * The TLS key, errno and current queue lookups in each of 100 live queue
+ * threads, all the threads are created and have set their TLS values
+ * before any of them starts, then they run the lookups one by one, so
+ * the time is not mixed with the scheduling of the other threads.
+ **/
+#define TLS_THREADS 100
+#define TLS_LOOPS 1000000
+
+struct tls_bench {
+  aosl_tls_key_t key;
+  aosl_atomic_t ready;
+  aosl_atomic_t done;
+  volatile intptr_t turn;
+  volatile int stop;
+  uint64_t key_ns[TLS_THREADS];
+  uint64_t errno_ns[TLS_THREADS];
+  uint64_t this_q_ns[TLS_THREADS];
+  int err;
+};
+
+static void tls_lookup_func(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  struct tls_bench *b = (struct tls_bench *)argv[0];
+  uintptr_t idx = argv[1];
+  uintptr_t sum = 0;
+  uint64_t start;
+  int i;
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+
+  if (aosl_tls_key_set(b->key, b) < 0)
+    b->err = -1;
+
+  aosl_atomic_inc(&b->ready);
+  while (b->turn != (intptr_t)idx) {
+    if (b->stop)
+      return;
+    aosl_msleep(1);
+  }
+
+  start = bench_now_ns();
+  for (i = 0; i < TLS_LOOPS; i++)
+    sum += (uintptr_t)aosl_tls_key_get(b->key);
+  b->key_ns[idx] = bench_now_ns() - start;
+  if (sum != (uintptr_t)b * TLS_LOOPS)
+    b->err = -1;
+
+  start = bench_now_ns();
+  for (i = 0; i < TLS_LOOPS; i++)
+    aosl_errno = i;
+  b->errno_ns[idx] = bench_now_ns() - start;
+
+  start = bench_now_ns();
+  for (i = 0; i < TLS_LOOPS; i++)
+    sum += (uintptr_t)aosl_mpq_this();
+  b->this_q_ns[idx] = bench_now_ns() - start;
+
+  aosl_atomic_inc(&b->done);
+  b->turn++;
+}
+
+static double tls_avg_ns(const uint64_t *ns)
+{
+  uint64_t total = 0;
+  int i;
+
+  for (i = 0; i < TLS_THREADS; i++)
+    total += ns[i];
+
+  return (double)total / TLS_THREADS / TLS_LOOPS;
+}
+
+int bench_tls(void)
+{
+  static struct tls_bench b;
+  aosl_mpq_t qs[TLS_THREADS];
+  int err = -1;
+  int i;
+
+  memset(&b, 0, sizeof b);
+  b.turn = -1;
+  for (i = 0; i < TLS_THREADS; i++)
+    qs[i] = AOSL_MPQ_INVALID;
+
+  if (aosl_tls_key_create(&b.key) < 0)
+    return -1;
+
+  for (i = 0; i < TLS_THREADS; i++) {
+    qs[i] = aosl_mpq_create(0, 0, 10, "bench-tls", NULL, NULL, NULL);
+    if (aosl_mpq_invalid(qs[i]))
+      goto __out;
+
+    if (aosl_mpq_queue(qs[i], AOSL_MPQ_INVALID, AOSL_REF_INVALID, "tls_lookup_func", tls_lookup_func, 2, &b, (uintptr_t)i) < 0)
+      goto __out;
+  }
+
+  if (bench_wait_count(&b.ready, TLS_THREADS, 10000) < 0)
+    goto __out;
+
+  b.turn = 0;
+  if (bench_wait_count(&b.done, TLS_THREADS, 600000) < 0 || b.err < 0) {
+    BENCH_LOG("tls lookups failed");
+    goto __out;
+  }
+
+  bench_report("threads", TLS_THREADS, "count");
+  bench_report("tls_key_get_ns", tls_avg_ns(b.key_ns), "ns");
+  bench_report("errno_set_ns", tls_avg_ns(b.errno_ns), "ns");
+  bench_report("mpq_this_ns", tls_avg_ns(b.this_q_ns), "ns");
+  err = 0;
+
+__out:
+  /* the waiting threads quit on failure */
+  b.stop = 1;
+  for (i = 0; i < TLS_THREADS; i++) {
+    if (!aosl_mpq_invalid(qs[i]))
+      aosl_mpq_destroy_wait(qs[i]);
+  }
+
+  aosl_tls_key_delete(b.key);
+  return err;
+}
@@ -0,0 +1,149 @@
+/***************************************************************************
+ * Module:	aosl write queue benchmark
+ *
+ * Copyright © 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+#include <string.h>
+
+#include "api/aosl_mm.h"
+#include "api/aosl_mpq.h"
+#include "api/aosl_mpq_net.h"
+#include "api/aosl_socket.h"
+#include "api/aosl_atomic.h"
+#include "api/aosl_time.h"
+#include "hal/aosl_hal_socket.h"
+#include "aosl_bench.h"
+
+/**
+ * Small sends on a congested stream connection: the peer never reads,
+ * so after the socket buffer is full every send goes to the write queue
+ * until the queue is full.
+ **/
+#define WQ_SEND_SIZE 100
+
+static aosl_fd_t wq_peer_fd = AOSL_INVALID_FD;
+
+static isize_t wq_chk_pkt(const void *data, size_t len, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(data);
+  UNUSED(argc);
+  UNUSED(argv);
+  return (isize_t)len;
+}
+
+static void wq_on_data(void *data, size_t len, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(data);
+  UNUSED(len);
+  UNUSED(argc);
+  UNUSED(argv);
+}
+
+static void wq_on_event(aosl_fd_t fd, int event, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(fd);
+  UNUSED(event);
+  UNUSED(argc);
+  UNUSED(argv);
+}
+
+static void wq_on_accepted(aosl_accept_data_t *accept_data, size_t len, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(len);
+  UNUSED(argc);
+  UNUSED(argv);
+
+  /* keep the connection open but never read it */
+  wq_peer_fd = accept_data->newsk;
+}
+
+static void wq_fill(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  aosl_fd_t fd = (aosl_fd_t)argv[0];
+  char buf[WQ_SEND_SIZE];
+  uint64_t allocs, start;
+  size_t sends = 0;
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+
+  memset(buf, 'w', sizeof buf);
+  allocs = bench_alloc_count();
+  start = bench_now_ns();
+  while (aosl_send(fd, buf, sizeof buf, 0) == (isize_t)sizeof buf)
+    sends++;
+
+  *(uint64_t *)argv[1] = bench_now_ns() - start;
+  *(uint64_t *)argv[2] = bench_alloc_count() - allocs;
+  *(size_t *)argv[3] = sends;
+}
+
+int bench_wq_congestion(void)
+{
+  aosl_mpq_t srv_q, cli_q;
+  aosl_sockaddr_t addr;
+  aosl_fd_t listen_fd, fd;
+  uint64_t ns = 0, allocs = 0;
+  size_t sends = 0;
+  aosl_ts_t start;
+  int err = -1;
+
+  srv_q = aosl_mpq_create(0, 0, 100000, "wq-srv", NULL, NULL, NULL);
+  cli_q = aosl_mpq_create(0, 0, 100000, "wq-cli", NULL, NULL, NULL);
+  if (aosl_mpq_invalid(srv_q) || aosl_mpq_invalid(cli_q))
+    goto __out;
+
+  listen_fd = aosl_socket(AOSL_AF_INET, AOSL_SOCK_STREAM, AOSL_IPPROTO_TCP);
+  memset(&addr, 0, sizeof addr);
+  addr.sa_family = AOSL_AF_INET;
+  aosl_inet_addr_from_string(&addr.sin_addr, "127.0.0.1");
+  if (aosl_bind(listen_fd, &addr) < 0 || aosl_hal_sk_get_sockname(listen_fd, &addr) < 0)
+    goto __out;
+
+  if (aosl_mpq_listen_on_q(srv_q, listen_fd, 16, wq_on_accepted, wq_on_event, 0) < 0)
+    goto __out;
+
+  fd = aosl_socket(AOSL_AF_INET, AOSL_SOCK_STREAM, AOSL_IPPROTO_TCP);
+  if (aosl_fd_invalid(fd) ||
+      aosl_mpq_connect_on_q(cli_q, fd, &addr, 5000, 2048, wq_chk_pkt, wq_on_data, wq_on_event, 0) < 0)
+    goto __out;
+
+  start = aosl_tick_ms();
+  while (aosl_fd_invalid(wq_peer_fd)) {
+    if ((int)(aosl_tick_ms() - start) > 5000) {
+      BENCH_LOG("connection not accepted");
+      goto __out;
+    }
+
+    aosl_msleep(1);
+  }
+
+  /* let the connecting side get ready */
+  aosl_msleep(100);
+  if (aosl_mpq_call(cli_q, AOSL_REF_INVALID, "wq_fill", wq_fill, 4, (uintptr_t)fd, &ns, &allocs, &sends) < 0 || sends == 0)
+    goto __out;
+
+  bench_report("sends", (double)sends, "sends");
+  bench_report("ns_per_send", (double)ns / sends, "ns");
+  bench_report("allocs", (double)allocs, "allocs");
+  if (allocs > 0)
+    bench_report("bytes_per_alloc", (double)(sends * WQ_SEND_SIZE) / allocs, "bytes");
+  err = 0;
+
+__out:
+  if (!aosl_mpq_invalid(cli_q))
+    aosl_mpq_destroy_wait(cli_q);
+
+  if (!aosl_mpq_invalid(srv_q))
+    aosl_mpq_destroy_wait(srv_q);
+
+  if (!aosl_fd_invalid(wq_peer_fd)) {
+    aosl_close(wq_peer_fd);
+    wq_peer_fd = AOSL_INVALID_FD;
+  }
+
+  return err;
+}
@@ -45,6 +45,7 @@ list(APPEND AOSL_ADD_SOURCES
     "${AOSL_DIR}/kernel/osmp.c"
     "${AOSL_DIR}/kernel/mpq.c"
     "${AOSL_DIR}/kernel/mpqp.c"
+    "${AOSL_DIR}/kernel/mpq_stats.c"
     "${AOSL_DIR}/kernel/refobj.c"
     "${AOSL_DIR}/kernel/file.c"
     "${AOSL_DIR}/kernel/time.c"
@@ -61,6 +62,7 @@ list(APPEND AOSL_ADD_SOURCES
     "${AOSL_DIR}/lib/atomic.c"
     "${AOSL_DIR}/lib/bitmap.c"
     "${AOSL_DIR}/lib/rbtree.c"
+    "${AOSL_DIR}/lib/hash.c"
     "${AOSL_DIR}/lib/marshalling.c"
     "${AOSL_DIR}/lib/marshalling-base-obj.c"
     "${AOSL_DIR}/lib/psbuff.c"
@@ -79,6 +81,7 @@ list(APPEND AOSL_ADD_SOURCES
     "${AOSL_DIR}/net/sk_utils.c"
     "${AOSL_DIR}/net/inet.c"
     "${AOSL_DIR}/net/dns.c"
+    "${AOSL_DIR}/net/flow.c"
 
     "${AOSL_DIR}/test/aosl_test.c"
 )
@@ -124,6 +127,35 @@ if (AOSL_DECLARE_PROJECT AND AOSL_COMPILE_TEST)
     message(STATUS "aosl_test created")
 endif()
 
+############## Compile bench bin ############
+if (AOSL_DECLARE_PROJECT AND AOSL_COMPILE_BENCH)
+    add_executable(aosl_bench
+        ${AOSL_DIR}/bench/aosl_bench_main.c
+        ${AOSL_DIR}/bench/bench_mpq.c
+        ${AOSL_DIR}/bench/bench_net.c
+        ${AOSL_DIR}/bench/bench_marshal.c
+        ${AOSL_DIR}/bench/bench_psb.c
+        ${AOSL_DIR}/bench/bench_iofd.c
+        ${AOSL_DIR}/bench/bench_wq.c
+        ${AOSL_DIR}/bench/bench_tls.c
+        ${AOSL_DIR}/bench/bench_log.c
+        ${AOSL_DIR}/bench/bench_accept.c
+        ${AOSL_DIR}/bench/bench_flow.c
+        ${AOSL_DIR}/bench/bench_hash.c
+        ${AOSL_DIR}/bench/bench_rbtree.c
+    )
+    target_include_directories(aosl_bench PRIVATE ${AOSL_ADD_INCLUDES_PUBLIC})
+    if(APPLE)
+        target_link_libraries(aosl_bench PRIVATE aosl "pthread" "m")
+    else()
+        # count the allocations of the library
+        target_compile_definitions(aosl_bench PRIVATE BENCH_WRAP_MALLOC)
+        target_link_options(aosl_bench PRIVATE "-Wl,--wrap=aosl_hal_malloc")
+        target_link_libraries(aosl_bench PRIVATE aosl "pthread" "dl" "rt" "m")
+    endif()
+    message(STATUS "aosl_bench created")
+endif()
+
 ############## Copy include file ############
 if (AOSL_DECLARE_PROJECT)
     get_filename_component(ABS_BINARY_DIR "${CMAKE_BINARY_DIR}" ABSOLUTE)
@@ -0,0 +1,210 @@
+/***************************************************************************
+ * Module:	AOSL intrusive hash table header file
+ *
+ * Copyright (c) 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+
+#ifndef	__AOSL_HASH_H__
+#define	__AOSL_HASH_H__
+
+#include <api/aosl_types.h>
+#include <api/aosl_defs.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * The intrusive hash table for the point lookups, embed an aosl_hash_node
+ * in the entry struct like an aosl_rb_node. The caller computes the hash
+ * value of a key with an inline hash function, and compares the keys of
+ * the candidates inline while walking aosl_hash_for_each_possible, so no
+ * callback is invoked per node.
+ *
+ * The table grows and shrinks by a power of 2 incrementally: the buckets
+ * of the old array are moved into the new one by a few per update, so no
+ * single insertion pays for rehashing the whole table.
+ **/
+struct aosl_hash_node {
+	struct aosl_hash_node *next;
+	struct aosl_hash_node **pprev;
+	uintptr_t hash;
+};
+
+struct aosl_hash_table {
+	struct aosl_hash_node **buckets;
+	uintptr_t mask;
+	/* the old buckets being moved, the ones below migrated are empty */
+	struct aosl_hash_node **old_buckets;
+	uintptr_t old_mask;
+	uintptr_t migrated;
+	uintptr_t count;
+	uint32_t flags;
+	/* the only bucket before the first growing */
+	struct aosl_hash_node *bucket0;
+};
+
+/**
+ * The lookups never modify the table with this flag, so they could run
+ * concurrently under a shared (read) lock while the updates are under an
+ * exclusive one. Without it, a lookup also moves an old bucket while the
+ * table is being resized, so it needs the same exclusive access as the
+ * updates, and a read mostly table finishes resizing sooner.
+ **/
+#define AOSL_HASH_F_CONCURRENT_READ 0x1
+
+/**
+ * @brief Get the container struct from a hash node pointer.
+ * @param [in] ptr     pointer to the aosl_hash_node member
+ * @param [in] type    the type of the container struct
+ * @param [in] member  the name of the aosl_hash_node member within the struct
+ */
+#define	aosl_hash_entry(ptr, type, member) container_of(ptr, type, member)
+
+/**
+ * @brief The static initializer of a hash table.
+ * @param [in] name   the hash table variable name
+ * @param [in] flags  the AOSL_HASH_F_* flags
+ **/
+#define AOSL_HASH_TABLE_INIT(name, flags) { &(name).bucket0, 0, NULL, 0, 0, 0, flags, NULL }
+
+/**
+ * @brief Mix a pointer sized integer key into a hash value, the low bits
+ *        of which are used for selecting the bucket.
+ * @param [in] x  the key
+ * @return        the hash value
+ **/
+static __inline__ uintptr_t aosl_hash_uintptr (uintptr_t x)
+{
+#if UINTPTR_MAX > 0xffffffffu
+	uint64_t h = (uint64_t)x * 0x9e3779b97f4a7c15ull;
+	return (uintptr_t)(h ^ (h >> 32));
+#else
+	uint32_t h = (uint32_t)x * 0x9e3779b9u;
+	return (uintptr_t)(h ^ (h >> 16));
+#endif
+}
+
+/**
+ * @brief Mix a pointer key into a hash value.
+ * @param [in] ptr  the key
+ * @return          the hash value
+ **/
+static __inline__ uintptr_t aosl_hash_ptr (const void *ptr)
+{
+	return aosl_hash_uintptr ((uintptr_t)ptr);
+}
+
+/**
+ * @brief Initialize a hash table.
+ * @param [out] ht     pointer to the hash table to initialize
+ * @param [in]  flags  the AOSL_HASH_F_* flags
+ **/
+extern __aosl_api__ void aosl_hash_init (struct aosl_hash_table *ht, uint32_t flags);
+
+/**
+ * @brief Insert a node into the hash table, the table is grown as needed.
+ *        Inserting a key already in the table is not checked, the caller
+ *        should look it up first if the keys must be unique.
+ * @param [in,out] ht    the hash table
+ * @param [in]     node  the node to insert
+ * @param [in]     hash  the hash value of the key of the node
+ **/
+extern __aosl_api__ void aosl_hash_add (struct aosl_hash_table *ht, struct aosl_hash_node *node, uintptr_t hash);
+
+/**
+ * @brief Remove a node from the hash table (node must be in the table).
+ * @param [in,out] ht    the hash table
+ * @param [in]     node  the node to remove
+ **/
+extern __aosl_api__ void aosl_hash_del (struct aosl_hash_table *ht, struct aosl_hash_node *node);
+
+/**
+ * @brief Move an old bucket of an incremental resizing, used by the lookups.
+ * @param [in,out] ht  the hash table
+ **/
+extern __aosl_api__ void aosl_hash_migrate (struct aosl_hash_table *ht);
+
+typedef int (*aosl_hash_walk_func_t) (struct aosl_hash_node *node, void *arg);
+
+/**
+ * @brief Traverse all the nodes in no particular order, the table must not
+ *        be modified by the callback.
+ * @param [in] ht    the hash table
+ * @param [in] func  callback invoked for each node; return non-zero to stop
+ * @param [in] arg   user argument passed to the callback
+ **/
+extern __aosl_api__ void aosl_hash_traverse (struct aosl_hash_table *ht, aosl_hash_walk_func_t func, void *arg);
+
+/**
+ * @brief Remove all the nodes and release the buckets, the table is empty
+ *        and could be used again after this.
+ * @param [in,out] ht    the hash table
+ * @param [in]     func  callback invoked for each removed node, which could
+ *                       free the node, could be NULL
+ * @param [in]     arg   user argument passed to the callback
+ **/
+extern __aosl_api__ void aosl_hash_fini (struct aosl_hash_table *ht, aosl_hash_walk_func_t func, void *arg);
+
+/* the bucket a key of the hash value is in, in the old array if not moved yet */
+static __inline__ struct aosl_hash_node **aosl_hash_bucket (const struct aosl_hash_table *ht, uintptr_t hash)
+{
+	if (ht->old_buckets != NULL && (hash & ht->old_mask) >= ht->migrated)
+		return &ht->old_buckets [hash & ht->old_mask];
+
+	return &ht->buckets [hash & ht->mask];
+}
+
+static __inline__ struct aosl_hash_node *__aosl_hash_match (struct aosl_hash_node *node, uintptr_t hash)
+{
+	while (node != NULL && node->hash != hash)
+		node = node->next;
+
+	return node;
+}
+
+/**
+ * @brief Get the first node with the hash value.
+ * @param [in] ht    the hash table
+ * @param [in] hash  the hash value of the key
+ * @return           the first node with the same hash value, or NULL
+ **/
+static __inline__ struct aosl_hash_node *aosl_hash_first (struct aosl_hash_table *ht, uintptr_t hash)
+{
+	if (ht->old_buckets != NULL && !(ht->flags & AOSL_HASH_F_CONCURRENT_READ))
+		aosl_hash_migrate (ht);
+
+	return __aosl_hash_match (*aosl_hash_bucket (ht, hash), hash);
+}
+
+/**
+ * @brief Get the next node with the same hash value.
+ * @param [in] node  the current node
+ * @return           the next node with the same hash value, or NULL
+ **/
+static __inline__ struct aosl_hash_node *aosl_hash_next (struct aosl_hash_node *node)
+{
+	return __aosl_hash_match (node->next, node->hash);
+}
+
+/**
+ * @brief Iterate over the nodes with a hash value, the keys of which are
+ *        compared by the caller in the loop body.
+ * @param [in]  ht    the hash table
+ * @param [out] pos   the struct aosl_hash_node * loop cursor
+ * @param [in]  hash  the hash value of the key
+ **/
+#define aosl_hash_for_each_possible(ht, pos, hash) \
+	for (pos = aosl_hash_first (ht, hash); pos != NULL; pos = aosl_hash_next (pos))
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AOSL_HASH_H__ */
@@ -119,6 +119,38 @@ extern __aosl_api__ void aosl_vprintf (const char *fmt, va_list args);
  **/
 extern __aosl_api__ void aosl_printf_fmt12 aosl_panic (const char *fmt, ...);
 
+/**
+ * @brief Enable or disable the async logging mode, which is disabled by default.
+ * In the async mode, the logging thread only copies the format pointer and the
+ * arguments into a lock free ring buffer of its own, and a background thread
+ * formats the messages and calls the log function, so a slow log function never
+ * blocks the logging threads. The messages of different threads might be out of
+ * order with each other, the ones which could not be queued in a full ring are
+ * dropped, and the format strings must be static strings in this mode.
+ * Disabling the async mode outputs all the queued messages before returning.
+ * @param [in] enable  non-zero to enable, 0 to disable
+ * @return             0 on success, <0 on failure with aosl_errno set
+ **/
+extern __aosl_api__ int aosl_log_set_async (int enable);
+
+/**
+ * @brief Output all the queued messages of the async logging mode now, this is
+ * called by aosl_panic, so the messages before the panic are not lost.
+ **/
+extern __aosl_api__ void aosl_log_flush (void);
+
+typedef struct {
+	uint64_t queued; /* the messages queued in the async mode */
+	uint64_t dropped; /* the messages dropped because of a full ring */
+	uint64_t overflow; /* the messages queued with the long strings cut */
+} aosl_log_stats_t;
+
+/**
+ * @brief Get the counters of the async logging mode.
+ * @param [out] stats  the counters
+ **/
+extern __aosl_api__ void aosl_log_get_stats (aosl_log_stats_t *stats);
+
 
 #define AOSL_LOG(level, fmt, ...) aosl_log(level, "[%d][aosl][%s:%u]" fmt "\n", level, __FUNCTION__, __LINE__, ##__VA_ARGS__)
 
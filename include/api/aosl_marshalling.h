@@ -235,6 +235,65 @@ extern __aosl_api__ isize_t aosl_marshal (const aosl_type_info_t *type, const vo
  **/
 extern __aosl_api__ isize_t aosl_unmarshal (const aosl_type_info_t *type, void *typed_obj_p, const aosl_psb_t *psb);
 
+/**
+ * @brief Compile a type descriptor into a flat marshalling plan.
+ * The descriptor tree is flattened into a linear program with the offsets
+ * and sizes precomputed, and the plan is cached by the descriptor address,
+ * then aosl_marshal, aosl_unmarshal, aosl_init_typed_obj and
+ * aosl_fini_typed_obj of this descriptor run the plan instead of
+ * interpreting the tree on every call. The plans are kept until aosl_dtor,
+ * so the descriptor and all its children must keep valid and unchanged,
+ * such as the static const ones.
+ * @param [in] type  the type descriptor
+ * @return           0 on success, <0 on failure with aosl_errno set
+ **/
+extern __aosl_api__ int aosl_type_compile (const aosl_type_info_t *type);
+
+/**
+ * The arena holding all the variable size data of the objects unmarshalled
+ * by aosl_unmarshal_arena: the pointed objects, strings, dynamic bytes and
+ * dynamic arrays. The caller provided buffer is used first, and the heap
+ * blocks are only allocated when it is not enough. The objects must not be
+ * finalized by aosl_fini_typed_obj, all of them are released at once by
+ * aosl_unmarshal_arena_fini.
+ **/
+typedef struct {
+	void *buf;
+	size_t size;
+	size_t used;
+	void *blocks;
+} aosl_unmarshal_arena_t;
+
+/**
+ * @brief Initialize an unmarshalling arena.
+ * @param [out] arena  the arena to initialize
+ * @param [in]  buf    the caller provided buffer, could be NULL
+ * @param [in]  size   the buffer size in bytes
+ **/
+extern __aosl_api__ void aosl_unmarshal_arena_init (aosl_unmarshal_arena_t *arena, void *buf, size_t size);
+
+/**
+ * @brief Unmarshal a typed object with all its variable size data placed in
+ * the arena. For a type compiled by aosl_type_compile, the sizes are scanned
+ * before decoding, so decoding a message allocates at most one heap block,
+ * or none if the arena has enough room; otherwise the arena grows on demand.
+ * The dynamic arrays of the object have a 0 'allocated' field, so adding
+ * elements to them copies the elements out of the arena.
+ * @param [in]  type         the type descriptor
+ * @param [out] typed_obj_p  pointer to the object to fill
+ * @param [in]  psb          the PSB to read from
+ * @param [in]  arena        the arena for the variable size data
+ * @return             the number of bytes consumed, or <0 on failure
+ **/
+extern __aosl_api__ isize_t aosl_unmarshal_arena (const aosl_type_info_t *type, void *typed_obj_p, const aosl_psb_t *psb, aosl_unmarshal_arena_t *arena);
+
+/**
+ * @brief Release all the objects unmarshalled with the arena, and free the
+ * heap blocks of it. The arena could be used again after this.
+ * @param [in] arena  the arena
+ **/
+extern __aosl_api__ void aosl_unmarshal_arena_fini (aosl_unmarshal_arena_t *arena);
+
 /**
  * @brief Finalize a typed object, freeing any dynamically allocated fields.
  * @param [in] type         the type descriptor
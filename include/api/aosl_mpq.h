@@ -102,6 +102,29 @@ extern __aosl_api__ aosl_mpq_t aosl_mpq_create (int pri, int stack_size, int max
 // qflags definitions
 #define AOSL_MPQ_FLAG_NONBLOCK   0x00000001
 #define AOSL_MPQ_FLAG_SIGP_EVENT 0x00000002
+/* grow the event batch of one wait adaptively when it is filled up */
+#define AOSL_MPQ_FLAG_ADAPTIVE_EVENTS 0x00000004
+
+/**
+ * The event batch size of one wait is AOSL_MPQ_EVENTS_DEFAULT << order,
+ * and capped by AOSL_MPQ_EVENTS_MAX, specify the order via this macro.
+ **/
+#define AOSL_MPQ_EVENTS_DEFAULT 64
+#define AOSL_MPQ_EVENTS_MAX 1024
+#define AOSL_MPQ_FLAG_EVENTS_SHIFT 8
+#define AOSL_MPQ_FLAG_EVENTS_MASK 0x00000f00
+#define AOSL_MPQ_FLAG_EVENTS(order) (((order) << AOSL_MPQ_FLAG_EVENTS_SHIFT) & AOSL_MPQ_FLAG_EVENTS_MASK)
+
+/**
+ * Busy poll the fds with 0 timeout for at most the specified budget before
+ * sleeping, the budget is in AOSL_MPQ_BUSY_POLL_UNIT_US units (1 ~ 15), 0
+ * for disabling. Only for the queues not using AOSL_MPQ_FLAG_SIGP_EVENT.
+ **/
+#define AOSL_MPQ_BUSY_POLL_UNIT_US 32
+#define AOSL_MPQ_FLAG_BUSY_POLL_SHIFT 12
+#define AOSL_MPQ_FLAG_BUSY_POLL_MASK 0x0000f000
+#define AOSL_MPQ_FLAG_BUSY_POLL(units) (((units) << AOSL_MPQ_FLAG_BUSY_POLL_SHIFT) & AOSL_MPQ_FLAG_BUSY_POLL_MASK)
+
 #define AOSL_MPQ_FLAG_DESTROY_NOT_ALLOWED  0x80000000  // internal
 
 /**
@@ -125,6 +148,21 @@ extern __aosl_api__ aosl_mpq_t aosl_mpq_create (int pri, int stack_size, int max
  **/
 extern __aosl_api__ aosl_mpq_t aosl_mpq_create_flags (int flags, int pri, int stack_size, int max, const char *name, aosl_mpq_init_t init, aosl_mpq_fini_t fini, void *arg);
 
+/**
+ * @brief Set the max count of the parked queues for recycling.
+ * A destroyed queue parks its thread and multiplexer in a cache instead of
+ * tearing them down, and a queue created later with the same priority, stack
+ * size and AOSL_MPQ_FLAG_SIGP_EVENT flag takes a parked one over without
+ * creating a new thread. The parked queues exceeding max are freed, and a
+ * parked queue not taken over for a while is freed too.
+ * Parameter:
+ *      max: the max parked queues count, 0 for disabling the recycling,
+ *           <0 for just getting the current one
+ * Return value:
+ *     the previous max count.
+ **/
+extern __aosl_api__ int aosl_mpq_set_park_max (int max);
+
 #define BITOP_OR 0
 #define BITOP_AND 1
 #define BITOP_XOR 2
@@ -339,6 +377,89 @@ extern __aosl_api__ int aosl_mpq_call_data (aosl_mpq_t q, aosl_ref_t ref, const
  **/
 extern __aosl_api__ int aosl_mpq_run_data (aosl_mpq_t q, aosl_ref_t ref, const char *f_name, aosl_mpq_func_data_t f, size_t len, void *data);
 
+/**
+ * @brief The same as 'aosl_mpq_queue' except the function expires at the deadline.
+ * If the function is still not run when the deadline passed, the queue invokes
+ * it with the free only robj(AOSL_FREE_ONLY_OBJ) to free the relative resources
+ * only, and no done notification to dq, then the overloaded queues could shed
+ * the load rather than running everything late.
+ * Parameter:
+ *  deadline: the absolute tick time(aosl_tick_now) after which the function
+ *            expires, 0 for never
+ **/
+extern __aosl_api__ int aosl_mpq_queue_deadline (aosl_mpq_t tq, aosl_mpq_t dq, aosl_ref_t ref, aosl_ts_t deadline, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, ...);
+
+/* The same as 'aosl_mpq_queue_data' except the function expires at the deadline */
+extern __aosl_api__ int aosl_mpq_queue_data_deadline (aosl_mpq_t tq, aosl_mpq_t dq, aosl_ref_t ref, aosl_ts_t deadline, const char *f_name, aosl_mpq_func_data_t f, size_t len, void *data);
+
+/**
+ * @brief The same as 'aosl_mpq_queue' except the function coalesces with the pending
+ * one queued with the same key, the last value wins. If the pending one is the same
+ * function with the same args count, its args are replaced by the new ones in place
+ * and nothing new is queued, otherwise the pending one would not run and the new one
+ * is queued. Either way, the replaced args are passed to the function with the free
+ * only robj(AOSL_FREE_ONLY_OBJ) in the target queue for freeing the relative resources,
+ * and the done queue of the replaced call is not notified.
+ * Parameter:
+ *       key: the coalescing key, use the same key for the updates of the same state
+ **/
+extern __aosl_api__ int aosl_mpq_queue_coalesce (aosl_mpq_t tq, aosl_mpq_t dq, aosl_ref_t ref, uintptr_t key, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, ...);
+
+/**
+ * The priority lanes of a queue. The functions in a higher lane are served
+ * first, but every lane is also served by its weight in each round once it
+ * has functions queued, so the lower lanes would not be starved. All the
+ * functions queued by the APIs without a priority go to AOSL_MPQ_PRI_NORMAL.
+ **/
+#define AOSL_MPQ_PRI_LOW 0
+#define AOSL_MPQ_PRI_NORMAL 1
+#define AOSL_MPQ_PRI_HIGH 2
+#define AOSL_MPQ_PRI_URGENT 3
+#define AOSL_MPQ_PRI_COUNT 4
+
+/* the default lane weights from AOSL_MPQ_PRI_LOW to AOSL_MPQ_PRI_URGENT */
+#define AOSL_MPQ_PRI_WEIGHTS_DEFAULT { 1, 4, 16, 64 }
+
+/**
+ * @brief The same as 'aosl_mpq_queue' except the function is queued to the
+ * priority lane specified by pri(AOSL_MPQ_PRI_*).
+ **/
+extern __aosl_api__ int aosl_mpq_queue_pri (aosl_mpq_t tq, aosl_mpq_t dq, aosl_ref_t ref, int pri, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, ...);
+
+/* The synchronous version, the target f must have been invoked when this function returns */
+extern __aosl_api__ int aosl_mpq_call_pri (aosl_mpq_t q, aosl_ref_t ref, int pri, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, ...);
+
+/**
+ * @brief Set the weights of the priority lanes of a queue.
+ * Parameters:
+ *         q: the queue object id
+ *   weights: the max functions count of each lane served in one round before
+ *            serving the lower lanes, from AOSL_MPQ_PRI_LOW to AOSL_MPQ_PRI_URGENT,
+ *            all must be > 0
+ * Return value:
+ *        <0: indicates error, check errno for detail
+ *         0: successful.
+ **/
+extern __aosl_api__ int aosl_mpq_set_pri_weights (aosl_mpq_t q, const int weights [AOSL_MPQ_PRI_COUNT]);
+
+/**
+ * @brief Set the budgets of one loop iteration of a queue. The queued functions,
+ * the expired timers and the fd events are served by turns in each iteration,
+ * and a source stops at its budget and leaves the rest to the next iteration,
+ * so none of them could hold the queue thread too long.
+ * Parameters:
+ *          q: the queue object id
+ *  max_funcs: the max queued functions to run in one iteration, 0 for no limit
+ *     max_us: the max time in micro seconds spent on the functions, and on the
+ *             timers, in one iteration, 0 for no limit
+ * max_events: the max fd events to dispatch in one iteration, 0 for no limit
+ *             other than the event batch size
+ * Return value:
+ *        <0: indicates error, check errno for detail
+ *         0: successful.
+ **/
+extern __aosl_api__ int aosl_mpq_set_budget (aosl_mpq_t q, int max_funcs, int max_us, int max_events);
+
 /**
  * @brief Start aosl main mpq, only a single main mpq allowed.
  **/
@@ -365,6 +486,17 @@ extern __aosl_api__ aosl_mpq_t aosl_mpq_main (void);
  */
 extern __aosl_api__ int aosl_mpq_queued_count (aosl_mpq_t q);
 
+/**
+ * @brief Get the queued function invocations count of a priority lane.
+ * Parameters:
+ *      q: the queue object id
+ *    pri: the priority lane, AOSL_MPQ_PRI_*
+ * Return value:
+ *     <0: indicates error, check errno for detail
+ *    >=0: the queued function invocations count of the lane
+ */
+extern __aosl_api__ int aosl_mpq_queued_count_pri (aosl_mpq_t q, int pri);
+
 /**
  * @brief Get the last load/idle costs in micro seconds of this mpq
  * Parameters:
@@ -388,6 +520,100 @@ extern __aosl_api__ int aosl_mpq_last_costs (aosl_ts_t *load_p, aosl_ts_t *idle_
  */
 extern __aosl_api__ int aosl_mpq_exec_counters (uint64_t *funcs_count_p, uint64_t *timers_count_p, uint64_t *fds_count_p);
 
+/**
+ * The histogram buckets count of the mpq stats, the bucket 0 counts the
+ * values less than 1us, the bucket i counts the values in [2^(i-1), 2^i)
+ * us, and the last bucket counts all the values not less than 2^(N-2) us.
+ **/
+#define AOSL_MPQ_STATS_BUCKETS 24
+
+/* The sources served by turns in each iteration of the mpq loop */
+#define AOSL_MPQ_SRC_FUNCS 0
+#define AOSL_MPQ_SRC_TIMERS 1
+#define AOSL_MPQ_SRC_FDS 2
+#define AOSL_MPQ_SRC_COUNT 3
+
+/* The max count of different function names tracked by the mpq stats */
+#define AOSL_MPQ_STATS_FUNCS 64
+
+/* The function names longer than this would be truncated in the stats */
+#define AOSL_MPQ_STATS_NAME_LEN 32
+
+typedef struct {
+	char f_name [AOSL_MPQ_STATS_NAME_LEN];
+	uint64_t calls;
+	uint64_t total_us;
+	uint64_t max_us;
+} aosl_mpq_func_stats_t;
+
+typedef struct {
+	/* the invoked queued functions and timers count */
+	uint64_t funcs;
+	uint64_t timers;
+
+	/* the high-water mark of the queued functions count */
+	uint32_t depth_max;
+
+	/* the valid elements count of funcs_stats */
+	uint32_t funcs_stats_count;
+
+	/* the invocations not counted in funcs_stats for the table is full */
+	uint64_t funcs_untracked;
+
+	/* the queued functions dropped for expired, see aosl_mpq_queue_deadline */
+	uint64_t funcs_expired;
+
+	/* the queued args replaced by the newer ones, see aosl_mpq_queue_coalesce */
+	uint64_t funcs_coalesced;
+
+	/* the histograms of enqueue to run time, execution time and timer lateness */
+	uint64_t wait_hist [AOSL_MPQ_STATS_BUCKETS];
+	uint64_t exec_hist [AOSL_MPQ_STATS_BUCKETS];
+	uint64_t timer_late_hist [AOSL_MPQ_STATS_BUCKETS];
+
+	/* the data delivered to the read callbacks, and accepted by the write functions */
+	uint64_t rx_bytes;
+	uint64_t rx_pkts;
+	uint64_t tx_bytes;
+	uint64_t tx_pkts;
+
+	/**
+	 * The starvation counters of the loop sources: the iterations in which
+	 * a source stopped at its budget with more work ready, and the time the
+	 * fds were not polled for running the functions and timers.
+	 **/
+	uint64_t budget_hits [AOSL_MPQ_SRC_COUNT];
+	uint64_t fds_starve_max_us;
+	uint64_t fds_starve_hist [AOSL_MPQ_STATS_BUCKETS];
+
+	aosl_mpq_func_stats_t funcs_stats [AOSL_MPQ_STATS_FUNCS];
+} aosl_mpq_stats_t;
+
+/**
+ * @brief Get a consistent snapshot of the runtime stats of an mpq. The stats
+ * are always recorded by the queue thread itself without any lock, so this
+ * function could be called in any thread at any time.
+ * Parameters:
+ *      qid: the queue object id
+ *    stats: the variable for saving the stats snapshot
+ * Return value:
+ *     <0: indicates error, check errno for detail
+ *      0: the snapshot was saved to *stats
+ **/
+extern __aosl_api__ int aosl_mpq_stats_get (aosl_mpq_t qid, aosl_mpq_stats_t *stats);
+
+/**
+ * @brief Reset the runtime stats of an mpq. The reset is done by the queue
+ * thread itself, so it takes effect immediately when called in the queue
+ * thread, otherwise before the queue thread runs anything else.
+ * Parameters:
+ *      qid: the queue object id
+ * Return value:
+ *     <0: indicates error, check errno for detail
+ *      0: success
+ **/
+extern __aosl_api__ int aosl_mpq_stats_reset (aosl_mpq_t qid);
+
 /**
  * @brief Invoking this function will enter the infinite run loop of current thread's multiplex queue.
  * Generally, this function is only used in the non-mpq thread, such as the main thread.
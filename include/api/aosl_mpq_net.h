@@ -14,6 +14,7 @@
 #include <api/aosl_socket.h>
 #include <api/aosl_defs.h>
 #include <api/aosl_mpq.h>
+#include <api/aosl_mpqp.h>
 #include <api/aosl_mpq_fd.h>
 
 
@@ -180,6 +181,93 @@ extern __aosl_api__ int aosl_mpq_listen (aosl_fd_t fd, int backlog, aosl_sk_acce
 extern __aosl_api__ int aosl_mpq_listen_on_q (aosl_mpq_t qid, aosl_fd_t fd, int backlog,
 				aosl_sk_accepted_t accepted_f, aosl_fd_event_t event_f, uintptr_t argc, ...);
 
+/* the max connections accepted in one batch */
+#define AOSL_LISTEN_BATCH_MAX 64
+
+/**
+ * The listen options:
+ * batch         the max connections accepted in one wakeup and handed off
+ *               at once, clamped to [1, AOSL_LISTEN_BATCH_MAX], the accepting
+ *               goes on until no more pending connection anyway;
+ * place_qp      if not NULL, each accepted connection is added as a stream
+ *               socket on the queue with the least fds of this pool, with
+ *               one handoff per target queue for a batch, and the accepted_f
+ *               is invoked on the target queue after the socket was added;
+ *               the pool must outlive the listener and should not shrink
+ *               idle queues (max_idles < 0), since the sockets live there;
+ * max_pkt_size  the stream socket max packet size, for place_qp only;
+ * chk_pkt_f     the stream socket packet checking callback, for place_qp only;
+ * data_f        the stream socket data callback, required for place_qp;
+ * The placed sockets get the same event_f and variable arguments as the listener.
+ **/
+typedef struct {
+	int batch;
+	aosl_mpqp_t place_qp;
+	size_t max_pkt_size;
+	aosl_check_packet_t chk_pkt_f;
+	aosl_fd_data_t data_f;
+} aosl_listen_opts_t;
+
+/**
+ * @brief Start listening for incoming connections on the current mpq with options.
+ * @param [in] fd          the socket fd (must be bound)
+ * @param [in] backlog     the maximum pending connection queue length
+ * @param [in] opts        the listen options
+ * @param [in] accepted_f  the callback invoked for each accepted connection
+ * @param [in] event_f     the event notification callback
+ * @param [in] argc        the number of variable arguments
+ * @param [in] ...         variable arguments passed to callbacks
+ * @return                 0 on success, <0 on failure
+ **/
+extern __aosl_api__ int aosl_mpq_listen_opts (aosl_fd_t fd, int backlog, const aosl_listen_opts_t *opts,
+				aosl_sk_accepted_t accepted_f, aosl_fd_event_t event_f, uintptr_t argc, ...);
+
+/**
+ * @brief Start listening for incoming connections on the specified mpq with options.
+ * @param [in] qid         the target mpq id
+ * @param [in] fd          the socket fd (must be bound)
+ * @param [in] backlog     the maximum pending connection queue length
+ * @param [in] opts        the listen options
+ * @param [in] accepted_f  the callback invoked for each accepted connection
+ * @param [in] event_f     the event notification callback
+ * @param [in] argc        the number of variable arguments
+ * @param [in] ...         variable arguments passed to callbacks
+ * @return                 0 on success, <0 on failure
+ **/
+extern __aosl_api__ int aosl_mpq_listen_opts_on_q (aosl_mpq_t qid, aosl_fd_t fd, int backlog, const aosl_listen_opts_t *opts,
+				aosl_sk_accepted_t accepted_f, aosl_fd_event_t event_f, uintptr_t argc, ...);
+
+/**
+ * @brief Start listening for incoming TCP connections on all the queues of a pool.
+ * Each queue gets its own listening socket bound to the same address with the
+ * port reuse option, the system balances the connections among them, and the
+ * accepted_f of a connection is invoked on the queue which accepted it. The
+ * pool is grown to its full size, and the queues holding the listeners are not
+ * shrunk until the listeners are closed by aosl_mpqp_listen_close. A platform
+ * without the balancing gets only one listener.
+ * @param [in] qp          the queue pool object
+ * @param [in] addr        the address to bind, a 0 port picks one for all
+ * @param [in] backlog     the maximum pending connection queue length of each listener
+ * @param [out] fds        the listening socket fds
+ * @param [in] max_fds     the max listeners count, the size of fds
+ * @param [in] accepted_f  the callback invoked when a new connection is accepted
+ * @param [in] event_f     the event notification callback
+ * @param [in] argc        the number of variable arguments
+ * @param [in] ...         variable arguments passed to callbacks
+ * @return                 the listeners count filled in fds on success, <0 on failure
+ **/
+extern __aosl_api__ int aosl_mpqp_listen (aosl_mpqp_t qp, const aosl_sockaddr_t *addr, int backlog, aosl_fd_t fds [], int max_fds,
+				aosl_sk_accepted_t accepted_f, aosl_fd_event_t event_f, uintptr_t argc, ...);
+
+/**
+ * @brief Close the listeners returned by aosl_mpqp_listen.
+ * @param [in] qp     the queue pool object
+ * @param [in] fds    the listening socket fds
+ * @param [in] count  the listeners count
+ * @return            0 on success, <0 on failure
+ **/
+extern __aosl_api__ int aosl_mpqp_listen_close (aosl_mpqp_t qp, const aosl_fd_t fds [], int count);
+
 /**
  * @brief Add a datagram socket to the current mpq for async I/O.
  * @param [in] fd            the datagram socket fd
@@ -538,6 +626,90 @@ extern __aosl_api__ int aosl_udp_resolve_host_async (const char *hostname, unsig
  **/
 extern __aosl_api__ int aosl_udp_resolve_host_asyncv (const char *hostname, unsigned short port, aosl_sk_addrinfo_t *addrs, size_t addr_count, aosl_mpq_t q, aosl_mpq_func_argv_t f, uintptr_t argc, va_list args);
 
+/**
+ * @brief Set the name servers used by the asynchronous resolving functions
+ * above instead of the system configured ones, and flush the resolved cache.
+ * The hosts file is always searched first.
+ * @param [in]  servers     the name server addresses, a zero port means 53,
+ *                          NULL for using the system configuration again
+ * @param [in]  count       the count of the servers, at most 3 are used
+ * @return                  0 on success, <0 on failure
+ **/
+extern __aosl_api__ int aosl_dns_set_servers (const aosl_sk_addr_t *servers, size_t count);
+
+
+/**
+ * The peer address flow table for the datagram servers, which maps the
+ * peer address of a packet to the per peer data. The address and port
+ * are the key, an IPv4-mapped IPv6 address is the same peer as the IPv4
+ * one. A flow table is NOT thread safe, it must only be used on the mpq
+ * which created it.
+ **/
+typedef struct aosl_flow_table *aosl_flow_table_t;
+
+/**
+ * @brief The flow data destructor, invoked when a flow is deleted, expired
+ *        or its table is destroyed, the table must not be touched in it.
+ * Parameters:
+ *    addr: the peer address of the flow
+ *    data: the flow data
+ *     arg: the arg specified when creating the table
+ * Return value:
+ *    None.
+ **/
+typedef void (*aosl_flow_dtor_t) (const aosl_sk_addr_t *addr, void *data, void *arg);
+
+/**
+ * @brief Create a flow table on the current mpq.
+ * @param [in] data_size   the size of each flow data in bytes, must not be 0
+ * @param [in] init_flows  the expected flow count for sizing the table, it grows as needed
+ * @param [in] idle_ms     a flow not looked up for this long is expired by a timer of
+ *                         the current mpq in about one to two and a half times of it,
+ *                         0 for never
+ * @param [in] dtor        the flow data destructor, could be NULL
+ * @param [in] arg         the arg passed to dtor
+ * @return                 the flow table, or NULL with aosl_errno set on failure
+ **/
+extern __aosl_api__ aosl_flow_table_t aosl_flow_table_create (size_t data_size, size_t init_flows, uintptr_t idle_ms, aosl_flow_dtor_t dtor, void *arg);
+
+/**
+ * @brief Destroy a flow table, the dtor is invoked for each remaining flow.
+ * @param [in] ft  the flow table
+ **/
+extern __aosl_api__ void aosl_flow_table_destroy (aosl_flow_table_t ft);
+
+/**
+ * @brief Find the flow of a peer address, and mark it active.
+ * @param [in] ft    the flow table
+ * @param [in] addr  the peer address
+ * @return           the flow data, or NULL if not found
+ **/
+extern __aosl_api__ void *aosl_flow_find (aosl_flow_table_t ft, const aosl_sk_addr_t *addr);
+
+/**
+ * @brief Find the flow of a peer address, or add it with zeroed data if not found.
+ * @param [in]  ft         the flow table
+ * @param [in]  addr       the peer address
+ * @param [out] created_p  receives whether the flow was added, could be NULL
+ * @return                 the flow data, or NULL with aosl_errno set on failure
+ **/
+extern __aosl_api__ void *aosl_flow_get (aosl_flow_table_t ft, const aosl_sk_addr_t *addr, int *created_p);
+
+/**
+ * @brief Delete the flow of a peer address.
+ * @param [in] ft    the flow table
+ * @param [in] addr  the peer address
+ * @return           0 on success, <0 on failure with aosl_errno set
+ **/
+extern __aosl_api__ int aosl_flow_del (aosl_flow_table_t ft, const aosl_sk_addr_t *addr);
+
+/**
+ * @brief Get the flow count of a flow table.
+ * @param [in] ft  the flow table
+ * @return         the flow count
+ **/
+extern __aosl_api__ size_t aosl_flow_count (aosl_flow_table_t ft);
+
 
 
 #ifdef __cplusplus
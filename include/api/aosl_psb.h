@@ -50,6 +50,27 @@ extern __aosl_api__ aosl_psb_t *aosl_alloc_user_psb (void *buf, size_t bufsz);
  **/
 extern __aosl_api__ aosl_psb_t *aosl_alloc_psb (size_t size);
 
+/**
+ * @brief Clone a PSB list, the clones share the data with the original
+ *        segments, so this is O(1) for each segment without copying any
+ *        data. Whoever writes the shared data later by aosl_psb_put or
+ *        aosl_psb_push gets its own copy first, so the others are never
+ *        affected. The segments of user buffers are copied directly.
+ *        Each clone is freed by aosl_free_psb_list independently, in any
+ *        thread and in any order with the original one.
+ * @param [in] psb  the head PSB of the list to clone
+ * @return          pointer to the head of the cloned list, or NULL on failure
+ **/
+extern __aosl_api__ aosl_psb_t *aosl_psb_clone (const aosl_psb_t *psb);
+
+/**
+ * @brief Make the data of a PSB segment private before modifying the data
+ *        in place via aosl_psb_data, it is a no-op if the data is not shared.
+ * @param [in,out] psb  the PSB segment
+ * @return              0 on success, <0 on failure with aosl_errno set
+ **/
+extern __aosl_api__ int aosl_psb_unshare (aosl_psb_t *psb);
+
 /**
  * @brief Attach an external buffer to an existing PSB.
  * @param [in,out] psb    the PSB to attach to
@@ -190,6 +190,194 @@ do {                                                                           \
 } while(0)
 
 
+/**
+ * @brief Rebalance the tree after linking a new node, and count it.
+ * @param [in]     node  the node just linked by aosl_rb_link_node
+ * @param [in,out] root  the tree root
+ **/
+extern __aosl_api__ void aosl_rb_insert_color (struct aosl_rb_node *node, struct aosl_rb_root *root);
+
+/**
+ * @brief Link a new node at the position found by walking down the tree,
+ *        aosl_rb_insert_color must be called right after this.
+ * @param [in]  node     the new node
+ * @param [in]  parent   the parent of the position, NULL for the root
+ * @param [out] rb_link  the link pointer of the position
+ **/
+static __inline__ void aosl_rb_link_node (struct aosl_rb_node *node, struct aosl_rb_node *parent, struct aosl_rb_node **rb_link)
+{
+	node->rb_parent_color = (uintptr_t)parent;
+	node->rb_left = node->rb_right = NULL;
+	*rb_link = node;
+}
+
+/**
+ * @brief Mark a node as not in any tree, checked by aosl_rb_node_empty.
+ * @param [out] node  the node
+ **/
+static __inline__ void aosl_rb_clear_node (struct aosl_rb_node *node)
+{
+	node->rb_parent_color = (uintptr_t)node;
+}
+
+/**
+ * @brief Check whether a node was cleared by aosl_rb_clear_node.
+ * @param [in] node  the node
+ * @return           non-zero if the node is not in any tree
+ **/
+static __inline__ int aosl_rb_node_empty (const struct aosl_rb_node *node)
+{
+	return node->rb_parent_color == (uintptr_t)node;
+}
+
+/**
+ * The tree root caching its leftmost node, for the users mostly taking
+ * the first node, like the timers ordered by the expire time.
+ **/
+struct aosl_rb_root_cached {
+	struct aosl_rb_root rb_root;
+	struct aosl_rb_node *rb_leftmost;
+};
+
+/**
+ * @brief Initialize a leftmost cached tree root for the generated functions.
+ * @param [out] root  the tree root
+ **/
+static __inline__ void aosl_rb_root_cached_init (struct aosl_rb_root_cached *root)
+{
+	aosl_rb_root_init (&root->rb_root, NULL);
+	root->rb_leftmost = NULL;
+}
+
+/**
+ * @brief Get the first (smallest) node of a leftmost cached tree in O(1).
+ * @param [in] root  the tree root
+ * @return           the first node, or NULL if the tree is empty
+ **/
+static __inline__ struct aosl_rb_node *aosl_rb_first_cached (const struct aosl_rb_root_cached *root)
+{
+	return root->rb_leftmost;
+}
+
+/**
+ * @brief Erase a node from a leftmost cached tree (node must be in the tree).
+ * @param [in,out] root  the tree root
+ * @param [in]     node  the node to erase
+ **/
+static __inline__ void aosl_rb_erase_cached (struct aosl_rb_root_cached *root, struct aosl_rb_node *node)
+{
+	if (root->rb_leftmost == node)
+		root->rb_leftmost = aosl_rb_next (node);
+
+	aosl_rb_erase (&root->rb_root, node);
+}
+
+/**
+ * @brief Compare two scalar keys for the generated functions.
+ * @return <0, 0 or >0 as a is less than, equal to or greater than b
+ **/
+#define AOSL_RB_CMP(a, b) (((a) > (b)) - ((a) < (b)))
+
+/**
+ * @brief Generate the red-black tree functions specialised for an entry
+ *        type, the key comparison is inlined instead of calling the rb_cmp
+ *        of the root with the key in a va_list at every level. The roots
+ *        used by the generated functions need no rb_cmp.
+ * @param [in] name     the prefix of the generated functions
+ * @param [in] type     the entry struct type
+ * @param [in] member   the name of the aosl_rb_node member within the struct
+ * @param [in] key_type the key type
+ * @param [in] key_of   the function or macro getting the key of an entry pointer
+ * @param [in] key_cmp  the function or macro comparing two keys like strcmp,
+ *                      AOSL_RB_CMP for the scalar keys
+ *
+ * The generated functions are:
+ *   type *name_find (const struct aosl_rb_root *root, key_type key);
+ *     find an entry of the key, NULL if not found;
+ *   type *name_insert (struct aosl_rb_root *root, type *entry);
+ *     insert an entry of a unique key, returns the existing entry of the
+ *     same key without inserting, or NULL if inserted;
+ *   void name_add (struct aosl_rb_root *root, type *entry);
+ *     insert an entry, after the ones of the same key;
+ *   type *name_remove (struct aosl_rb_root *root, key_type key);
+ *     find and erase an entry of the key, NULL if not found;
+ *   void name_add_cached (struct aosl_rb_root_cached *root, type *entry);
+ *     insert an entry into a leftmost cached tree, after the ones of the same key.
+ **/
+#define AOSL_RB_DEFINE(name, type, member, key_type, key_of, key_cmp)                   \
+static __inline__ type *name##_find (const struct aosl_rb_root *root, key_type key)        \
+{                                                                                        \
+	struct aosl_rb_node *__n = root->rb_node;                                            \
+	while (__n != NULL) {                                                                \
+		type *__e = aosl_rb_entry (__n, type, member);                                     \
+		int __c = key_cmp (key, key_of (__e));                                             \
+		if (__c == 0)                                                                      \
+			return __e;                                                                      \
+		__n = __c < 0 ? __n->rb_left : __n->rb_right;                                      \
+	}                                                                                    \
+	return NULL;                                                                         \
+}                                                                                        \
+                                                                                         \
+static __inline__ type *name##_insert (struct aosl_rb_root *root, type *entry)          \
+{                                                                                        \
+	struct aosl_rb_node **__link = &root->rb_node;                                       \
+	struct aosl_rb_node *__parent = NULL;                                                \
+	while (*__link != NULL) {                                                            \
+		type *__e = aosl_rb_entry (*__link, type, member);                                 \
+		int __c = key_cmp (key_of (entry), key_of (__e));                                  \
+		if (__c == 0)                                                                      \
+			return __e;                                                                      \
+		__parent = *__link;                                                                \
+		__link = __c < 0 ? &__parent->rb_left : &__parent->rb_right;                       \
+	}                                                                                    \
+	aosl_rb_link_node (&entry->member, __parent, __link);                                \
+	aosl_rb_insert_color (&entry->member, root);                                         \
+	return NULL;                                                                         \
+}                                                                                        \
+                                                                                         \
+static __inline__ void name##_add (struct aosl_rb_root *root, type *entry)              \
+{                                                                                        \
+	struct aosl_rb_node **__link = &root->rb_node;                                       \
+	struct aosl_rb_node *__parent = NULL;                                                \
+	while (*__link != NULL) {                                                            \
+		__parent = *__link;                                                                \
+		if (key_cmp (key_of (entry), key_of (aosl_rb_entry (__parent, type, member))) < 0) \
+			__link = &__parent->rb_left;                                                     \
+		else                                                                               \
+			__link = &__parent->rb_right;                                                    \
+	}                                                                                    \
+	aosl_rb_link_node (&entry->member, __parent, __link);                                \
+	aosl_rb_insert_color (&entry->member, root);                                         \
+}                                                                                        \
+                                                                                         \
+static __inline__ type *name##_remove (struct aosl_rb_root *root, key_type key)            \
+{                                                                                        \
+	type *__e = name##_find (root, key);                                                 \
+	if (__e != NULL)                                                                     \
+		aosl_rb_erase (root, &__e->member);                                                \
+	return __e;                                                                          \
+}                                                                                        \
+                                                                                         \
+static __inline__ void name##_add_cached (struct aosl_rb_root_cached *root, type *entry) \
+{                                                                                        \
+	struct aosl_rb_node **__link = &root->rb_root.rb_node;                               \
+	struct aosl_rb_node *__parent = NULL;                                                \
+	int __leftmost = 1;                                                                  \
+	while (*__link != NULL) {                                                            \
+		__parent = *__link;                                                                \
+		if (key_cmp (key_of (entry), key_of (aosl_rb_entry (__parent, type, member))) < 0) { \
+			__link = &__parent->rb_left;                                                     \
+		} else {                                                                           \
+			__link = &__parent->rb_right;                                                    \
+			__leftmost = 0;                                                                  \
+		}                                                                                  \
+	}                                                                                    \
+	if (__leftmost)                                                                      \
+		root->rb_leftmost = &entry->member;                                                \
+	aosl_rb_link_node (&entry->member, __parent, __link);                                \
+	aosl_rb_insert_color (&entry->member, &root->rb_root);                               \
+}
+
 #ifdef __cplusplus
 }
 #endif
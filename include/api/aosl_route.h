@@ -136,12 +136,23 @@ typedef void (*aosl_net_ev_func_t) (aosl_net_ev_t ev, void *arg, ...);
 extern __aosl_api__ int aosl_subscribe_net_events (aosl_net_ev_func_t f, void *arg);
 
 /**
- * @brief Get the current default route information.
+ * @brief Get the current default route information. While the network events
+ * are subscribed, this is the state the last event was reported from, read
+ * without any lock, otherwise the routes are retrieved from the system.
  * @param [out] def_rt  pointer to receive the default route info
  * @return              the default route count (0: none, 1: IPv4 or IPv6 only, 2: both)
  **/
 extern __aosl_api__ int aosl_get_default_rt (aosl_def_rt_t *def_rt);
 
+/**
+ * @brief Get the generation of the default route state, which changes each time
+ * the state read by aosl_get_default_rt/aosl_is_mobile_net/aosl_network_is_down
+ * changes. A decision derived from the state could be cached until the generation
+ * changes, read the generation before the state for this.
+ * @return  the current generation
+ **/
+extern __aosl_api__ uint32_t aosl_def_rt_generation (void);
+
 
 /**
  * @brief Check if the current default route is a mobile/cellular network.
@@ -63,6 +63,9 @@ static __inline__ int aosl_hal_set_error(int err)
 			case AOSL_HAL_RET_EINPROGRESS:
 				newerr = AOSL_EINPROGRESS;
 				break;
+			case AOSL_HAL_RET_ECONNABORTED:
+				newerr = AOSL_ECONNABORTED;
+				break;
 			default:
 				newerr = AOSL_EHAL;
 				break;
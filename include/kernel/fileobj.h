@@ -13,14 +13,14 @@
 
 #include <api/aosl_types.h>
 #include <api/aosl_defs.h>
-#include <api/aosl_rbtree.h>
+#include <api/aosl_hash.h>
 #include <kernel/atomic.h>
 #include <kernel/list.h>
 
 typedef void (*k_obj_dtor_t) (void *obj);
 
 struct file_obj {
-	struct aosl_rb_node rb_node;
+	struct aosl_hash_node hash_node;
 	aosl_fd_t fd;
 	atomic_t usage;
 	int mpq_fd;
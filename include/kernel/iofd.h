@@ -14,6 +14,7 @@
 #include <api/aosl_defs.h>
 #include <api/aosl_mpq_fd.h>
 #include <api/aosl_mpq_timer.h>
+#include <kernel/kernel.h>
 #include <kernel/atomic.h>
 #include <kernel/list.h>
 #include <kernel/fileobj.h>
@@ -27,11 +28,31 @@ typedef isize_t (*iofd_post_process_t) (void *data, size_t len, uintptr_t argc,
 
 #define FD_MAX_WBUF_SIZE (128 << 10) /* 128KB for the writing buffer size is big enough */
 
+/**
+ * The data waiting for writing is queued as records appended to fixed
+ * size chunks, so a burst of small sends under congestion costs one chunk
+ * allocation for W_CHUNK_SIZE bytes, but not one allocation for each send.
+ * Every record keeps its own length, so the packet boundaries are kept for
+ * the datagram fds, and the extra bytes of a record (such as the flags or
+ * the destination address) follow the payload at the pointer aligned place
+ * just as the aosl_fd_write_t functions expect. For a stream fd, the data
+ * with the same extra bytes is appended to the last record directly, so it
+ * could be written by a single syscall.
+ **/
+#define W_CHUNK_SIZE (16 << 10)
+
+typedef struct w_record {
+	uint32_t len;
+	uint32_t extra_size;
+} w_record_t;
+
 typedef struct w_buffer_node {
 	struct w_buffer_node *next;
-	void *w_data;
-	void *w_tail;
-	size_t w_extra_size;
+	w_record_t *w_rec; /* the record being written */
+	w_record_t *w_last; /* the last appended record */
+	size_t w_sent; /* the written bytes of w_rec */
+	char *w_end; /* the end of the appended records */
+	char *w_limit; /* the end of the chunk */
 } w_buffer_t;
 
 typedef struct {
@@ -43,34 +64,14 @@ typedef struct {
 
 extern void w_queue_init (w_queue_t *q);
 
-static __inline__ void w_queue_add (w_queue_t *q, w_buffer_t *b)
+static __inline__ size_t w_record_size (size_t len, size_t extra_size)
 {
-	b->next = NULL;
-	if (q->tail != NULL) {
-		q->tail->next = b;
-	} else {
-		q->head = b;
-	}
-	q->tail = b;
-	q->count++;
-	q->total_len += (char *)b->w_tail - (char *)(b + 1);
+	return sizeof (w_record_t) + AOSL_I_ALIGN_PTR (len) + AOSL_I_ALIGN_PTR (extra_size);
 }
 
-static __inline__ w_buffer_t *w_queue_remove_head (w_queue_t *q)
+static __inline__ void *w_record_extra (w_record_t *rec)
 {
-	if (q->head != NULL) {
-		w_buffer_t *b = q->head;
-		q->head = b->next;
-		if (q->head == NULL)
-			q->tail = NULL;
-
-		q->count--;
-		q->total_len -= (char *)b->w_tail - (char *)(b + 1);
-		b->next = NULL;
-		return b;
-	}
-
-	return NULL;
+	return AOSL_P_ALIGN_PTR ((char *)(rec + 1) + rec->len);
 }
 
 static __inline__ size_t w_queue_space (w_queue_t *q)
@@ -81,6 +82,31 @@ static __inline__ size_t w_queue_space (w_queue_t *q)
 	return 0;
 }
 
+/**
+ * The receive buffers are not reserved in the iofd objects, they are
+ * borrowed from the pool of the owner queue for the reading, and only
+ * a stream fd with a partial packet pending keeps holding its buffer
+ * between two reads. The buffers are grouped into power of 2 classes,
+ * the smallest is 2KB, and the biggest one is big enough for the max
+ * stream buffer of 2 FD_MAX_PACKET_SIZE_MAX packets plus extra bytes.
+ * The chunks of the write queues are allocated from the same pool.
+ **/
+#define RBUF_MIN_SHIFT 11
+#define RBUF_CLASSES 14
+#define RBUF_FREE_MAX 32 /* max cached buffers count of one class */
+#define RBUF_CACHE_MAX (4 << 20) /* max cached bytes of one pool */
+
+typedef struct rbuf_node {
+	struct rbuf_node *next;
+	uintptr_t cls;
+} rbuf_t;
+
+struct rbuf_pool {
+	rbuf_t *free [RBUF_CLASSES];
+	uint32_t free_count [RBUF_CLASSES];
+	size_t cached_bytes;
+};
+
 struct iofd;
 
 typedef int (*iofd_get_fd_t) (aosl_fd_t *fd_p, struct iofd *f);
@@ -96,14 +122,19 @@ struct iofd {
 #define IOFD_SOCK_LISTEN (1 << 9)
 #define IOFD_READ_RETURN_0 (1 << 10)
 #define IOFD_NO_INIT_READ (1 << 11)
+#define IOFD_READING (1 << 12)
+#define IOFD_STREAM (1 << 13)
+#define IOFD_NONBLOCK (1 << 14) /* the fd is non-blocking already */
+#define IOFD_PAUSED (1 << 15) /* a listener not being polled, see __iofd_listen_pause */
 
 	uint32_t flags; // IOFD_xxx above and aosl_poll_type_e
+	int mp_idx; /* slot index in the poll backend fd set, -1 for none */
 
 	aosl_mpq_t q;
 	aosl_timer_t timer;
 
 	size_t max_pkt_size;
-	void *r_head;
+	void *r_head; /* NULL when no receive buffer held */
 	void *r_data;
 	void *r_tail;
 	size_t r_extra_size;
@@ -152,6 +183,22 @@ extern void mpq_fini_iofds (struct mp_queue *q);
 
 extern void f_event_and_close (struct mp_queue *q, struct iofd *f, int iofd_err);
 
+/**
+ * Append the data and the extra bytes to the write queue of the iofd as a
+ * record, must be called in the owner queue of the iofd.
+ **/
+extern int w_queue_append (struct mp_queue *q, struct iofd *f, const void *data, size_t len, const void *extra, size_t extra_size);
+
+/**
+ * Allocate/free a buffer of the rbuf classes from the pool of the current
+ * queue, or from the heap directly in a thread which is not a queue. The
+ * buffer could be freed in any thread, it just goes to the pool of the
+ * freeing thread then. Other modules such as the psb use these to share
+ * the recycled buffers with the iofds of the same queue.
+ **/
+extern void *mpq_buf_alloc (size_t size);
+extern void mpq_buf_free (void *buf);
+
 
 /**
  * According to the real test result, the cost of a simplest
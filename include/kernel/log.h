@@ -12,5 +12,20 @@
 #include <kernel/types.h>
 #include <api/aosl_log.h>
 
+extern void k_log_init (void);
+extern void k_log_fini (void);
+
+/* mark the calling thread as created by us, so it gets a logging ring of its own */
+extern void k_log_thread_init (void);
+
+/* release the async logging ring of the calling thread when it exits */
+extern void k_log_thread_exit (void);
+
+/* output the queued messages in a crash path, without blocking */
+extern void k_log_flush_panic (void);
+
+/* output the message synchronously regardless of the async mode */
+extern void k_vlog_sync (int level, const char *fmt, va_list args);
+
 
 #endif /* __KERNEL_LOG_H__ */
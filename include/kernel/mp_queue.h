@@ -19,6 +19,7 @@
 #include <kernel/osmp.h>
 #include <kernel/timer.h>
 #include <kernel/iofd.h>
+#include <kernel/mpq_stats.h>
 
 #include <kernel/atomic.h>
 #include <kernel/thread.h>
@@ -34,8 +35,18 @@ struct q_func_obj {
 	struct q_func_obj *next;
 
 	aosl_ts_t queued_ts;
-
-	k_sync_t *sync_obj;
+	aosl_ts_t queued_us;
+	/* the aosl_tick_now time after which the function expires, 0 for never */
+	aosl_ts_t deadline;
+	/* the priority lane the function is queued in */
+	int pri;
+
+	/* the coalescing key and the hash chain of the pending keyed functions */
+	struct q_func_obj *key_next;
+	uintptr_t key;
+	int key_state;
+
+	k_completion_t *sync_obj;
 	aosl_mpq_t done_qid;
 	aosl_ref_t ref;
 	const char *f_name;
@@ -113,6 +124,22 @@ struct wakeup_signal {
 	aosl_event_t  event; // event for signal
 };
 
+#define FO_KEY_NONE 0
+#define FO_KEY_PENDING 1
+#define FO_KEY_SUPERSEDED 2
+
+#define MPQ_KEYS_HASH_BITS 6
+#define MPQ_KEYS_HASH_SIZE (1 << MPQ_KEYS_HASH_BITS)
+
+/* a priority lane of the queued functions, protected by the queue lock */
+struct mpq_lane {
+	struct q_func_obj *head;
+	struct q_func_obj *tail;
+	int count;
+	int weight;
+	int credit;
+};
+
 struct mp_queue {
 	const char *q_name;
 	atomic_t usage;
@@ -120,6 +147,19 @@ struct mp_queue {
 	aosl_mpq_t qid;
 
 	aosl_fd_t efd;
+
+	/* the persistent pollfd set, only used by the poll backend */
+	aosl_poll_event_t *pfds;
+	struct iofd **pfd_iofds;
+	int pfd_count;
+	int pfd_size;
+	int pfd_next;
+
+	/* the event batch of one wait, NULL for using the stack one */
+	aosl_poll_event_t *events;
+	int events_size;
+	int events_low_waits;
+
 	int need_kicking;
 	k_thread_t thrd;
 	struct wakeup_signal sigp;
@@ -129,6 +169,11 @@ struct mp_queue {
 	int q_flags;
 	int q_max;
 
+	/* the budgets of one loop iteration, 0 for no limit */
+	int budget_funcs;
+	int budget_us;
+	int budget_events;
+
 	/**
 	 * The IPv6 prefix for converting an IPv4 address.
 	 * Putting this member here is really ugly, but it
@@ -141,9 +186,15 @@ struct mp_queue {
 	k_cond_t wait_q;
 	int wait_q_count;
 
-	struct q_func_obj *head;
-	struct q_func_obj *tail;
+	struct mpq_lane lanes [AOSL_MPQ_PRI_COUNT];
 	atomic_t count;
+
+	/**
+	 * The pending keyed functions for coalescing, and the objects carrying
+	 * the replaced args to be freed by the queue thread, with lock held.
+	 **/
+	struct q_func_obj *keys_hash [MPQ_KEYS_HASH_SIZE];
+	struct q_func_obj *stale;
 	atomic_t kick_q_count;
 
 	aosl_mpq_t run_func_done_qid;
@@ -160,6 +211,8 @@ struct mp_queue {
 	uint64_t exec_timers_count;
 	uint64_t exec_fds_count;
 
+	struct mpq_stats stats;
+
 	aosl_ts_t last_idle_ts;
 	aosl_ts_t last_wake_ts;
 
@@ -168,6 +221,7 @@ struct mp_queue {
 
 	struct aosl_list_head iofds;
 	size_t iofd_count;
+	struct rbuf_pool rbuf_pool;
 
 	struct aosl_list_head timers;
 	size_t timer_count;
@@ -175,8 +229,23 @@ struct mp_queue {
 
 	struct q_wait_entry *destroy_wait_head;
 	struct q_wait_entry *destroy_wait_tail;
+
+	/**
+	 * The recycling cache of the parked queues, the park fields
+	 * are protected by the park lock, but the park_args is set
+	 * with q->lock held for waking the parked thread up.
+	 **/
+	struct mp_queue *park_next;
+	struct __mpq_create_args *park_args;
+	int park_pri;
+	int park_stack_size;
+	int parked;
 };
 
+/* the destroying threads waiting their queues to be idle */
+extern atomic_t mpq_idle_waits;
+extern void __mpq_idle_wake (struct mp_queue *q);
+
 static inline void ____q_get (struct mp_queue *q)
 {
 	atomic_inc (&q->usage);
@@ -184,7 +253,12 @@ static inline void ____q_get (struct mp_queue *q)
 
 static inline void ____q_put (struct mp_queue *q)
 {
-	atomic_dec (&q->usage);
+	/**
+	 * The q might be freed by the destroying thread once the usage
+	 * drops to 1, so only the pointer value is used for the waking.
+	 **/
+	if (atomic_dec_return (&q->usage) == 1 && atomic_read (&mpq_idle_waits) != 0)
+		__mpq_idle_wake (q);
 }
 
 extern void __mpq_add_wait (struct mp_queue *q, struct q_wait_entry *wait);
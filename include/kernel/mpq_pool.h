@@ -23,5 +23,18 @@ extern aosl_mpq_t genp_queue_no_fail_argv (aosl_mpq_t dq, aosl_ref_t ref, const
 extern aosl_mpq_t genp_best_q_get (void);
 extern int mpqp_best_q_put (aosl_mpq_t qid);
 
+/**
+ * Get the queues with the least fds of a pool for placing n new fds,
+ * each got queue must be put by mpqp_best_q_put after adding the fd.
+ **/
+extern int mpqp_fd_best_qs_get (aosl_mpqp_t qp, aosl_mpq_t qids [], int n);
+
+/**
+ * Pin/unpin the pool queues for the jobs sharded by queue,
+ * a pinned queue would not be shrunk until it is unpinned.
+ **/
+extern int mpqp_pin_qs (aosl_mpqp_t qp, aosl_mpq_t qids [], int max);
+extern int mpqp_unpin_q (aosl_mpqp_t qp, aosl_mpq_t qid);
+
 
 #endif /* __MPQ_POOL_H__ */
\ No newline at end of file
@@ -0,0 +1,44 @@
+/***************************************************************************
+ * Module:	Multiplex queue runtime stats header file
+ *
+ * Copyright © 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+#ifndef __MPQ_STATS_H__
+#define __MPQ_STATS_H__
+
+#include <api/aosl_types.h>
+#include <api/aosl_mpq.h>
+
+
+/**
+ * The stats of a queue are only written by the queue thread, and the
+ * readers in other threads get a consistent snapshot by checking the
+ * sequence count, which is odd while the queue thread is writing.
+ * The only exception is depth_max, which is updated by the queuing
+ * threads with the queue lock held.
+ **/
+struct mpq_stats {
+	uint32_t seq;
+	int reset_req;
+	uint32_t f_hash [AOSL_MPQ_STATS_FUNCS];
+	aosl_mpq_stats_t data;
+};
+
+struct mp_queue;
+
+extern void mpq_stats_init (struct mp_queue *q);
+extern void mpq_stats_check_reset (struct mp_queue *q);
+extern void mpq_stats_func (struct mp_queue *q, const char *f_name, aosl_ts_t wait_us, aosl_ts_t exec_us);
+extern void mpq_stats_expired (struct mp_queue *q);
+extern void mpq_stats_coalesced (struct mp_queue *q);
+extern void mpq_stats_timer (struct mp_queue *q, aosl_ts_t late_us);
+extern void mpq_stats_rx (struct mp_queue *q, size_t bytes);
+extern void mpq_stats_tx (struct mp_queue *q, size_t bytes);
+extern void mpq_stats_budget_hit (struct mp_queue *q, int src);
+extern void mpq_stats_fds_starve (struct mp_queue *q, aosl_ts_t starve_us);
+
+
+#endif /* __MPQ_STATS_H__ */
@@ -12,10 +12,21 @@
 #include <api/aosl_types.h>
 #include <api/aosl_route.h>
 
-extern void netifs_hash_init (void);
+extern void netifs_init (void);
+extern void netifs_fini (void);
+/* drop all the links, when the net events are unsubscribed */
 extern void netifs_hash_fini (void);
 
-extern aosl_netif_t *netif_by_index (int idx);
+/* copy the link info out, the table is updated on the subscriber queue */
+extern int netif_get (int idx, aosl_netif_t *netif);
 extern int update_netifs (int del, int ifindex, ...);
 
+/**
+ * The wireless/cellular attributes probed for a link are cached with
+ * it, get returns -AOSL_EAGAIN if they have not been probed since the
+ * link was added or renamed.
+ **/
+extern int netif_get_attrs (int idx, int *wireless_p, int *cellnet_p);
+extern int netif_set_attrs (int idx, int wireless, int cellnet);
+
 #endif
@@ -23,6 +23,13 @@ extern void os_mp_fini (struct mp_queue *q);
 extern int os_add_event_fd (struct mp_queue *q, struct iofd *f);
 extern int os_del_event_fd (struct mp_queue *q, struct iofd *f);
 
+/**
+ * Re-arm the one-shot interest events(AOSL_POLLIN/AOSL_POLLOUT) of an
+ * iofd for the level triggered backends(poll/select), the edge triggered
+ * epoll backend just ignores it.
+ **/
+extern void os_rearm_event_fd (struct mp_queue *q, struct iofd *f, uint32_t events);
+
 extern int os_poll_dispatch (struct mp_queue *q, intptr_t timeo);
 
 #endif /* __KERNEL_OSMP_H__ */
@@ -12,9 +12,28 @@
 
 
 #include <kernel/err.h>
+#include <kernel/atomic.h>
 
 
 #define PSB_USER_BUFFER (0x00800000u)
+#define PSB_EMBEDDED (0x00400000u) /* the header lives in the block of its segment */
+
+/**
+ * The data of a psb lives in a refcounted segment, so a clone could share
+ * the data with the original psb in O(1), and whoever writes the shared
+ * data gets a private copy first(copy on write). The psb allocated by the
+ * alloc_psb is one block of [struct ps_buff][struct psb_seg][data], the
+ * embedded header holds one reference of the block for its lifetime, so
+ * the block is freed after both the header and all the clones are gone.
+ * The blocks are allocated from the buffer pool of the current queue.
+ **/
+#define PSB_SEG_POOLED (1u << 0) /* from mpq_buf_alloc, but not aosl_malloc */
+#define PSB_SEG_EMBEDDED (1u << 1) /* the block begins with the embedded header */
+
+struct psb_seg {
+	atomic_t refs;
+	uintptr_t flags;
+};
 
 /* NPTS packet piece buffer */
 struct ps_buff {
@@ -26,6 +45,7 @@ struct ps_buff {
 	void *head;
 	size_t size;
 	unsigned int flags;
+	struct psb_seg *seg; /* NULL for a user buffer */
 };
 
 
@@ -34,6 +54,13 @@ extern struct ps_buff *alloc_psb (size_t size);
 extern void psb_attach_buf (struct ps_buff *psb, void *buf, size_t bufsz);
 extern void psb_detach_buf (struct ps_buff *psb);
 extern void free_psb (struct ps_buff *psb);
+extern struct ps_buff *psb_clone (const struct ps_buff *psb);
+extern int psb_unshare (struct ps_buff *psb);
+
+static inline int psb_shared (const struct ps_buff *psb)
+{
+	return psb->seg != NULL && atomic_read (&psb->seg->refs) > 1;
+}
 
 
 /**
@@ -83,11 +110,19 @@ static inline int psb_reserve(struct ps_buff *psb, unsigned int len)
  *	psb_put - add data to a buffer
  *	@psb: buffer to use
  *	@len: amount of data to add
+ *
+ *	The shared data is copied to a private segment before returning
+ *	the writable tail, so the clones never see the new data.
  **/
 static inline void *psb_put (struct ps_buff *psb, unsigned int len)
 {
 	if (likely ((uint8_t *)psb->data + psb->len + len <= (uint8_t *)psb->head + psb->size)) {
-		void *tmp = (uint8_t *)psb->data + psb->len;
+		void *tmp;
+
+		if (unlikely (psb_shared (psb)) && psb_unshare (psb) < 0)
+			return ERR_PTR (-AOSL_ENOMEM);
+
+		tmp = (uint8_t *)psb->data + psb->len;
 		psb->len += len;
 		return tmp;
 	}
@@ -129,12 +164,17 @@ static inline void *psb_peek (const struct ps_buff *psb, unsigned int len)
  *	psb_push - add data to the start of a buffer
  *	@psb: buffer to use
  *	@len: amount of data to add
+ *
+ *	The shared data is copied to a private segment first as psb_put.
  **/
 static inline void *psb_push (struct ps_buff *psb, unsigned int len)
 {
 	if ((uint8_t *)psb->data - (uint8_t *)psb->head < (int)len)
 		return ERR_PTR (-AOSL_ENOSPC);
 
+	if (unlikely (psb_shared (psb)) && psb_unshare (psb) < 0)
+		return ERR_PTR (-AOSL_ENOMEM);
+
 	psb->len += len;
 	psb->data = (uint8_t *)psb->data - len;
 	return psb->data;
@@ -13,8 +13,6 @@
 #include <api/aosl_rbtree.h>
 
 
-extern void aosl_rb_insert_color (struct aosl_rb_node *, struct aosl_rb_root *);
-
 /* Find logical next and previous nodes in a tree */
 extern struct aosl_rb_node *aosl_rb_next (struct aosl_rb_node *);
 extern struct aosl_rb_node *aosl_rb_prev (struct aosl_rb_node *);
@@ -27,10 +25,7 @@ extern void aosl_rb_replace_node (struct aosl_rb_node *victim, struct aosl_rb_no
 static inline void
 rb_link_node (struct aosl_rb_node *node, struct aosl_rb_node *parent, struct aosl_rb_node **rb_link)
 {
-	node->rb_parent_color = (uintptr_t) parent;
-	node->rb_left = node->rb_right = NULL;
-
-	*rb_link = node;
+	aosl_rb_link_node (node, parent, rb_link);
 }
 
 static __inline__ void rb_insert (struct aosl_rb_root *root, struct aosl_rb_node *node,
@@ -14,10 +14,12 @@
 
 #if defined (__linux__)
 extern int os_get_def_rt (aosl_def_rt_t *def_rt);
+extern int os_get_monitored_def_rt (aosl_def_rt_t *def_rt);
 extern int os_subscribe_net_events (aosl_net_ev_func_t f, void *arg);
 extern void os_unsubscribe_net_events (void);
 #else
 static int os_get_def_rt (aosl_def_rt_t *def_rt) { (void)def_rt; return -1; }
+static int os_get_monitored_def_rt (aosl_def_rt_t *def_rt) { (void)def_rt; return -1; }
 static int os_subscribe_net_events (aosl_net_ev_func_t f, void *arg) { (void)f; (void)arg; return -1;}
 static void os_unsubscribe_net_events (void) {}
 #endif
@@ -62,6 +62,7 @@ typedef struct {
 extern int k_thread_create (k_thread_t *thread, const char *name, int priority, int stack_size,
 													  k_thread_entry_t entry, void *arg);
 extern k_thread_t k_thread_self (void);
+extern void k_thread_set_name (const char *name);
 extern void k_thread_exit (void *retval);
 static inline int k_processors_count (void) {return 1;}
 
@@ -79,6 +80,25 @@ typedef struct {
 
 typedef k_sync_t k_event_t;
 
+/**
+ * The completion for one waiter and one completer, which is used for
+ * the synchronous calls. A waiting thread always gets the same object
+ * with the futex backend, and the pooled ones otherwise, so there is
+ * no creating and destroying of the underlying primitives per wait.
+ **/
+typedef struct k_completion {
+	volatile int done;
+#if !defined(AOSL_HAL_HAVE_FUTEX) || !AOSL_HAL_HAVE_FUTEX
+	struct k_completion *next;
+#if defined(AOSL_HAL_HAVE_SEM) && AOSL_HAL_HAVE_SEM == 1
+	aosl_sem_t sem;
+#else
+	k_lock_t mutex;
+	k_cond_t cond;
+#endif
+#endif
+} k_completion_t;
+
 /**
  * @brief Static lock initialization states
  */
@@ -104,6 +124,20 @@ typedef aosl_static_lock_t k_static_lock_t;
 	.state = K_STATIC_LOCK_UNINIT \
 }
 
+/**
+ * The compiler thread local storage, which is a single memory access,
+ * so the per thread data of the hot paths (such as the errno and the
+ * current queue) uses it directly when supported. The TLS keys are
+ * also looked up via a native thread local pointer to the table of
+ * the thread without any lock, otherwise the thread tables are found
+ * by the thread id in a tree.
+ **/
+#if defined(_MSC_VER)
+#define K_THREAD_LOCAL __declspec(thread)
+#elif defined(__linux__) || defined(__APPLE__) || defined(_WIN32)
+#define K_THREAD_LOCAL __thread
+#endif
+
 typedef int k_tls_key_t;
 extern void rb_tls_init (void);
 extern void rb_tls_fini (void);
@@ -112,6 +146,13 @@ extern void *k_tls_key_get (k_tls_key_t key);
 extern int k_tls_key_set (k_tls_key_t key, void *value);
 extern int k_tls_key_delete (k_tls_key_t key);
 
+/* free the TLS table of the calling thread, called when the thread exits */
+extern void k_tls_thread_exit (void);
+#if !defined(K_THREAD_LOCAL)
+/* the errno cell in the TLS table of the calling thread */
+extern int *k_tls_errno_ptr (void);
+#endif
+
 extern void k_lock_init (k_lock_t *lk);
 extern void k_lock_init_recursive (k_lock_t *lk);
 extern void k_lock_lock (k_lock_t *lk);
@@ -160,4 +201,10 @@ extern int k_event_timedwait (k_event_t *event, intptr_t timeo);
 extern void k_event_reset (k_event_t *event);
 extern void k_event_destroy (k_event_t *event);
 
+extern k_completion_t *k_completion_get (void);
+extern void k_completion_wait (k_completion_t *c);
+extern void k_completion_done (k_completion_t *c);
+extern void k_completion_put (k_completion_t *c);
+extern void k_completion_fini (void);
+
 #endif /* __KERNEL_THREAD_H__ */
\ No newline at end of file
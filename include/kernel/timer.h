@@ -24,9 +24,8 @@
 struct timer_node {
 	struct aosl_list_head node; /* node for multiplex queue timers table */
 
+	/* cleared when the timer is not scheduled */
 	struct aosl_rb_node timer_node;
-	struct timer_node *timer_prev;
-	struct timer_node *timer_next;
 
 	aosl_ref_t obj_id;
 	atomic_t usage;
@@ -60,15 +59,26 @@ static __inline__ void __timer_put (struct timer_node *timer)
 }
 
 struct timer_base {
-	struct aosl_rb_root active;
-	struct timer_node *first;
+	/* ordered by the expire time, the leftmost is the first to expire */
+	struct aosl_rb_root_cached active;
 };
 
+static __inline__ struct timer_node *timer_base_first (struct timer_base *base)
+{
+	struct aosl_rb_node *node = aosl_rb_first_cached (&base->active);
+
+	if (node != NULL)
+		return aosl_rb_entry (node, struct timer_node, timer_node);
+
+	return NULL;
+}
+
 struct mp_queue;
 
 extern void mpq_init_timers (struct mp_queue *q);
 
-extern int __check_and_run_timers (struct mp_queue *q);
+/* deadline_us: stop running the expired timers at this aosl_tick_us time, 0 for no limit */
+extern int __check_and_run_timers (struct mp_queue *q, aosl_ts_t deadline_us);
 
 extern void mpq_fini_timers (struct mp_queue *q);
 
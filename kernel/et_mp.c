@@ -91,6 +91,11 @@ int os_del_event_fd_epoll (struct mp_queue *q, struct iofd *f)
 	return err;
 }
 
+void os_rearm_event_fd_epoll (struct mp_queue *q, struct iofd *f, uint32_t events)
+{
+	/* edge triggered, nothing to do */
+}
+
 int os_mp_wait_epoll (struct mp_queue *q, aosl_poll_event_t *events, int maxevents, intptr_t timeo)
 {
 	int err;
@@ -19,45 +19,44 @@
 
 static k_rwlock_t fds_lock;
 static uint32_t __fobj_life_id = 0;
-static struct aosl_rb_root attached_fds;
+static struct aosl_hash_table attached_fds;
 
-static int cmp_fd (struct aosl_rb_node *rb_node, struct aosl_rb_node *node, va_list args)
+static __inline__ uintptr_t __fd_hash (aosl_fd_t fd)
 {
-	struct file_obj *rb_entry = aosl_rb_entry (rb_node, struct file_obj, rb_node);
-	aosl_fd_t fd;
+	return aosl_hash_uintptr ((uintptr_t)fd);
+}
 
-	if (node != NULL) {
-		fd = aosl_rb_entry (node, struct file_obj, rb_node)->fd;
-	} else {
-		fd = va_arg (args, aosl_fd_t);
+/* the caller must hold fds_lock */
+static struct file_obj *__fd_lookup (aosl_fd_t fd)
+{
+	uintptr_t hash = __fd_hash (fd);
+	struct aosl_hash_node *node;
+	struct file_obj *f;
+
+	aosl_hash_for_each_possible (&attached_fds, node, hash) {
+		f = aosl_hash_entry (node, struct file_obj, hash_node);
+		if (f->fd == fd)
+			return f;
 	}
 
-	if ((uintptr_t)rb_entry->fd > (uintptr_t)fd)
-		return 1;
-
-	if ((uintptr_t)rb_entry->fd < (uintptr_t)fd)
-		return -1;
-
-	return 0;
+	return NULL;
 }
 
 int install_fd (aosl_fd_t fd, struct file_obj *f)
 {
 	int err;
-	struct aosl_rb_node *node;
 
 	if (aosl_fd_invalid (fd))
 		return -AOSL_EBADF;
 
 	k_rwlock_wrlock (&fds_lock);
-	node = aosl_find_rb_node (&attached_fds, NULL, fd);
-	if (node != NULL) {
+	if (__fd_lookup (fd) != NULL) {
 		err = -AOSL_EBUSY;
 		goto ____out;
 	}
 
 	f->life_id = __fobj_life_id++;
-	aosl_rb_insert_node (&attached_fds, &f->rb_node);
+	aosl_hash_add (&attached_fds, &f->hash_node, __fd_hash (fd));
 	err = 0;
 
 ____out:
@@ -68,31 +67,27 @@ ____out:
 
 int remove_fd (struct file_obj *f)
 {
-	aosl_fd_t fd = f->fd;
-	struct aosl_rb_node *node;
+	int err = -AOSL_ENONET;
 
 	k_rwlock_wrlock (&fds_lock);
-	node = aosl_rb_remove (&attached_fds, NULL, fd);
+	if (__fd_lookup (f->fd) == f) {
+		aosl_hash_del (&attached_fds, &f->hash_node);
+		err = 0;
+	}
 	k_rwlock_wrunlock (&fds_lock);
 
-	if (node != &f->rb_node)
-		return -AOSL_ENONET;
-
-	return 0;
+	return err;
 }
 
 struct file_obj *fget (aosl_fd_t fd)
 {
 	if (!aosl_fd_invalid (fd)) {
-		struct aosl_rb_node *node;
-		struct file_obj *f = NULL;
+		struct file_obj *f;
 
 		k_rwlock_rdlock (&fds_lock);
-		node = aosl_find_rb_node (&attached_fds, NULL, fd);
-		if (node != NULL) {
-			f = aosl_rb_entry (node, struct file_obj, rb_node);
+		f = __fd_lookup (fd);
+		if (f != NULL)
 			__fget (f);
-		}
 		k_rwlock_rdunlock (&fds_lock);
 
 		return f;
@@ -113,7 +108,7 @@ void fput (struct file_obj *f)
 
 static void attached_fds_check (void)
 {
-	if (NULL != aosl_rb_first (&attached_fds)) {
+	if (attached_fds.count != 0) {
 		AOSL_LOG_ERR("[dtor] attached_fds no free");
 	}
 }
@@ -121,11 +116,13 @@ static void attached_fds_check (void)
 void fileobj_init (void)
 {
 	k_rwlock_init (&fds_lock);
-	aosl_rb_root_init (&attached_fds, cmp_fd);
+	/* fget looks up under the read lock */
+	aosl_hash_init (&attached_fds, AOSL_HASH_F_CONCURRENT_READ);
 }
 
 void fileobj_fini (void)
 {
 	attached_fds_check ();
+	aosl_hash_fini (&attached_fds, NULL, NULL);
 	k_rwlock_destroy (&fds_lock);
 }
\ No newline at end of file
@@ -25,7 +25,7 @@
 
 void iofd_init (void)
 {
-	if (!AOSL_IS_ALIGNED_PTR (sizeof (struct iofd)) || !AOSL_IS_ALIGNED_PTR (sizeof (w_buffer_t)))
+	if (!AOSL_IS_ALIGNED_PTR (sizeof (struct iofd)) || !AOSL_IS_ALIGNED_PTR (sizeof (w_buffer_t)) || !AOSL_IS_ALIGNED_PTR (sizeof (w_record_t)))
 		abort ();
 }
 
@@ -37,8 +37,18 @@ static void iofd_destructor (void *obj)
 {
 	struct iofd *f = (struct iofd *)obj;
 	w_buffer_t *node;
-	while ((node = w_queue_remove_head (&f->w_q)) != NULL)
-		aosl_free (node);
+
+	/**
+	 * The last reference might be dropped in any thread, so do
+	 * not return the chunks and buffer to the queue pool here.
+	 **/
+	while ((node = f->w_q.head) != NULL) {
+		f->w_q.head = node->next;
+		aosl_free ((rbuf_t *)node - 1);
+	}
+
+	if (f->r_head != NULL)
+		aosl_free ((rbuf_t *)f->r_head - 1);
 }
 
 int make_fd_nb_clex (aosl_fd_t fd)
@@ -51,10 +61,128 @@ int make_fd_nb_clex (aosl_fd_t fd)
 	return 0;
 }
 
+static void rbuf_pool_init (struct rbuf_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < RBUF_CLASSES; i++) {
+		pool->free [i] = NULL;
+		pool->free_count [i] = 0;
+	}
+
+	pool->cached_bytes = 0;
+}
+
+static void rbuf_pool_fini (struct rbuf_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < RBUF_CLASSES; i++) {
+		rbuf_t *b;
+		while ((b = pool->free [i]) != NULL) {
+			pool->free [i] = b->next;
+			aosl_free (b);
+		}
+
+		pool->free_count [i] = 0;
+	}
+
+	pool->cached_bytes = 0;
+}
+
+static void *rbuf_alloc (struct rbuf_pool *pool, size_t size)
+{
+	uintptr_t cls = 0;
+	rbuf_t *b;
+
+	while (((size_t)1 << (RBUF_MIN_SHIFT + cls)) < size)
+		cls++;
+
+	if (cls >= RBUF_CLASSES)
+		return NULL;
+
+	b = (pool != NULL) ? pool->free [cls] : NULL;
+	if (b != NULL) {
+		pool->free [cls] = b->next;
+		pool->free_count [cls]--;
+		pool->cached_bytes -= (size_t)1 << (RBUF_MIN_SHIFT + cls);
+	} else {
+		b = (rbuf_t *)aosl_malloc (sizeof (rbuf_t) + ((size_t)1 << (RBUF_MIN_SHIFT + cls)));
+		if (b == NULL)
+			return NULL;
+
+		b->cls = cls;
+	}
+
+	return b + 1;
+}
+
+static void rbuf_free (struct rbuf_pool *pool, void *buf)
+{
+	rbuf_t *b = (rbuf_t *)buf - 1;
+	uintptr_t cls = b->cls;
+	size_t size = (size_t)1 << (RBUF_MIN_SHIFT + cls);
+
+	if (pool == NULL) {
+		aosl_free (b);
+		return;
+	}
+
+	/* always keep one buffer of each class for reusing */
+	if (pool->free_count [cls] == 0 || (pool->free_count [cls] < RBUF_FREE_MAX && pool->cached_bytes + size <= RBUF_CACHE_MAX)) {
+		b->next = pool->free [cls];
+		pool->free [cls] = b;
+		pool->free_count [cls]++;
+		pool->cached_bytes += size;
+	} else {
+		aosl_free (b);
+	}
+}
+
+void *mpq_buf_alloc (size_t size)
+{
+	struct mp_queue *q = THIS_MPQ ();
+	return rbuf_alloc ((q != NULL) ? &q->rbuf_pool : NULL, size);
+}
+
+void mpq_buf_free (void *buf)
+{
+	struct mp_queue *q = THIS_MPQ ();
+	rbuf_free ((q != NULL) ? &q->rbuf_pool : NULL, buf);
+}
+
+static __inline__ size_t __iofd_buff_size (struct iofd *f)
+{
+	return (f->chk_pkt_f != NULL) ? (f->max_pkt_size * 2) : f->max_pkt_size;
+}
+
+static int __iofd_rbuf_get (struct mp_queue *q, struct iofd *f)
+{
+	void *buf = rbuf_alloc (&q->rbuf_pool, __iofd_buff_size (f) + f->r_extra_size);
+	if (buf == NULL)
+		return -AOSL_ENOMEM;
+
+	f->r_head = buf;
+	f->r_data = buf;
+	f->r_tail = buf;
+	return 0;
+}
+
+static void __iofd_rbuf_put (struct mp_queue *q, struct iofd *f)
+{
+	if (f->r_head != NULL) {
+		rbuf_free (&q->rbuf_pool, f->r_head);
+		f->r_head = NULL;
+		f->r_data = NULL;
+		f->r_tail = NULL;
+	}
+}
+
 void mpq_init_iofds (struct mp_queue *q)
 {
 	aosl_list_head_init (&q->iofds);
 	q->iofd_count = 0;
+	rbuf_pool_init (&q->rbuf_pool);
 }
 
 
@@ -71,9 +199,61 @@ static int __q_add_fd (struct mp_queue *q, struct iofd *f)
 	return 0;
 }
 
-int __iofd_read_data (struct mp_queue *q, struct iofd *f)
+/**
+ * A listener failing to accept for a reason other than no pending
+ * connection, mostly running out of fds or buffers, is still readable.
+ * Polling it again at once would spin a level triggered backend and an
+ * edge triggered one would never report it again, and closing it would
+ * stop accepting for good, so stop polling it for a while instead.
+ **/
+#define IOFD_LISTEN_PAUSE_MS 100
+
+static void __iofd_listen_resume (aosl_timer_t timer, const aosl_ts_t *now_p, uintptr_t argc, uintptr_t argv [])
+{
+	struct iofd *f = (struct iofd *)argv [0];
+	struct mp_queue *q = THIS_MPQ ();
+	int err;
+	UNUSED (timer);
+	UNUSED (now_p);
+	UNUSED (argc);
+
+	__iofd_get (f);
+	if (!aosl_mpq_timer_invalid (f->timer)) {
+		aosl_mpq_kill_timer (f->timer);
+		f->timer = AOSL_MPQ_TIMER_INVALID;
+	}
+
+	if (f->flags & IOFD_PAUSED) {
+		f->flags &= ~IOFD_PAUSED;
+		/* the backends report a still pending connection right after adding */
+		err = os_add_event_fd (q, f);
+		if (err < 0)
+			f_event_and_close (q, f, err);
+	}
+
+	iofd_put (f);
+}
+
+static int __iofd_listen_pause (struct mp_queue *q, struct iofd *f, int err)
+{
+	int del_err;
+
+	f->timer = aosl_mpq_set_oneshot_timer (aosl_tick_now () + IOFD_LISTEN_PAUSE_MS, __iofd_listen_resume, NULL, 1, f);
+	if (aosl_mpq_timer_invalid (f->timer))
+		return -AOSL_ENOMEM;
+
+	del_err = os_del_event_fd (q, f);
+	if (del_err < 0)
+		AOSL_LOG(AOSL_LOG_WARNING, "os_del_event_fd failed err=%d fd=%d", del_err, f->fobj.fd);
+
+	f->flags |= IOFD_PAUSED;
+	AOSL_LOG(AOSL_LOG_WARNING, "accept on fd %d failed err=%d, pause for %d ms", f->fobj.fd, err, IOFD_LISTEN_PAUSE_MS);
+	return 0;
+}
+
+static int __iofd_read_buffered (struct mp_queue *q, struct iofd *f)
 {
-	size_t buff_size = (f->chk_pkt_f != NULL) ? (f->max_pkt_size * 2) : f->max_pkt_size;
+	size_t buff_size = __iofd_buff_size (f);
 	void *extra_bytes = (f->r_extra_size > 0) ? (char *)f->r_head + buff_size : NULL;
 
 	for (;;) {
@@ -127,6 +307,7 @@ int __iofd_read_data (struct mp_queue *q, struct iofd *f)
 				}
 
 				if (data_len >= 0) {
+					mpq_stats_rx (q, (size_t)data_len);
 					f->data_f (f->r_data, data_len, f->argc, f->argv, extra_bytes);
 					mpq_stack_fini (q->q_stack_curr);
 					if (aosl_fd_invalid (iofd_fobj (f)->fd)) {
@@ -181,9 +362,12 @@ int __iofd_read_data (struct mp_queue *q, struct iofd *f)
 		}
 
 		err = f->read_f (iofd_fobj (f)->fd, f->r_tail, buff_size - ((char *)f->r_tail - (char *)f->r_head), f->r_extra_size, f->argc, f->argv);
-		f->flags |= AOSL_POLLIN;
+		os_rearm_event_fd (q, f, AOSL_POLLIN);
 		if (err < 0) {
 			if (err != -AOSL_EAGAIN) {
+				if ((f->flags & IOFD_SOCK_LISTEN) && __iofd_listen_pause (q, f, (int)err) == 0)
+					break;
+
 				f_event_and_close (q, f, err);
 				return err;
 			}
@@ -200,6 +384,29 @@ ____out:
 	return 0;
 }
 
+int __iofd_read_data (struct mp_queue *q, struct iofd *f)
+{
+	int err;
+
+	if (f->r_head == NULL && __iofd_rbuf_get (q, f) < 0) {
+		f_event_and_close (q, f, -AOSL_ENOMEM);
+		return -AOSL_ENOMEM;
+	}
+
+	f->flags |= IOFD_READING;
+	err = __iofd_read_buffered (q, f);
+	f->flags &= ~IOFD_READING;
+
+	/**
+	 * Only a still alive fd with a partial packet pending keeps the
+	 * buffer, return it to the pool for all the other cases.
+	 **/
+	if (aosl_fd_invalid (iofd_fobj (f)->fd) || f->r_tail == f->r_data)
+		__iofd_rbuf_put (q, f);
+
+	return err;
+}
+
 void w_queue_init (w_queue_t *q)
 {
 	q->head = NULL;
@@ -208,6 +415,99 @@ void w_queue_init (w_queue_t *q)
 	q->total_len = 0;
 }
 
+static w_buffer_t *__w_queue_add_chunk (struct mp_queue *q, w_queue_t *wq, size_t rec_size)
+{
+	size_t size = sizeof (w_buffer_t) + rec_size;
+	w_buffer_t *node;
+
+	if (size < W_CHUNK_SIZE)
+		size = W_CHUNK_SIZE;
+
+	node = (w_buffer_t *)rbuf_alloc (&q->rbuf_pool, size);
+	if (node == NULL)
+		return NULL;
+
+	node->next = NULL;
+	node->w_rec = (w_record_t *)(node + 1);
+	node->w_last = NULL;
+	node->w_sent = 0;
+	node->w_end = (char *)(node + 1);
+	node->w_limit = (char *)node + ((size_t)1 << (RBUF_MIN_SHIFT + ((rbuf_t *)node - 1)->cls));
+
+	if (wq->tail != NULL) {
+		wq->tail->next = node;
+	} else {
+		wq->head = node;
+	}
+
+	wq->tail = node;
+	wq->count++;
+	return node;
+}
+
+int w_queue_append (struct mp_queue *q, struct iofd *f, const void *data, size_t len, const void *extra, size_t extra_size)
+{
+	w_queue_t *wq = &f->w_q;
+	w_buffer_t *node = wq->tail;
+	size_t rec_size = w_record_size (len, extra_size);
+	w_record_t *rec;
+
+	if (node != NULL) {
+		rec = node->w_last;
+		if ((f->flags & IOFD_STREAM) != 0 && rec != NULL && rec->extra_size == extra_size
+				&& (extra_size == 0 || memcmp (w_record_extra (rec), extra, extra_size) == 0)) {
+			size_t grow = AOSL_I_ALIGN_PTR (rec->len + len) - AOSL_I_ALIGN_PTR (rec->len);
+			if (node->w_end + grow <= node->w_limit) {
+				/**
+				 * The extra bytes are overwritten by the new data,
+				 * and they are the same ones, so just copy again.
+				 **/
+				memcpy ((char *)(rec + 1) + rec->len, data, len);
+				rec->len += (uint32_t)len;
+				if (extra_size > 0)
+					memcpy (w_record_extra (rec), extra, extra_size);
+
+				node->w_end += grow;
+				wq->total_len += len;
+				return 0;
+			}
+		}
+
+		if (node->w_end + rec_size > node->w_limit)
+			node = NULL;
+	}
+
+	if (node == NULL) {
+		node = __w_queue_add_chunk (q, wq, rec_size);
+		if (node == NULL)
+			return -AOSL_ENOMEM;
+	}
+
+	rec = (w_record_t *)node->w_end;
+	rec->len = (uint32_t)len;
+	rec->extra_size = (uint32_t)extra_size;
+	memcpy (rec + 1, data, len);
+	if (extra_size > 0)
+		memcpy (w_record_extra (rec), extra, extra_size);
+
+	node->w_last = rec;
+	node->w_end += rec_size;
+	wq->total_len += len;
+	return 0;
+}
+
+static void __w_queue_free_head (struct mp_queue *q, w_queue_t *wq)
+{
+	w_buffer_t *node = wq->head;
+
+	wq->head = node->next;
+	if (wq->head == NULL)
+		wq->tail = NULL;
+
+	wq->count--;
+	rbuf_free (&q->rbuf_pool, node);
+}
+
 int __iofd_write_data (struct mp_queue *q, struct iofd *f)
 {
 	if (f->flags & IOFD_NOT_READY) {
@@ -220,22 +520,31 @@ int __iofd_write_data (struct mp_queue *q, struct iofd *f)
 
 	while (f->w_q.head != NULL) {
 		w_buffer_t *node = f->w_q.head;
-		isize_t err;
-		err = f->write_f (iofd_fobj (f)->fd, node->w_data, (char *)node->w_tail - (char *)node->w_data, node->w_extra_size, f->argc, f->argv);
-		f->flags |= AOSL_POLLOUT;
-		if (err < 0) {
-			if (err != -AOSL_EAGAIN) {
-				f_event_and_close (q, f, err);
-				return err;
+
+		while ((char *)node->w_rec < node->w_end) {
+			w_record_t *rec = node->w_rec;
+			isize_t err;
+
+			err = f->write_f (iofd_fobj (f)->fd, (char *)(rec + 1) + node->w_sent, rec->len - node->w_sent, rec->extra_size, f->argc, f->argv);
+			os_rearm_event_fd (q, f, AOSL_POLLOUT);
+			if (err < 0) {
+				if (err != -AOSL_EAGAIN) {
+					f_event_and_close (q, f, err);
+					return err;
+				}
+				return 0;
 			}
-			return 0;
+
+			node->w_sent += err;
+			f->w_q.total_len -= err;
+			if (node->w_sent < rec->len)
+				return 0;
+
+			node->w_rec = (w_record_t *)((char *)rec + w_record_size (rec->len, rec->extra_size));
+			node->w_sent = 0;
 		}
-		node->w_data = (char *)node->w_data + err;
-		if (node->w_data < node->w_tail)
-			return 0;
 
-		w_queue_remove_head (&f->w_q);
-		aosl_free (node);
+		__w_queue_free_head (q, &f->w_q);
 	}
 
 	if (f->event_f != NULL) {
@@ -298,7 +607,6 @@ int __mpq_add_fd_argv (struct mp_queue *q, aosl_fd_t fd, int not_ready_timeo, si
 	struct iofd *f;
 	size_t argv_size;
 	uintptr_t l;
-	size_t buff_size;
 	int err;
 
 	if (q->q_flags & AOSL_MPQ_FLAG_SIGP_EVENT)
@@ -323,8 +631,7 @@ int __mpq_add_fd_argv (struct mp_queue *q, aosl_fd_t fd, int not_ready_timeo, si
 
 	max_pkt_size = AOSL_I_ALIGN_PTR (max_pkt_size);
 	argv_size = argc * sizeof (uintptr_t);
-	buff_size = (chk_pkt_f != NULL) ? (max_pkt_size * 2) : max_pkt_size;
-	f = aosl_malloc (sizeof (struct iofd) + argv_size + buff_size + extra_bytes);
+	f = aosl_malloc (sizeof (struct iofd) + argv_size);
 	if (f == NULL)
 		return -AOSL_ENOMEM;
 
@@ -338,11 +645,12 @@ int __mpq_add_fd_argv (struct mp_queue *q, aosl_fd_t fd, int not_ready_timeo, si
 	iofd_fobj (f)->mpq_fd = 1;
 	iofd_fobj (f)->dtor = iofd_destructor;
 	f->flags = flags;
+	f->mp_idx = -1;
 	f->q = q->qid;
 	f->max_pkt_size = max_pkt_size;
-	f->r_head = (char *)(f + 1) + argv_size;
-	f->r_data = f->r_head;
-	f->r_tail = f->r_data;
+	f->r_head = NULL;
+	f->r_data = NULL;
+	f->r_tail = NULL;
 	f->r_extra_size = extra_bytes;
 
 	w_queue_init (&f->w_q);
@@ -386,7 +694,8 @@ int __mpq_add_fd_argv (struct mp_queue *q, aosl_fd_t fd, int not_ready_timeo, si
 	if (err < 0)
 		return err;
 #else
-	make_fd_nb_clex (fd);
+	if (!(flags & IOFD_NONBLOCK))
+		make_fd_nb_clex (fd);
 #endif
 
 	err = install_fd (fd, iofd_fobj (f));
@@ -509,9 +818,11 @@ static int __q_del_f (struct mp_queue *q, struct iofd *f)
 		f->timer = AOSL_MPQ_TIMER_INVALID;
 	}
 
-	err = os_del_event_fd (q, f);
-	if (err < 0) {
-		AOSL_LOG(AOSL_LOG_WARNING, "os_del_event_fd failed err=%d fd=%d", err, f->fobj.fd);
+	if (!(f->flags & IOFD_PAUSED)) {
+		err = os_del_event_fd (q, f);
+		if (err < 0) {
+			AOSL_LOG(AOSL_LOG_WARNING, "os_del_event_fd failed err=%d fd=%d", err, f->fobj.fd);
+		}
 	}
 
 	err = remove_fd (iofd_fobj (f));
@@ -522,6 +833,14 @@ static int __q_del_f (struct mp_queue *q, struct iofd *f)
 
 	aosl_list_del (&f->node);
 	q->iofd_count--;
+
+	/**
+	 * The buffer is still being used if we are deleted in the
+	 * data callback, __iofd_read_data will release it for us.
+	 **/
+	if (!(f->flags & IOFD_READING))
+		__iofd_rbuf_put (q, f);
+
 	iofd_put (f); /* decrease the initial usage count */
 	return err;
 }
@@ -607,6 +926,7 @@ void mpq_fini_iofds (struct mp_queue *q)
 	}
 
 	q->iofd_count = 0;
+	rbuf_pool_fini (&q->rbuf_pool);
 }
 
 int __close_fd (aosl_fd_t fd)
@@ -715,7 +1035,6 @@ __export_in_so__ int aosl_mpq_del_fd (aosl_fd_t fd)
 
 static isize_t ____write (struct iofd *f, const void *buf, size_t len)
 {
-	w_buffer_t *node;
 	isize_t err;
 
 	if (len > FD_MAX_WBUF_SIZE)
@@ -731,7 +1050,7 @@ static isize_t ____write (struct iofd *f, const void *buf, size_t len)
 
 	err = aosl_hal_sk_write (iofd_fobj (f)->fd, buf, len);
 
-	f->flags |= AOSL_POLLOUT;
+	os_rearm_event_fd (THIS_MPQ (), f, AOSL_POLLOUT);
 
 	if (err <= 0) {
 		return aosl_hal_set_error(err);
@@ -739,18 +1058,12 @@ static isize_t ____write (struct iofd *f, const void *buf, size_t len)
 
 	if ((size_t)err < len) {
 __queue_it:
-		node = aosl_malloc (sizeof (w_buffer_t) + AOSL_I_ALIGN_PTR (len - err));
-		if (node == NULL)
-			return -AOSL_ENOMEM;
-
-		memcpy (node + 1, (char *)buf + err, len - err);
-		node->w_data = node + 1;
-		node->w_tail = (char *)(node + 1) + (len - err);
-		node->w_extra_size = 0;
-
-		w_queue_add (&f->w_q, node);
+		err = w_queue_append (THIS_MPQ (), f, (char *)buf + err, len - err, NULL, 0);
+		if (err < 0)
+			return err;
 	}
 
+	mpq_stats_tx (THIS_MPQ (), len);
 	return len;
 }
 
@@ -6,9 +6,17 @@
  * Licensed under the Apache License, Version 2.0, with certain conditions.
  * Refer to the "LICENSE" file in the root directory for more information.
  ***************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
 #include <kernel/kernel.h>
 #include <kernel/types.h>
 #include <kernel/log.h>
+#include <kernel/thread.h>
+#include <api/aosl_mm.h>
+#include <api/aosl_atomic.h>
+#include <api/aosl_errno.h>
 #include <hal/aosl_hal_log.h>
 
 #define UNUSED(expr) (void)(expr)
@@ -42,9 +50,906 @@ __export_in_so__ void aosl_set_log_level (int level)
 		aosl_log_level = level;
 }
 
+/**
+ * The async logging mode: the logging thread only captures the format
+ * pointer and the raw arguments(the strings are copied) into its own
+ * single producer ring, and a background thread formats the records and
+ * calls the log function, so a slow log function never stalls the event
+ * loops. The rings are lock free, a full ring just drops the record and
+ * counts it. The records of different threads are not ordered with each
+ * other, and the format strings must be static ones, just as all the
+ * AOSL_LOG_XXX macros use.
+ * Only the threads created by us release their rings when exiting, so
+ * the other threads share one ring under the log_shared_lock, otherwise
+ * a thread logging once would keep its ring till k_log_fini.
+ **/
+#define LOG_RING_SIZE (16 << 10)
+#define LOG_REC_MAX 512 /* max bytes of a record, the longer strings are cut */
+#define LOG_TEXT_MAX 1024 /* max bytes of a formatted message */
+#define LOG_DRAIN_INTERVAL 10 /* ms */
+#define LOG_ALIGN 16
+
+#define LOG_REC_PAD 0x1 /* skip to the ring beginning */
+#define LOG_REC_TEXT 0x2 /* formatted already, the args are the text */
+
+struct log_rec {
+	uint32_t len; /* bytes of the whole record, LOG_ALIGN aligned */
+	uint16_t level;
+	uint16_t flags;
+	uint64_t fmt; /* the format pointer */
+	/* the args follow */
+};
+
+struct log_ring {
+	struct log_ring *next;
+	atomic_t owned;
+	volatile uint32_t head; /* only written by the owner thread */
+	volatile uint32_t tail; /* only written by the draining thread */
+	/* only written by the owner thread, so no atomic operation */
+	uint64_t queued;
+	uint64_t dropped;
+	uint64_t overflow;
+	uint8_t buf [LOG_RING_SIZE];
+};
+
+static volatile int log_async = 0;
+static k_lock_t log_lock; /* for the rings list and the drainer state */
+/**
+ * Serializing the draining, so the records keep their order. The log
+ * function is called with only this one held, never the log_lock, so
+ * it could log again or query the stats.
+ **/
+static k_lock_t log_drain_lock;
+static k_lock_t log_shared_lock; /* for the producers of the shared ring */
+static k_cond_t log_cond;
+static struct log_ring *log_rings = NULL;
+static struct log_ring *log_shared_ring = NULL;
+static int log_drainer_running = 0;
+static int log_drainer_exited = 1;
+
+#if defined(K_THREAD_LOCAL)
+/**
+ * The rings are freed in k_log_fini, so the ring of a thread is only
+ * valid with the same generation, just in case the library is inited
+ * again with some threads still alive.
+ **/
+static uintptr_t log_gen = 1;
+static K_THREAD_LOCAL struct log_ring *__this_ring;
+static K_THREAD_LOCAL uintptr_t __this_ring_gen;
+static K_THREAD_LOCAL int __this_thread_ours;
+
+static __inline__ struct log_ring *__log_this_ring (void)
+{
+	if (__this_ring_gen != log_gen)
+		return NULL;
+
+	return __this_ring;
+}
+
+static __inline__ void __log_set_this_ring (struct log_ring *ring)
+{
+	__this_ring = ring;
+	__this_ring_gen = log_gen;
+}
+
+static __inline__ int __log_thread_ours (void)
+{
+	return __this_thread_ours;
+}
+
+static __inline__ void __log_set_thread_ours (void)
+{
+	__this_thread_ours = 1;
+}
+#else
+/* the key value of a thread created by us but owning no ring */
+#define LOG_RING_NONE ((struct log_ring *)1)
+
+static k_tls_key_t log_ring_key = -1;
+
+static __inline__ struct log_ring *__log_this_ring (void)
+{
+	struct log_ring *ring = (struct log_ring *)k_tls_key_get (log_ring_key);
+
+	return (ring != LOG_RING_NONE) ? ring : NULL;
+}
+
+static __inline__ void __log_set_this_ring (struct log_ring *ring)
+{
+	k_tls_key_set (log_ring_key, (ring != NULL) ? ring : LOG_RING_NONE);
+}
+
+static __inline__ int __log_thread_ours (void)
+{
+	return k_tls_key_get (log_ring_key) != NULL;
+}
+
+static __inline__ void __log_set_thread_ours (void)
+{
+	if (k_tls_key_get (log_ring_key) == NULL)
+		k_tls_key_set (log_ring_key, LOG_RING_NONE);
+}
+#endif
+
+/* must be called with the log_lock held */
+static struct log_ring *__log_ring_alloc (void)
+{
+	struct log_ring *ring = (struct log_ring *)aosl_malloc (sizeof *ring);
+
+	if (ring != NULL) {
+		memset (ring, 0, offsetof (struct log_ring, buf));
+		atomic_set (&ring->owned, 1);
+		ring->next = log_rings;
+		/* the draining walks the list without the log_lock */
+		aosl_wmb ();
+		log_rings = ring;
+	}
+
+	return ring;
+}
+
+static struct log_ring *__log_ring_get (void)
+{
+	struct log_ring *ring = __log_this_ring ();
+
+	if (ring != NULL)
+		return ring;
+
+	k_lock_lock (&log_lock);
+	/* take over a ring released by an exited thread first */
+	for (ring = log_rings; ring != NULL; ring = ring->next) {
+		if (atomic_cmpxchg (&ring->owned, 0, 1) == 0)
+			break;
+	}
+
+	if (ring == NULL)
+		ring = __log_ring_alloc ();
+	k_lock_unlock (&log_lock);
+
+	if (ring != NULL)
+		__log_set_this_ring (ring);
+
+	return ring;
+}
+
+static struct log_ring *__log_shared_ring_get (void)
+{
+	struct log_ring *ring = *(struct log_ring *volatile *)&log_shared_ring;
+
+	if (ring != NULL)
+		return ring;
+
+	k_lock_lock (&log_lock);
+	if (log_shared_ring == NULL)
+		log_shared_ring = __log_ring_alloc ();
+	ring = log_shared_ring;
+	k_lock_unlock (&log_lock);
+	return ring;
+}
+
+enum {
+	LOG_ARG_NONE, /* %% */
+	LOG_ARG_INT,
+	LOG_ARG_UINT,
+	LOG_ARG_CHAR,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_PTR,
+	LOG_ARG_STR,
+};
+
+enum {
+	LOG_LEN_NONE,
+	LOG_LEN_HH,
+	LOG_LEN_H,
+	LOG_LEN_L,
+	LOG_LEN_LL,
+	LOG_LEN_J,
+	LOG_LEN_Z,
+	LOG_LEN_T,
+};
+
+struct log_spec {
+	const char *start; /* the '%' */
+	const char *len_start; /* the length modifier */
+	const char *end; /* after the conversion char */
+	int type;
+	int len;
+	int stars;
+	/* the precision, LOG_PREC_NONE for none and LOG_PREC_STAR for the last star */
+	int prec;
+};
+
+#define LOG_PREC_NONE (-1)
+#define LOG_PREC_STAR (-2)
+
+/**
+ * Parse the next conversion spec from *pp, return 0 for the end of the
+ * format, 1 for a spec, and <0 for the ones we do not capture(such as
+ * %n, %ls and %Lf), which make the whole message formatted in place.
+ **/
+static int __log_next_spec (const char **pp, struct log_spec *spec)
+{
+	const char *p = *pp;
+
+	while (*p != '\0' && *p != '%')
+		p++;
+
+	if (*p == '\0') {
+		*pp = p;
+		return 0;
+	}
+
+	spec->start = p++;
+	spec->stars = 0;
+	spec->prec = LOG_PREC_NONE;
+	while (*p != '\0' && strchr ("-+ #0'", *p) != NULL)
+		p++;
+
+	if (*p == '*') {
+		spec->stars++;
+		p++;
+	} else {
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			spec->stars++;
+			spec->prec = LOG_PREC_STAR;
+			p++;
+		} else {
+			spec->prec = 0;
+			while (*p >= '0' && *p <= '9') {
+				if (spec->prec < LOG_REC_MAX)
+					spec->prec = spec->prec * 10 + (*p - '0');
+				p++;
+			}
+		}
+	}
+
+	spec->len_start = p;
+	spec->len = LOG_LEN_NONE;
+	switch (*p) {
+	case 'h':
+		p++;
+		spec->len = LOG_LEN_H;
+		if (*p == 'h') {
+			p++;
+			spec->len = LOG_LEN_HH;
+		}
+		break;
+	case 'l':
+		p++;
+		spec->len = LOG_LEN_L;
+		if (*p == 'l') {
+			p++;
+			spec->len = LOG_LEN_LL;
+		}
+		break;
+	case 'j':
+		p++;
+		spec->len = LOG_LEN_J;
+		break;
+	case 'z':
+		p++;
+		spec->len = LOG_LEN_Z;
+		break;
+	case 't':
+		p++;
+		spec->len = LOG_LEN_T;
+		break;
+	default:
+		break;
+	}
+
+	switch (*p) {
+	case '%':
+		spec->type = LOG_ARG_NONE;
+		break;
+	case 'd':
+	case 'i':
+		spec->type = LOG_ARG_INT;
+		break;
+	case 'u':
+	case 'x':
+	case 'X':
+	case 'o':
+		spec->type = LOG_ARG_UINT;
+		break;
+	case 'c':
+		spec->type = LOG_ARG_CHAR;
+		break;
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		spec->type = LOG_ARG_DOUBLE;
+		break;
+	case 'p':
+		spec->type = LOG_ARG_PTR;
+		break;
+	case 's':
+		spec->type = LOG_ARG_STR;
+		break;
+	default:
+		return -1;
+	}
+
+	/* the wide chars and strings are not supported */
+	if ((spec->type == LOG_ARG_CHAR || spec->type == LOG_ARG_STR) && spec->len != LOG_LEN_NONE)
+		return -1;
+
+	spec->end = ++p;
+	*pp = p;
+	return 1;
+}
+
+static int64_t __log_va_int (int len, va_list *args)
+{
+	switch (len) {
+	case LOG_LEN_HH:
+		return (signed char)va_arg (*args, int);
+	case LOG_LEN_H:
+		return (short)va_arg (*args, int);
+	case LOG_LEN_L:
+		return va_arg (*args, long);
+	case LOG_LEN_LL:
+		return va_arg (*args, long long);
+	case LOG_LEN_J:
+		return va_arg (*args, intmax_t);
+	case LOG_LEN_Z:
+		return va_arg (*args, isize_t);
+	case LOG_LEN_T:
+		return va_arg (*args, ptrdiff_t);
+	default:
+		return va_arg (*args, int);
+	}
+}
+
+static uint64_t __log_va_uint (int len, va_list *args)
+{
+	switch (len) {
+	case LOG_LEN_HH:
+		return (unsigned char)va_arg (*args, unsigned int);
+	case LOG_LEN_H:
+		return (unsigned short)va_arg (*args, unsigned int);
+	case LOG_LEN_L:
+		return va_arg (*args, unsigned long);
+	case LOG_LEN_LL:
+		return va_arg (*args, unsigned long long);
+	case LOG_LEN_J:
+		return va_arg (*args, uintmax_t);
+	case LOG_LEN_Z:
+		return va_arg (*args, size_t);
+	case LOG_LEN_T:
+		return (uint64_t)va_arg (*args, ptrdiff_t);
+	default:
+		return va_arg (*args, unsigned int);
+	}
+}
+
+/**
+ * Capture the raw args into the record buffer as 8 bytes values, and
+ * the strings as the 8 bytes length followed by the padded chars.
+ * Return the record length, or <0 if the format is not supported.
+ **/
+static int __log_capture (struct log_rec *rec, const char *fmt, va_list args, int *overflow_p)
+{
+	uint8_t *p = (uint8_t *)(rec + 1);
+	uint8_t *end = (uint8_t *)rec + LOG_REC_MAX;
+	struct log_spec spec;
+	va_list ap;
+	int prec = LOG_PREC_NONE;
+	int err;
+	int i;
+
+	va_copy (ap, args);
+	while ((err = __log_next_spec (&fmt, &spec)) > 0) {
+		if (spec.type == LOG_ARG_NONE)
+			continue;
+
+		if (p + (spec.stars + 1) * sizeof (uint64_t) > end) {
+			err = -1;
+			break;
+		}
+
+		for (i = 0; i < spec.stars; i++) {
+			prec = va_arg (ap, int);
+			*(int64_t *)p = prec;
+			p += sizeof (uint64_t);
+		}
+
+		/* the precision star is the last one, a negative one is taken as none */
+		if (spec.prec != LOG_PREC_STAR)
+			prec = spec.prec;
+
+		switch (spec.type) {
+		case LOG_ARG_INT:
+			*(int64_t *)p = __log_va_int (spec.len, &ap);
+			break;
+		case LOG_ARG_UINT:
+			*(uint64_t *)p = __log_va_uint (spec.len, &ap);
+			break;
+		case LOG_ARG_CHAR:
+			*(int64_t *)p = va_arg (ap, int);
+			break;
+		case LOG_ARG_DOUBLE:
+			*(double *)p = va_arg (ap, double);
+			break;
+		case LOG_ARG_PTR:
+			*(uint64_t *)p = (uintptr_t)va_arg (ap, void *);
+			break;
+		case LOG_ARG_STR: {
+			const char *str = va_arg (ap, const char *);
+			size_t room = (size_t)(end - p) - sizeof (uint64_t);
+			size_t len = 6;
+
+			/**
+			 * A string with the precision need not be terminated, so
+			 * never read beyond the precision, nor beyond the room.
+			 **/
+			if (str != NULL) {
+				const char *nul;
+
+				len = (prec >= 0 && (size_t)prec <= room) ? (size_t)prec : room + 1;
+				nul = (const char *)memchr (str, '\0', len);
+				if (nul != NULL)
+					len = nul - str;
+			}
+
+			if (len > room) {
+				len = room;
+				*overflow_p = 1;
+			}
+
+			memcpy (p + sizeof (uint64_t), (str != NULL) ? str : "(null)", len);
+			*(uint64_t *)p = len;
+			p += (len + sizeof (uint64_t) - 1) & ~(sizeof (uint64_t) - 1);
+			break;
+		}
+		default:
+			break;
+		}
+
+		p += sizeof (uint64_t);
+	}
+	va_end (ap);
+
+	if (err < 0)
+		return err;
+
+	return (int)(((p - (uint8_t *)rec) + LOG_ALIGN - 1) & ~(LOG_ALIGN - 1));
+}
+
+static int __log_text (struct log_rec *rec, const char *fmt, va_list args, int *overflow_p)
+{
+	char *text = (char *)(rec + 1);
+	size_t room = LOG_REC_MAX - sizeof *rec;
+	va_list ap;
+	int len;
+
+	va_copy (ap, args);
+	len = vsnprintf (text, room, fmt, ap);
+	va_end (ap);
+	if (len < 0)
+		return -1;
+
+	if ((size_t)len >= room) {
+		len = (int)room - 1;
+		*overflow_p = 1;
+	}
+
+	rec->flags |= LOG_REC_TEXT;
+	return (int)((sizeof *rec + len + 1 + LOG_ALIGN - 1) & ~(LOG_ALIGN - 1));
+}
+
+static void __log_enqueue (struct log_ring *ring, int level, const char *fmt, va_list args)
+{
+	uint64_t rec_buf [LOG_REC_MAX / sizeof (uint64_t)];
+	struct log_rec *rec = (struct log_rec *)rec_buf;
+	uint32_t head = ring->head;
+	uint32_t off = head & (LOG_RING_SIZE - 1);
+	uint32_t contig = LOG_RING_SIZE - off;
+	uint32_t need;
+	int overflow = 0;
+	int len;
+
+	rec->level = (uint16_t)level;
+	rec->flags = 0;
+	rec->fmt = (uintptr_t)fmt;
+	len = __log_capture (rec, fmt, args, &overflow);
+	if (len < 0) {
+		overflow = 0;
+		len = __log_text (rec, fmt, args, &overflow);
+		if (len < 0)
+			return;
+	}
+
+	rec->len = (uint32_t)len;
+	need = (len > (int)contig) ? contig + len : (uint32_t)len;
+	if (need > LOG_RING_SIZE - (head - ring->tail)) {
+		ring->dropped++;
+		return;
+	}
+
+	/* the space is free only after the drainer read all the old data */
+	aosl_mb ();
+	if (len > (int)contig) {
+		struct log_rec *pad = (struct log_rec *)&ring->buf [off];
+		pad->len = contig;
+		pad->flags = LOG_REC_PAD;
+		off = 0;
+	}
+
+	memcpy (&ring->buf [off], rec, len);
+	ring->queued++;
+	if (overflow)
+		ring->overflow++;
+
+	aosl_wmb ();
+	ring->head = head + need;
+}
+
+static void __vlog_call (int level, const char *fmt, ...)
+{
+	va_list args;
+	va_start (args, fmt);
+	vlog_func_p (level, fmt, args);
+	va_end (args);
+}
+
+static int __log_format_spec (char *out, size_t room, const struct log_spec *spec, const uint64_t **argp)
+{
+	char sf [32];
+	char str [LOG_REC_MAX];
+	const uint64_t *a = *argp;
+	size_t n;
+	int w [2];
+	int i;
+	int ret;
+
+	/* the flags, width and precision part, then the length normalized */
+	n = spec->len_start - spec->start;
+	if (n > sizeof sf - 4)
+		return 0;
+
+	memcpy (sf, spec->start, n);
+	if (spec->type == LOG_ARG_INT || spec->type == LOG_ARG_UINT) {
+		sf [n++] = 'l';
+		sf [n++] = 'l';
+	}
+
+	sf [n++] = spec->end [-1];
+	sf [n] = '\0';
+
+	for (i = 0; i < spec->stars; i++)
+		w [i] = (int)*(const int64_t *)a++;
+
+#define __LOG_SNPRINTF(v) \
+	(spec->stars == 0 ? snprintf (out, room, sf, v) : \
+	 spec->stars == 1 ? snprintf (out, room, sf, w [0], v) : \
+	 snprintf (out, room, sf, w [0], w [1], v))
+
+	switch (spec->type) {
+	case LOG_ARG_INT:
+		ret = __LOG_SNPRINTF ((long long)*(const int64_t *)a);
+		a++;
+		break;
+	case LOG_ARG_UINT:
+		ret = __LOG_SNPRINTF ((unsigned long long)*a);
+		a++;
+		break;
+	case LOG_ARG_CHAR:
+		ret = __LOG_SNPRINTF ((int)*(const int64_t *)a);
+		a++;
+		break;
+	case LOG_ARG_DOUBLE:
+		ret = __LOG_SNPRINTF (*(const double *)a);
+		a++;
+		break;
+	case LOG_ARG_PTR:
+		ret = __LOG_SNPRINTF ((void *)(uintptr_t)*a);
+		a++;
+		break;
+	case LOG_ARG_STR:
+		n = (size_t)*a++;
+		memcpy (str, a, n);
+		str [n] = '\0';
+		a += (n + sizeof (uint64_t) - 1) / sizeof (uint64_t);
+		ret = __LOG_SNPRINTF (str);
+		break;
+	default:
+		ret = 0;
+		break;
+	}
+#undef __LOG_SNPRINTF
+
+	*argp = a;
+	return ret;
+}
+
+static void __log_emit (const struct log_rec *rec)
+{
+	char text [LOG_TEXT_MAX];
+	const char *fmt = (const char *)(uintptr_t)rec->fmt;
+	const uint64_t *a = (const uint64_t *)(rec + 1);
+	struct log_spec spec;
+	size_t pos = 0;
+	int ret;
+
+	if (rec->flags & LOG_REC_TEXT) {
+		__vlog_call (rec->level, "%s", (const char *)(rec + 1));
+		return;
+	}
+
+	for (;;) {
+		/* the literal part before the spec */
+		const char *lit = fmt;
+		size_t n;
+
+		ret = __log_next_spec (&fmt, &spec);
+		n = ((ret > 0) ? spec.start : fmt) - lit;
+		if (n > sizeof text - 1 - pos)
+			n = sizeof text - 1 - pos;
+
+		memcpy (text + pos, lit, n);
+		pos += n;
+		if (ret <= 0 || pos >= sizeof text - 1)
+			break;
+
+		if (spec.type == LOG_ARG_NONE) {
+			text [pos++] = '%';
+			continue;
+		}
+
+		ret = __log_format_spec (text + pos, sizeof text - pos, &spec, &a);
+		if (ret > 0)
+			pos += ((size_t)ret < sizeof text - pos) ? (size_t)ret : sizeof text - 1 - pos;
+	}
+
+	text [pos] = '\0';
+	__vlog_call (rec->level, "%s", text);
+}
+
+static int __log_drain_ring (struct log_ring *ring)
+{
+	uint32_t tail = ring->tail;
+	uint32_t head = ring->head;
+	int count = 0;
+
+	aosl_rmb ();
+	while (tail != head) {
+		const struct log_rec *rec = (const struct log_rec *)&ring->buf [tail & (LOG_RING_SIZE - 1)];
+
+		if (!(rec->flags & LOG_REC_PAD)) {
+			__log_emit (rec);
+			count++;
+		}
+
+		tail += rec->len;
+	}
+
+	aosl_mb ();
+	ring->tail = tail;
+	return count;
+}
+
+/**
+ * Must be called with the log_drain_lock held. The rings are only added
+ * to the list head and never freed before k_log_fini, so the list could
+ * be walked without the log_lock.
+ **/
+static int __log_drain (void)
+{
+	struct log_ring *ring;
+	int count = 0;
+
+	for (ring = *(struct log_ring *volatile *)&log_rings; ring != NULL; ring = ring->next)
+		count += __log_drain_ring (ring);
+
+	return count;
+}
+
+static void __log_drain_all (void)
+{
+	k_lock_lock (&log_drain_lock);
+	__log_drain ();
+	k_lock_unlock (&log_drain_lock);
+}
+
+static void log_drainer (void *arg)
+{
+	UNUSED (arg);
+
+	/**
+	 * The log function might log again, get the ring before holding
+	 * the lock, so that goes to the ring without locking.
+	 **/
+	__log_ring_get ();
+
+	k_lock_lock (&log_lock);
+	while (log_drainer_running) {
+		k_cond_timedwait (&log_cond, &log_lock, LOG_DRAIN_INTERVAL);
+		k_lock_unlock (&log_lock);
+		__log_drain_all ();
+		k_lock_lock (&log_lock);
+	}
+
+	log_drainer_exited = 1;
+	k_cond_broadcast (&log_cond);
+	k_lock_unlock (&log_lock);
+}
+
+static void __log_stop_drainer (void)
+{
+	k_lock_lock (&log_lock);
+	log_drainer_running = 0;
+	k_cond_broadcast (&log_cond);
+	while (!log_drainer_exited)
+		k_cond_wait (&log_cond, &log_lock);
+	k_lock_unlock (&log_lock);
+
+	__log_drain_all ();
+}
+
+__export_in_so__ int aosl_log_set_async (int enable)
+{
+	k_thread_t thread;
+	int err = 0;
+
+	if (enable) {
+		k_lock_lock (&log_lock);
+		if (!log_drainer_running) {
+			while (!log_drainer_exited)
+				k_cond_wait (&log_cond, &log_lock);
+
+			log_drainer_running = 1;
+			log_drainer_exited = 0;
+			err = k_thread_create (&thread, "aosl_log", AOSL_THRD_PRI_LOW, 0, log_drainer, NULL);
+			if (err < 0) {
+				log_drainer_running = 0;
+				log_drainer_exited = 1;
+			}
+		}
+		k_lock_unlock (&log_lock);
+
+		if (err < 0)
+			return -1;
+
+		log_async = 1;
+	} else if (log_async) {
+		log_async = 0;
+		__log_stop_drainer ();
+	}
+
+	return 0;
+}
+
+__export_in_so__ void aosl_log_flush (void)
+{
+	/* the same as the drainer, in case of logging in the log function */
+	if (log_async && __log_thread_ours ())
+		__log_ring_get ();
+
+	__log_drain_all ();
+}
+
+__export_in_so__ void aosl_log_get_stats (aosl_log_stats_t *stats)
+{
+	struct log_ring *ring;
+
+	memset (stats, 0, sizeof *stats);
+	k_lock_lock (&log_lock);
+	for (ring = log_rings; ring != NULL; ring = ring->next) {
+		stats->queued += ring->queued;
+		stats->dropped += ring->dropped;
+		stats->overflow += ring->overflow;
+	}
+	k_lock_unlock (&log_lock);
+}
+
+void k_log_flush_panic (void)
+{
+	/* the lock might be held by this thread, such as panic in the log function */
+	if (k_lock_trylock (&log_drain_lock)) {
+		__log_drain ();
+		k_lock_unlock (&log_drain_lock);
+	}
+}
+
+void k_log_thread_exit (void)
+{
+	struct log_ring *ring = __log_this_ring ();
+
+	if (ring != NULL) {
+		__log_set_this_ring (NULL);
+		/* the drainer still drains the remaining records */
+		atomic_set (&ring->owned, 0);
+	}
+}
+
+void k_log_thread_init (void)
+{
+	__log_set_thread_ours ();
+}
+
+void k_log_init (void)
+{
+	k_lock_init (&log_lock);
+	k_lock_init (&log_drain_lock);
+	k_lock_init (&log_shared_lock);
+	k_cond_init (&log_cond);
+#if !defined(K_THREAD_LOCAL)
+	if (k_tls_key_create (&log_ring_key) < 0)
+		abort ();
+#endif
+}
+
+void k_log_fini (void)
+{
+	struct log_ring *ring;
+
+	if (log_async) {
+		log_async = 0;
+		__log_stop_drainer ();
+	}
+
+	/* the records queued after the last draining of the disabling */
+	__log_drain_all ();
+	while ((ring = log_rings) != NULL) {
+		log_rings = ring->next;
+		aosl_free (ring);
+	}
+
+	log_shared_ring = NULL;
+
+#if defined(K_THREAD_LOCAL)
+	log_gen++;
+#else
+	k_tls_key_delete (log_ring_key);
+	log_ring_key = -1;
+#endif
+	k_cond_destroy (&log_cond);
+	k_lock_destroy (&log_shared_lock);
+	k_lock_destroy (&log_drain_lock);
+	k_lock_destroy (&log_lock);
+}
+
+void k_vlog_sync (int level, const char *fmt, va_list args)
+{
+	if (vlog_func_p != NULL && level <= aosl_log_level)
+		vlog_func_p (level, fmt, args);
+}
+
 static inline void ____vlog (int level, const char *fmt, va_list args)
 {
 	if (vlog_func_p != NULL && level <= aosl_log_level) {
+		if (log_async) {
+			struct log_ring *ring;
+
+			if (__log_thread_ours ()) {
+				ring = __log_ring_get ();
+				if (ring != NULL) {
+					__log_enqueue (ring, level, fmt, args);
+					return;
+				}
+			} else {
+				ring = __log_shared_ring_get ();
+				if (ring != NULL) {
+					k_lock_lock (&log_shared_lock);
+					__log_enqueue (ring, level, fmt, args);
+					k_lock_unlock (&log_shared_lock);
+					return;
+				}
+			}
+		}
+
 		vlog_func_p (level, fmt, args);
 	}
 }
@@ -24,6 +24,7 @@
 #include <kernel/timer.h>
 #include <kernel/iofd.h>
 #include <kernel/mp_queue.h>
+#include <kernel/log.h>
 
 #include <kernel/bitmap.h>
 #include <kernel/atomic.h>
@@ -42,8 +43,8 @@ static uint16_t __mpqobj_life_id = 1;
 
 static uintptr_t __mpq_count = 0;
 
-#if defined(__linux__) || defined(__APPLE__)
-__thread struct mp_queue *__this_q;
+#if defined(K_THREAD_LOCAL)
+K_THREAD_LOCAL struct mp_queue *__this_q;
 struct mp_queue *__get_this_mpq (void)
 {
 	return __this_q;
@@ -56,9 +57,31 @@ struct mp_queue *__get_this_mpq (void)
 }
 #endif
 
+/**
+ * The recycling cache of the parked queues: a queue created by __mpq_create
+ * parks its thread, multiplexer and wakeup fds here after it was destroyed,
+ * instead of tearing all of them down, and a later __mpq_create with the
+ * same priority, stack size and wakeup type takes a parked one over, which
+ * saves the thread creating and the multiplexer initializing. A parked queue
+ * exits by itself after staying in the cache for MPQ_PARK_IDLE_MS.
+ **/
+#define MPQ_PARK_MAX_DEFAULT 8
+#define MPQ_PARK_IDLE_MS (30 * 1000)
+
+static k_lock_t mpq_park_lock;
+static struct mp_queue *mpq_park_head = NULL;
+static int mpq_park_count = 0;
+static int mpq_park_max = MPQ_PARK_MAX_DEFAULT;
+
+/* the parked threads not taken over yet, including the exiting ones */
+static atomic_t mpq_park_threads = 0;
+
+static void __mpq_park_flush (int max, int wait);
+
 static void mpq_init (void)
 {
 	k_rwlock_init (&mpq_table_lock);
+	k_lock_init (&mpq_park_lock);
 
 	mpq_id_pool_bits = bitmap_create(STATIC_MPQ_ID_POOL_SIZE);
 	mpq_table = (struct mp_queue **)aosl_malloc_impl (sizeof (struct mp_queue *) * STATIC_MPQ_ID_POOL_SIZE);
@@ -68,7 +91,7 @@ static void mpq_init (void)
 	mpq_table_size = STATIC_MPQ_ID_POOL_SIZE;
 	memset (mpq_table, 0, sizeof (struct mp_queue *) * mpq_table_size);
 
-#if !defined(__linux__) && !defined(__APPLE__)
+#if !defined(K_THREAD_LOCAL)
 	if (k_tls_key_create (&__this_q_key) != 0)
 		abort ();
 #endif
@@ -76,6 +99,9 @@ static void mpq_init (void)
 
 static void mpq_fini (void)
 {
+	/* the parked threads must be gone before the world is destroyed */
+	__mpq_park_flush (0, 1);
+
 	if (mpq_id_pool_bits) {
 		bitmap_destroy (mpq_id_pool_bits);
 		mpq_id_pool_bits = NULL;
@@ -92,6 +118,7 @@ static void mpq_fini (void)
 	}
 
 	k_rwlock_destroy (&mpq_table_lock);
+	k_lock_destroy (&mpq_park_lock);
 }
 
 #define MPQ_ID_POOL_MAX_SIZE 2048
@@ -366,13 +393,108 @@ static __inline__ void __free_fo (struct q_func_obj *fo)
 	aosl_free ((void *)fo);
 }
 
-#define FO_EXECUTED (void *)(uintptr_t)0x99
+/* the optional attributes of a queued function, NULL for the defaults */
+struct q_func_opts {
+	int pri;
+	aosl_ts_t deadline;
+	int keyed;
+	uintptr_t key;
+};
+
+static const struct q_func_opts default_opts = {
+	.pri = AOSL_MPQ_PRI_NORMAL,
+	.deadline = 0,
+	.keyed = 0,
+	.key = 0,
+};
+
+static __inline__ struct q_func_obj **__key_bucket (struct mp_queue *q, uintptr_t key)
+{
+	return &q->keys_hash [((uint32_t)key * 2654435761u) >> (32 - MPQ_KEYS_HASH_BITS)];
+}
+
+static void __key_unlink (struct mp_queue *q, struct q_func_obj *fo)
+{
+	struct q_func_obj **pp;
+
+	for (pp = __key_bucket (q, fo->key); *pp != NULL; pp = &(*pp)->key_next) {
+		if (*pp == fo) {
+			*pp = fo->key_next;
+			break;
+		}
+	}
+
+	fo->key_state = FO_KEY_NONE;
+}
+
+/**
+ * Coalesce the keyed fo with the pending one of the same key, with the
+ * queue lock held. If the pending one is the same function with the same
+ * args size in the same lane, then just swap the args, and the fo with
+ * the old args goes to the stale list for freeing by the queue thread,
+ * return 1 for this case. Otherwise, the pending one is marked superseded
+ * and would be freed only when popped, and the caller should queue the
+ * fo then, in its own lane. Either way, the replaced call is only invoked
+ * for freeing without the done notification, like an expired one.
+ **/
+static int __coalesce_f (struct mp_queue *q, struct q_func_obj *fo)
+{
+	struct q_func_obj *old;
+
+	for (old = *__key_bucket (q, fo->key); old != NULL; old = old->key_next) {
+		if (old->key == fo->key)
+			break;
+	}
+
+	if (old == NULL)
+		return 0;
+
+	if (old->f == fo->f && old->argc == fo->argc && old->pri == fo->pri) {
+		size_t len = (fo->argc & ARGC_TYPE_DATA_LEN) ? (size_t)(fo->argc & ~ARGC_TYPE_DATA_LEN) : sizeof (uintptr_t) * fo->argc;
+		uint8_t *a = (uint8_t *)old->argv;
+		uint8_t *b = (uint8_t *)fo->argv;
+		const char *f_name;
+		aosl_mpq_t done_qid;
+		aosl_ref_t ref;
+		size_t i;
+
+		for (i = 0; i < len; i++) {
+			uint8_t t = a [i];
+			a [i] = b [i];
+			b [i] = t;
+		}
+
+		f_name = old->f_name;
+		old->f_name = fo->f_name;
+		fo->f_name = f_name;
+
+		done_qid = old->done_qid;
+		old->done_qid = fo->done_qid;
+		fo->done_qid = done_qid;
+
+		ref = old->ref;
+		old->ref = fo->ref;
+		fo->ref = ref;
+
+		old->deadline = fo->deadline;
+
+		fo->key_state = FO_KEY_NONE;
+		fo->next = q->stale;
+		q->stale = fo;
+		return 1;
+	}
+
+	__key_unlink (q, old);
+	old->key_state = FO_KEY_SUPERSEDED;
+	return 0;
+}
 
 static int ____add_f (struct mp_queue *q, int no_fail, int sync, aosl_mpq_t done_qid, aosl_ref_t ref,
-								int type_argv, const char *f_name, void *f, size_t len, void *data)
+					const struct q_func_opts *opts, int type_argv, const char *f_name, void *f, size_t len, void *data)
 {
+	struct mpq_lane *lane;
 	struct q_func_obj *fo;
-	k_sync_t sync_obj;
+	k_completion_t *sync_obj = NULL;
 	size_t extra_size;
 	struct mp_queue *this_q;
 	int err;
@@ -400,6 +522,14 @@ static int ____add_f (struct mp_queue *q, int no_fail, int sync, aosl_mpq_t done
 
 	fo->done_qid = done_qid;
 	fo->ref = ref;
+	if (opts == NULL)
+		opts = &default_opts;
+
+	lane = &q->lanes [opts->pri];
+	fo->deadline = opts->deadline;
+	fo->pri = opts->pri;
+	fo->key = opts->key;
+	fo->key_state = FO_KEY_NONE;
 	fo->f_name = aosl_strdup (f_name);
 	fo->f = (aosl_mpq_func_argv_t)f;
 	fo->argc = (uintptr_t)(type_argv ? (len / sizeof (uintptr_t)) : (len | ARGC_TYPE_DATA_LEN));
@@ -413,10 +543,8 @@ static int ____add_f (struct mp_queue *q, int no_fail, int sync, aosl_mpq_t done
 		 **/
 		fo->argv = (uintptr_t *)data;
 
-		k_lock_init (&sync_obj.mutex);
-		k_cond_init (&sync_obj.cond);
-		sync_obj.result = NULL;
-		fo->sync_obj = &sync_obj;
+		sync_obj = k_completion_get ();
+		fo->sync_obj = sync_obj;
 	} else {
 		fo->argv = (uintptr_t *)(fo + 1);
 		if (len > 0)
@@ -429,36 +557,46 @@ static int ____add_f (struct mp_queue *q, int no_fail, int sync, aosl_mpq_t done
 
 	k_lock_lock (&q->lock);
 	for (;;) {
+		if (opts->keyed && __coalesce_f (q, fo)) {
+			k_lock_unlock (&q->lock);
+			return 0;
+		}
+
 		if (no_fail || atomic_read (&q->count) < q->q_max) {
-			/* Queue mode, add to tail. */
+			if (opts->keyed) {
+				struct q_func_obj **bucket = __key_bucket (q, fo->key);
+				fo->key_next = *bucket;
+				*bucket = fo;
+				fo->key_state = FO_KEY_PENDING;
+			}
+
+			/* Queue mode, add to tail of the lane. */
 			fo->next = NULL;
-			if (q->tail != NULL) {
-				q->tail->next = fo;
+			if (lane->tail != NULL) {
+				lane->tail->next = fo;
 			} else {
-				q->head = fo;
+				lane->head = fo;
 			}
-			q->tail = fo;
+			lane->tail = fo;
+			lane->count++;
 
 			fo->queued_ts = aosl_tick_now ();
+			fo->queued_us = aosl_tick_us ();
 			atomic_inc (&q->count);
+			if ((uint32_t)atomic_read (&q->count) > q->stats.data.depth_max)
+				q->stats.data.depth_max = (uint32_t)atomic_read (&q->count);
 			k_lock_unlock (&q->lock);
 
 			if (q != this_q) {
 				mp_kick_q (q);
+				/* the q might be waiting to be idle for destroying */
+				if (atomic_read (&mpq_idle_waits) != 0)
+					__mpq_idle_wake (q);
 			}
 
 			if (sync) {
-				k_lock_lock (&sync_obj.mutex);
-				/**
-				 * Must consider the case of waking up by signal, so
-				 * a 'while' rather than 'if' employed here.
-				 **/
-				while (sync_obj.result != FO_EXECUTED)
-					k_cond_wait (&sync_obj.cond, &sync_obj.mutex);
-				k_lock_unlock (&sync_obj.mutex);
-
-				k_lock_destroy (&sync_obj.mutex);
-				k_cond_destroy (&sync_obj.cond);
+				k_completion_wait (sync_obj);
+				k_completion_put (sync_obj);
 			}
 
 			return 0;
@@ -487,18 +625,21 @@ static int ____add_f (struct mp_queue *q, int no_fail, int sync, aosl_mpq_t done
 
 	k_lock_unlock (&q->lock);
 	__free_fo (fo);
+	if (sync_obj != NULL)
+		k_completion_put (sync_obj);
+
 	return err;
 }
 
 int __mpq_queue_no_fail_argv (struct mp_queue *q, aosl_mpq_t done_qid, aosl_ref_t ref, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, uintptr_t *argv)
 {
-	____add_f (q, 1 /* no fail, ignore count */, 0, done_qid, ref, 1, f_name, f, sizeof (uintptr_t) * argc, argv);
+	____add_f (q, 1 /* no fail, ignore count */, 0, done_qid, ref, NULL, 1, f_name, f, sizeof (uintptr_t) * argc, argv);
 	return 0;
 }
 
 int __mpq_queue_no_fail_data (struct mp_queue *q, aosl_mpq_t done_qid, aosl_ref_t ref, const char * f_name, aosl_mpq_func_data_t f, size_t len, void *data)
 {
-	____add_f (q, 1 /* no fail, ignore count */, 0, done_qid, ref, 0, f_name, f, len, data);
+	____add_f (q, 1 /* no fail, ignore count */, 0, done_qid, ref, NULL, 0, f_name, f, len, data);
 	return 0;
 }
 
@@ -506,7 +647,7 @@ int mpq_queue_no_fail_argv (aosl_mpq_t tq, aosl_mpq_t dq, aosl_ref_t ref, const
 {
 	struct mp_queue *q = __mpq_get (tq);
 	if (q != NULL) {
-		____add_f (q, 1 /* no fail, ignore count */, 0, dq, ref, 1, f_name, f, sizeof (uintptr_t) * argc, argv);
+		____add_f (q, 1 /* no fail, ignore count */, 0, dq, ref, NULL, 1, f_name, f, sizeof (uintptr_t) * argc, argv);
 		__mpq_put (q);
 		return 0;
 	}
@@ -639,9 +780,9 @@ static __inline__ void __invoke_f (struct mp_queue *q, aosl_mpq_t done_qid, aosl
 		struct mp_queue *done_q = __mpq_get (done_qid);
 		if (done_q != NULL) {
 			if (!(argc & ARGC_TYPE_DATA_LEN)) {
-				____add_f (done_q, 1 /* no fail, ignore count */, 0, AOSL_MPQ_INVALID, ref, 1, f_name, f, sizeof (uintptr_t) * argc, argv);
+				____add_f (done_q, 1 /* no fail, ignore count */, 0, AOSL_MPQ_INVALID, ref, NULL, 1, f_name, f, sizeof (uintptr_t) * argc, argv);
 			} else {
-				____add_f (done_q, 1 /* no fail, ignore count */, 0, AOSL_MPQ_INVALID, ref, 0, f_name, f, (size_t)(argc & ~ARGC_TYPE_DATA_LEN), argv);
+				____add_f (done_q, 1 /* no fail, ignore count */, 0, AOSL_MPQ_INVALID, ref, NULL, 0, f_name, f, (size_t)(argc & ~ARGC_TYPE_DATA_LEN), argv);
 			}
 			__mpq_put (done_q);
 		} else {
@@ -652,51 +793,166 @@ static __inline__ void __invoke_f (struct mp_queue *q, aosl_mpq_t done_qid, aosl
 
 static __inline__ void __process_fo (struct mp_queue *q, struct q_func_obj *fo)
 {
-	k_sync_t *sync_obj = fo->sync_obj;
+	k_completion_t *sync_obj = fo->sync_obj;
+	aosl_ts_t start_us = aosl_tick_us ();
 
-	__invoke_f (q, fo->done_qid, fo->ref, fo->f_name, fo->f, &fo->queued_ts, fo->argc, fo->argv);
+	if (fo->key_state == FO_KEY_SUPERSEDED) {
+		/* a newer one with the same key has been queued */
+		q_invoke_f (q, AOSL_MPQ_INVALID, AOSL_FREE_ONLY_OBJ, fo->f_name, fo->f, &fo->queued_ts, fo->argc, fo->argv);
+		mpq_stats_coalesced (q);
+	} else if (fo->deadline != 0 && time_after (aosl_tick_now (), fo->deadline)) {
+		/**
+		 * Running a function later than its deadline does not make
+		 * sense, so just let it free the relative resources, and no
+		 * done notification for this case, the same as the ref has
+		 * been destroyed.
+		 **/
+		q_invoke_f (q, AOSL_MPQ_INVALID, AOSL_FREE_ONLY_OBJ, fo->f_name, fo->f, &fo->queued_ts, fo->argc, fo->argv);
+		mpq_stats_expired (q);
+	} else {
+		__invoke_f (q, fo->done_qid, fo->ref, fo->f_name, fo->f, &fo->queued_ts, fo->argc, fo->argv);
+		mpq_stats_func (q, fo->f_name, start_us - fo->queued_us, aosl_tick_us () - start_us);
+	}
 	mpq_stack_fini (q->q_stack_curr);
 	__free_fo (fo);
 	/* Decrease the queued count before possible wakeup for sync call */
 	atomic_dec (&q->count);
 
-	if (sync_obj != NULL) {
-		k_lock_lock (&sync_obj->mutex);
-		sync_obj->result = FO_EXECUTED;
-		k_cond_signal (&sync_obj->cond);
-		k_lock_unlock (&sync_obj->mutex);
+	if (sync_obj != NULL)
+		k_completion_done (sync_obj);
+}
+
+static void __init_lanes (struct mp_queue *q)
+{
+	static const int weights [AOSL_MPQ_PRI_COUNT] = AOSL_MPQ_PRI_WEIGHTS_DEFAULT;
+	int i;
+
+	for (i = 0; i < AOSL_MPQ_PRI_COUNT; i++) {
+		struct mpq_lane *lane = &q->lanes [i];
+		lane->head = NULL;
+		lane->tail = NULL;
+		lane->count = 0;
+		lane->weight = weights [i];
+		lane->credit = weights [i];
+	}
+}
+
+/**
+ * Pick the next function to run with the queue lock held: the highest
+ * lane which still has credits in this round wins, and all the lanes
+ * get their credits refilled by weights once no queued lane has any.
+ **/
+static struct q_func_obj *__lanes_pop (struct mp_queue *q)
+{
+	struct q_func_obj *fo;
+	struct mpq_lane *lane;
+	int refilled = 0;
+	int i;
+
+	for (;;) {
+		for (i = AOSL_MPQ_PRI_COUNT - 1; i >= 0; i--) {
+			lane = &q->lanes [i];
+			if (lane->head != NULL && lane->credit > 0)
+				break;
+		}
+
+		if (i >= 0)
+			break;
+
+		if (refilled)
+			return NULL;
+
+		for (i = 0; i < AOSL_MPQ_PRI_COUNT; i++)
+			q->lanes [i].credit = q->lanes [i].weight;
+
+		refilled = 1;
+	}
+
+	fo = lane->head;
+	lane->head = fo->next;
+	if (lane->head == NULL)
+		lane->tail = NULL;
+
+	if (fo->key_state == FO_KEY_PENDING)
+		__key_unlink (q, fo);
+
+	lane->count--;
+	lane->credit--;
+	return fo;
+}
+
+static void __free_stale_fos (struct mp_queue *q, struct q_func_obj *stale)
+{
+	while (stale != NULL) {
+		struct q_func_obj *fo = stale;
+		stale = stale->next;
+
+		q_invoke_f (q, AOSL_MPQ_INVALID, AOSL_FREE_ONLY_OBJ, fo->f_name, fo->f, &fo->queued_ts, fo->argc, fo->argv);
+		mpq_stack_fini (q->q_stack_curr);
+		mpq_stats_coalesced (q);
+		__free_fo (fo);
 	}
 }
 
-static int __check_and_call_funcs (struct mp_queue *q)
+/**
+ * Run the queued functions, stop at max functions if max > 0, or at the
+ * aosl_tick_us time deadline_us if deadline_us != 0.
+ **/
+static int __check_and_call_funcs (struct mp_queue *q, int max, aosl_ts_t deadline_us)
 {
 	int count = 0;
 
 	/**
 	 * No memory access fence needed here although it is
 	 * lockless here, because we hold a lock when writing
-	 * this list.
+	 * the lanes.
 	 **/
-	if (q->head != NULL) {
-		struct q_func_obj *head;
+	if (atomic_read (&q->count) > 0) {
+		struct q_func_obj *fo;
+		/**
+		 * Only run the functions queued before this round, the
+		 * ones queued by the running functions are left to the
+		 * next round, so the timers and fds would get a chance.
+		 **/
+		int limit = atomic_read (&q->count);
+		int budget_out = 0;
+
+		struct q_func_obj *stale;
 
 		k_lock_lock (&q->lock);
-		head = q->head;
-		q->head = NULL;
-		q->tail = NULL;
+		fo = __lanes_pop (q);
+		stale = q->stale;
+		q->stale = NULL;
 		k_lock_unlock (&q->lock);
 
-		while (head != NULL) {
-			struct q_func_obj *fo = head;
-			head = head->next;
+		while (fo != NULL) {
+			/**
+			 * The stale ones were replaced by the pending ones, so
+			 * they always show up before the last pending one got
+			 * popped, then free them here.
+			 **/
+			__free_stale_fos (q, stale);
 			__process_fo (q, fo);
 			count++;
 
+			if (count < limit) {
+				if (count == max || (deadline_us != 0 && (int64_t)(aosl_tick_us () - deadline_us) >= 0))
+					budget_out = 1;
+			}
+
 			k_lock_lock (&q->lock);
 			if (q->wait_q_count > 0)
 				k_cond_signal (&q->wait_q);
+			fo = (count < limit && !budget_out) ? __lanes_pop (q) : NULL;
+			stale = q->stale;
+			q->stale = NULL;
 			k_lock_unlock (&q->lock);
 		}
+
+		__free_stale_fos (q, stale);
+
+		if (budget_out)
+			mpq_stats_budget_hit (q, AOSL_MPQ_SRC_FUNCS);
 	}
 
 	return count;
@@ -708,7 +964,7 @@ static __inline__ intptr_t mpq_max_wait_time (struct mp_queue *q)
 	struct timer_node *timer;
 	struct timer_base *base = &q->timer_base;
 
-	timer = base->first;
+	timer = timer_base_first (base);
 	if (timer != NULL) {
 		msecs = (intptr_t)(timer->expire_time - aosl_tick_now ());
 		if (msecs < 0)
@@ -718,19 +974,19 @@ static __inline__ intptr_t mpq_max_wait_time (struct mp_queue *q)
 	return msecs;
 }
 
-static __inline__ void __free_q_obj (struct mp_queue *q)
+static __inline__ void __free_q_name (struct mp_queue *q)
 {
 	if (q->q_name != NULL) {
 		AOSL_LOG_CRT("q_name=%s exit...", q->q_name);
 		aosl_free ((void *)q->q_name);
+		q->q_name = NULL;
 	}
-
-	aosl_free ((void *)q);
 }
 
 static aosl_mpq_t aosl_main_qid = AOSL_MPQ_INVALID;
 
-static void __q_destroy (struct mp_queue *q)
+/* release the resources of one queue life, the thread and multiplexer are kept */
+static void __q_release (struct mp_queue *q)
 {
 	int mpq_id = get_mpq_id (q->qid);
 
@@ -740,13 +996,10 @@ static void __q_destroy (struct mp_queue *q)
 	/* finish the timers */
 	mpq_fini_timers (q);
 
-	os_mp_fini (q);
-
-	k_lock_destroy (&q->lock);
-	k_cond_destroy (&q->wait_q);
-
-	if (q->ipv6_prefix_96 != NULL)
+	if (q->ipv6_prefix_96 != NULL) {
 		aosl_free (q->ipv6_prefix_96);
+		q->ipv6_prefix_96 = NULL;
+	}
 
 	__put_unused_mpq_id (mpq_id - MIN_MPQ_ID);
 	if (q->qid == aosl_main_qid) {
@@ -754,29 +1007,58 @@ static void __q_destroy (struct mp_queue *q)
 		aosl_shrink_resources ();
 	}
 
-	__free_q_obj (q);
+	__free_q_name (q);
+}
+
+static void __q_free (struct mp_queue *q)
+{
+	os_mp_fini (q);
+
+	k_lock_destroy (&q->lock);
+	k_cond_destroy (&q->wait_q);
+
+	__free_q_name (q);
+	aosl_free ((void *)q);
 }
 
 static __inline__ void __set_this_mpq (struct mp_queue *q)
 {
-#if defined(__linux__) || defined(__APPLE__)
+#if defined(K_THREAD_LOCAL)
 	__this_q = q;
 #else
 	k_tls_key_set (__this_q_key, q);
 #endif
 }
 
+static __inline__ aosl_ts_t __budget_deadline (struct mp_queue *q)
+{
+	int budget_us = q->budget_us;
+
+	if (budget_us > 0)
+		return aosl_tick_us () + (aosl_ts_t)budget_us;
+
+	return 0;
+}
+
+/**
+ * The functions, the timers and the fds are served by turns, each one
+ * stops at its budget of the iteration and leaves the rest to the next
+ * one, and the poll does not sleep while any work is left over.
+ **/
 static void __mp_queue_poll_loop (struct mp_queue *q)
 {
+	aosl_ts_t polled_us = aosl_tick_us ();
+
 	for (;;) {
 		int err;
 		intptr_t timeo;
 
-		err = __check_and_call_funcs (q);
+		mpq_stats_check_reset (q);
+		err = __check_and_call_funcs (q, q->budget_funcs, __budget_deadline (q));
 		if (err > 0)
 			q->exec_funcs_count += err;
 
-		err = __check_and_run_timers (q);
+		err = __check_and_run_timers (q, __budget_deadline (q));
 		if (err > 0)
 			q->exec_timers_count += err;
 
@@ -785,6 +1067,9 @@ static void __mp_queue_poll_loop (struct mp_queue *q)
 			break;
 		}
 
+		if (q->iofd_count > 0)
+			mpq_stats_fds_starve (q, aosl_tick_us () - polled_us);
+
 		timeo = mpq_max_wait_time (q);
 		err = os_poll_dispatch (q, timeo);
 		if (err < 0)
@@ -792,23 +1077,117 @@ static void __mp_queue_poll_loop (struct mp_queue *q)
 
 		if (err > 0)
 			q->exec_fds_count += err;
+
+		polled_us = aosl_tick_us ();
 	}
 }
 
 #define __MPQ_DESTROY_DONE ((void *)(uintptr_t)456)
 
-static void __q_wait_destroy (struct mp_queue *q, aosl_mpq_fini_t fini, void *arg)
+/**
+ * The destroying thread waits the other references of its queue to be
+ * put on a completion, which is woken up by the putting of the usage
+ * to 1 or by the queuing of a function to the queue. The waits are in
+ * a global list matched by the queue pointer, so the waking never
+ * touches a queue object which might have been freed just now.
+ **/
+struct q_idle_wait {
+	struct aosl_list_head node;
+	struct mp_queue *q;
+	k_completion_t *c;
+};
+
+atomic_t mpq_idle_waits = 0;
+static k_static_lock_t mpq_idle_lock = K_STATIC_LOCK_INIT;
+static AOSL_DEFINE_LIST_HEAD (mpq_idle_list);
+
+void __mpq_idle_wake (struct mp_queue *q)
+{
+	struct q_idle_wait *w;
+	k_completion_t *c = NULL;
+
+	k_static_lock_lock (&mpq_idle_lock);
+	aosl_list_for_each_entry_t (struct q_idle_wait, w, &mpq_idle_list, node) {
+		if (w->q == q) {
+			aosl_list_del_init (&w->node);
+			atomic_dec (&mpq_idle_waits);
+			c = w->c;
+			break;
+		}
+	}
+	k_static_lock_unlock (&mpq_idle_lock);
+
+	if (c != NULL)
+		k_completion_done (c);
+}
+
+static void __q_wait_idle (struct mp_queue *q)
+{
+	struct q_idle_wait w;
+	int woken;
+
+	w.q = q;
+	for (;;) {
+		/* check and call the already queued funcs */
+		if (__check_and_call_funcs (q, 0, 0) > 0)
+			continue;
+
+		if (atomic_read (&q->usage) <= 1)
+			break;
+
+		w.c = k_completion_get ();
+		k_static_lock_lock (&mpq_idle_lock);
+		aosl_list_add_tail (&w.node, &mpq_idle_list);
+		atomic_inc (&mpq_idle_waits);
+		k_static_lock_unlock (&mpq_idle_lock);
+
+		/* check again after being visible to the wakers */
+		if (atomic_read (&q->usage) > 1 && atomic_read (&q->count) == 0) {
+			woken = 1;
+		} else {
+			k_static_lock_lock (&mpq_idle_lock);
+			woken = aosl_list_empty (&w.node);
+			if (!woken) {
+				aosl_list_del_init (&w.node);
+				atomic_dec (&mpq_idle_waits);
+			}
+			k_static_lock_unlock (&mpq_idle_lock);
+		}
+
+		/* consume the completion if a waker has taken it */
+		if (woken)
+			k_completion_wait (w.c);
+
+		k_completion_put (w.c);
+	}
+}
+
+static void __q_wake_destroy_waiters (struct q_wait_entry *wait)
+{
+	while (wait != NULL) {
+		struct q_wait_entry *next = wait->next;
+
+		k_lock_lock (&wait->sync.mutex);
+		wait->sync.result = __MPQ_DESTROY_DONE;
+		k_cond_broadcast (&wait->sync.cond);
+		k_lock_unlock (&wait->sync.mutex);
+
+		wait = next;
+	}
+}
+
+/**
+ * Wait the queue to be idle and release it, return the destroy
+ * waiters for waking up after the queue object was disposed.
+ **/
+static struct q_wait_entry *__q_wait_destroy (struct mp_queue *q, aosl_mpq_fini_t fini, void *arg)
 {
 	struct q_wait_entry *wait;
 
 	/* Uninstall the qid here anyway */
 	__mpq_id_uninstall (get_mpq_id (q->qid), q);
 
-	while (atomic_read (&q->usage) > 1) {
-		/* check and call the already queued funcs */
-		if (__check_and_call_funcs (q) == 0)
-			aosl_msleep (1);
-	}
+	__q_wait_idle (q);
 
 	/**
 	 * Check and call the already queued funcs again for the racing
@@ -822,7 +1201,7 @@ static void __q_wait_destroy (struct mp_queue *q, aosl_mpq_fini_t fini, void *ar
 		 * risk of dead loop, but this should be the responsibility
 		 * of applications to avoid these conditions.
 		 **/
-		if (__check_and_call_funcs (q) == 0)
+		if (__check_and_call_funcs (q, 0, 0) == 0)
 			break;
 	}
 
@@ -838,101 +1217,117 @@ static void __q_wait_destroy (struct mp_queue *q, aosl_mpq_fini_t fini, void *ar
 	 **/
 	wait = q->destroy_wait_head;
 
-	__q_destroy (q);
-
-	while (wait != NULL) {
-		struct q_wait_entry *next = wait->next;
-
-		k_lock_lock (&wait->sync.mutex);
-		wait->sync.result = __MPQ_DESTROY_DONE;
-		k_cond_broadcast (&wait->sync.cond);
-		k_lock_unlock (&wait->sync.mutex);
-
-		wait = next;
-	}
+	__q_release (q);
+	return wait;
 }
 
-static struct mp_queue *__q_create (const char *name, int flags, int max)
+/* allocate a queue object with its multiplexer, kept for all the lives */
+static struct mp_queue *__q_alloc (int flags)
 {
 	struct mp_queue *q;
 	q = (struct mp_queue *)aosl_malloc (sizeof *q);
 	if (q != NULL) {
-		int err;
-		aosl_ts_t tick_us;
-
-		q->q_name = aosl_strdup (name);
+		q->q_name = NULL;
 		q->q_flags = flags;
-		q->q_max = max;
-		q->ipv6_prefix_96 = NULL;
-		q->need_kicking = 0;
-
 		if (os_mp_init (q) < 0) {
-			err = -aosl_errno;
-			goto __free_q;
+			int err = aosl_errno;
+			aosl_free ((void *)q);
+			aosl_errno = err;
+			return NULL;
 		}
 
-		mpq_init_iofds (q);
-		mpq_init_timers (q);
-
-		q->thrd = k_thread_self ();
-		q->terminated = 0;
-		q->exiting = 0;
-
 		k_lock_init (&q->lock);
 		k_cond_init (&q->wait_q);
-		q->wait_q_count = 0;
 
-		q->head = NULL;
-		q->tail = NULL;
-		atomic_set (&q->count, 0);
-		atomic_set (&q->kick_q_count, 0);
+		q->park_next = NULL;
+		q->park_args = NULL;
+		q->park_pri = AOSL_THRD_PRI_DEFAULT;
+		q->park_stack_size = 0;
+		q->parked = 0;
+	}
+
+	return q;
+}
 
-		q->run_func_done_qid = AOSL_MPQ_INVALID;
-		q->run_func_refobj = NULL;
-		q->run_func_argc = 0;
-		q->run_func_argv = NULL;
+/* start a new life of the queue object */
+static int __q_init (struct mp_queue *q, const char *name, int flags, int max)
+{
+	int err;
+	aosl_ts_t tick_us;
 
-		q->q_arg = NULL;
+	q->q_name = aosl_strdup (name);
+	q->q_flags = flags;
+	q->q_max = max;
+	q->budget_funcs = 0;
+	q->budget_us = 0;
+	q->budget_events = 0;
+	q->ipv6_prefix_96 = NULL;
+	q->need_kicking = 0;
 
-		mpq_stack_init (&q->q_stack_base, AOSL_STACK_INVALID);
-		q->q_stack_curr = &q->q_stack_base;
+	mpq_init_iofds (q);
+	mpq_init_timers (q);
 
-		q->exec_funcs_count = 0;
-		q->exec_timers_count = 0;
-		q->exec_fds_count = 0;
+	q->thrd = k_thread_self ();
+	q->terminated = 0;
+	q->exiting = 0;
 
-		tick_us = aosl_tick_us ();
-		q->last_idle_ts = tick_us;
-		q->last_wake_ts = tick_us;
+	q->wait_q_count = 0;
 
-		q->last_load_us = 0;
-		q->last_idle_us = 0;
+	__init_lanes (q);
+	memset (q->keys_hash, 0, sizeof q->keys_hash);
+	q->stale = NULL;
+	atomic_set (&q->count, 0);
+	atomic_set (&q->kick_q_count, 0);
 
-		atomic_set (&q->usage, 1);
-		q->destroy_wait_head = NULL;
-		q->destroy_wait_tail = NULL;
+	q->run_func_done_qid = AOSL_MPQ_INVALID;
+	q->run_func_refobj = NULL;
+	q->run_func_argc = 0;
+	q->run_func_argv = NULL;
 
-		err = get_unused_mpq_id ();
-		if (err < 0)
-			goto __err_alloc_mpq_id;
+	q->q_arg = NULL;
+
+	mpq_stack_init (&q->q_stack_base, AOSL_STACK_INVALID);
+	q->q_stack_curr = &q->q_stack_base;
 
-		__mpq_id_install (err, q);
+	q->exec_funcs_count = 0;
+	q->exec_timers_count = 0;
+	q->exec_fds_count = 0;
+	mpq_stats_init (q);
 
-		return q;
+	tick_us = aosl_tick_us ();
+	q->last_idle_ts = tick_us;
+	q->last_wake_ts = tick_us;
 
-__err_alloc_mpq_id:
-		k_lock_destroy (&q->lock);
-		k_cond_destroy (&q->wait_q);
+	q->last_load_us = 0;
+	q->last_idle_us = 0;
 
-		os_mp_fini (q);
+	atomic_set (&q->usage, 1);
+	q->destroy_wait_head = NULL;
+	q->destroy_wait_tail = NULL;
 
-__free_q:
-		__free_q_obj (q);
+	err = get_unused_mpq_id ();
+	if (err < 0) {
+		__free_q_name (q);
 		aosl_errno = -err;
+		return -1;
+	}
+
+	__mpq_id_install (err, q);
+	return 0;
+}
+
+static struct mp_queue *__q_create (const char *name, int flags, int max)
+{
+	struct mp_queue *q = __q_alloc (flags);
+
+	if (q != NULL && __q_init (q, name, flags, max) < 0) {
+		int err = aosl_errno;
+		__q_free (q);
+		aosl_errno = err;
 		return NULL;
 	}
 
-	return NULL;
+	return q;
 }
 
 struct __mpq_create_args {
@@ -941,59 +1336,255 @@ struct __mpq_create_args {
 	aosl_mpq_fini_t fini;
 	void *arg;
 	int flags;
+	int pri;
+	int stack_size;
 	int q_max;
 	k_sync_t *sync;
 	int err;
 };
 
-static void mpq_thread_entry (void *param)
+#define __MPQ_PARK_EXIT ((struct __mpq_create_args *)(uintptr_t)789)
+
+static __inline__ int __park_match (struct mp_queue *q, int flags, int pri, int stack_size)
 {
-	struct __mpq_create_args *args = (struct __mpq_create_args *)param;
-	aosl_mpq_fini_t fini = args->fini;
-	void *arg = args->arg;
-	struct mp_queue *q = __q_create (args->name, args->flags, args->q_max);
-	int err = aosl_errno;
+	return q->park_pri == pri && q->park_stack_size == stack_size
+			&& ((q->q_flags ^ flags) & AOSL_MPQ_FLAG_SIGP_EVENT) == 0;
+}
 
-	if (q != NULL) {
-		q->q_arg = arg;
-		__set_this_mpq (q);
+static struct mp_queue *__park_take (int flags, int pri, int stack_size)
+{
+	struct mp_queue *q;
+	struct mp_queue **pp;
+
+	k_lock_lock (&mpq_park_lock);
+	for (pp = &mpq_park_head; (q = *pp) != NULL; pp = &q->park_next) {
+		if (__park_match (q, flags, pri, stack_size)) {
+			*pp = q->park_next;
+			q->parked = 0;
+			mpq_park_count--;
+			atomic_dec (&mpq_park_threads);
+			break;
+		}
+	}
+	k_lock_unlock (&mpq_park_lock);
 
-		/**
-		 * MUST set the stack base before any potential
-		 * call to the user callback functions.
-		 **/
-		q->q_stack_base.id = (aosl_stack_id_t)&q;
-		if (args->init != NULL && args->init (arg) < 0) {
-			err = aosl_errno;
-			q->terminated = 1;
-			q->exiting = 1;
-			__q_wait_destroy (q, fini, arg);
-			q = NULL;
+	return q;
+}
+
+static void __park_wake (struct mp_queue *q, struct __mpq_create_args *args)
+{
+	k_lock_lock (&q->lock);
+	q->park_args = args;
+	k_cond_signal (&q->wait_q);
+	k_lock_unlock (&q->lock);
+}
+
+static void __mpq_park_flush (int max, int wait)
+{
+	struct mp_queue *q;
+	struct mp_queue *list = NULL;
+
+	k_lock_lock (&mpq_park_lock);
+	while (mpq_park_count > max) {
+		q = mpq_park_head;
+		mpq_park_head = q->park_next;
+		q->parked = 0;
+		mpq_park_count--;
+
+		q->park_next = list;
+		list = q;
+	}
+	k_lock_unlock (&mpq_park_lock);
+
+	while ((q = list) != NULL) {
+		/* the q would be freed by its thread after waking up */
+		list = q->park_next;
+		__park_wake (q, __MPQ_PARK_EXIT);
+	}
+
+	if (wait) {
+		while (atomic_read (&mpq_park_threads) > 0)
+			aosl_msleep (1);
+	}
+}
+
+/**
+ * Park the destroyed queue in the recycling cache, wake the destroy
+ * waiters up, and wait to be taken over.
+ * Return value:
+ *     the create args of the new life when taken over;
+ *     NULL when the cache is full, the queue was not parked and
+ *          the destroy waiters are left to the caller;
+ *     __MPQ_PARK_EXIT when the queue should exit from the cache.
+ **/
+static struct __mpq_create_args *__q_park (struct mp_queue *q, struct q_wait_entry *wait)
+{
+	struct __mpq_create_args *args;
+	aosl_ts_t deadline;
+
+	k_lock_lock (&mpq_park_lock);
+	if (mpq_park_count >= mpq_park_max) {
+		k_lock_unlock (&mpq_park_lock);
+		return NULL;
+	}
+
+	/**
+	 * Nobody could kick us any more, so just drain the wakeup
+	 * fd here, and forget the per thread data of the old life
+	 * as if the thread exited.
+	 **/
+	if (!(q->q_flags & AOSL_MPQ_FLAG_SIGP_EVENT))
+		os_drain_sigp (q);
+
+	atomic_set (&q->kick_q_count, 0);
+	q->need_kicking = 0;
+	k_log_thread_exit ();
+	k_tls_thread_exit ();
+
+	q->park_args = NULL;
+	q->parked = 1;
+	q->park_next = mpq_park_head;
+	mpq_park_head = q;
+	mpq_park_count++;
+	atomic_inc (&mpq_park_threads);
+	k_lock_unlock (&mpq_park_lock);
+
+	/* the destroy waiters see the queue recyclable already */
+	__q_wake_destroy_waiters (wait);
+
+	deadline = aosl_tick_ms () + MPQ_PARK_IDLE_MS;
+	for (;;) {
+		k_lock_lock (&q->lock);
+		while (q->park_args == NULL) {
+			intptr_t timeo = (intptr_t)(deadline - aosl_tick_ms ());
+			if (timeo <= 0)
+				break;
+
+			k_cond_timedwait (&q->wait_q, &q->lock, timeo);
 		}
-	} else {
-		/**
-		 * For creating q failed case, we also need to call the
-		 * possible fini function to free potential resources.
-		 **/
-		if (fini != NULL)
-			fini (arg);
+		args = q->park_args;
+		k_lock_unlock (&q->lock);
+
+		if (args != NULL)
+			return args;
+
+		/* idle for too long, leave the cache unless being taken over just now */
+		k_lock_lock (&mpq_park_lock);
+		if (q->parked) {
+			struct mp_queue **pp = &mpq_park_head;
+
+			while (*pp != q)
+				pp = &(*pp)->park_next;
+
+			*pp = q->park_next;
+			q->parked = 0;
+			mpq_park_count--;
+			k_lock_unlock (&mpq_park_lock);
+			return __MPQ_PARK_EXIT;
+		}
+		k_lock_unlock (&mpq_park_lock);
 	}
+}
 
+static void __q_create_done (struct __mpq_create_args *args, struct mp_queue *q, int err)
+{
 	k_lock_lock (&args->sync->mutex);
 	args->sync->result = q;
 	args->err = err;
 	k_cond_signal (&args->sync->cond);
 	k_lock_unlock (&args->sync->mutex);
+}
+
+/* run one life of the queue on this thread, return the destroy waiters */
+static struct q_wait_entry *__q_run (struct mp_queue *q, struct __mpq_create_args *args)
+{
+	aosl_mpq_fini_t fini = args->fini;
+	void *arg = args->arg;
+	struct q_wait_entry *wait;
+	int err;
+
+	if (__q_init (q, args->name, args->flags, args->q_max) < 0) {
+		err = aosl_errno;
 
-	if (q != NULL) {
 		/**
-		 * MUST set the stack base before any potential
-		 * call to the user callback functions.
+		 * For creating q failed case, we also need to call the
+		 * possible fini function to free potential resources.
 		 **/
-		q->q_stack_base.id = (aosl_stack_id_t)&q;
-		__mp_queue_poll_loop (q);
-		__q_wait_destroy (q, fini, arg);
+		if (fini != NULL)
+			fini (arg);
+
+		__q_create_done (args, NULL, err);
+		return NULL;
+	}
+
+	q->q_arg = arg;
+	__set_this_mpq (q);
+
+	/**
+	 * MUST set the stack base before any potential
+	 * call to the user callback functions.
+	 **/
+	q->q_stack_base.id = (aosl_stack_id_t)&q;
+	if (args->init != NULL && args->init (arg) < 0) {
+		err = aosl_errno;
+		q->terminated = 1;
+		q->exiting = 1;
+		wait = __q_wait_destroy (q, fini, arg);
+		__q_create_done (args, NULL, err);
+		return wait;
+	}
+
+	/* the args would be gone after this */
+	__q_create_done (args, q, 0);
+
+	/**
+	 * MUST set the stack base before any potential
+	 * call to the user callback functions.
+	 **/
+	q->q_stack_base.id = (aosl_stack_id_t)&q;
+	__mp_queue_poll_loop (q);
+	return __q_wait_destroy (q, fini, arg);
+}
+
+static void mpq_thread_entry (void *param)
+{
+	struct __mpq_create_args *args = (struct __mpq_create_args *)param;
+	struct mp_queue *q = __q_alloc (args->flags);
+	struct q_wait_entry *wait;
+
+	if (q == NULL) {
+		int err = aosl_errno;
+
+		if (args->fini != NULL)
+			args->fini (args->arg);
+
+		__q_create_done (args, NULL, err);
+		return;
+	}
+
+	q->park_pri = args->pri;
+	q->park_stack_size = args->stack_size;
+
+	for (;;) {
+		wait = __q_run (q, args);
+
+		args = __q_park (q, wait);
+		if (args == NULL) {
+			__q_free (q);
+			__q_wake_destroy_waiters (wait);
+			return;
+		}
+
+		if (args == __MPQ_PARK_EXIT)
+			break;
+
+		/* taken over by a new queue */
+		if (args->name != NULL)
+			k_thread_set_name (args->name);
 	}
+
+	__q_free (q);
+	atomic_dec (&mpq_park_threads);
 }
 
 #define __MPQ_CREATE_INIT ((struct mp_queue *)(uintptr_t)123)
@@ -1002,6 +1593,7 @@ struct mp_queue *__mpq_create (int flags, int pri, int stack_size, int max, cons
 {
 	k_thread_t t;
 	struct __mpq_create_args args;
+	struct mp_queue *q;
 	k_sync_t sync;
 	int err;
 	if (max < 1 || max > MPQ_MAX_SIZE) {
@@ -1009,22 +1601,32 @@ struct mp_queue *__mpq_create (int flags, int pri, int stack_size, int max, cons
 		return NULL;
 	}
 
+	if (stack_size == 0)
+		stack_size = THREAD_STACK_SIZE;
+
 	args.name = name;
 	args.init = init;
 	args.fini = fini;
 	args.arg = arg;
 	args.flags = flags;
+	args.pri = pri;
+	args.stack_size = stack_size;
 	args.q_max = max;
 	k_lock_init (&sync.mutex);
 	k_cond_init (&sync.cond);
 	sync.result = __MPQ_CREATE_INIT;
 	args.sync = &sync;
 
-	err = k_thread_create (&t, name, pri, stack_size, mpq_thread_entry, &args);
-	if (err != 0) {
-		k_lock_destroy (&sync.mutex);
-		k_cond_destroy (&sync.cond);
-		return NULL;
+	q = __park_take (flags, pri, stack_size);
+	if (q != NULL) {
+		__park_wake (q, &args);
+	} else {
+		err = k_thread_create (&t, name, pri, stack_size, mpq_thread_entry, &args);
+		if (err != 0) {
+			k_lock_destroy (&sync.mutex);
+			k_cond_destroy (&sync.cond);
+			return NULL;
+		}
 	}
 
 	k_lock_lock (&sync.mutex);
@@ -1041,6 +1643,22 @@ struct mp_queue *__mpq_create (int flags, int pri, int stack_size, int max, cons
 	return (struct mp_queue *)sync.result;
 }
 
+__export_in_so__ int aosl_mpq_set_park_max (int max)
+{
+	int old;
+
+	k_lock_lock (&mpq_park_lock);
+	old = mpq_park_max;
+	if (max >= 0)
+		mpq_park_max = max;
+	k_lock_unlock (&mpq_park_lock);
+
+	if (max >= 0)
+		__mpq_park_flush (max, 0);
+
+	return old;
+}
+
 static aosl_mpq_t __mpq_create_flags (int flags, int pri, int stack_size, int max, const char *name, aosl_mpq_init_t init, aosl_mpq_fini_t fini, void *arg)
 {
 	struct mp_queue *q;
@@ -1254,7 +1872,7 @@ __export_in_so__ int aosl_mpq_set_q_arg (void *arg)
 }
 
 static int __add_or_invoke_f (struct mp_queue *q, int sync, aosl_mpq_t done_qid, aosl_ref_t ref,
-							int type_argv, const char *f_name, void *f, size_t len, void *data)
+							const struct q_func_opts *opts, int type_argv, const char *f_name, void *f, size_t len, void *data)
 {
 	if (sync && !aosl_mpq_invalid (done_qid)) {
 		abort ();
@@ -1290,7 +1908,7 @@ static int __add_or_invoke_f (struct mp_queue *q, int sync, aosl_mpq_t done_qid,
 		return 0;
 	}
 
-	return ____add_f (q, 0, sync, done_qid, ref, type_argv, f_name, f, len, data);
+	return ____add_f (q, 0, sync, done_qid, ref, opts, type_argv, f_name, f, len, data);
 }
 
 /**
@@ -1299,7 +1917,7 @@ static int __add_or_invoke_f (struct mp_queue *q, int sync, aosl_mpq_t done_qid,
  * it is a compiler special type, and may be various across compilers.
  * Otherwise, we may encounter crashes.
  **/
-static int __add_func_args (struct mp_queue *q, int sync, aosl_mpq_t done_qid, aosl_ref_t ref, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, va_list args)
+static int __add_func_args (struct mp_queue *q, int sync, aosl_mpq_t done_qid, aosl_ref_t ref, const struct q_func_opts *opts, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, va_list args)
 {
 	uintptr_t *argv = NULL;
 
@@ -1316,10 +1934,10 @@ static int __add_func_args (struct mp_queue *q, int sync, aosl_mpq_t done_qid, a
 			argv [l] = va_arg (args, uintptr_t);
 	}
 
-	return_err (__add_or_invoke_f (q, sync, done_qid, ref, 1, f_name, f, argc * sizeof (uintptr_t), (void *)argv));
+	return_err (__add_or_invoke_f (q, sync, done_qid, ref, opts, 1, f_name, f, argc * sizeof (uintptr_t), (void *)argv));
 }
 
-static int __add_func_args_qid (aosl_mpq_t tq, int treat_this, int sync, aosl_mpq_t dq, aosl_ref_t ref, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, va_list args)
+static int __add_func_args_qid (aosl_mpq_t tq, int treat_this, int sync, aosl_mpq_t dq, aosl_ref_t ref, const struct q_func_opts *opts, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, va_list args)
 {
 	int err;
 	struct mp_queue *q;
@@ -1335,7 +1953,7 @@ static int __add_func_args_qid (aosl_mpq_t tq, int treat_this, int sync, aosl_mp
 		return -1;
 	}
 
-	err = __add_func_args (q, sync, dq, ref, f_name, f, argc, args);
+	err = __add_func_args (q, sync, dq, ref, opts, f_name, f, argc, args);
 
 	if (treat_this) {
 		__mpq_put_or_this (q);
@@ -1353,7 +1971,7 @@ static int __add_func_argv (struct mp_queue *q, int sync, aosl_mpq_t done_qid, a
 		return -1;
 	}
 
-	return_err (__add_or_invoke_f (q, sync, done_qid, ref, 1, f_name, f, argc * sizeof (uintptr_t), (void *)argv));
+	return_err (__add_or_invoke_f (q, sync, done_qid, ref, NULL, 1, f_name, f, argc * sizeof (uintptr_t), (void *)argv));
 }
 
 static int __add_func_argv_qid (aosl_mpq_t tq, int treat_this, int sync, aosl_mpq_t dq, aosl_ref_t ref, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, uintptr_t *argv)
@@ -1383,17 +2001,17 @@ static int __add_func_argv_qid (aosl_mpq_t tq, int treat_this, int sync, aosl_mp
 	return err;
 }
 
-static int __add_func_data (struct mp_queue *q, int sync, aosl_mpq_t done_qid, aosl_ref_t ref, const char *f_name, aosl_mpq_func_data_t f, size_t len, void *data)
+static int __add_func_data (struct mp_queue *q, int sync, aosl_mpq_t done_qid, aosl_ref_t ref, const struct q_func_opts *opts, const char *f_name, aosl_mpq_func_data_t f, size_t len, void *data)
 {
 	if (len > MPQ_DATA_LEN_MAX) {
 		aosl_errno = AOSL_EMSGSIZE;
 		return -1;
 	}
 
-	return_err (__add_or_invoke_f (q, sync, done_qid, ref, 0, f_name, f, len, data));
+	return_err (__add_or_invoke_f (q, sync, done_qid, ref, opts, 0, f_name, f, len, data));
 }
 
-static int __add_func_data_qid (aosl_mpq_t tq, int treat_this, int sync, aosl_mpq_t dq, aosl_ref_t ref, const char *f_name, aosl_mpq_func_data_t f, size_t len, void *data)
+static int __add_func_data_qid (aosl_mpq_t tq, int treat_this, int sync, aosl_mpq_t dq, aosl_ref_t ref, const struct q_func_opts *opts, const char *f_name, aosl_mpq_func_data_t f, size_t len, void *data)
 {
 	int err;
 	struct mp_queue *q;
@@ -1409,7 +2027,7 @@ static int __add_func_data_qid (aosl_mpq_t tq, int treat_this, int sync, aosl_mp
 		return -1;
 	}
 
-	err = __add_func_data (q, sync, dq, ref, f_name, f, len, data);
+	err = __add_func_data (q, sync, dq, ref, opts, f_name, f, len, data);
 
 	if (treat_this) {
 		__mpq_put_or_this (q);
@@ -1422,27 +2040,27 @@ static int __add_func_data_qid (aosl_mpq_t tq, int treat_this, int sync, aosl_mp
 
 int __mpq_queue_args (struct mp_queue *q, aosl_mpq_t done_qid, aosl_ref_t ref, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, va_list args)
 {
-	return __add_func_args (q, 0, done_qid, ref, f_name, f, argc, args);
+	return __add_func_args (q, 0, done_qid, ref, NULL, f_name, f, argc, args);
 }
 
 __export_in_so__ int aosl_mpq_queue_args (aosl_mpq_t tq, aosl_mpq_t dq, aosl_ref_t ref, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, va_list args)
 {
-	return __add_func_args_qid (tq, 0, 0, dq, ref, f_name, f, argc, args);
+	return __add_func_args_qid (tq, 0, 0, dq, ref, NULL, f_name, f, argc, args);
 }
 
 int __mpq_call_args (struct mp_queue *q, aosl_ref_t ref, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, va_list args)
 {
-	return __add_func_args (q, 1, AOSL_MPQ_INVALID, ref, f_name, f, argc, args);
+	return __add_func_args (q, 1, AOSL_MPQ_INVALID, ref, NULL, f_name, f, argc, args);
 }
 
 __export_in_so__ int aosl_mpq_call_args (aosl_mpq_t qid, aosl_ref_t ref, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, va_list args)
 {
-	return __add_func_args_qid (qid, 1, 1, AOSL_MPQ_INVALID, ref, f_name, f, argc, args);
+	return __add_func_args_qid (qid, 1, 1, AOSL_MPQ_INVALID, ref, NULL, f_name, f, argc, args);
 }
 
 __export_in_so__ int aosl_mpq_run_args (aosl_mpq_t qid, aosl_ref_t ref, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, va_list args)
 {
-	return __add_func_args_qid (qid, 1, (this_mpq_id () == qid), AOSL_MPQ_INVALID, ref, f_name, f, argc, args);
+	return __add_func_args_qid (qid, 1, (this_mpq_id () == qid), AOSL_MPQ_INVALID, ref, NULL, f_name, f, argc, args);
 }
 
 int __mpq_queue (struct mp_queue *q, aosl_mpq_t done_qid, aosl_ref_t ref, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, ...)
@@ -1450,7 +2068,7 @@ int __mpq_queue (struct mp_queue *q, aosl_mpq_t done_qid, aosl_ref_t ref, const
 	va_list args;
 	int err;
 	va_start (args, argc);
-	err = __add_func_args (q, 0, done_qid, ref, f_name, f, argc, args);
+	err = __add_func_args (q, 0, done_qid, ref, NULL, f_name, f, argc, args);
 	va_end (args);
 	return err;
 }
@@ -1461,7 +2079,7 @@ __export_in_so__ int aosl_mpq_queue (aosl_mpq_t tq, aosl_mpq_t dq, aosl_ref_t re
 	int err;
 
 	va_start (args, argc);
-	err = __add_func_args_qid (tq, 0, 0, dq, ref, f_name, f, argc, args);
+	err = __add_func_args_qid (tq, 0, 0, dq, ref, NULL, f_name, f, argc, args);
 	va_end (args);
 	return err;
 }
@@ -1471,7 +2089,7 @@ int __mpq_call (struct mp_queue *q, aosl_ref_t ref, const char *f_name, aosl_mpq
 	va_list args;
 	int err;
 	va_start (args, argc);
-	err = __add_func_args (q, 1, AOSL_MPQ_INVALID, ref, f_name, f, argc, args);
+	err = __add_func_args (q, 1, AOSL_MPQ_INVALID, ref, NULL, f_name, f, argc, args);
 	va_end (args);
 	return err;
 }
@@ -1482,7 +2100,7 @@ __export_in_so__ int aosl_mpq_call (aosl_mpq_t qid, aosl_ref_t ref, const char *
 	int err;
 
 	va_start (args, argc);
-	err = __add_func_args_qid (qid, 1, 1, AOSL_MPQ_INVALID, ref, f_name, f, argc, args);
+	err = __add_func_args_qid (qid, 1, 1, AOSL_MPQ_INVALID, ref, NULL, f_name, f, argc, args);
 	va_end (args);
 	return err;
 }
@@ -1493,11 +2111,108 @@ __export_in_so__ int aosl_mpq_run (aosl_mpq_t qid, aosl_ref_t ref, const char *f
 	int err;
 
 	va_start (args, argc);
-	err = __add_func_args_qid (qid, 1, (this_mpq_id () == qid), AOSL_MPQ_INVALID, ref, f_name, f, argc, args);
+	err = __add_func_args_qid (qid, 1, (this_mpq_id () == qid), AOSL_MPQ_INVALID, ref, NULL, f_name, f, argc, args);
 	va_end (args);
 	return err;
 }
 
+__export_in_so__ int aosl_mpq_queue_pri (aosl_mpq_t tq, aosl_mpq_t dq, aosl_ref_t ref, int pri, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, ...)
+{
+	struct q_func_opts opts = default_opts;
+	va_list args;
+	int err;
+
+	if (pri < 0 || pri >= AOSL_MPQ_PRI_COUNT) {
+		aosl_errno = AOSL_EINVAL;
+		return -1;
+	}
+
+	opts.pri = pri;
+	va_start (args, argc);
+	err = __add_func_args_qid (tq, 0, 0, dq, ref, &opts, f_name, f, argc, args);
+	va_end (args);
+	return err;
+}
+
+__export_in_so__ int aosl_mpq_call_pri (aosl_mpq_t qid, aosl_ref_t ref, int pri, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, ...)
+{
+	struct q_func_opts opts = default_opts;
+	va_list args;
+	int err;
+
+	if (pri < 0 || pri >= AOSL_MPQ_PRI_COUNT) {
+		aosl_errno = AOSL_EINVAL;
+		return -1;
+	}
+
+	opts.pri = pri;
+	va_start (args, argc);
+	err = __add_func_args_qid (qid, 1, 1, AOSL_MPQ_INVALID, ref, &opts, f_name, f, argc, args);
+	va_end (args);
+	return err;
+}
+
+__export_in_so__ int aosl_mpq_queue_deadline (aosl_mpq_t tq, aosl_mpq_t dq, aosl_ref_t ref, aosl_ts_t deadline, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, ...)
+{
+	struct q_func_opts opts = default_opts;
+	va_list args;
+	int err;
+
+	opts.deadline = deadline;
+	va_start (args, argc);
+	err = __add_func_args_qid (tq, 0, 0, dq, ref, &opts, f_name, f, argc, args);
+	va_end (args);
+	return err;
+}
+
+__export_in_so__ int aosl_mpq_queue_coalesce (aosl_mpq_t tq, aosl_mpq_t dq, aosl_ref_t ref, uintptr_t key, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, ...)
+{
+	struct q_func_opts opts = default_opts;
+	va_list args;
+	int err;
+
+	opts.keyed = 1;
+	opts.key = key;
+	va_start (args, argc);
+	err = __add_func_args_qid (tq, 0, 0, dq, ref, &opts, f_name, f, argc, args);
+	va_end (args);
+	return err;
+}
+
+__export_in_so__ int aosl_mpq_set_pri_weights (aosl_mpq_t qid, const int weights [AOSL_MPQ_PRI_COUNT])
+{
+	struct mp_queue *q;
+	int i;
+
+	if (weights == NULL) {
+		aosl_errno = AOSL_EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < AOSL_MPQ_PRI_COUNT; i++) {
+		if (weights [i] <= 0) {
+			aosl_errno = AOSL_EINVAL;
+			return -1;
+		}
+	}
+
+	q = __mpq_get_or_this (qid);
+	if (q == NULL) {
+		aosl_errno = AOSL_ESRCH;
+		return -1;
+	}
+
+	k_lock_lock (&q->lock);
+	for (i = 0; i < AOSL_MPQ_PRI_COUNT; i++) {
+		q->lanes [i].weight = weights [i];
+		q->lanes [i].credit = weights [i];
+	}
+	k_lock_unlock (&q->lock);
+
+	__mpq_put_or_this (q);
+	return 0;
+}
+
 int __mpq_queue_argv (struct mp_queue *q, aosl_mpq_t done_qid, aosl_ref_t ref, const char *f_name, aosl_mpq_func_argv_t f, uintptr_t argc, uintptr_t *argv)
 {
 	return __add_func_argv (q, 0, done_qid, ref, f_name, f, argc, argv);
@@ -1525,27 +2240,35 @@ __export_in_so__ int aosl_mpq_run_argv (aosl_mpq_t qid, aosl_ref_t ref, const ch
 
 int __mpq_queue_data (struct mp_queue *q, aosl_mpq_t done_qid, aosl_ref_t ref, const char *f_name, aosl_mpq_func_data_t f, size_t len, void *data)
 {
-	return __add_func_data (q, 0, done_qid, ref, f_name, f, len, data);
+	return __add_func_data (q, 0, done_qid, ref, NULL, f_name, f, len, data);
 }
 
 __export_in_so__ int aosl_mpq_queue_data (aosl_mpq_t tq, aosl_mpq_t dq, aosl_ref_t ref, const char *f_name, aosl_mpq_func_data_t f, size_t len, void *data)
 {
-	return __add_func_data_qid (tq, 0, 0, dq, ref, f_name, f, len, data);
+	return __add_func_data_qid (tq, 0, 0, dq, ref, NULL, f_name, f, len, data);
 }
 
 int __mpq_call_data (struct mp_queue *q, aosl_ref_t ref, const char *f_name, aosl_mpq_func_data_t f, size_t len, void *data)
 {
-	return __add_func_data (q, 1, AOSL_MPQ_INVALID, ref, f_name, f, len, data);
+	return __add_func_data (q, 1, AOSL_MPQ_INVALID, ref, NULL, f_name, f, len, data);
 }
 
 __export_in_so__ int aosl_mpq_call_data (aosl_mpq_t qid, aosl_ref_t ref, const char *f_name, aosl_mpq_func_data_t f, size_t len, void *data)
 {
-	return __add_func_data_qid (qid, 1, 1, AOSL_MPQ_INVALID, ref, f_name, f, len, data);
+	return __add_func_data_qid (qid, 1, 1, AOSL_MPQ_INVALID, ref, NULL, f_name, f, len, data);
 }
 
 __export_in_so__ int aosl_mpq_run_data (aosl_mpq_t qid, aosl_ref_t ref, const char *f_name, aosl_mpq_func_data_t f, size_t len, void *data)
 {
-	return __add_func_data_qid (qid, 1, (this_mpq_id () == qid), AOSL_MPQ_INVALID, ref, f_name, f, len, data);
+	return __add_func_data_qid (qid, 1, (this_mpq_id () == qid), AOSL_MPQ_INVALID, ref, NULL, f_name, f, len, data);
+}
+
+__export_in_so__ int aosl_mpq_queue_data_deadline (aosl_mpq_t tq, aosl_mpq_t dq, aosl_ref_t ref, aosl_ts_t deadline, const char *f_name, aosl_mpq_func_data_t f, size_t len, void *data)
+{
+	struct q_func_opts opts = default_opts;
+
+	opts.deadline = deadline;
+	return __add_func_data_qid (tq, 0, 0, dq, ref, &opts, f_name, f, len, data);
 }
 
 __export_in_so__ int aosl_mpq_queued_count (aosl_mpq_t qid)
@@ -1564,6 +2287,54 @@ __export_in_so__ int aosl_mpq_queued_count (aosl_mpq_t qid)
 	return count;
 }
 
+__export_in_so__ int aosl_mpq_set_budget (aosl_mpq_t qid, int max_funcs, int max_us, int max_events)
+{
+	struct mp_queue *q;
+
+	if (max_funcs < 0 || max_us < 0 || max_events < 0) {
+		aosl_errno = AOSL_EINVAL;
+		return -1;
+	}
+
+	q = __mpq_get_or_this (qid);
+	if (q == NULL) {
+		aosl_errno = AOSL_ESRCH;
+		return -1;
+	}
+
+	/* only read by the queue thread at the start of each iteration */
+	q->budget_funcs = max_funcs;
+	q->budget_us = max_us;
+	q->budget_events = max_events;
+
+	__mpq_put_or_this (q);
+	return 0;
+}
+
+__export_in_so__ int aosl_mpq_queued_count_pri (aosl_mpq_t qid, int pri)
+{
+	struct mp_queue *q;
+	int count;
+
+	if (pri < 0 || pri >= AOSL_MPQ_PRI_COUNT) {
+		aosl_errno = AOSL_EINVAL;
+		return -1;
+	}
+
+	q = __mpq_get_or_this (qid);
+	if (q == NULL) {
+		aosl_errno = AOSL_EINVAL;
+		return -1;
+	}
+
+	k_lock_lock (&q->lock);
+	count = q->lanes [pri].count;
+	k_lock_unlock (&q->lock);
+
+	__mpq_put_or_this (q);
+	return count;
+}
+
 __export_in_so__ int aosl_mpq_last_costs (aosl_ts_t *load_p, aosl_ts_t *idle_p)
 {
 	struct mp_queue *q = THIS_MPQ ();
@@ -1606,6 +2377,7 @@ __export_in_so__ int aosl_mpq_exec_counters (uint64_t *funcs_count_p, uint64_t *
 __export_in_so__ void aosl_mpq_loop (void)
 {
 	struct mp_queue *q = THIS_MPQ ();
+	struct q_wait_entry *wait;
 	if (q != NULL) {
 		/**
 		 * MUST set the stack base before any potential
@@ -1613,7 +2385,9 @@ __export_in_so__ void aosl_mpq_loop (void)
 		 **/
 		q->q_stack_base.id = (aosl_stack_id_t)&q;
 		__mp_queue_poll_loop (q);
-		__q_wait_destroy (q, NULL, NULL);
+		wait = __q_wait_destroy (q, NULL, NULL);
+		__q_free (q);
+		__q_wake_destroy_waiters (wait);
 	}
 }
 
@@ -1830,6 +2604,7 @@ extern void mpqp_shrink_pools (void);
 __export_in_so__ void aosl_shrink_resources (void)
 {
 	mpqp_shrink_pools ();
+	__mpq_park_flush (0, 0);
 }
 
 /**
@@ -1851,6 +2626,11 @@ extern void k_mpqp_init (void);
 extern void k_mpqp_fini (void);
 extern void k_route_init (void);
 extern void k_route_fini (void);
+extern void k_dns_init (void);
+extern void k_dns_fini (void);
+extern void k_marshal_fini (void);
+extern void k_log_init (void);
+extern void k_log_fini (void);
 
 /*
  * aosl_ctor()/aosl_dtor() form a process-wide ownership pair.  Keep the
@@ -1900,13 +2680,17 @@ __export_in_so__ void aosl_dtor (void)
 		abort ();
 	}
 
+	k_dns_fini ();
 	k_route_fini ();
 	k_mpqp_fini ();
 	mpq_fini ();
+	k_marshal_fini ();
 	iofd_fini ();
 	fileobj_fini ();
 	k_timer_fini ();
 	k_refobj_fini ();
+	/* after all the queues are gone, none could log into the rings */
+	k_log_fini ();
 	k_errno_fini ();
 	os_thread_fini ();
 	k_mm_fini ();
@@ -1928,6 +2712,7 @@ __export_in_so__ void aosl_ctor (void)
 	k_mm_init ();
 	os_thread_init ();
 	k_errno_init ();
+	k_log_init ();
 	k_refobj_init ();
 	k_timer_init ();
 	fileobj_init ();
@@ -1935,6 +2720,7 @@ __export_in_so__ void aosl_ctor (void)
 	mpq_init ();
 	k_mpqp_init ();
 	k_route_init ();
+	k_dns_init ();
 
 	atomic_set (&s_aosl_init_refcount, 1);
 	aosl_lifecycle_unlock ();
@@ -0,0 +1,273 @@
+/***************************************************************************
+ * Module:	Multiplex queue runtime stats implementation file
+ *
+ * Copyright © 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+#include <string.h>
+
+#include <api/aosl_types.h>
+#include <api/aosl_defs.h>
+#include <api/aosl_mpq.h>
+#include <api/aosl_atomic.h>
+#include <api/aosl_errno.h>
+#include <kernel/kernel.h>
+#include <kernel/mp_queue.h>
+#include <kernel/mpq_stats.h>
+#include <kernel/err.h>
+
+
+static void __stats_reset (struct mp_queue *q)
+{
+	struct mpq_stats *st = &q->stats;
+
+	st->reset_req = 0;
+	memset (st->f_hash, 0, sizeof st->f_hash);
+	memset (&st->data, 0, sizeof st->data);
+
+	/* the queuing threads update depth_max with the lock held */
+	k_lock_lock (&q->lock);
+	st->data.depth_max = 0;
+	k_lock_unlock (&q->lock);
+}
+
+static __inline__ void __stats_write_begin (struct mp_queue *q)
+{
+	struct mpq_stats *st = &q->stats;
+
+	st->seq++;
+	aosl_wmb ();
+
+	if (unlikely (*(volatile int *)&st->reset_req))
+		__stats_reset (q);
+}
+
+static __inline__ void __stats_write_end (struct mp_queue *q)
+{
+	aosl_wmb ();
+	q->stats.seq++;
+}
+
+/* bucket 0 for 0, bucket i for [2^(i-1), 2^i), the last one for all the bigger */
+static __inline__ int __stats_bucket (aosl_ts_t us)
+{
+	int i = 0;
+
+	while (us > 0 && i < AOSL_MPQ_STATS_BUCKETS - 1) {
+		us >>= 1;
+		i++;
+	}
+
+	return i;
+}
+
+static __inline__ uint32_t __f_name_hash (const char *f_name)
+{
+	/* FNV-1a of the stored part of the name */
+	uint32_t h = 2166136261u;
+	int i;
+
+	for (i = 0; i < AOSL_MPQ_STATS_NAME_LEN - 1 && f_name [i] != '\0'; i++) {
+		h ^= (uint8_t)f_name [i];
+		h *= 16777619u;
+	}
+
+	/* 0 indicates an unused slot */
+	return h != 0 ? h : 1;
+}
+
+static aosl_mpq_func_stats_t *__f_stats_slot (struct mpq_stats *st, const char *f_name)
+{
+	uint32_t h = __f_name_hash (f_name);
+	uint32_t i = h & (AOSL_MPQ_STATS_FUNCS - 1);
+	int n;
+
+	for (n = 0; n < AOSL_MPQ_STATS_FUNCS; n++) {
+		aosl_mpq_func_stats_t *slot = &st->data.funcs_stats [i];
+
+		if (st->f_hash [i] == 0) {
+			st->f_hash [i] = h;
+			strncpy (slot->f_name, f_name, AOSL_MPQ_STATS_NAME_LEN - 1);
+			st->data.funcs_stats_count++;
+			return slot;
+		}
+
+		if (st->f_hash [i] == h && strncmp (slot->f_name, f_name, AOSL_MPQ_STATS_NAME_LEN - 1) == 0)
+			return slot;
+
+		i = (i + 1) & (AOSL_MPQ_STATS_FUNCS - 1);
+	}
+
+	return NULL;
+}
+
+void mpq_stats_init (struct mp_queue *q)
+{
+	memset (&q->stats, 0, sizeof q->stats);
+}
+
+void mpq_stats_check_reset (struct mp_queue *q)
+{
+	if (unlikely (*(volatile int *)&q->stats.reset_req)) {
+		__stats_write_begin (q);
+		__stats_write_end (q);
+	}
+}
+
+void mpq_stats_func (struct mp_queue *q, const char *f_name, aosl_ts_t wait_us, aosl_ts_t exec_us)
+{
+	struct mpq_stats *st = &q->stats;
+	aosl_mpq_func_stats_t *slot;
+
+	__stats_write_begin (q);
+	st->data.funcs++;
+	st->data.wait_hist [__stats_bucket (wait_us)]++;
+	st->data.exec_hist [__stats_bucket (exec_us)]++;
+
+	slot = __f_stats_slot (st, f_name != NULL ? f_name : "(anonymous)");
+	if (slot != NULL) {
+		slot->calls++;
+		slot->total_us += exec_us;
+		if (slot->max_us < exec_us)
+			slot->max_us = exec_us;
+	} else {
+		st->data.funcs_untracked++;
+	}
+	__stats_write_end (q);
+}
+
+void mpq_stats_expired (struct mp_queue *q)
+{
+	__stats_write_begin (q);
+	q->stats.data.funcs_expired++;
+	__stats_write_end (q);
+}
+
+void mpq_stats_coalesced (struct mp_queue *q)
+{
+	__stats_write_begin (q);
+	q->stats.data.funcs_coalesced++;
+	__stats_write_end (q);
+}
+
+void mpq_stats_timer (struct mp_queue *q, aosl_ts_t late_us)
+{
+	__stats_write_begin (q);
+	q->stats.data.timers++;
+	q->stats.data.timer_late_hist [__stats_bucket (late_us)]++;
+	__stats_write_end (q);
+}
+
+void mpq_stats_rx (struct mp_queue *q, size_t bytes)
+{
+	__stats_write_begin (q);
+	q->stats.data.rx_bytes += bytes;
+	q->stats.data.rx_pkts++;
+	__stats_write_end (q);
+}
+
+void mpq_stats_tx (struct mp_queue *q, size_t bytes)
+{
+	__stats_write_begin (q);
+	q->stats.data.tx_bytes += bytes;
+	q->stats.data.tx_pkts++;
+	__stats_write_end (q);
+}
+
+void mpq_stats_budget_hit (struct mp_queue *q, int src)
+{
+	__stats_write_begin (q);
+	q->stats.data.budget_hits [src]++;
+	__stats_write_end (q);
+}
+
+void mpq_stats_fds_starve (struct mp_queue *q, aosl_ts_t starve_us)
+{
+	__stats_write_begin (q);
+	if (q->stats.data.fds_starve_max_us < starve_us)
+		q->stats.data.fds_starve_max_us = starve_us;
+	q->stats.data.fds_starve_hist [__stats_bucket (starve_us)]++;
+	__stats_write_end (q);
+}
+
+static void __stats_snapshot (struct mp_queue *q, aosl_mpq_stats_t *stats)
+{
+	struct mpq_stats *st = &q->stats;
+	uint32_t seq;
+	uint32_t i, n;
+
+	for (;;) {
+		seq = *(volatile uint32_t *)&st->seq;
+		aosl_rmb ();
+		if ((seq & 1) == 0) {
+			memcpy (stats, &st->data, sizeof *stats);
+			aosl_rmb ();
+			if (*(volatile uint32_t *)&st->seq == seq)
+				break;
+		}
+	}
+
+	/* move the used hash slots to the front */
+	n = 0;
+	for (i = 0; i < AOSL_MPQ_STATS_FUNCS; i++) {
+		if (stats->funcs_stats [i].f_name [0] == '\0')
+			continue;
+
+		if (n != i)
+			stats->funcs_stats [n] = stats->funcs_stats [i];
+
+		n++;
+	}
+
+	if (n < AOSL_MPQ_STATS_FUNCS)
+		memset (&stats->funcs_stats [n], 0, sizeof (aosl_mpq_func_stats_t) * (AOSL_MPQ_STATS_FUNCS - n));
+
+	stats->funcs_stats_count = n;
+}
+
+__export_in_so__ int aosl_mpq_stats_get (aosl_mpq_t qid, aosl_mpq_stats_t *stats)
+{
+	struct mp_queue *q;
+
+	if (stats == NULL) {
+		aosl_errno = AOSL_EINVAL;
+		return -1;
+	}
+
+	q = __mpq_get_or_this (qid);
+	if (q == NULL) {
+		aosl_errno = AOSL_ESRCH;
+		return -1;
+	}
+
+	if (q == THIS_MPQ ())
+		mpq_stats_check_reset (q);
+
+	__stats_snapshot (q, stats);
+	__mpq_put_or_this (q);
+	return 0;
+}
+
+__export_in_so__ int aosl_mpq_stats_reset (aosl_mpq_t qid)
+{
+	struct mp_queue *q;
+
+	q = __mpq_get_or_this (qid);
+	if (q == NULL) {
+		aosl_errno = AOSL_ESRCH;
+		return -1;
+	}
+
+	q->stats.reset_req = 1;
+	if (q == THIS_MPQ ()) {
+		mpq_stats_check_reset (q);
+	} else {
+		/* let an idle queue thread do the reset */
+		mp_kick_q (q);
+	}
+
+	__mpq_put_or_this (q);
+	return 0;
+}
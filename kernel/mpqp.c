@@ -20,6 +20,7 @@
 #include <kernel/mp_queue.h>
 #include <kernel/err.h>
 #include <kernel/refobj.h>
+#include <kernel/mpq_pool.h>
 
 #define UNUSED(expr) (void)(expr)
 
@@ -238,6 +239,63 @@ aosl_mpq_t genp_best_q_get (void)
 	return AOSL_MPQ_INVALID;
 }
 
+static __inline__ size_t __mpqp_q_fd_load (struct mp_queue *q)
+{
+	return q->iofd_count + (size_t)atomic_read (&q->count);
+}
+
+/**
+ * Get the queues with the least fds of the pool for placing n new fds,
+ * one queue for each fd. The placing fds are counted in the load of the
+ * queues just like the best q get, so the following picks see them even
+ * before they are added, and each got queue must be put by the function
+ * mpqp_best_q_put once the fd has been added. The pool grows when all
+ * the queues have fds already.
+ * Return value:
+ *     0 on success, the queue ids are filled in qids;
+ *    <0: -AOSL_Exxx error code.
+ **/
+int mpqp_fd_best_qs_get (aosl_mpqp_t qpobj, aosl_mpq_t qids [], int n)
+{
+	struct mpq_pool *qp = (struct mpq_pool *)qpobj;
+	int err = 0;
+	int i;
+
+	k_lock_lock (&qp->lock);
+	for (i = 0; i < n; i++) {
+		struct mp_queue *best = NULL;
+		int l;
+
+		for (l = 0; l < qp->q_count; l++) {
+			struct mp_queue *q = qp->pool_entries [l].q;
+			if (best == NULL || __mpqp_q_fd_load (q) < __mpqp_q_fd_load (best))
+				best = q;
+		}
+
+		if (best == NULL || (__mpqp_q_fd_load (best) > 0 && qp->q_count < qp->pool_size)) {
+			struct pool_entry *entry = __pool_create_add_mpq_locked (qp);
+			if (!IS_ERR_OR_NULL (entry)) {
+				best = entry->q;
+			} else if (best == NULL) {
+				err = (int)PTR_ERR (entry);
+				break;
+			}
+		}
+
+		____q_get (best);
+		atomic_inc (&best->count);
+		qids [i] = best->qid;
+	}
+	k_lock_unlock (&qp->lock);
+
+	if (err < 0) {
+		while (i-- > 0)
+			mpqp_best_q_put (qids [i]);
+	}
+
+	return err;
+}
+
 static struct pool_entry *__mpqp_best_entry_get_or_alloc (struct mpq_pool *qp)
 {
 	struct pool_entry *entry;
@@ -1045,29 +1103,72 @@ __export_in_so__ aosl_mpq_t aosl_mpq_alloc (void)
 	return entry->q->qid;
 }
 
-__export_in_so__ int aosl_mpq_free (aosl_mpq_t qid)
+/**
+ * Pin the queues of a pool for the jobs sharded by queue, the missing
+ * queues are created up to the pool size or the max count. The pinned
+ * queues are counted as the alloc-ed ones, so the pool never shrinks
+ * them until they are unpinned.
+ * Return value:
+ *     the pinned queues count, and the ids are filled in qids;
+ *     <0: -AOSL_Exxx error code.
+ **/
+int mpqp_pin_qs (aosl_mpqp_t qpobj, aosl_mpq_t qids [], int max)
 {
+	struct mpq_pool *qp = (struct mpq_pool *)qpobj;
+	int err = 0;
+	int i;
+
+	if (qp == NULL || max < 1)
+		return -AOSL_EINVAL;
+
+	k_lock_lock (&qp->lock);
+	while (qp->q_count < qp->pool_size && qp->q_count < max) {
+		struct pool_entry *entry = __pool_create_add_mpq_locked (qp);
+		if (IS_ERR (entry)) {
+			/* go on with the ones we have got */
+			err = (int)PTR_ERR (entry);
+			break;
+		}
+	}
+
+	for (i = 0; i < qp->q_count && i < max; i++) {
+		struct pool_entry *entry = &qp->pool_entries [i];
+		entry->usage++;
+		qids [i] = entry->q->qid;
+	}
+	k_lock_unlock (&qp->lock);
+
+	if (i == 0)
+		return err;
+
+	return i;
+}
+
+int mpqp_unpin_q (aosl_mpqp_t qpobj, aosl_mpq_t qid)
+{
+	struct mpq_pool *qp = (struct mpq_pool *)qpobj;
 	struct pool_entry *entry;
+	int err = 0;
 
-	k_lock_lock (&gen_pool->lock);
-	entry = __mpqp_find_entry_with_qid_locked (gen_pool, qid);
+	k_lock_lock (&qp->lock);
+	entry = __mpqp_find_entry_with_qid_locked (qp, qid);
 	if (entry != NULL) {
 		if (entry->usage > 1) {
 			entry->usage--;
 		} else {
-			entry = ERR_PTR (-AOSL_EPERM);
+			err = -AOSL_EPERM;
 		}
 	} else {
-		entry = ERR_PTR (-AOSL_EINVAL);
+		err = -AOSL_EINVAL;
 	}
-	k_lock_unlock (&gen_pool->lock);
+	k_lock_unlock (&qp->lock);
 
-	if (IS_ERR (entry)) {
-		aosl_errno = PTR_ERR (entry);
-		return -1;
-	}
+	return err;
+}
 
-	return 0;
+__export_in_so__ int aosl_mpq_free (aosl_mpq_t qid)
+{
+	return_err (mpqp_unpin_q ((aosl_mpqp_t)gen_pool, qid));
 }
 
 /**
@@ -13,6 +13,7 @@
 #include <kernel/err.h>
 #include <api/aosl_time.h>
 #include <api/aosl_atomic.h>
+#include <api/aosl_mm.h>
 #include <kernel/mp_queue.h>
 #include <kernel/iofd.h>
 #include <kernel/osmp.h>
@@ -24,6 +25,7 @@ extern int os_activate_sigp_epoll (struct mp_queue *q);
 extern int os_deactivate_sigp_epoll (struct mp_queue *q);
 extern int os_add_event_fd_epoll (struct mp_queue *q, struct iofd *f);
 extern int os_del_event_fd_epoll (struct mp_queue *q, struct iofd *f);
+extern void os_rearm_event_fd_epoll (struct mp_queue *q, struct iofd *f, uint32_t events);
 extern int os_mp_wait_epoll (struct mp_queue *q, aosl_poll_event_t *events, int maxevents, intptr_t timeo);
 extern void os_mp_dispatch_epoll (struct mp_queue *q, aosl_poll_event_t *events, int events_count);
 
@@ -31,6 +33,7 @@ extern void os_mp_dispatch_epoll (struct mp_queue *q, aosl_poll_event_t *events,
 #define os_mp_fini_pub          os_mp_fini_epoll
 #define os_add_event_fd_pub     os_add_event_fd_epoll
 #define os_del_event_fd_pub     os_del_event_fd_epoll
+#define os_rearm_event_fd_pub   os_rearm_event_fd_epoll
 #define os_activate_sigp        os_activate_sigp_epoll
 #define os_deactivate_sigp      os_deactivate_sigp_epoll
 #define os_mp_wait              os_mp_wait_epoll
@@ -42,6 +45,7 @@ extern int os_activate_sigp_poll (struct mp_queue *q);
 extern int os_deactivate_sigp_poll (struct mp_queue *q);
 extern int os_add_event_fd_poll (struct mp_queue *q, struct iofd *f);
 extern int os_del_event_fd_poll (struct mp_queue *q, struct iofd *f);
+extern void os_rearm_event_fd_poll (struct mp_queue *q, struct iofd *f, uint32_t events);
 extern int os_mp_wait_poll (struct mp_queue *q, aosl_poll_event_t *events, int maxevents, intptr_t timeo);
 extern void os_mp_dispatch_poll (struct mp_queue *q, aosl_poll_event_t *events, int events_count);
 
@@ -49,6 +53,7 @@ extern void os_mp_dispatch_poll (struct mp_queue *q, aosl_poll_event_t *events,
 #define os_mp_fini_pub          os_mp_fini_poll
 #define os_add_event_fd_pub     os_add_event_fd_poll
 #define os_del_event_fd_pub     os_del_event_fd_poll
+#define os_rearm_event_fd_pub   os_rearm_event_fd_poll
 #define os_activate_sigp        os_activate_sigp_poll
 #define os_deactivate_sigp      os_deactivate_sigp_poll
 #define os_mp_wait              os_mp_wait_poll
@@ -60,6 +65,7 @@ extern int os_activate_sigp_select (struct mp_queue *q);
 extern int os_deactivate_sigp_select (struct mp_queue *q);
 extern int os_add_event_fd_select (struct mp_queue *q, struct iofd *f);
 extern int os_del_event_fd_select (struct mp_queue *q, struct iofd *f);
+extern void os_rearm_event_fd_select (struct mp_queue *q, struct iofd *f, uint32_t events);
 extern int os_mp_wait_select (struct mp_queue *q, aosl_poll_event_t *events, int maxevents, intptr_t timeo);
 extern void os_mp_dispatch_select (struct mp_queue *q, aosl_poll_event_t *events, int events_count);
 
@@ -67,6 +73,7 @@ extern void os_mp_dispatch_select (struct mp_queue *q, aosl_poll_event_t *events
 #define os_mp_fini_pub          os_mp_fini_select
 #define os_add_event_fd_pub     os_add_event_fd_select
 #define os_del_event_fd_pub     os_del_event_fd_select
+#define os_rearm_event_fd_pub   os_rearm_event_fd_select
 #define os_activate_sigp        os_activate_sigp_select
 #define os_deactivate_sigp      os_deactivate_sigp_select
 #define os_mp_wait              os_mp_wait_select
@@ -99,17 +106,160 @@ static __inline__ int __os_event_wait(struct mp_queue *q, intptr_t timeo)
 	return 0;
 }
 
+/**
+ * The event batch size of one os_mp_wait. The default batch lives on the
+ * stack, a bigger one configured via AOSL_MPQ_FLAG_EVENTS or grown by the
+ * AOSL_MPQ_FLAG_ADAPTIVE_EVENTS is kept in the queue object. The adaptive
+ * batch is doubled each time a wait fills it up, and halved again after
+ * EVENTS_SHRINK_WAITS waits in a row used no more than a quarter of it.
+ **/
+#define EVENTS_SHRINK_WAITS 256
+
+static __inline__ int __events_base_size (struct mp_queue *q)
+{
+	int order = (q->q_flags & AOSL_MPQ_FLAG_EVENTS_MASK) >> AOSL_MPQ_FLAG_EVENTS_SHIFT;
+	int size = AOSL_MPQ_EVENTS_DEFAULT << order;
+
+	if (size > AOSL_MPQ_EVENTS_MAX || size <= 0)
+		size = AOSL_MPQ_EVENTS_MAX;
+
+	return size;
+}
+
+static void __events_resize (struct mp_queue *q, int size)
+{
+	aosl_poll_event_t *events = NULL;
+
+	if (size > AOSL_MPQ_EVENTS_DEFAULT) {
+		events = (aosl_poll_event_t *)aosl_malloc (sizeof (aosl_poll_event_t) * size);
+		if (events == NULL) {
+			/* just keep the current batch */
+			return;
+		}
+	}
+
+	if (q->events != NULL)
+		aosl_free (q->events);
+
+	q->events = events;
+	q->events_size = size;
+	q->events_low_waits = 0;
+}
+
+static __inline__ void __events_check (struct mp_queue *q)
+{
+	int base = __events_base_size (q);
+
+	/**
+	 * The flags might be changed at any time, so adjust the batch here
+	 * if it does not match the flags any more.
+	 **/
+	if (q->events_size < base || (q->events_size > base && !(q->q_flags & AOSL_MPQ_FLAG_ADAPTIVE_EVENTS)))
+		__events_resize (q, base);
+}
+
+static __inline__ void __events_adapt (struct mp_queue *q, int count)
+{
+	if (!(q->q_flags & AOSL_MPQ_FLAG_ADAPTIVE_EVENTS))
+		return;
+
+	if (count >= q->events_size) {
+		if (q->events_size < AOSL_MPQ_EVENTS_MAX)
+			__events_resize (q, q->events_size * 2);
+		return;
+	}
+
+	if (q->events_size > __events_base_size (q) && count <= q->events_size / 4) {
+		if (++q->events_low_waits >= EVENTS_SHRINK_WAITS)
+			__events_resize (q, q->events_size / 2);
+	} else {
+		q->events_low_waits = 0;
+	}
+}
+
+/**
+ * Busy poll the fds with 0 timeout for at most the budget configured via
+ * AOSL_MPQ_FLAG_BUSY_POLL, bounded by the wait time. Nobody needs to kick
+ * us while spinning, so we check the queued functions count by ourselves.
+ * Return value:
+ *     >0: the events count got while spinning;
+ *      0: a function was queued, or the budget ran out, and the caller
+ *         should check the queued functions count again before sleeping;
+ *     <0: error.
+ **/
+static int __os_iomp_busy_poll (struct mp_queue *q, aosl_poll_event_t *events, int maxevents, intptr_t timeo)
+{
+	aosl_ts_t budget_us = (aosl_ts_t)((q->q_flags & AOSL_MPQ_FLAG_BUSY_POLL_MASK) >> AOSL_MPQ_FLAG_BUSY_POLL_SHIFT) * AOSL_MPQ_BUSY_POLL_UNIT_US;
+	aosl_ts_t deadline;
+	int err;
+
+	if (timeo > 0 && (aosl_ts_t)timeo * 1000 < budget_us)
+		budget_us = (aosl_ts_t)timeo * 1000;
+
+	q->need_kicking = 0;
+	deadline = aosl_tick_us () + budget_us;
+	for (;;) {
+		err = os_mp_wait (q, events, maxevents, 0);
+		if (err != 0)
+			break;
+
+		if (atomic_read (&q->count) > 0 || atomic_read (&q->kick_q_count) > 0 || q->terminated)
+			break;
+
+		if ((int64_t)(aosl_tick_us () - deadline) >= 0)
+			break;
+	}
+
+	return err;
+}
+
 static __inline__ int __os_iomp_wait(struct mp_queue *q, intptr_t timeo)
 {
 	int err = 0;
-	aosl_poll_event_t events [64] = {0};
+	aosl_poll_event_t stack_events [AOSL_MPQ_EVENTS_DEFAULT];
+	aosl_poll_event_t *events;
+	int maxevents;
+
+	__events_check (q);
+	events = q->events != NULL ? q->events : stack_events;
+
+	/**
+	 * The events not fetched for the budget are still ready in the
+	 * kernel, and would be got in the next iteration.
+	 **/
+	maxevents = q->events_size;
+	if (q->budget_events > 0 && q->budget_events < maxevents)
+		maxevents = q->budget_events;
 
-	q->need_kicking = 1;
 	__update_load_time (q);
-	err = os_mp_wait (q, events, sizeof events / sizeof events [0], timeo);
+	if (timeo != 0 && (q->q_flags & AOSL_MPQ_FLAG_BUSY_POLL_MASK) != 0) {
+		err = __os_iomp_busy_poll (q, events, maxevents, timeo);
+		if (err == 0) {
+			/**
+			 * The spinning budget ran out, so tell the world we need
+			 * kicking again, and check the queued functions count
+			 * after that, just the same as os_poll_dispatch does.
+			 **/
+			q->need_kicking = 1;
+			aosl_mb ();
+			if (atomic_read (&q->count) > 0 || q->terminated)
+				timeo = 0;
+
+			err = os_mp_wait (q, events, maxevents, timeo);
+		}
+	} else {
+		q->need_kicking = 1;
+		err = os_mp_wait (q, events, maxevents, timeo);
+	}
 	__update_idle_time (q);
 	q->need_kicking = 0;
 	os_mp_dispatch (q, events, err);
+	if (maxevents < q->events_size) {
+		if (err >= maxevents)
+			mpq_stats_budget_hit (q, AOSL_MPQ_SRC_FDS);
+	} else {
+		__events_adapt (q, err);
+	}
 	return err;
 }
 
@@ -163,9 +313,10 @@ int os_poll_dispatch (struct mp_queue *q, intptr_t timeo)
 				 * If we have queued functions unprocessed, and
 				 * nobody kicked us & we have no any fd, then
 				 * just return 0 here, no need to do following
-				 * other checkings.
+				 * other checkings. Do not sleep here, the caller
+				 * of a synchronous call is just waiting for the
+				 * function queued while we were running others.
 				 **/
-				aosl_msleep(5);
 				return 0;
 			}
 
@@ -340,6 +491,10 @@ static int os_init_sigp (struct mp_queue *q)
 
 extern int os_mp_init (struct mp_queue *q)
 {
+	q->events = NULL;
+	q->events_size = AOSL_MPQ_EVENTS_DEFAULT;
+	q->events_low_waits = 0;
+
 	if (os_mp_init_pub(q) != 0) {
 		return -1;
 	}
@@ -356,6 +511,11 @@ extern void os_mp_fini (struct mp_queue *q)
 {
 	os_fini_sigp(q);
 	os_mp_fini_pub(q);
+
+	if (q->events != NULL) {
+		aosl_free (q->events);
+		q->events = NULL;
+	}
 }
 
 int os_add_event_fd (struct mp_queue *q, struct iofd *f)
@@ -367,3 +527,9 @@ int os_del_event_fd (struct mp_queue *q, struct iofd *f)
 {
 	return os_del_event_fd_pub(q, f);
 }
+
+void os_rearm_event_fd (struct mp_queue *q, struct iofd *f, uint32_t events)
+{
+	f->flags |= events;
+	os_rearm_event_fd_pub(q, f, events);
+}
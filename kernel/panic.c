@@ -14,6 +14,16 @@
 #include <string.h>
 
 #include <kernel/thread.h>
+#include <kernel/log.h>
+
+static void __log_sync (int level, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start (args, fmt);
+	k_vlog_sync (level, fmt, args);
+	va_end (args);
+}
 
 void bug_slowpath (const char *file, int line, void *caller, const char *fmt, ...)
 {
@@ -26,11 +36,12 @@ void bug_slowpath (const char *file, int line, void *caller, const char *fmt, ..
 	if (aosl_hal_thread_get_name (thread_name, sizeof thread_name) != 0)
 		strcpy (thread_name, "thread");
 
-	aosl_log (AOSL_LOG_EMERG, "------------[ cut here ]------------\n");
-	aosl_log (AOSL_LOG_EMERG, "BUG(thread-%s/%p): %s:%d, caller=%p\n", thread_name, (void *)(uintptr_t)this, file, line, caller);
+	k_log_flush_panic ();
+	__log_sync (AOSL_LOG_EMERG, "------------[ cut here ]------------\n");
+	__log_sync (AOSL_LOG_EMERG, "BUG(thread-%s/%p): %s:%d, caller=%p\n", thread_name, (void *)(uintptr_t)this, file, line, caller);
 
 	va_start (args, fmt);
-	aosl_vlog (AOSL_LOG_EMERG, fmt, args);
+	k_vlog_sync (AOSL_LOG_EMERG, fmt, args);
 	va_end (args);
 
 	abort ();
@@ -42,8 +53,11 @@ __export_in_so__ void aosl_printf_fmt12 aosl_panic (const char *fmt, ...)
 {
 	va_list args;
 
+	/* the messages queued before must go first */
+	k_log_flush_panic ();
+
 	va_start (args, fmt);
-	aosl_vlog (AOSL_LOG_EMERG, fmt, args);
+	k_vlog_sync (AOSL_LOG_EMERG, fmt, args);
 	va_end (args);
 
 	abort ();
@@ -11,65 +11,169 @@
 #if defined(AOSL_HAL_HAVE_POLL) && AOSL_HAL_HAVE_POLL == 1
 
 
+#include <string.h>
+
 #include <api/aosl_types.h>
+#include <api/aosl_mm.h>
 #include <kernel/err.h>
 #include <api/aosl_time.h>
-#include <api/aosl_alloca.h>
 #include <kernel/mp_queue.h>
 
 
-int os_mp_init_poll (struct mp_queue *q)
+#define POLL_MAX_FDS 1024
+#define POLL_INIT_FDS 16
+
+/**
+ * The poll backend keeps a persistent pollfd array in the queue object
+ * rather than rebuilding it from the iofds list for every wait. The slot
+ * 0 is always the wakeup pipe, and the other slots are maintained by the
+ * add/del functions incrementally, a parallel iofd pointer array is kept
+ * for mapping a slot back to the iofd, and the slot index is saved in
+ * iofd->mp_idx for O(1) removing.
+ **/
+static int __poll_fds_grow (struct mp_queue *q)
 {
+	aosl_poll_event_t *pfds;
+	struct iofd **pfd_iofds;
+	int size = q->pfd_size * 2;
+
+	if (size > POLL_MAX_FDS + 1)
+		size = POLL_MAX_FDS + 1;
+
+	if (size <= q->pfd_size)
+		return -AOSL_ENFILE;
+
+	pfds = (aosl_poll_event_t *)aosl_malloc (sizeof (aosl_poll_event_t) * size);
+	if (pfds == NULL)
+		return -AOSL_ENOMEM;
+
+	pfd_iofds = (struct iofd **)aosl_malloc (sizeof (struct iofd *) * size);
+	if (pfd_iofds == NULL) {
+		aosl_free (pfds);
+		return -AOSL_ENOMEM;
+	}
+
+	memcpy (pfds, q->pfds, sizeof (aosl_poll_event_t) * q->pfd_count);
+	memcpy (pfd_iofds, q->pfd_iofds, sizeof (struct iofd *) * q->pfd_count);
+	aosl_free (q->pfds);
+	aosl_free (q->pfd_iofds);
+
+	q->pfds = pfds;
+	q->pfd_iofds = pfd_iofds;
+	q->pfd_size = size;
 	return 0;
 }
 
 void os_mp_fini_poll (struct mp_queue *q)
 {
+	if (q->pfds != NULL) {
+		aosl_free (q->pfds);
+		q->pfds = NULL;
+	}
+
+	if (q->pfd_iofds != NULL) {
+		aosl_free (q->pfd_iofds);
+		q->pfd_iofds = NULL;
+	}
+
+	q->pfd_count = 0;
+	q->pfd_size = 0;
+}
+
+int os_mp_init_poll (struct mp_queue *q)
+{
+	q->pfds = (aosl_poll_event_t *)aosl_malloc (sizeof (aosl_poll_event_t) * POLL_INIT_FDS);
+	q->pfd_iofds = (struct iofd **)aosl_malloc (sizeof (struct iofd *) * POLL_INIT_FDS);
+	if (q->pfds == NULL || q->pfd_iofds == NULL) {
+		os_mp_fini_poll (q);
+		return -AOSL_ENOMEM;
+	}
+
+	/* slot 0 is reserved for the wakeup pipe */
+	q->pfds [0].fd = AOSL_INVALID_FD;
+	q->pfds [0].events = 0;
+	q->pfds [0].revents = 0;
+	q->pfd_iofds [0] = NULL;
+	q->pfd_count = 1;
+	q->pfd_size = POLL_INIT_FDS;
+	q->pfd_next = 1;
+	return 0;
 }
 
 int os_activate_sigp_poll (struct mp_queue *q)
 {
+	q->pfds [0].fd = q->sigp.piper;
+	q->pfds [0].events = AOSL_POLLIN;
+	q->pfds [0].revents = 0;
 	return 0;
 }
 
 int os_deactivate_sigp_poll (struct mp_queue *q)
 {
+	q->pfds [0].fd = AOSL_INVALID_FD;
+	q->pfds [0].events = 0;
 	return 0;
 }
 
 int os_add_event_fd_poll (struct mp_queue *q, struct iofd *f)
 {
+	aosl_poll_event_t *pfd;
+
+	if (q->pfd_count >= q->pfd_size) {
+		int err = __poll_fds_grow (q);
+		if (err < 0)
+			return err;
+	}
+
 	if (f->read_f != NULL)
 		f->flags |= AOSL_POLLIN;
 
 	if (f->write_f != NULL)
 		f->flags |= AOSL_POLLOUT;
 
+	f->mp_idx = q->pfd_count;
+	pfd = &q->pfds [f->mp_idx];
+	pfd->fd = iofd_fobj (f)->fd;
+	pfd->events = f->flags & (AOSL_POLLIN | AOSL_POLLOUT);
+	pfd->revents = 0;
+	q->pfd_iofds [f->mp_idx] = f;
+	q->pfd_count++;
 	return 0;
 }
 
 int os_del_event_fd_poll (struct mp_queue *q, struct iofd *f)
 {
+	int idx = f->mp_idx;
+	int last;
+
+	if (idx <= 0 || idx >= q->pfd_count || q->pfd_iofds [idx] != f)
+		return -AOSL_ENOENT;
+
+	/* move the last slot to the hole */
+	last = q->pfd_count - 1;
+	if (idx != last) {
+		q->pfds [idx] = q->pfds [last];
+		q->pfd_iofds [idx] = q->pfd_iofds [last];
+		q->pfd_iofds [idx]->mp_idx = idx;
+	}
+
+	q->pfd_iofds [last] = NULL;
+	q->pfd_count--;
+	f->mp_idx = -1;
 	return 0;
 }
 
-#define POLL_MAX_FDS 1024
+void os_rearm_event_fd_poll (struct mp_queue *q, struct iofd *f, uint32_t events)
+{
+	int idx = f->mp_idx;
+	if (idx > 0 && idx < q->pfd_count)
+		q->pfds [idx].events |= events;
+}
 
 int os_mp_wait_poll (struct mp_queue *q, aosl_poll_event_t *events, int maxevents, intptr_t timeo)
 {
 	int err;
 	uint64_t time_stamp = 0;
-	aosl_poll_event_t *fds;
-	aosl_poll_event_t *pfd;
-	size_t fds_count;
-	struct iofd *f = NULL;
-
-	if (q->iofd_count > POLL_MAX_FDS)
-		return -AOSL_ENFILE;
-
-	fds_count = q->iofd_count;
-	fds_count++;
-	fds = (aosl_poll_event_t *)aosl_alloca (sizeof (aosl_poll_event_t) * fds_count);
 
 	if (timeo > 0)
 		time_stamp = aosl_tick_now ();
@@ -83,74 +187,70 @@ __again:
 			timeo = 0;
 	}
 
-	pfd = fds;
-	pfd->fd = q->sigp.piper;
-	pfd->events = AOSL_POLLIN;
-	pfd->revents = 0;
-	pfd++;
-
-	aosl_list_for_each_entry_t (struct iofd, f, &q->iofds, node) {
-		pfd->fd = iofd_fobj (f)->fd;
-		pfd->events = 0;
-		pfd->revents = 0;
-
-		if (f->flags & AOSL_POLLIN)
-			pfd->events |= AOSL_POLLIN;
-
-		if (f->flags & AOSL_POLLOUT)
-			pfd->events |= AOSL_POLLOUT;
-
-		pfd++;
-	}
-
-	err = aosl_hal_poll (fds, fds_count, timeo);
+	err = aosl_hal_poll (q->pfds, q->pfd_count, timeo);
 	if (err < 0 && (err == AOSL_HAL_RET_EINTR))
 		goto __again;
 
 	if (err > 0) {
-		int i;
-		for (i = 0; i < maxevents; i++) {
-			events [i].fd = AOSL_INVALID_FD;
-			events [i].events = 0;
-		}
-
-		pfd = fds;
-		i = 0;
-
-		BUG_ON (pfd->fd != q->sigp.piper);
-
-		if (pfd->revents & AOSL_POLLIN) {
-			events [i].fd = q->sigp.piper;
-			events [i].events = AOSL_POLLIN;
-			i++;
-		}
-
-		pfd++;
-
-		aosl_list_for_each_entry_t (struct iofd, f, &q->iofds, node) {
-			BUG_ON (pfd->fd != iofd_fobj (f)->fd);
-
+		aosl_poll_event_t *pfd;
+		int ready = err;
+		int i = 0;
+		int slots;
+		int idx;
+
+		pfd = &q->pfds [0];
+		if (pfd->revents != 0) {
 			if (pfd->revents & AOSL_POLLIN) {
-				f->flags &= ~AOSL_POLLIN;
-				events [i].events |= AOSL_POLLIN;
-			}
-
-			if (pfd->revents & AOSL_POLLOUT) {
-				f->flags &= ~AOSL_POLLOUT;
-				events [i].events |= AOSL_POLLOUT;
-			}
-
-			if (events [i].events != 0) {
-				events [i].fd = iofd_fobj (f)->fd;
+				events [i].fd = q->sigp.piper;
+				events [i].events = AOSL_POLLIN;
 				i++;
 			}
+			pfd->revents = 0;
+			ready--;
+		}
 
-			if (i >= err || i >= maxevents)
-				break;
+		/**
+		 * Only scan the slots until all the ready ones have been found.
+		 * The one-shot interest bits of the reported events are cleared
+		 * both in the slot and the iofd flags, and they will be re-armed
+		 * via os_rearm_event_fd after the read/write operations. The hal
+		 * poll only ORs the revents in, so clear them when consumed, the
+		 * events exceed maxevents are just dropped and polled again, and
+		 * the next scan starts from the first dropped slot for fairness.
+		 **/
+		idx = q->pfd_next;
+		if (idx < 1 || idx >= q->pfd_count)
+			idx = 1;
+
+		for (slots = q->pfd_count - 1; slots > 0 && ready > 0; slots--) {
+			uint32_t revents;
+
+			pfd = &q->pfds [idx];
+			if (pfd->revents != 0) {
+				revents = pfd->revents & (AOSL_POLLIN | AOSL_POLLOUT);
+				pfd->revents = 0;
+				ready--;
+				if (revents != 0) {
+					if (i < maxevents) {
+						pfd->events &= ~revents;
+						q->pfd_iofds [idx]->flags &= ~revents;
+						events [i].fd = pfd->fd;
+						events [i].events = revents;
+						i++;
+					} else if (i == maxevents) {
+						q->pfd_next = idx;
+						i++;
+					}
+				}
+			}
 
-			pfd++;
+			if (++idx >= q->pfd_count)
+				idx = 1;
 		}
 
+		if (i > maxevents)
+			return maxevents;
+
 		return i;
 	}
 
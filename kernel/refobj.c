@@ -253,41 +253,20 @@ static void refobj_lock_threads_cleanup (struct refobj *robj)
 	}
 }
 
-static int cmp_thread (struct aosl_rb_node *rb_node, struct aosl_rb_node *node, va_list args)
-{
-	struct robj_thread_node *rb_entry = aosl_rb_entry (rb_node, struct robj_thread_node, rb_node);
-	k_thread_t thread_id;
-
-	if (node != NULL) {
-		thread_id = aosl_rb_entry (node, struct robj_thread_node, rb_node)->thread_id;
-	} else {
-		thread_id = va_arg (args, k_thread_t);
-	}
-
-	if (rb_entry->thread_id > thread_id)
-		return 1;
+#define thread_node_id(thread_node) ((thread_node)->thread_id)
 
-	if (rb_entry->thread_id < thread_id)
-		return -1;
-
-	return 0;
-}
+AOSL_RB_DEFINE (thread_rb, struct robj_thread_node, rb_node, k_thread_t, thread_node_id, AOSL_RB_CMP)
 
 static struct robj_thread_node *robj_this_thread_node_get (struct refobj *robj, int create)
 {
-	struct aosl_rb_node *node;
 	struct robj_thread_node *thread_node;
 	k_thread_t this_thread;
 
 	this_thread = k_thread_self ();
 	k_rwlock_rdlock (&robj->thread_nodes_lock);
-	node = aosl_find_rb_node (&robj->thread_nodes, NULL, this_thread);
-	if (node != NULL) {
-		thread_node = aosl_rb_entry (node, struct robj_thread_node, rb_node);
+	thread_node = thread_rb_find (&robj->thread_nodes, this_thread);
+	if (thread_node != NULL)
 		__thread_node_get (thread_node); /* Increase the usage inside the read lock */
-	} else {
-		thread_node = NULL;
-	}
 	k_rwlock_rdunlock (&robj->thread_nodes_lock);
 
 	if (thread_node == NULL && create) {
@@ -308,7 +287,7 @@ static struct robj_thread_node *robj_this_thread_node_get (struct refobj *robj,
 		 * itself, so no racing condition after we released the read
 		 * lock and before the write lock.
 		 **/
-		aosl_rb_insert_node (&robj->thread_nodes, &thread_node->rb_node);
+		thread_rb_add (&robj->thread_nodes, thread_node);
 		k_rwlock_wrunlock (&robj->thread_nodes_lock);
 	}
 
@@ -436,7 +415,7 @@ static int refobj_ctor (struct refobj *robj, void *arg, aosl_ref_dtor_t dtor, in
 		refobj_set_caller_free (robj);
 
 	k_rwlock_init (&robj->thread_nodes_lock);
-	aosl_rb_root_init (&robj->thread_nodes, cmp_thread);
+	aosl_rb_root_init (&robj->thread_nodes, NULL);
 	return 0;
 }
 
@@ -24,6 +24,10 @@
 #include <api/aosl_mpq_net.h>
 #include <api/aosl_route.h>
 #include <api/aosl_mpq_fd.h>
+#include <api/aosl_mpq_timer.h>
+#include <api/aosl_time.h>
+#include <api/aosl_mm.h>
+#include <api/aosl_list.h>
 
 #include <kernel/rt_monitor.h>
 #include <kernel/kernel.h>
@@ -74,41 +78,16 @@ static __inline__ int __socket_nl_rt ()
 
 static uint32_t __nlmsg_seq = 0;
 
-static int update_ifinfos (struct nlmsghdr *h)
-{
-	const char *ifname;
-	struct ifinfomsg *ifi = NLMSG_DATA (h);
-	struct rtattr *rtas [__IFLA_MAX];
-	struct rtattr *rta;
-
-	if (h->nlmsg_type != RTM_NEWLINK && h->nlmsg_type != RTM_DELLINK)
-		return 0;
-
-	if (h->nlmsg_len < NLMSG_LENGTH (sizeof (struct ifinfomsg)))
-		return -1;
-
-	if (h->nlmsg_type == RTM_DELLINK)
-		return update_netifs (1, ifi->ifi_index);
-
-	parse_rtattrs (IFLA_RTA (ifi), IFLA_PAYLOAD (h), rtas, __IFLA_MAX);
+typedef void (*nl_dump_func_t) (struct nlmsghdr *h, void *arg);
 
-	rta = rtas [IFLA_IFNAME];
-	if (rta != NULL) {
-		ifname = (const char *)RTA_DATA (rta);
-	} else {
-		ifname = NULL;
-	}
-
-	return update_netifs (0, ifi->ifi_index, ifname, ifi->ifi_type);
-}
-
-static int afnetlink_init_netifs ()
+/* dump the links or routes of the specified family, passing each message to f */
+static int __nl_dump (uint16_t type, uint8_t family, nl_dump_func_t f, void *arg)
 {
 	int sk;
 	isize_t err;
 	char req [sizeof (struct nlmsghdr) + sizeof (struct rtmsg)];
 	struct nlmsghdr *nlh = (struct nlmsghdr *)req;
-	struct ifinfomsg *ifm = (struct ifinfomsg *)(nlh + 1);
+	struct rtmsg *rtm = (struct rtmsg *)(nlh + 1);
 	uint32_t seq = __nlmsg_seq++;
 
 	sk = __socket_nl_rt ();
@@ -118,12 +97,13 @@ static int afnetlink_init_netifs ()
 	memset (req, 0, sizeof req);
 
 	nlh->nlmsg_len = sizeof req;
-	nlh->nlmsg_type = RTM_GETLINK;
+	nlh->nlmsg_type = type;
 	nlh->nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST;
 	nlh->nlmsg_pid = 0;
 	nlh->nlmsg_seq = seq;
 
-	ifm->ifi_family = AOSL_AF_UNSPEC;
+	/* rtm_family and ifi_family are both the first byte */
+	rtm->rtm_family = family;
 
 	err = send (sk, req, sizeof req, 0);
 	if (err < (int)sizeof req) {
@@ -156,15 +136,11 @@ static int afnetlink_init_netifs ()
 
 				err = -err_h->error;
 				goto __close_sk;
-			case RTM_NEWLINK:
-				break;
-			case RTM_DELLINK:
-				break;
 			default:
-				continue;
+				break;
 			}
 
-			update_ifinfos (h);
+			f (h, arg);
 		}
 	}
 
@@ -173,6 +149,44 @@ __close_sk:
 	return (int)err;
 }
 
+static int update_ifinfos (struct nlmsghdr *h)
+{
+	const char *ifname;
+	struct ifinfomsg *ifi = NLMSG_DATA (h);
+	struct rtattr *rtas [__IFLA_MAX];
+	struct rtattr *rta;
+
+	if (h->nlmsg_type != RTM_NEWLINK && h->nlmsg_type != RTM_DELLINK)
+		return 0;
+
+	if (h->nlmsg_len < NLMSG_LENGTH (sizeof (struct ifinfomsg)))
+		return -1;
+
+	if (h->nlmsg_type == RTM_DELLINK)
+		return update_netifs (1, ifi->ifi_index);
+
+	parse_rtattrs (IFLA_RTA (ifi), IFLA_PAYLOAD (h), rtas, __IFLA_MAX);
+
+	rta = rtas [IFLA_IFNAME];
+	if (rta != NULL) {
+		ifname = (const char *)RTA_DATA (rta);
+	} else {
+		ifname = NULL;
+	}
+
+	return update_netifs (0, ifi->ifi_index, ifname, ifi->ifi_type);
+}
+
+static void __dump_ifinfo (struct nlmsghdr *h, void *arg)
+{
+	update_ifinfos (h);
+}
+
+static int afnetlink_init_netifs ()
+{
+	return __nl_dump (RTM_GETLINK, AOSL_AF_UNSPEC, __dump_ifinfo, NULL);
+}
+
 static int __get_if_wireless(const char *if_name)
 {
 	if (!if_name)
@@ -200,222 +214,283 @@ static int __get_if_wireless(const char *if_name)
 }
 
 /**
- * Return value is whether the default route exists for the specified af.
- *      0: the default route does not exist for the specified af
- *      1: the default route exists for the specified af
+ * A unicast default route with an output interface, as learned from
+ * a route dump or a route message.
  **/
-static int __af_get_default_rt (uint16_t af, aosl_rt_t *rt, uint32_t *tb_id_p)
+struct def_rt_entry {
+	struct aosl_list_head node;
+	uint32_t table;
+	uint32_t priority;
+	int has_priority;
+	int oif;
+	int gw_len;
+	uint8_t gw [16];
+};
+
+static __inline__ int __af_idx (uint8_t family)
 {
-	int sk;
-	isize_t err;
-	int def_rt_exist = 0;
-	int def_rt_cnt = 0;
-	char req [sizeof (struct nlmsghdr) + sizeof (struct rtmsg)];
-	struct nlmsghdr *nlh = (struct nlmsghdr *)req;
-	struct rtmsg *rtm = (struct rtmsg *)(nlh + 1);
+	switch (family) {
+	case AF_INET:
+		return 0;
+	case AF_INET6:
+		return 1;
+	default:
+		break;
+	}
+
+	return -1;
+}
+
+/**
+ * Parse a route message into e, return value is the address family
+ * index of the route, or -1 if it is not a default route we care.
+ **/
+static int __parse_def_rt (struct nlmsghdr *h, struct def_rt_entry *e)
+{
+	struct rtattr *rtas [__RTA_MAX];
+	struct rtmsg *rtm = NLMSG_DATA (h);
+	struct rtattr *rta;
+	int af_idx;
+
+	if (h->nlmsg_len < NLMSG_LENGTH (sizeof (struct rtmsg)))
+		return -1;
+
+	if (rtm->rtm_type != RTN_UNICAST || rtm->rtm_dst_len != 0)
+		return -1;
+
+	af_idx = __af_idx (rtm->rtm_family);
+	if (af_idx < 0)
+		return -1;
+
+	parse_rtattrs (RTM_RTA (rtm), RTM_PAYLOAD (h), rtas, __RTA_MAX);
 
 	/**
-	 * This variable must be defined outside the following for loop,
-	 * because the rta_oif/rta_gw etc pointers whick pointing to it
-	 * and will be used outside the for loop, although this operation
-	 * makes no trouble, but we use a memory outside its' scope.
+	 * Skip the routes without output interface, this is very important,
+	 * otherwise we would get unexpected result for the multiple route
+	 * table cases, because some route table may have rtm_dst_len is zero,
+	 * but have no RTA_GATEWAY attribute.
+	 *
+	 * The Xinke system of Zhiyang has a very strange behavior that
+	 * the default route has no GW attribute, so we should consider
+	 * these cases, if the default route having no GW attribute, we
+	 * would clear the GW with zeros.
 	 **/
-	char buf [16384];
-	struct rtattr *rta_priority = NULL;
-	struct rtattr *rta_oif = NULL;
-	struct rtattr *rta_gw = NULL;
-	uint32_t min_metric = 0xffffffffu; /* set to the max unsigned integer value */
-	uint32_t seq = __nlmsg_seq++;
+	if (rtas [RTA_OIF] == NULL)
+		return -1;
 
-	aosl_invalidate_rt (rt);
+#ifdef CONFIG_AOSL_IPV6
+	// TODO(zgx): ignore fe80:: scope link ipv6 route
+#endif
 
-	sk = __socket_nl_rt ();
-	if (sk < 0)
-		return 0;
+	e->oif = *(int *)RTA_DATA (rtas [RTA_OIF]);
 
-	memset (req, 0, sizeof req);
+	rta = rtas [RTA_TABLE];
+	e->table = (rta != NULL) ? *(uint32_t *)RTA_DATA (rta) : rtm->rtm_table;
 
-	nlh->nlmsg_len = sizeof req;
-	nlh->nlmsg_type = RTM_GETROUTE;
-	nlh->nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST;
-	nlh->nlmsg_pid = 0;
-	nlh->nlmsg_seq = seq;
+	rta = rtas [RTA_PRIORITY];
+	e->has_priority = (rta != NULL);
+	e->priority = (rta != NULL) ? *(uint32_t *)RTA_DATA (rta) : 0;
 
-	rtm->rtm_family = af;
+	rta = rtas [RTA_GATEWAY];
+	e->gw_len = 0;
+	if (rta != NULL) {
+		e->gw_len = RTA_PAYLOAD (rta);
+		if (e->gw_len > (int)sizeof e->gw)
+			e->gw_len = sizeof e->gw;
 
-	err = send (sk, req, sizeof req, 0);
-	if (err < (int)sizeof req)
-		goto __close_sk;
+		memcpy (e->gw, RTA_DATA (rta), e->gw_len);
+	}
 
-	for (;;) {
-		struct nlmsghdr *h;
-		err = recv (sk, buf, sizeof buf, 0);
-		if (err <= 0)
-			goto __done;
+	return af_idx;
+}
 
-		for (h = (struct nlmsghdr *)buf; NLMSG_OK (h, err); h = NLMSG_NEXT (h, err)) {
-			struct rtattr *rtas [__RTA_MAX];
-			struct rtmsg *rtm;
-			struct nlmsgerr *err_h;
+static int __same_def_rt_entry (const struct def_rt_entry *e1, const struct def_rt_entry *e2)
+{
+	return e1->table == e2->table && e1->has_priority == e2->has_priority &&
+	       e1->priority == e2->priority && e1->oif == e2->oif &&
+	       e1->gw_len == e2->gw_len && memcmp (e1->gw, e2->gw, e1->gw_len) == 0;
+}
 
-			switch (h->nlmsg_type) {
-			case NLMSG_DONE:
-				goto __done;
-			case NLMSG_ERROR:
-				err_h = (struct nlmsgerr *)NLMSG_DATA (h);
-				if (h->nlmsg_len < NLMSG_LENGTH (sizeof (struct nlmsgerr))) {
-					//aosl_errno = EMSGSIZE;
-					goto __done;
-				}
-				//errno = err_h->error;
-				goto __done;
-			case RTM_NEWROUTE:
-				break;
-			case RTM_DELROUTE:
-				/* fall through */
-			default:
-				continue;
-			}
+static int __def_rt_list_add (struct aosl_list_head *list, const struct def_rt_entry *e)
+{
+	struct def_rt_entry *node;
 
-			rtm = NLMSG_DATA (h);
-			if (rtm->rtm_type != RTN_UNICAST)
-				continue;
+	aosl_list_for_each_entry_t (struct def_rt_entry, node, list, node) {
+		if (__same_def_rt_entry (node, e))
+			return 0;
+	}
 
-			switch (rtm->rtm_family) {
-			case AF_INET:
-				/* fall through */
-			case AF_INET6:
-				break;
-			default:
-				continue;
-			}
+	node = aosl_malloc (sizeof *node);
+	if (node == NULL)
+		return -AOSL_ENOMEM;
 
-			/* the default route */
-			if (rtm->rtm_dst_len == 0) {
-				parse_rtattrs (RTM_RTA (rtm), RTM_PAYLOAD (h), rtas, __RTA_MAX);
-				/**
-				 * Skip the routes without output interface or gateway, this is
-				 * very important, otherwise we would get unexpected result for
-				 * the multiple route table cases, because some route table may
-				 * have rtm_dst_len is zero, but have no RTA_GATEWAY attribute.
-				 *
-				 * The Xinke system of Zhiyang has a very strange behavior that
-				 * the default route has no GW attribute, so we should consider
-				 * these cases, if the default route having no GW attribute, we
-				 * would clear the GW with zeros.
-				 **/
-				if (rtas [RTA_OIF] == NULL /*|| rtas [RTA_GATEWAY] == NULL*/)
-					continue;
+	memcpy (node, e, sizeof *node);
+	aosl_list_add_tail (&node->node, list);
+	return 1;
+}
 
-#ifdef CONFIG_AOSL_IPV6
-				// TODO(zgx): ignore fe80:: scope link ipv6 route
-#endif
+static void __def_rt_list_free (struct aosl_list_head *list)
+{
+	struct def_rt_entry *node;
 
-				++def_rt_cnt;
-
-				/**
-				 * According to studying the linux/xnu kernel source code and testing it many times,
-				 * we found that there are many differences between the mechanisms of how the
-				 * xnu kernel and the linux kernel handles the default routes:
-				 * 1. linux kernel allows many default routes to be added as long as the metrics
-				 *	   are different, regardless the scope parameter, metric has a smaller value
-				 *	   means this route has a higher priority(fib_info.fib_priority for IPv4 and
-				 *	   rt6_info.rt6i_metric for IPv6), we could not add more than one default route
-				 *	   with the same metric in linux even they have different scopes, but we can only
-				 *	   add one default route with the same metric for IPv4 and IPv6 respectively, so
-				 *	   we can retrieve at most 2 different default routes with the same metric in linux.
-				 * 2. xnu kernel allows many default routes, but only ONE global default route is
-				 *	   allowed, all other default routes must be interface scope(RTF_IFSCOPE),
-				 *	   and xnu routing system has no metric parameter. But we can do add a global
-				 *	   default route for both IPv4 and IPv6 at the same time, so we also can retrieve
-				 *	   at most 2 different default routes with global scope in xnu.
-				 *
-				 * So, we only care the default route with minimal metric value for linux kernel.
-				 **/
-				rta_priority = rtas [RTA_PRIORITY];
-				if (rta_priority != NULL) {
-					uint32_t pri = *(uint32_t *)RTA_DATA (rta_priority);
-					if (pri < min_metric) {
-						min_metric = pri;
-						rta_oif = rtas [RTA_OIF];
-						rta_gw = rtas [RTA_GATEWAY];
-					}
-				} else if (rta_oif == NULL && rta_gw == NULL) {
-					rta_oif = rtas [RTA_OIF];
-					rta_gw = rtas [RTA_GATEWAY];
-				}
-			}
-		}
+	for (;;) {
+		node = aosl_list_remove_head_entry (list, struct def_rt_entry, node);
+		if (node == NULL)
+			break;
+
+		aosl_free (node);
 	}
+}
 
-__done:
-	if (rta_oif != NULL) {
-		void *gw_af_addr;
-		int oif = *(int *)RTA_DATA (rta_oif);
-		aosl_netif_t *nif = netif_by_index (oif);
+static void __dump_def_rt (struct nlmsghdr *h, void *arg)
+{
+	struct aosl_list_head *lists = (struct aosl_list_head *)arg;
+	struct def_rt_entry e;
+	int af_idx;
+
+	if (h->nlmsg_type != RTM_NEWROUTE)
+		return;
+
+	af_idx = __parse_def_rt (h, &e);
+	if (af_idx >= 0)
+		__def_rt_list_add (&lists [af_idx], &e);
+}
 
-		rt->netif.if_index = oif;
-		if (nif != NULL) {
-			rt->netif.if_type = nif->if_type;
-			strcpy (rt->netif.if_name, nif->if_name);
+static void __rt_set_netif (aosl_rt_t *rt, int oif)
+{
+	aosl_netif_t nif;
+	int if_wireless;
+	int if_cellnet;
+
+	rt->netif.if_index = oif;
+	if (netif_get (oif, &nif) == 0) {
+		rt->netif.if_type = nif.if_type;
+		strcpy (rt->netif.if_name, nif.if_name);
+
+		/* probing the wireless attribute needs a socket and an ioctl, so cache it with the link */
+		if (netif_get_attrs (oif, &if_wireless, &if_cellnet) < 0) {
 #ifdef CONFIG_ANDROID
-			rt->if_cellnet = (int)(!!memcmp (nif->if_name, "wlan", 4));
+			if_cellnet = (int)(!!memcmp (nif.if_name, "wlan", 4));
 #else
-			rt->if_cellnet = 0; /* if_type: ARPHRD_ETHER/ARPHRD_AX25/ARPHRD_IEEE80211, but no cellnet type :-( */
+			if_cellnet = 0; /* if_type: ARPHRD_ETHER/ARPHRD_AX25/ARPHRD_IEEE80211, but no cellnet type :-( */
 #endif
-			rt->if_wireless = __get_if_wireless(nif->if_name);
-		} else {
-			rt->netif.if_type = -1;
-			sprintf (rt->netif.if_name, "%d", oif);
+			if_wireless = __get_if_wireless (nif.if_name);
+			netif_set_attrs (oif, if_wireless, if_cellnet);
+		}
+
+		rt->if_cellnet = if_cellnet;
+		rt->if_wireless = if_wireless;
+	} else {
+		rt->netif.if_type = -1;
+		sprintf (rt->netif.if_name, "%d", oif);
 #ifdef CONFIG_ANDROID
-			rt->if_cellnet = 1; /* default, is cellular net */
+		rt->if_cellnet = 1; /* default, is cellular net */
 #else
-			rt->if_cellnet = 0; /* if_type: ARPHRD_ETHER/ARPHRD_AX25/ARPHRD_IEEE80211, but no cellnet type :-( */
+		rt->if_cellnet = 0; /* if_type: ARPHRD_ETHER/ARPHRD_AX25/ARPHRD_IEEE80211, but no cellnet type :-( */
 #endif
-		}
+		rt->if_wireless = 0;
+	}
+}
 
-		if (rta_gw != NULL) {
-			if (rtm->rtm_family == AF_INET) {
-				gw_af_addr = &rt->gw.in.sin_addr;
-			} else {
-				gw_af_addr = &rt->gw.in6.sin6_addr;
-			}
+/**
+ * Select the default route of the specified af from the list.
+ * Return value is whether the default route exists for the specified af.
+ *      0: the default route does not exist for the specified af
+ *      1: the default route exists for the specified af
+ **/
+static int __select_def_rt (struct aosl_list_head *list, uint16_t af, aosl_rt_t *rt)
+{
+	struct def_rt_entry *e;
+	struct def_rt_entry *sel = NULL;
+	uint32_t min_metric = 0xffffffffu; /* set to the max unsigned integer value */
+	int def_rt_cnt = 0;
 
-			memcpy (gw_af_addr, RTA_DATA (rta_gw), RTA_PAYLOAD (rta_gw));
-		} else {
-			/**
-			 * The Xinke system of Zhiyang has a very strange behavior that
-			 * the default route has no GW attribute, so we should consider
-			 * these cases, if the default route having no GW attribute, we
-			 * would clear the GW with zeros.
-			 **/
-			memset (&rt->gw, 0, sizeof rt->gw);
-		}
+	aosl_invalidate_rt (rt);
 
-		rt->gw.sa.sa_family = rtm->rtm_family;
-		if (tb_id_p != NULL) {
-			{
-				*tb_id_p = 0;
+	aosl_list_for_each_entry_t (struct def_rt_entry, e, list, node) {
+		++def_rt_cnt;
+
+		/**
+		 * According to studying the linux/xnu kernel source code and testing it many times,
+		 * we found that there are many differences between the mechanisms of how the
+		 * xnu kernel and the linux kernel handles the default routes:
+		 * 1. linux kernel allows many default routes to be added as long as the metrics
+		 *	   are different, regardless the scope parameter, metric has a smaller value
+		 *	   means this route has a higher priority(fib_info.fib_priority for IPv4 and
+		 *	   rt6_info.rt6i_metric for IPv6), we could not add more than one default route
+		 *	   with the same metric in linux even they have different scopes, but we can only
+		 *	   add one default route with the same metric for IPv4 and IPv6 respectively, so
+		 *	   we can retrieve at most 2 different default routes with the same metric in linux.
+		 * 2. xnu kernel allows many default routes, but only ONE global default route is
+		 *	   allowed, all other default routes must be interface scope(RTF_IFSCOPE),
+		 *	   and xnu routing system has no metric parameter. But we can do add a global
+		 *	   default route for both IPv4 and IPv6 at the same time, so we also can retrieve
+		 *	   at most 2 different default routes with global scope in xnu.
+		 *
+		 * So, we only care the default route with minimal metric value for linux kernel.
+		 **/
+		if (e->has_priority) {
+			if (e->priority < min_metric) {
+				min_metric = e->priority;
+				sel = e;
 			}
+		} else if (sel == NULL) {
+			sel = e;
 		}
+	}
 
-#if 0 //def CONFIG_AOSL_IPV6
-		// ignore fe80:: scope link route
-		if (rt->gw.sa.sa_family == AF_INET6) {
-			if (rt->gw.in6.sin6_addr.s6_addr_v[0] == 0xfe && rt->gw.in6.sin6_addr.s6_addr_v[1] == 0x80) {
-					aosl_invalidate_rt (rt);
-				goto __close_sk;
-			}
+	if (sel == NULL)
+		return 0;
+
+	__rt_set_netif (rt, sel->oif);
+
+	if (sel->gw_len > 0) {
+		void *gw_af_addr;
+
+		if (af == AF_INET) {
+			gw_af_addr = &rt->gw.in.sin_addr;
+		} else {
+			gw_af_addr = &rt->gw.in6.sin6_addr;
 		}
-#endif
 
-		// ignore the case that more than two default routes
-		rt->def_rt_cnt = def_rt_cnt > 2 ? 2 : def_rt_cnt;
-		def_rt_exist = 1;
+		memcpy (gw_af_addr, sel->gw, sel->gw_len);
+	} else {
+		/**
+		 * The Xinke system of Zhiyang has a very strange behavior that
+		 * the default route has no GW attribute, so we should consider
+		 * these cases, if the default route having no GW attribute, we
+		 * would clear the GW with zeros.
+		 **/
+		memset (&rt->gw, 0, sizeof rt->gw);
 	}
 
-__close_sk:
-	close (sk);
+	rt->gw.sa.sa_family = af;
+
+	// ignore the case that more than two default routes
+	rt->def_rt_cnt = def_rt_cnt > 2 ? 2 : def_rt_cnt;
+	return 1;
+}
+
+/**
+ * Return value is whether the default route exists for the specified af.
+ *      0: the default route does not exist for the specified af
+ *      1: the default route exists for the specified af
+ **/
+static int __af_get_default_rt (uint16_t af, aosl_rt_t *rt)
+{
+	struct aosl_list_head lists [2];
+	int af_idx = __af_idx ((uint8_t)af);
+	int def_rt_exist = 0;
+
+	aosl_invalidate_rt (rt);
+
+	aosl_list_head_init (&lists [0]);
+	aosl_list_head_init (&lists [1]);
+	if (__nl_dump (RTM_GETROUTE, (uint8_t)af, __dump_def_rt, lists) == 0)
+		def_rt_exist = __select_def_rt (&lists [af_idx], af, rt);
+
+	__def_rt_list_free (&lists [0]);
+	__def_rt_list_free (&lists [1]);
 	return def_rt_exist;
 }
 
@@ -429,9 +504,122 @@ int os_get_def_rt (aosl_def_rt_t *def_rt)
 {
 	int got_v4 = 0, got_v6 = 0;
 
-	got_v4 = __af_get_default_rt (AF_INET, &def_rt->IPv4, NULL);
+	got_v4 = __af_get_default_rt (AF_INET, &def_rt->IPv4);
 #ifdef CONFIG_AOSL_IPV6
-	got_v6 = __af_get_default_rt (AF_INET6, &def_rt->IPv6, NULL);
+	got_v6 = __af_get_default_rt (AF_INET6, &def_rt->IPv6);
+#endif
+
+	return got_v4 + got_v6;
+}
+
+/**
+ * The default routes kept up to date by the multicast route messages
+ * while the net events are subscribed, so evaluating the default route
+ * needs no dump. It is only touched on the subscriber queue.
+ *
+ * The kernel flushes the IPv4 routes of a link going down without any
+ * route message, so a link message marks the cache stale, and the next
+ * evaluation dumps the routes again. The evaluations are coalesced by
+ * the RT_EVAL_DELAY_MS one-shot timer, a route flap costs one per window
+ * rather than one per message.
+ **/
+#define RT_EVAL_DELAY_MS 50
+
+static struct aosl_list_head def_rt_cache [2] = {
+	AOSL_LIST_HEAD_INIT (def_rt_cache [0]),
+	AOSL_LIST_HEAD_INIT (def_rt_cache [1]),
+};
+
+static int def_rt_cache_stale = 1;
+static aosl_timer_t rt_eval_timer = AOSL_MPQ_TIMER_INVALID;
+static int rt_eval_pending = 0;
+
+static void __def_rt_cache_clear (void)
+{
+	__def_rt_list_free (&def_rt_cache [0]);
+	__def_rt_list_free (&def_rt_cache [1]);
+}
+
+static int __def_rt_cache_resync (void)
+{
+	int err;
+
+	__def_rt_cache_clear ();
+	err = __nl_dump (RTM_GETROUTE, AF_INET, __dump_def_rt, def_rt_cache);
+#ifdef CONFIG_AOSL_IPV6
+	if (err == 0)
+		err = __nl_dump (RTM_GETROUTE, AF_INET6, __dump_def_rt, def_rt_cache);
+#endif
+
+	return err;
+}
+
+/* apply a route message to the cache, return value is whether the cache changed */
+static int __def_rt_cache_update (struct nlmsghdr *h)
+{
+	struct def_rt_entry e;
+	struct def_rt_entry *node;
+	struct def_rt_entry *n;
+	int af_idx;
+	int changed = 0;
+
+	af_idx = __parse_def_rt (h, &e);
+	if (af_idx < 0)
+		return 0;
+
+	if (h->nlmsg_type == RTM_DELROUTE) {
+		aosl_list_for_each_entry_safe_t (struct def_rt_entry, node, n, &def_rt_cache [af_idx], node) {
+			if (__same_def_rt_entry (node, &e)) {
+				aosl_list_del (&node->node);
+				aosl_free (node);
+				return 1;
+			}
+		}
+
+		return 0;
+	}
+
+	/* a replaced route is announced by the new one only */
+	if (h->nlmsg_flags & NLM_F_REPLACE) {
+		aosl_list_for_each_entry_safe_t (struct def_rt_entry, node, n, &def_rt_cache [af_idx], node) {
+			if (node->table == e.table && node->has_priority == e.has_priority && node->priority == e.priority) {
+				aosl_list_del (&node->node);
+				aosl_free (node);
+				changed = 1;
+			}
+		}
+	}
+
+	switch (__def_rt_list_add (&def_rt_cache [af_idx], &e)) {
+	case 0:
+		break;
+	case 1:
+		changed = 1;
+		break;
+	default:
+		/* could not track it, dump again */
+		def_rt_cache_stale = 1;
+		changed = 1;
+		break;
+	}
+
+	return changed;
+}
+
+int os_get_monitored_def_rt (aosl_def_rt_t *def_rt)
+{
+	int got_v4 = 0, got_v6 = 0;
+
+	if (def_rt_cache_stale) {
+		if (__def_rt_cache_resync () < 0)
+			return os_get_def_rt (def_rt);
+
+		def_rt_cache_stale = 0;
+	}
+
+	got_v4 = __select_def_rt (&def_rt_cache [0], AF_INET, &def_rt->IPv4);
+#ifdef CONFIG_AOSL_IPV6
+	got_v6 = __select_def_rt (&def_rt_cache [1], AF_INET6, &def_rt->IPv6);
 #endif
 
 	return got_v4 + got_v6;
@@ -439,7 +627,25 @@ int os_get_def_rt (aosl_def_rt_t *def_rt)
 
 extern void check_report_def_rt_change_event (aosl_net_ev_func_t f, void *arg);
 
-static void __process_rtmsg (void *buf, size_t len, aosl_net_ev_func_t f, void *arg)
+static void __rt_eval_timeout (aosl_timer_t timer_id, const aosl_ts_t *now_p, uintptr_t argc, uintptr_t argv [])
+{
+	aosl_net_ev_func_t f = (aosl_net_ev_func_t)argv [0];
+	void *arg = (void *)argv [1];
+
+	rt_eval_pending = 0;
+	check_report_def_rt_change_event (f, arg);
+}
+
+static void __rt_eval_schedule (void)
+{
+	/* do not postpone a pending evaluation, so a long flap is still evaluated every window */
+	if (!rt_eval_pending && !aosl_mpq_timer_invalid (rt_eval_timer)) {
+		if (aosl_mpq_resched_oneshot_timer (rt_eval_timer, aosl_tick_now () + RT_EVAL_DELAY_MS) == 0)
+			rt_eval_pending = 1;
+	}
+}
+
+static void __process_rtmsg (void *buf, size_t len)
 {
 	struct nlmsghdr *hdr;
 	for (hdr = buf; hdr->nlmsg_type != NLMSG_DONE && NLMSG_OK (hdr, len); hdr = NLMSG_NEXT (hdr, len)) {
@@ -448,11 +654,14 @@ static void __process_rtmsg (void *buf, size_t len, aosl_net_ev_func_t f, void *
 			/* fall through */
 		case RTM_DELLINK:
 			update_ifinfos (hdr);
+			def_rt_cache_stale = 1;
+			__rt_eval_schedule ();
 			continue;
 		case RTM_NEWROUTE:
 			/* fall through */
 		case RTM_DELROUTE:
-			check_report_def_rt_change_event (f, arg);
+			if (__def_rt_cache_update (hdr))
+				__rt_eval_schedule ();
 			break;
 		default:
 			continue;
@@ -462,11 +671,8 @@ static void __process_rtmsg (void *buf, size_t len, aosl_net_ev_func_t f, void *
 
 static void __on_af_netlink_data (void *data, size_t len, uintptr_t argc, uintptr_t argv [], const aosl_sk_addr_t *addr)
 {
-	aosl_net_ev_func_t f = (aosl_net_ev_func_t)argv [0];
-	void *arg = (void *)argv [1];
-
 	if (len > 0)
-		__process_rtmsg (data, len, f, arg);
+		__process_rtmsg (data, len);
 }
 
 static void __on_af_netlink_event (int fd, int event, uintptr_t argc, uintptr_t argv []);
@@ -509,9 +715,11 @@ static void __on_af_netlink_event (int fd, int event, uintptr_t argc, uintptr_t
 		aosl_net_ev_func_t f = (aosl_net_ev_func_t)argv [0];
 		void *arg = (void *)argv [1];
 
-		/* if an error encountered, recreate the socket */
+		/* if an error encountered, recreate the socket, the lost messages need a dump */
 		aosl_close (fd);
 		__create_and_attach_af_netlink (f, arg);
+		def_rt_cache_stale = 1;
+		__rt_eval_schedule ();
 	}
 }
 
@@ -519,11 +727,21 @@ int os_subscribe_net_events (aosl_net_ev_func_t f, void *arg)
 {
 	int err;
 
+	rt_eval_timer = aosl_mpq_create_oneshot_timer (__rt_eval_timeout, NULL, 2, f, arg);
+	if (aosl_mpq_timer_invalid (rt_eval_timer))
+		return -1;
+
 	err = __create_and_attach_af_netlink (f, arg);
-	if (err < 0)
+	if (err < 0) {
+		aosl_mpq_kill_timer (rt_eval_timer);
+		rt_eval_timer = AOSL_MPQ_TIMER_INVALID;
 		return err;
+	}
 
 	afnetlink_init_netifs ();
+
+	/* the first evaluation dumps the routes, after the socket is listening */
+	def_rt_cache_stale = 1;
 	return err;
 }
 
@@ -533,6 +751,15 @@ void os_unsubscribe_net_events (void)
 		aosl_close (af_netlink_fd);
 		af_netlink_fd = -1;
 	}
+
+	if (!aosl_mpq_timer_invalid (rt_eval_timer)) {
+		aosl_mpq_kill_timer (rt_eval_timer);
+		rt_eval_timer = AOSL_MPQ_TIMER_INVALID;
+	}
+
+	rt_eval_pending = 0;
+	__def_rt_cache_clear ();
+	def_rt_cache_stale = 1;
 }
 
 #endif // __linux__
@@ -61,6 +61,13 @@ int os_del_event_fd_select (struct mp_queue *q, struct iofd *f)
 	return 0;
 }
 
+void os_rearm_event_fd_select (struct mp_queue *q, struct iofd *f, uint32_t events)
+{
+	UNUSED (q);
+	UNUSED (f);
+	UNUSED (events);
+}
+
 int os_mp_wait_select (struct mp_queue *q, aosl_poll_event_t *events, int maxevents, intptr_t timeo)
 {
 	int err;
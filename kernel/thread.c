@@ -7,13 +7,16 @@
  * Refer to the "LICENSE" file in the root directory for more information.
  ***************************************************************************/
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <kernel/compiler.h>
 #include <kernel/kernel.h>
 #include <kernel/err.h>
 #include <kernel/types.h>
 #include <kernel/thread.h>
+#include <kernel/log.h>
 #include <api/aosl_mm.h>
+#include <api/aosl_atomic.h>
 #include <api/aosl_log.h>
 #include <api/aosl_thread.h>
 #include <api/aosl_time.h>
@@ -28,30 +31,35 @@ void os_thread_init (void)
 
 void os_thread_fini (void)
 {
+	k_completion_fini ();
 	rb_tls_fini ();
 }
 
+void k_thread_set_name (const char *name)
+{
+	size_t namelen;
+	char __thread_name[THREAD_NAME_LEN];
+	const char *thread_name;
+
+	namelen = strlen (name);
+	if (namelen < THREAD_NAME_LEN) {
+		thread_name = name;
+	} else {
+		snprintf (__thread_name, THREAD_NAME_LEN, "%s", name);
+		thread_name = __thread_name;
+	}
+
+	aosl_hal_thread_set_name (thread_name);
+}
+
 static void *k_os_thread_entry (void *arg)
 {
 	k_thread_create_args_t *args = (k_thread_create_args_t *)arg;
 	k_thread_entry_t entry;
 
 	// set thread name
-	if (args->name != NULL) {
-		size_t namelen;
-		char __thread_name[THREAD_NAME_LEN];
-		const char *thread_name;
-
-		namelen = strlen (args->name);
-		if (namelen < THREAD_NAME_LEN) {
-			thread_name = args->name;
-		} else {
-			snprintf (__thread_name, THREAD_NAME_LEN, "%s", args->name);
-			thread_name = __thread_name;
-		}
-
-		aosl_hal_thread_set_name (thread_name);
-	}
+	if (args->name != NULL)
+		k_thread_set_name (args->name);
 
 	// set thread priority
 	if (args->pri >= AOSL_THRD_PRI_LOW && args->pri <= AOSL_THRD_PRI_RT)
@@ -65,7 +73,10 @@ static void *k_os_thread_entry (void *arg)
 	k_cond_signal (args->cond);
 	k_lock_unlock (args->lock);
 
+	k_log_thread_init ();
 	entry (arg);
+	k_log_thread_exit ();
+	k_tls_thread_exit ();
 
 	return NULL;
 }
@@ -125,6 +136,8 @@ k_thread_t k_thread_self (void)
 
 void k_thread_exit (void *retval)
 {
+	k_log_thread_exit ();
+	k_tls_thread_exit ();
 	aosl_hal_thread_exit(retval);
 }
 
@@ -387,6 +400,145 @@ void k_event_destroy (k_event_t *event)
 	k_cond_destroy (&event->cond);
 }
 
+#if defined(AOSL_HAL_HAVE_FUTEX) && AOSL_HAL_HAVE_FUTEX
+/**
+ * The futex word needs nothing but the memory, so just one object
+ * per thread, which also makes sure a late wakeup from the previous
+ * completer never hits any other futex word.
+ **/
+static K_THREAD_LOCAL k_completion_t __this_completion;
+
+k_completion_t *k_completion_get (void)
+{
+	k_completion_t *c = &__this_completion;
+
+	c->done = 0;
+	return c;
+}
+
+void k_completion_wait (k_completion_t *c)
+{
+	while (!c->done)
+		aosl_hal_futex_wait (&c->done, 0);
+
+	aosl_rmb ();
+}
+
+void k_completion_done (k_completion_t *c)
+{
+	aosl_wmb ();
+	c->done = 1;
+	aosl_hal_futex_wake (&c->done, 1);
+}
+
+void k_completion_put (k_completion_t *c)
+{
+	UNUSED (c);
+}
+
+void k_completion_fini (void)
+{
+}
+#else
+static k_static_lock_t completion_pool_lock = K_STATIC_LOCK_INIT;
+static k_completion_t *completion_pool = NULL;
+
+static k_completion_t *__completion_create (void)
+{
+	k_completion_t *c = (k_completion_t *)aosl_malloc (sizeof *c);
+	if (c == NULL)
+		abort ();
+
+#if defined(AOSL_HAL_HAVE_SEM) && AOSL_HAL_HAVE_SEM == 1
+	c->sem = aosl_hal_sem_create ();
+	if (c->sem == NULL)
+		abort ();
+#else
+	k_lock_init (&c->mutex);
+	k_cond_init (&c->cond);
+#endif
+	return c;
+}
+
+static void __completion_destroy (k_completion_t *c)
+{
+#if defined(AOSL_HAL_HAVE_SEM) && AOSL_HAL_HAVE_SEM == 1
+	aosl_hal_sem_destroy (c->sem);
+#else
+	k_lock_destroy (&c->mutex);
+	k_cond_destroy (&c->cond);
+#endif
+	aosl_free (c);
+}
+
+k_completion_t *k_completion_get (void)
+{
+	k_completion_t *c;
+
+	k_static_lock_lock (&completion_pool_lock);
+	c = completion_pool;
+	if (c != NULL)
+		completion_pool = c->next;
+	k_static_lock_unlock (&completion_pool_lock);
+
+	if (c == NULL)
+		c = __completion_create ();
+
+	c->done = 0;
+	return c;
+}
+
+void k_completion_wait (k_completion_t *c)
+{
+#if defined(AOSL_HAL_HAVE_SEM) && AOSL_HAL_HAVE_SEM == 1
+	/* one post for each completion, so the count never accumulates */
+	do {
+		aosl_hal_sem_wait (c->sem);
+	} while (!c->done);
+	aosl_rmb ();
+#else
+	k_lock_lock (&c->mutex);
+	while (!c->done)
+		k_cond_wait (&c->cond, &c->mutex);
+	k_lock_unlock (&c->mutex);
+#endif
+}
+
+void k_completion_done (k_completion_t *c)
+{
+#if defined(AOSL_HAL_HAVE_SEM) && AOSL_HAL_HAVE_SEM == 1
+	aosl_wmb ();
+	c->done = 1;
+	aosl_hal_sem_post (c->sem);
+#else
+	k_lock_lock (&c->mutex);
+	c->done = 1;
+	k_cond_signal (&c->cond);
+	k_lock_unlock (&c->mutex);
+#endif
+}
+
+void k_completion_put (k_completion_t *c)
+{
+	k_static_lock_lock (&completion_pool_lock);
+	c->next = completion_pool;
+	completion_pool = c;
+	k_static_lock_unlock (&completion_pool_lock);
+}
+
+void k_completion_fini (void)
+{
+	k_completion_t *c;
+
+	k_static_lock_lock (&completion_pool_lock);
+	while ((c = completion_pool) != NULL) {
+		completion_pool = c->next;
+		__completion_destroy (c);
+	}
+	k_static_lock_unlock (&completion_pool_lock);
+}
+#endif
+
 int k_static_lock_init (k_static_lock_t *lock)
 {
 	// Use atomic compare-and-exchange to try to change state from UNINIT to INITIALIZING
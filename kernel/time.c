@@ -23,7 +23,7 @@ __export_in_so__ aosl_ts_t aosl_tick_ms (void)
 
 __export_in_so__ aosl_ts_t aosl_tick_us (void)
 {
-	return 0;
+	return (aosl_ts_t)(aosl_hal_get_tick_us ());
 }
 
 __export_in_so__ aosl_ts_t aosl_time_sec (void)
@@ -248,125 +248,33 @@ void timer_put (struct timer_node *timer)
 	__timer_put (timer);
 }
 
-static struct aosl_rb_node **__find_timer_prepare (struct timer_base * base, struct timer_node * timer, struct timer_node ** pprev,
-					struct aosl_rb_node **rb_parent)
-{
-	struct aosl_rb_node **__rb_link = &base->active.rb_node;
-	struct aosl_rb_node *__rb_parent, *rb_prev;
-
-	rb_prev = __rb_parent = NULL;
-
-	while (*__rb_link) {
-		struct timer_node *entry;
-
-		__rb_parent = *__rb_link;
-		entry = aosl_rb_entry (__rb_parent, struct timer_node, timer_node);
-
-		if (entry->expire_time > timer->expire_time) {
-			__rb_link = &__rb_parent->rb_left;
-		} else {
-			rb_prev = __rb_parent;
-			__rb_link = &__rb_parent->rb_right;
-		}
-	}
-
-	if (pprev) {
-		if (rb_prev) {
-			*pprev = aosl_rb_entry (rb_prev, struct timer_node, timer_node);
-		} else {
-			*pprev = NULL;
-		}
-	}
+#define timer_expire_time(timer) ((timer)->expire_time)
 
-	if (rb_parent)
-		*rb_parent = __rb_parent;
-
-	return __rb_link;
-}
-
-static __inline__ void __timer_link_list (struct timer_base * base, struct timer_node * timer,
-				   struct timer_node * timer_prev, struct aosl_rb_node *rb_parent)
-{
-	timer->timer_prev = timer_prev;
-	if (!timer_prev) {
-		if (rb_parent) {
-			struct timer_node *timer_next = aosl_rb_entry (rb_parent, struct timer_node, timer_node);
-
-			timer->timer_next = timer_next;
-			timer_next->timer_prev = timer;
-		} else {
-			timer->timer_next = NULL;
-		}
-		base->first = timer;
-	} else {
-		timer->timer_next = timer_prev->timer_next;
-		if (timer->timer_next)
-			timer->timer_next->timer_prev = timer;
-		timer_prev->timer_next = timer;
-	}
-}
-
-static __inline__ void __timer_link_rb (struct timer_base * base, struct timer_node * timer,
-				 struct aosl_rb_node **rb_link, struct aosl_rb_node *rb_parent)
-{
-	rb_link_node (&timer->timer_node, rb_parent, rb_link);
-	aosl_rb_insert_color (&timer->timer_node, &base->active);
-}
+AOSL_RB_DEFINE (timer_rb, struct timer_node, timer_node, aosl_ts_t, timer_expire_time, AOSL_RB_CMP)
 
 /*
  * __insert_timer - internal function to (re)start a timer
  *
- * The timer is inserted in expiry order. Insertion into the
- * red black tree is O(log(n)).
+ * The timer is inserted in expiry order, after the ones of the same
+ * expire time. Insertion into the red black tree is O(log(n)), and the
+ * first timer to expire is cached by the tree.
  */
-static void __insert_timer (struct timer_base *base, struct aosl_rb_node *node)
+static __inline__ void __insert_timer (struct timer_base *base, struct timer_node *timer)
 {
-	struct timer_node *timer = aosl_rb_entry (node, struct timer_node, timer_node);
-	struct aosl_rb_node **link;
-	struct timer_node *timer_prev;
-	struct aosl_rb_node *parent;
-
-	/*
-	 * Find the right place in the rbtree:
-	 */
-	link = __find_timer_prepare (base, timer, &timer_prev, &parent);
-
-	__timer_link_list (base, timer, timer_prev, parent);
-	__timer_link_rb (base, timer, link, parent);
+	timer_rb_add_cached (&base->active, timer);
 }
 
-static __inline__ void __timer_unlink_list (struct timer_base * base, struct timer_node * timer)
+static __inline__ void __unlink_timer (struct timer_base *base, struct timer_node *timer)
 {
-	struct timer_node *timer_next = timer->timer_next;
-
-	if (base->first == timer) {
-		if (timer_next) {
-			timer_next->timer_prev = NULL;
-			base->first = timer_next;
-		} else {
-			base->first = NULL;
-		}
-	} else {
-		timer->timer_prev->timer_next = timer_next;
-		if (timer_next)
-			timer_next->timer_prev = timer->timer_prev;
-	}
+	aosl_rb_erase_cached (&base->active, &timer->timer_node);
 
 	/* this is important for indicating the timer is not scheduled */
-	timer->timer_next = AOSL_LIST_POISON1;
-	timer->timer_prev = AOSL_LIST_POISON2;
-}
-
-static __inline__ void __timer_unlink_rb (struct timer_base * base, struct timer_node * timer)
-{
-	aosl_rb_erase (&base->active, &timer->timer_node);
+	aosl_rb_clear_node (&timer->timer_node);
 }
 
-static __inline__ void __unlink_timer (struct timer_base *base, struct aosl_rb_node *node)
+static __inline__ int __timer_scheduled (struct timer_node *timer)
 {
-	struct timer_node *timer = aosl_rb_entry (node, struct timer_node, timer_node);
-	__timer_unlink_list (base, timer);
-	__timer_unlink_rb (base, timer);
+	return !aosl_rb_node_empty (&timer->timer_node);
 }
 
 static __inline__ void __sched_timer (struct mp_queue *q, struct timer_node *timer, aosl_ts_t expire_time)
@@ -385,13 +293,13 @@ static __inline__ void __sched_timer (struct mp_queue *q, struct timer_node *tim
 		}
 	}
 
-	__insert_timer (&q->timer_base, &timer->timer_node);
+	__insert_timer (&q->timer_base, timer);
 }
 
 static void __resched_timer (struct mp_queue *q, struct timer_node *timer, uintptr_t interval, aosl_ts_t expire_time)
 {
-	if (timer->timer_next != AOSL_LIST_POISON1)
-		__unlink_timer (&q->timer_base, &timer->timer_node);
+	if (__timer_scheduled (timer))
+		__unlink_timer (&q->timer_base, timer);
 
 	if (expire_time == 0 && interval != AOSL_INVALID_TIMER_INTERVAL)
 		timer->interval = interval;
@@ -401,8 +309,8 @@ static void __resched_timer (struct mp_queue *q, struct timer_node *timer, uintp
 
 static __inline__ void __cancel_timer_on_q (struct mp_queue *q, struct timer_node *timer)
 {
-	if (timer->timer_next != AOSL_LIST_POISON1)
-		__unlink_timer (&q->timer_base, &timer->timer_node);
+	if (__timer_scheduled (timer))
+		__unlink_timer (&q->timer_base, timer);
 }
 
 static struct timer_node *__create_timer_on_q (struct mp_queue *q, uintptr_t interval,
@@ -424,8 +332,7 @@ static struct timer_node *__create_timer_on_q (struct mp_queue *q, uintptr_t int
 	}
 
 	/* this is important for indicating the timer is not scheduled */
-	timer->timer_next = AOSL_LIST_POISON1;
-	timer->timer_prev = AOSL_LIST_POISON2;
+	aosl_rb_clear_node (&timer->timer_node);
 
 	timer->obj_id = AOSL_MPQ_TIMER_INVALID;
 	atomic_set (&timer->usage, 1);
@@ -464,8 +371,7 @@ static int __kill_timer_on_q (struct mp_queue *q, struct timer_node *timer)
 
 void mpq_init_timers (struct mp_queue *q)
 {
-	aosl_rb_root_init (&q->timer_base.active, NULL /* we keep the timer using the raw mechanism */);
-	q->timer_base.first = NULL;
+	aosl_rb_root_cached_init (&q->timer_base.active);
 	aosl_list_head_init (&q->timers);
 	q->timer_count = 0;
 }
@@ -484,15 +390,16 @@ void mpq_fini_timers (struct mp_queue *q)
 	q->timer_count = 0;
 }
 
-int __check_and_run_timers (struct mp_queue *q)
+int __check_and_run_timers (struct mp_queue *q, aosl_ts_t deadline_us)
 {
 	struct timer_node *timer;
 	struct timer_base *base = &q->timer_base;
 	aosl_ts_t now = aosl_tick_now ();
 	int count = 0;
 
-	while ((timer = base->first) && time_after_eq (now, timer->expire_time)) {
-		__unlink_timer (&q->timer_base, &timer->timer_node);
+	while ((timer = timer_base_first (base)) && time_after_eq (now, timer->expire_time)) {
+		__unlink_timer (&q->timer_base, timer);
+		mpq_stats_timer (q, (now - timer->expire_time) * 1000);
 
 		/* All oneshot timers must have invalid interval */
 		if (timer->interval != AOSL_INVALID_TIMER_INTERVAL) {
@@ -530,12 +437,19 @@ int __check_and_run_timers (struct mp_queue *q)
 		    timer->expire_time = aosl_tick_now () + timer->interval - (now - timer->expire_time);
 #endif
 
-			__insert_timer (&q->timer_base, &timer->timer_node);
+			__insert_timer (&q->timer_base, timer);
 		}
 
 		timer->func (timer->obj_id, (const aosl_ts_t *)&now, timer->argc, timer->argv);
 		mpq_stack_fini (q->q_stack_curr);
 		count++;
+
+		if (deadline_us != 0 && time_after_eq (aosl_tick_us (), deadline_us)) {
+			timer = timer_base_first (base);
+			if (timer != NULL && time_after_eq (now, timer->expire_time))
+				mpq_stats_budget_hit (q, AOSL_MPQ_SRC_TIMERS);
+			break;
+		}
 	}
 
 	return count;
@@ -906,7 +820,7 @@ __export_in_so__ int aosl_mpq_timer_active (aosl_timer_t timer_id, int *active_p
 	struct timer_node *timer = timer_get (timer_id);
 	if (timer != NULL) {
 		if (active_p != NULL)
-			*active_p = (int)(timer->timer_next != AOSL_LIST_POISON1);
+			*active_p = __timer_scheduled (timer);
 
 		timer_put (timer);
 		return 0;
@@ -10,69 +10,33 @@
 #include <api/aosl_types.h>
 #include <api/aosl_defs.h>
 #include <api/aosl_errno.h>
-#include <api/aosl_mm.h>
-#include <api/aosl_list.h>
 #include <kernel/thread.h>
-#include <stdlib.h>
 
-static k_tls_key_t errno_key = -1;
-static AOSL_DEFINE_LIST_HEAD(s_err_list);
-
-struct err_mm_node {
-	struct aosl_list_head node;
-	int *errno_ptr;
-};
+/**
+ * The errno is read and written on almost every failure path, so it is
+ * a native thread local variable when supported, or the cell in the TLS
+ * table of the thread, which is freed along with the table when the
+ * thread exits.
+ **/
+#if defined(K_THREAD_LOCAL)
+static K_THREAD_LOCAL int __this_errno;
+#endif
 
 void k_errno_init (void)
 {
-	aosl_list_head_init(&s_err_list);
-
-	if (k_tls_key_create (&errno_key) < 0)
-		abort ();
 }
 
 void k_errno_fini (void)
 {
-	if (errno_key < 0) {
-		return;
-	}
-	k_tls_key_delete (errno_key);
-	errno_key = -1;
-
-	struct err_mm_node *err_node = NULL;
-	while ((err_node = aosl_list_remove_head_entry(&s_err_list, struct err_mm_node, node)) != NULL) {
-		aosl_free (err_node->errno_ptr);
-		aosl_free (err_node);
-	}
 }
 
 __export_in_so__ int *aosl_errno_ptr (void)
 {
-	int *errno_ptr;
-
-	if (errno_key < 0)
-		abort ();
-
-	errno_ptr = k_tls_key_get (errno_key);
-	if (errno_ptr == NULL) {
-		struct err_mm_node *err_node = aosl_malloc (sizeof(struct err_mm_node));
-		if (err_node == NULL) {
-			abort ();
-		}
-		errno_ptr = (int *)aosl_malloc (sizeof (int));
-		if (errno_ptr == NULL)
-			abort ();
-
-		err_node->errno_ptr = errno_ptr;
-		aosl_list_add(&err_node->node, &s_err_list);
-
-		if (k_tls_key_set (errno_key, errno_ptr) < 0)
-			abort ();
-
-		*errno_ptr = 0;
-	}
-
-	return errno_ptr;
+#if defined(K_THREAD_LOCAL)
+	return &__this_errno;
+#else
+	return k_tls_errno_ptr ();
+#endif
 }
 
 __export_in_so__ char *aosl_strerror (int errnum)
@@ -0,0 +1,197 @@
+/***************************************************************************
+ * Module:	Intrusive hash table implementation file
+ *
+ * Copyright © 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+
+#include <kernel/kernel.h>
+#include <api/aosl_mm.h>
+#include <api/aosl_hash.h>
+
+
+#define HASH_MIN_BUCKETS 16
+
+/**
+ * The old buckets moved per update, which finishes a growing before the
+ * table is full again. A shrinking right after a resizing might come
+ * earlier, then the remaining old buckets are moved at once.
+ **/
+#define HASH_MIGRATE_STEP 2
+
+__export_in_so__ void aosl_hash_init (struct aosl_hash_table *ht, uint32_t flags)
+{
+	ht->buckets = &ht->bucket0;
+	ht->mask = 0;
+	ht->old_buckets = NULL;
+	ht->old_mask = 0;
+	ht->migrated = 0;
+	ht->count = 0;
+	ht->flags = flags;
+	ht->bucket0 = NULL;
+}
+
+static __inline__ void __hash_link (struct aosl_hash_node **bucket, struct aosl_hash_node *node)
+{
+	node->next = *bucket;
+	if (node->next != NULL)
+		node->next->pprev = &node->next;
+
+	node->pprev = bucket;
+	*bucket = node;
+}
+
+static void __hash_buckets_free (struct aosl_hash_table *ht, struct aosl_hash_node **buckets)
+{
+	if (buckets != &ht->bucket0)
+		aosl_free (buckets);
+}
+
+/* move the next old bucket into the new array */
+static void __hash_migrate_one (struct aosl_hash_table *ht)
+{
+	struct aosl_hash_node **old_bucket = &ht->old_buckets [ht->migrated];
+	struct aosl_hash_node *node;
+
+	while ((node = *old_bucket) != NULL) {
+		*old_bucket = node->next;
+		__hash_link (&ht->buckets [node->hash & ht->mask], node);
+	}
+
+	if (ht->migrated++ == ht->old_mask) {
+		__hash_buckets_free (ht, ht->old_buckets);
+		ht->old_buckets = NULL;
+		ht->old_mask = 0;
+		ht->migrated = 0;
+	}
+}
+
+static void __hash_migrate_step (struct aosl_hash_table *ht)
+{
+	int i;
+
+	for (i = 0; i < HASH_MIGRATE_STEP && ht->old_buckets != NULL; i++)
+		__hash_migrate_one (ht);
+}
+
+__export_in_so__ void aosl_hash_migrate (struct aosl_hash_table *ht)
+{
+	if (ht->old_buckets != NULL)
+		__hash_migrate_one (ht);
+}
+
+/**
+ * Grow when the average chain is longer than 1, shrink when it is shorter
+ * than 1/8, so a table oscillating around a size does not resize again
+ * and again. The new array is installed at once, the nodes are moved by
+ * the following updates.
+ **/
+static void __hash_resize_check (struct aosl_hash_table *ht)
+{
+	uintptr_t nbuckets = ht->mask + 1;
+	uintptr_t new_nbuckets;
+	struct aosl_hash_node **new_buckets;
+
+	if (ht->count > nbuckets) {
+		if (nbuckets > (UINTPTR_MAX / sizeof (struct aosl_hash_node *)) / 2)
+			return;
+
+		new_nbuckets = nbuckets < HASH_MIN_BUCKETS ? HASH_MIN_BUCKETS : nbuckets * 2;
+	} else if (nbuckets > HASH_MIN_BUCKETS && ht->count < nbuckets / 8) {
+		new_nbuckets = nbuckets / 2;
+	} else {
+		return;
+	}
+
+	while (ht->old_buckets != NULL)
+		__hash_migrate_one (ht);
+
+	/* just keep the longer chains if no memory */
+	new_buckets = (struct aosl_hash_node **)aosl_calloc (new_nbuckets, sizeof (struct aosl_hash_node *));
+	if (new_buckets == NULL)
+		return;
+
+	ht->old_buckets = ht->buckets;
+	ht->old_mask = ht->mask;
+	ht->migrated = 0;
+	ht->buckets = new_buckets;
+	ht->mask = new_nbuckets - 1;
+}
+
+__export_in_so__ void aosl_hash_add (struct aosl_hash_table *ht, struct aosl_hash_node *node, uintptr_t hash)
+{
+	ht->count++;
+	__hash_resize_check (ht);
+	if (ht->old_buckets != NULL)
+		__hash_migrate_step (ht);
+
+	node->hash = hash;
+	__hash_link (aosl_hash_bucket (ht, hash), node);
+}
+
+__export_in_so__ void aosl_hash_del (struct aosl_hash_table *ht, struct aosl_hash_node *node)
+{
+	*node->pprev = node->next;
+	if (node->next != NULL)
+		node->next->pprev = node->pprev;
+
+	node->next = NULL;
+	node->pprev = NULL;
+	ht->count--;
+
+	if (ht->old_buckets != NULL)
+		__hash_migrate_step (ht);
+	__hash_resize_check (ht);
+}
+
+static int __hash_walk_buckets (struct aosl_hash_node **buckets, uintptr_t from, uintptr_t mask, aosl_hash_walk_func_t func, void *arg, int all)
+{
+	struct aosl_hash_node *node;
+	struct aosl_hash_node *next;
+	uintptr_t i;
+
+	for (i = from; i <= mask; i++) {
+		for (node = buckets [i]; node != NULL; node = next) {
+			/* the callback of aosl_hash_fini might free the node */
+			next = node->next;
+			if (func (node, arg) && !all)
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+__export_in_so__ void aosl_hash_traverse (struct aosl_hash_table *ht, aosl_hash_walk_func_t func, void *arg)
+{
+	if (ht->old_buckets != NULL) {
+		if (__hash_walk_buckets (ht->old_buckets, ht->migrated, ht->old_mask, func, arg, 0))
+			return;
+	}
+
+	__hash_walk_buckets (ht->buckets, 0, ht->mask, func, arg, 0);
+}
+
+static int __hash_node_drop (struct aosl_hash_node *node, void *arg)
+{
+	node->next = NULL;
+	node->pprev = NULL;
+	return 0;
+}
+
+__export_in_so__ void aosl_hash_fini (struct aosl_hash_table *ht, aosl_hash_walk_func_t func, void *arg)
+{
+	if (func == NULL)
+		func = __hash_node_drop;
+
+	if (ht->old_buckets != NULL) {
+		__hash_walk_buckets (ht->old_buckets, ht->migrated, ht->old_mask, func, arg, 1);
+		__hash_buckets_free (ht, ht->old_buckets);
+	}
+
+	__hash_walk_buckets (ht->buckets, 0, ht->mask, func, arg, 1);
+	__hash_buckets_free (ht, ht->buckets);
+	aosl_hash_init (ht, ht->flags);
+}
@@ -12,8 +12,10 @@
 
 #include <kernel/kernel.h>
 #include <kernel/types.h>
+#include <kernel/thread.h>
 #include <api/aosl_mm.h>
 #include <api/aosl_socket.h>
+#include <api/aosl_atomic.h>
 #include <kernel/byteorder/generic.h>
 #include <kernel/psbuff.h>
 #include <api/aosl_marshalling.h>
@@ -437,6 +439,7 @@ __CHECK_AND_ENCODE_BASETYPE (type, this_obj_addr, type, fn)
 		bool_val = (uint8_t)(pointer_val != NULL);
 		helper_type.type_id = AOSL_TYPE_INT8;
 		helper_type.obj_addr = &bool_val;
+		helper_type.is_have = NULL;
 
 		ret = _____marshal (&helper_type, NULL, &psb);
 		if (ret < 0)
@@ -465,6 +468,7 @@ __CHECK_AND_ENCODE_BASETYPE (type, this_obj_addr, type, fn)
 		bool_val = (uint8_t)(pointer_val != NULL);
 		helper_type.type_id = AOSL_TYPE_INT8;
 		helper_type.obj_addr = &bool_val;
+		helper_type.is_have = NULL;
 
 		ret = _____marshal (&helper_type, NULL, &psb);
 		if (ret < 0)
@@ -619,7 +623,94 @@ static __inline__ isize_t SAFE_STRSIZE (const aosl_psb_t *psb)
 	return (isize_t)__l;
 }
 
-isize_t _____unmarshal (const aosl_type_info_t *type, void *typed_obj_p, const aosl_psb_t **psb_p)
+/**
+ * The arena heap block, the data follows the header, and the header size
+ * keeps the data aligned.
+ **/
+struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+};
+
+#define ARENA_ALIGN sizeof (uint64_t)
+#define ARENA_ALIGNED(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define ARENA_BLOCK_MIN 1024
+
+static struct arena_block *__arena_block_alloc (aosl_unmarshal_arena_t *arena, size_t size)
+{
+	struct arena_block *block;
+
+	block = (struct arena_block *)aosl_malloc (sizeof *block + size);
+	if (block == NULL)
+		return NULL;
+
+	block->next = (struct arena_block *)arena->blocks;
+	block->size = size;
+	block->used = 0;
+	arena->blocks = block;
+	return block;
+}
+
+static void *__arena_alloc (aosl_unmarshal_arena_t *arena, size_t size)
+{
+	struct arena_block *block;
+	size_t block_size;
+	void *p;
+
+	size = ARENA_ALIGNED (size);
+	if (arena->buf != NULL && arena->size - arena->used >= size) {
+		p = (uint8_t *)arena->buf + arena->used;
+		arena->used += size;
+		return p;
+	}
+
+	block = (struct arena_block *)arena->blocks;
+	if (block == NULL || block->size - block->used < size) {
+		/* only when the size could not be scanned before decoding */
+		block_size = block != NULL ? block->size * 2 : ARENA_BLOCK_MIN;
+		if (block_size < size)
+			block_size = size;
+
+		block = __arena_block_alloc (arena, block_size);
+		if (block == NULL)
+			return NULL;
+	}
+
+	p = (uint8_t *)(block + 1) + block->used;
+	block->used += size;
+	return p;
+}
+
+/* make sure the following allocations of total bytes need no more blocks */
+static int __arena_reserve (aosl_unmarshal_arena_t *arena, size_t total)
+{
+	struct arena_block *block = (struct arena_block *)arena->blocks;
+
+	if (total == 0)
+		return 0;
+
+	if (arena->buf != NULL && arena->size - arena->used >= total)
+		return 0;
+
+	if (block != NULL && block->size - block->used >= total)
+		return 0;
+
+	if (__arena_block_alloc (arena, total) == NULL)
+		return -AOSL_ENOMEM;
+
+	return 0;
+}
+
+static __inline__ void *__unmarshal_alloc (aosl_unmarshal_arena_t *arena, size_t size)
+{
+	if (arena != NULL)
+		return __arena_alloc (arena, size);
+
+	return aosl_malloc (size);
+}
+
+isize_t _____unmarshal (const aosl_type_info_t *type, void *typed_obj_p, const aosl_psb_t **psb_p, aosl_unmarshal_arena_t *arena)
 {
 	isize_t ret = 0;
 	uint16_t val, i;
@@ -742,7 +833,8 @@ isize_t _____unmarshal (const aosl_type_info_t *type, void *typed_obj_p, const a
 		/* a 'logic bool' value is one byte value */
 		helper_type.type_id = AOSL_TYPE_INT8;
 		helper_type.obj_addr = &bool_val;
-		ret = _____unmarshal (&helper_type, NULL, &psb);
+		helper_type.is_have = NULL;
+		ret = _____unmarshal (&helper_type, NULL, &psb, arena);
 		if (ret < 0)
 			goto __err;
 
@@ -760,12 +852,15 @@ isize_t _____unmarshal (const aosl_type_info_t *type, void *typed_obj_p, const a
 			if (get_type_size (type->child, &obj_size) < 0)
 				goto __err;
 
-			pointer_val = aosl_malloc (obj_size);
+			pointer_val = __unmarshal_alloc (arena, obj_size);
 			if (pointer_val == NULL) {
 				ret = -AOSL_ENOMEM;
 				goto __err;
 			}
 
+			/* a failed decoding leaves the rest of the object for fini */
+			memset (pointer_val, 0, obj_size);
+
 			/**
 			 * We must set the the pointer first to avoid memory leak if encountered error,
 			 * because once we set the pointer, then we can free it when we finish the typed
@@ -773,7 +868,7 @@ isize_t _____unmarshal (const aosl_type_info_t *type, void *typed_obj_p, const a
 			 **/
 			*(void **)this_obj_addr = pointer_val;
 
-			ret = _____unmarshal (type->child, pointer_val, &psb);
+			ret = _____unmarshal (type->child, pointer_val, &psb, arena);
 			if (ret < 0)
 				goto __err;
 
@@ -783,7 +878,7 @@ isize_t _____unmarshal (const aosl_type_info_t *type, void *typed_obj_p, const a
 		}
 		break;
 	case AOSL_TYPE_REFERENCE:
-		ret = _____unmarshal (type->child, this_obj_addr, &psb);
+		ret = _____unmarshal (type->child, this_obj_addr, &psb, arena);
 		if (ret < 0)
 			goto __err;
 
@@ -793,7 +888,8 @@ isize_t _____unmarshal (const aosl_type_info_t *type, void *typed_obj_p, const a
 		/* a 'logic bool' value is one byte value */
 		helper_type.type_id = AOSL_TYPE_INT8;
 		helper_type.obj_addr = &bool_val;
-		ret = _____unmarshal (&helper_type, NULL, &psb);
+		helper_type.is_have = NULL;
+		ret = _____unmarshal (&helper_type, NULL, &psb, arena);
 		if (ret < 0)
 			goto __err;
 
@@ -805,7 +901,7 @@ isize_t _____unmarshal (const aosl_type_info_t *type, void *typed_obj_p, const a
 				goto __err;
 
 			val = (uint16_t)ret;
-			pointer_val = aosl_malloc (val);
+			pointer_val = __unmarshal_alloc (arena, val);
 			if (pointer_val == NULL) {
 				ret = -AOSL_ENOMEM;
 				goto __err;
@@ -826,7 +922,7 @@ isize_t _____unmarshal (const aosl_type_info_t *type, void *typed_obj_p, const a
 	case AOSL_TYPE_STRUCT:
 		type = type->child;
 		while (type->type_id != AOSL_TYPE_VOID) {
-			ret = _____unmarshal (type, this_obj_addr, &psb);
+			ret = _____unmarshal (type, this_obj_addr, &psb, arena);
 			if (ret < 0)
 				goto __err;
 
@@ -869,9 +965,10 @@ isize_t _____unmarshal (const aosl_type_info_t *type, void *typed_obj_p, const a
 	case AOSL_TYPE_DYNAMIC_STRING:
 		__CHECK_AND_DECODE_BASETYPE (uint16_t, &val, uint16_t, __decode_int16, 0);
 		((aosl_dynamic_array_t *)this_obj_addr)->count = val;
-		((aosl_dynamic_array_t *)this_obj_addr)->allocated = val + (type->type_id == AOSL_TYPE_DYNAMIC_STRING);
+		/* the values in an arena are not owned by the array */
+		((aosl_dynamic_array_t *)this_obj_addr)->allocated = arena == NULL ? val + (type->type_id == AOSL_TYPE_DYNAMIC_STRING) : 0;
 		if (val + (type->type_id == AOSL_TYPE_DYNAMIC_STRING) > 0) {
-			pointer_val = aosl_malloc (val + (type->type_id == AOSL_TYPE_DYNAMIC_STRING));
+			pointer_val = __unmarshal_alloc (arena, val + (type->type_id == AOSL_TYPE_DYNAMIC_STRING));
 			if (pointer_val == NULL) {
 				((aosl_dynamic_array_t *)this_obj_addr)->count = 0;
 				((aosl_dynamic_array_t *)this_obj_addr)->allocated = 0;
@@ -900,7 +997,7 @@ isize_t _____unmarshal (const aosl_type_info_t *type, void *typed_obj_p, const a
 			goto __err;
 
 		for (i = 0; i < type->array_size; i++) {
-			ret = _____unmarshal (type->child, (uint8_t *)this_obj_addr + (obj_size * i), &psb);
+			ret = _____unmarshal (type->child, (uint8_t *)this_obj_addr + (obj_size * i), &psb, arena);
 			if (ret < 0)
 				goto __err;
 
@@ -919,7 +1016,7 @@ isize_t _____unmarshal (const aosl_type_info_t *type, void *typed_obj_p, const a
 
 		*(uint16_t *)((uint8_t *)typed_obj_p + (uintptr_t)type->count_var_addr) = val;
 		for (i = 0; i < val; i++) {
-			ret = _____unmarshal (type->child, (uint8_t *)this_obj_addr + (obj_size * i), &psb);
+			ret = _____unmarshal (type->child, (uint8_t *)this_obj_addr + (obj_size * i), &psb, arena);
 			if (ret < 0)
 				goto __err;
 
@@ -929,7 +1026,7 @@ isize_t _____unmarshal (const aosl_type_info_t *type, void *typed_obj_p, const a
 	case AOSL_TYPE_DYNAMIC_ARRAY:
 		__CHECK_AND_DECODE_BASETYPE (uint16_t, &val, uint16_t, __decode_int16, 0);
 		((aosl_dynamic_array_t *)this_obj_addr)->count = val;
-		((aosl_dynamic_array_t *)this_obj_addr)->allocated = val;
+		((aosl_dynamic_array_t *)this_obj_addr)->allocated = arena == NULL ? val : 0;
 		if (val > 0) {
 			ret = get_type_size (type->child, &obj_size);
 			if (ret < 0) {
@@ -938,7 +1035,7 @@ isize_t _____unmarshal (const aosl_type_info_t *type, void *typed_obj_p, const a
 				goto __err;
 			}
 
-			pointer_val = aosl_malloc (obj_size * val);
+			pointer_val = __unmarshal_alloc (arena, obj_size * val);
 			if (pointer_val == NULL) {
 				((aosl_dynamic_array_t *)this_obj_addr)->count = 0;
 				((aosl_dynamic_array_t *)this_obj_addr)->allocated = 0;
@@ -949,12 +1046,13 @@ isize_t _____unmarshal (const aosl_type_info_t *type, void *typed_obj_p, const a
 			/**
 			 * We must set the the pointer first to avoid memory leak if encountered error,
 			 * because once we set the pointer, then we can free it when we finish the typed
-			 * object later.
+			 * object later, and zero the elements for the ones never decoded.
 			 **/
+			memset (pointer_val, 0, obj_size * val);
 			((aosl_dynamic_array_t *)this_obj_addr)->values = pointer_val;
 
 			for (i = 0; i < val; i++) {
-				ret = _____unmarshal (type->child, (uint8_t *)pointer_val + (obj_size * i), &psb);
+				ret = _____unmarshal (type->child, (uint8_t *)pointer_val + (obj_size * i), &psb, arena);
 				if (ret < 0)
 					goto __err;
 
@@ -975,9 +1073,1214 @@ __err:
 	return ret;
 }
 
-static isize_t smart_unmarshal (const aosl_type_info_t *obj_type, void *obj_addr, const aosl_psb_t *psb)
+static isize_t smart_unmarshal (const aosl_type_info_t *obj_type, void *obj_addr, const aosl_psb_t *psb, aosl_unmarshal_arena_t *arena)
+{
+	return _____unmarshal (obj_type, obj_addr, &psb, arena);
+}
+
+/**
+ * The compiled plan of a type descriptor: the descriptor tree is flattened
+ * into a linear program, with the structs and references inlined and their
+ * offsets accumulated. The adjacent fixed size fields sharing the same
+ * encoding are merged into one run, which is then encoded by one memcpy.
+ * A pointer or array element type gets a plan of its own, and an array of
+ * the element type encoded as a single run becomes one run too.
+ **/
+enum {
+	PLAN_COPY,
+	PLAN_COND,
+	PLAN_STRING,
+	PLAN_POINTER,
+	PLAN_VAR_BYTES,
+	PLAN_BYTES_WITH_NIL,
+	PLAN_DYNAMIC_BYTES,
+	PLAN_DYNAMIC_STRING,
+	PLAN_FIXED_ARRAY,
+	PLAN_VAR_ARRAY,
+	PLAN_DYNAMIC_ARRAY,
+};
+
+struct type_plan;
+
+struct plan_op {
+	int code;
+	/* the object offset from the base address */
+	uintptr_t off;
+	/* the count variable offset of the var bytes/array */
+	uintptr_t count_off;
+	/**
+	 * COPY: bytes of the run;
+	 * COND: the following ops to skip if not have;
+	 * FIXED_ARRAY: elements of the array;
+	 * VAR_*, BYTES_WITH_NIL: the max count;
+	 **/
+	size_t n;
+	/* the element size of pointers and arrays */
+	size_t stride;
+	int8_t (*is_have) (const void *obj_addr);
+	const struct type_plan *sub;
+};
+
+struct type_plan {
+	const aosl_type_info_t *type;
+	/* linking the plans of one compiling */
+	struct type_plan *next;
+	/* a single copy run covering the whole object */
+	int flat;
+	/* nothing to free when finishing the object */
+	int plain;
+	/* any conditional field in the object itself, not the pointed ones */
+	int has_cond;
+	/* the encoded size if it is fixed, -1 if not */
+	isize_t fixed_wire;
+	int nops;
+	struct plan_op *ops;
+};
+
+/**
+ * The plans are looked up by the descriptor address without any lock, so
+ * a plan is never changed after it is published, and all of them are only
+ * freed by aosl_dtor.
+ **/
+#define TYPE_PLANS_MAX 256
+#define TYPE_PLANS_LIMIT (TYPE_PLANS_MAX * 3 / 4)
+
+static struct type_plan *type_plans [TYPE_PLANS_MAX];
+static int type_plans_count = 0;
+static k_static_lock_t type_plans_lock = K_STATIC_LOCK_INIT;
+
+static __inline__ uint32_t __plan_hash (const aosl_type_info_t *type)
+{
+	return (uint32_t)(((uintptr_t)type >> 3) * 2654435761u) & (TYPE_PLANS_MAX - 1);
+}
+
+static const struct type_plan *__plan_find (const aosl_type_info_t *type)
+{
+	uint32_t i = __plan_hash (type);
+	int n;
+
+	for (n = 0; n < TYPE_PLANS_MAX; n++) {
+		const struct type_plan *plan = *(struct type_plan *const volatile *)&type_plans [i];
+		if (plan == NULL)
+			return NULL;
+
+		if (plan->type == type)
+			return plan;
+
+		i = (i + 1) & (TYPE_PLANS_MAX - 1);
+	}
+
+	return NULL;
+}
+
+static __inline__ const struct type_plan *plan_lookup (const aosl_type_info_t *type)
+{
+	if (*(volatile int *)&type_plans_count == 0)
+		return NULL;
+
+	return __plan_find (type);
+}
+
+struct plan_ctx {
+	struct type_plan *compiled;
+	int count;
+};
+
+struct plan_builder {
+	struct plan_op *ops;
+	int nops;
+	int size;
+	/* no merging into the ops before this one */
+	int floor;
+};
+
+static int __plan_emit (struct plan_builder *b, const struct plan_op *op)
+{
+	if (op->code == PLAN_COPY) {
+		if (op->n == 0)
+			return 0;
+
+		if (b->nops > b->floor) {
+			struct plan_op *last = &b->ops [b->nops - 1];
+			if (last->code == op->code && last->off + last->n == op->off) {
+				last->n += op->n;
+				return 0;
+			}
+		}
+	}
+
+	if (b->nops == b->size) {
+		int size = b->size > 0 ? b->size * 2 : 8;
+		struct plan_op *ops = (struct plan_op *)aosl_malloc (sizeof (struct plan_op) * size);
+		if (ops == NULL)
+			return -AOSL_ENOMEM;
+
+		if (b->nops > 0)
+			memcpy (ops, b->ops, sizeof (struct plan_op) * b->nops);
+
+		if (b->ops != NULL)
+			aosl_free (b->ops);
+
+		b->ops = ops;
+		b->size = size;
+	}
+
+	b->ops [b->nops++] = *op;
+	return 0;
+}
+
+static int __plan_emit_run (struct plan_builder *b, int code, uintptr_t off, size_t n)
+{
+	struct plan_op op;
+
+	memset (&op, 0, sizeof op);
+	op.code = code;
+	op.off = off;
+	op.n = n;
+	return __plan_emit (b, &op);
+}
+
+static int __plan_emit_int (struct plan_builder *b, uintptr_t off, size_t width)
+{
+	/**
+	 * The __encode_intxx only convert the value to the host byte order,
+	 * so the wire format is the host order and the integers are copied
+	 * as they are, the same as the descriptor walking does.
+	 **/
+	return __plan_emit_run (b, PLAN_COPY, off, width);
+}
+
+static int __plan_get (struct plan_ctx *ctx, const aosl_type_info_t *type, const struct type_plan **plan_p);
+
+static int __plan_flatten (struct plan_ctx *ctx, struct plan_builder *b, const aosl_type_info_t *type, uintptr_t base)
+{
+	uintptr_t off = base + (uintptr_t)type->obj_addr;
+	const aosl_type_info_t *field;
+	struct plan_op op;
+	int cond_at = -1;
+	int err = 0;
+
+	memset (&op, 0, sizeof op);
+	if (type->is_have != NULL) {
+		op.code = PLAN_COND;
+		op.off = off;
+		op.is_have = type->is_have;
+		err = __plan_emit (b, &op);
+		if (err < 0)
+			return err;
+
+		cond_at = b->nops - 1;
+		memset (&op, 0, sizeof op);
+	}
+
+	op.off = off;
+	switch (type->type_id) {
+	case AOSL_TYPE_VOID:
+		break;
+	case AOSL_TYPE_INT8:
+		err = __plan_emit_run (b, PLAN_COPY, off, 1);
+		break;
+	case AOSL_TYPE_INT16:
+		err = __plan_emit_int (b, off, 2);
+		break;
+	case AOSL_TYPE_INT32:
+	case AOSL_TYPE_FLOAT:
+		err = __plan_emit_int (b, off, 4);
+		break;
+	case AOSL_TYPE_INT64:
+	case AOSL_TYPE_DOUBLE:
+		err = __plan_emit_int (b, off, 8);
+		break;
+	case AOSL_TYPE_V4_IPADDR:
+		err = __plan_emit_run (b, PLAN_COPY, off, sizeof (aosl_in_addr_t));
+		break;
+	case AOSL_TYPE_V6_IPADDR:
+		err = __plan_emit_run (b, PLAN_COPY, off, sizeof (aosl_in6_addr_t));
+		break;
+	case AOSL_TYPE_POINTER:
+		op.code = PLAN_POINTER;
+		err = get_type_size (type->child, &op.stride);
+		if (err == 0)
+			err = __plan_get (ctx, type->child, &op.sub);
+		if (err == 0)
+			err = __plan_emit (b, &op);
+		break;
+	case AOSL_TYPE_REFERENCE:
+		err = __plan_flatten (ctx, b, type->child, off);
+		break;
+	case AOSL_TYPE_STRING:
+		op.code = PLAN_STRING;
+		err = __plan_emit (b, &op);
+		break;
+	case AOSL_TYPE_STRUCT:
+		for (field = type->child; field->type_id != AOSL_TYPE_VOID; field++) {
+			err = __plan_flatten (ctx, b, field, off);
+			if (err < 0)
+				break;
+		}
+		break;
+	case AOSL_TYPE_FIXED_BYTES:
+		err = __plan_emit_run (b, PLAN_COPY, off, type->array_size);
+		break;
+	case AOSL_TYPE_VAR_BYTES:
+		op.code = PLAN_VAR_BYTES;
+		op.count_off = base + (uintptr_t)type->count_var_addr;
+		op.n = type->array_size;
+		err = __plan_emit (b, &op);
+		break;
+	case AOSL_TYPE_BYTES_WITH_NIL:
+		op.code = PLAN_BYTES_WITH_NIL;
+		op.n = type->array_size;
+		err = __plan_emit (b, &op);
+		break;
+	case AOSL_TYPE_DYNAMIC_BYTES:
+		op.code = PLAN_DYNAMIC_BYTES;
+		err = __plan_emit (b, &op);
+		break;
+	case AOSL_TYPE_DYNAMIC_STRING:
+		op.code = PLAN_DYNAMIC_STRING;
+		err = __plan_emit (b, &op);
+		break;
+	case AOSL_TYPE_FIXED_ARRAY:
+		err = get_type_size (type->child, &op.stride);
+		if (err == 0)
+			err = __plan_get (ctx, type->child, &op.sub);
+		if (err < 0)
+			break;
+
+		if (op.sub->flat) {
+			err = __plan_emit_run (b, PLAN_COPY, off, op.stride * type->array_size);
+		} else {
+			op.code = PLAN_FIXED_ARRAY;
+			op.n = type->array_size;
+			err = __plan_emit (b, &op);
+		}
+		break;
+	case AOSL_TYPE_VAR_ARRAY:
+		op.code = PLAN_VAR_ARRAY;
+		op.count_off = base + (uintptr_t)type->count_var_addr;
+		op.n = type->array_size;
+		err = get_type_size (type->child, &op.stride);
+		if (err == 0)
+			err = __plan_get (ctx, type->child, &op.sub);
+		if (err == 0)
+			err = __plan_emit (b, &op);
+		break;
+	case AOSL_TYPE_DYNAMIC_ARRAY:
+		op.code = PLAN_DYNAMIC_ARRAY;
+		err = get_type_size (type->child, &op.stride);
+		if (err == 0)
+			err = __plan_get (ctx, type->child, &op.sub);
+		if (err == 0)
+			err = __plan_emit (b, &op);
+		break;
+	default:
+		err = -AOSL_EINVAL;
+		break;
+	}
+
+	if (err < 0)
+		return err;
+
+	if (cond_at >= 0) {
+		/* skip the whole object if not have, and never merge into it */
+		b->ops [cond_at].n = b->nops - cond_at - 1;
+		b->floor = b->nops;
+	}
+
+	return 0;
+}
+
+static int __plan_plain (const struct type_plan *plan)
+{
+	const struct plan_op *op;
+
+	for (op = plan->ops; op < plan->ops + plan->nops; op++) {
+		switch (op->code) {
+		case PLAN_COPY:
+		case PLAN_COND:
+		case PLAN_VAR_BYTES:
+		case PLAN_BYTES_WITH_NIL:
+			break;
+		case PLAN_FIXED_ARRAY:
+			/* the element type could not be recursive, so it has been built */
+			if (!op->sub->plain)
+				return 0;
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void __plan_scan_info (struct type_plan *plan)
+{
+	const struct plan_op *op;
+	isize_t fixed_wire = 0;
+	int has_cond = 0;
+
+	for (op = plan->ops; op < plan->ops + plan->nops; op++) {
+		switch (op->code) {
+		case PLAN_COPY:
+			if (fixed_wire >= 0)
+				fixed_wire += (isize_t)op->n;
+			break;
+		case PLAN_COND:
+			has_cond = 1;
+			fixed_wire = -1;
+			break;
+		case PLAN_FIXED_ARRAY:
+			if (op->sub->has_cond)
+				has_cond = 1;
+
+			if (fixed_wire >= 0 && op->sub->fixed_wire >= 0) {
+				fixed_wire += op->sub->fixed_wire * (isize_t)op->n;
+			} else {
+				fixed_wire = -1;
+			}
+			break;
+		default:
+			fixed_wire = -1;
+			break;
+		}
+	}
+
+	plan->has_cond = has_cond;
+	plan->fixed_wire = fixed_wire;
+}
+
+static int __plan_build (struct plan_ctx *ctx, struct type_plan *plan)
+{
+	struct plan_builder b;
+	size_t obj_size;
+	int err;
+
+	memset (&b, 0, sizeof b);
+	err = __plan_flatten (ctx, &b, plan->type, 0);
+	if (err == 0)
+		err = get_type_size (plan->type, &obj_size);
+
+	if (err < 0) {
+		if (b.ops != NULL)
+			aosl_free (b.ops);
+		return err;
+	}
+
+	plan->ops = b.ops;
+	plan->nops = b.nops;
+	if (b.nops == 1 && b.ops [0].off == 0 && b.ops [0].code == PLAN_COPY && b.ops [0].n == obj_size)
+		plan->flat = 1;
+
+	plan->plain = __plan_plain (plan);
+	__plan_scan_info (plan);
+	return 0;
+}
+
+static int __plan_get (struct plan_ctx *ctx, const aosl_type_info_t *type, const struct type_plan **plan_p)
+{
+	struct type_plan *plan;
+	const struct type_plan *found;
+
+	found = __plan_find (type);
+	if (found != NULL) {
+		*plan_p = found;
+		return 0;
+	}
+
+	for (plan = ctx->compiled; plan != NULL; plan = plan->next) {
+		/* a recursive type, the plan is being built */
+		if (plan->type == type) {
+			*plan_p = plan;
+			return 0;
+		}
+	}
+
+	plan = (struct type_plan *)aosl_malloc (sizeof *plan);
+	if (plan == NULL)
+		return -AOSL_ENOMEM;
+
+	plan->type = type;
+	plan->flat = 0;
+	plan->plain = 0;
+	plan->has_cond = 0;
+	plan->fixed_wire = -1;
+	plan->nops = 0;
+	plan->ops = NULL;
+	plan->next = ctx->compiled;
+	ctx->compiled = plan;
+	ctx->count++;
+
+	*plan_p = plan;
+	return __plan_build (ctx, plan);
+}
+
+static void __plan_free (struct type_plan *plan)
+{
+	if (plan->ops != NULL)
+		aosl_free (plan->ops);
+
+	aosl_free (plan);
+}
+
+static void __plans_publish (struct plan_ctx *ctx)
+{
+	struct type_plan *plan;
+
+	/* make sure all the plans are visible before they could be found */
+	aosl_wmb ();
+	for (plan = ctx->compiled; plan != NULL; plan = plan->next) {
+		uint32_t i = __plan_hash (plan->type);
+
+		while (type_plans [i] != NULL)
+			i = (i + 1) & (TYPE_PLANS_MAX - 1);
+
+		type_plans [i] = plan;
+		type_plans_count++;
+	}
+}
+
+struct plan_writer {
+	aosl_psb_t *psb;
+	size_t len;
+};
+
+static int __plan_put (struct plan_writer *w, const void *src, size_t n)
+{
+	struct ps_buff *psb = (struct ps_buff *)w->psb;
+	const uint8_t *p = (const uint8_t *)src;
+
+	w->len += n;
+	if (likely (psb_tailroom (psb) >= n)) {
+		memcpy (psb_put (psb, n), p, n);
+		return 0;
+	}
+
+	for (;;) {
+		struct ps_buff *next;
+		size_t copy = psb_tailroom (psb);
+
+		if (copy > n)
+			copy = n;
+		memcpy (psb_put (psb, copy), p, copy);
+		p += copy;
+		n -= copy;
+		if (n == 0)
+			break;
+
+		next = psb->next;
+		if (!next) {
+			next = alloc_psb (DFLT_MAX_PSB_PKT);
+			if (IS_ERR (next))
+				return PTR_ERR (next);
+
+			psb->next = next;
+		}
+		psb = next;
+	}
+
+	w->psb = (aosl_psb_t *)psb;
+	return 0;
+}
+
+static int __plan_marshal (const struct type_plan *plan, const void *base, struct plan_writer *w);
+
+static int __plan_marshal_elems (const struct type_plan *sub, const uint8_t *addr, size_t count, size_t stride, struct plan_writer *w)
+{
+	size_t i;
+	int err;
+
+	if (sub->flat)
+		return __plan_put (w, addr, count * stride);
+
+	for (i = 0; i < count; i++) {
+		err = __plan_marshal (sub, addr + stride * i, w);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+static int __plan_marshal (const struct type_plan *plan, const void *base, struct plan_writer *w)
+{
+	const struct plan_op *op;
+	const struct plan_op *end = plan->ops + plan->nops;
+	const aosl_dynamic_array_t *arr;
+	const void *pointer_val;
+	uint8_t bool_val;
+	uint16_t val;
+	uint16_t enc;
+	int err = 0;
+
+	for (op = plan->ops; op < end; op++) {
+		const uint8_t *addr = (const uint8_t *)base + op->off;
+
+		switch (op->code) {
+		case PLAN_COPY:
+			err = __plan_put (w, addr, op->n);
+			break;
+		case PLAN_COND:
+			if (!op->is_have (addr))
+				op += op->n;
+			continue;
+		case PLAN_STRING:
+			pointer_val = *(const char *const *)addr;
+			bool_val = (uint8_t)(pointer_val != NULL);
+			err = __plan_put (w, &bool_val, 1);
+			if (err == 0 && bool_val) {
+				val = strlen ((const char *)pointer_val) + 1;
+				err = __plan_put (w, pointer_val, val);
+			}
+			break;
+		case PLAN_POINTER:
+			pointer_val = *(void *const *)addr;
+			bool_val = (uint8_t)(pointer_val != NULL);
+			err = __plan_put (w, &bool_val, 1);
+			if (err == 0 && bool_val)
+				err = __plan_marshal (op->sub, pointer_val, w);
+			break;
+		case PLAN_VAR_BYTES:
+			val = *(const uint16_t *)((const uint8_t *)base + op->count_off);
+			enc = __encode_int16 (val);
+			err = __plan_put (w, &enc, sizeof enc);
+			if (err == 0)
+				err = __plan_put (w, addr, val);
+			break;
+		case PLAN_BYTES_WITH_NIL:
+			val = strlen ((const char *)addr) + 1;
+			/* for string, we'd better do this checking */
+			if (val > op->n)
+				return -AOSL_EINVAL;
+
+			err = __plan_put (w, addr, val);
+			break;
+		case PLAN_DYNAMIC_BYTES:
+		case PLAN_DYNAMIC_STRING:
+			arr = (const aosl_dynamic_array_t *)addr;
+			val = arr->count;
+			enc = __encode_int16 (val);
+			err = __plan_put (w, &enc, sizeof enc);
+			if (err == 0 && val > 0)
+				err = __plan_put (w, arr->values, val);
+			break;
+		case PLAN_FIXED_ARRAY:
+			err = __plan_marshal_elems (op->sub, addr, op->n, op->stride, w);
+			break;
+		case PLAN_VAR_ARRAY:
+			val = *(const uint16_t *)((const uint8_t *)base + op->count_off);
+			enc = __encode_int16 (val);
+			err = __plan_put (w, &enc, sizeof enc);
+			if (err == 0)
+				err = __plan_marshal_elems (op->sub, addr, val, op->stride, w);
+			break;
+		case PLAN_DYNAMIC_ARRAY:
+			arr = (const aosl_dynamic_array_t *)addr;
+			val = arr->count;
+			enc = __encode_int16 (val);
+			err = __plan_put (w, &enc, sizeof enc);
+			if (err == 0 && val > 0)
+				err = __plan_marshal_elems (op->sub, (const uint8_t *)arr->values, val, op->stride, w);
+			break;
+		default:
+			return -AOSL_EINVAL;
+		}
+
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+static isize_t plan_marshal (const struct type_plan *plan, const void *typed_obj_p, aosl_psb_t *psb)
+{
+	struct plan_writer w;
+	int err;
+
+	w.psb = psb;
+	w.len = 0;
+	err = __plan_marshal (plan, typed_obj_p, &w);
+	if (err < 0)
+		return err;
+
+	return (isize_t)w.len;
+}
+
+struct plan_reader {
+	const aosl_psb_t *psb;
+	size_t len;
+	aosl_unmarshal_arena_t *arena;
+};
+
+static int __plan_get_bytes (struct plan_reader *r, void *dst, size_t n)
+{
+	struct ps_buff *psb = (struct ps_buff *)r->psb;
+	uint8_t *p = (uint8_t *)dst;
+
+	r->len += n;
+	if (likely (psb->len >= n)) {
+		memcpy (p, psb_get (psb, n), n);
+		return 0;
+	}
+
+	for (;;) {
+		size_t copy = psb->len;
+
+		if (copy > n)
+			copy = n;
+		memcpy (p, psb_get (psb, copy), copy);
+		p += copy;
+		n -= copy;
+		if (n == 0)
+			break;
+
+		psb = psb->next;
+		if (psb == NULL)
+			return -AOSL_EMSGSIZE;
+	}
+
+	r->psb = (const aosl_psb_t *)psb;
+	return 0;
+}
+
+static int __plan_get_count (struct plan_reader *r, uint16_t *val_p)
+{
+	uint16_t enc;
+	int err;
+
+	err = __plan_get_bytes (r, &enc, sizeof enc);
+	if (err < 0)
+		return err;
+
+	*val_p = __decode_int16 (enc);
+	return 0;
+}
+
+static int __plan_unmarshal (const struct type_plan *plan, void *base, struct plan_reader *r);
+
+static int __plan_unmarshal_elems (const struct type_plan *sub, uint8_t *addr, size_t count, size_t stride, struct plan_reader *r)
+{
+	size_t i;
+	int err;
+
+	if (sub->flat)
+		return __plan_get_bytes (r, addr, count * stride);
+
+	for (i = 0; i < count; i++) {
+		err = __plan_unmarshal (sub, addr + stride * i, r);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+static int __plan_unmarshal (const struct type_plan *plan, void *base, struct plan_reader *r)
+{
+	const struct plan_op *op;
+	const struct plan_op *end = plan->ops + plan->nops;
+	aosl_dynamic_array_t *arr;
+	void *pointer_val;
+	uint8_t bool_val;
+	uint16_t val;
+	isize_t ret;
+	int str;
+	int err = 0;
+
+	for (op = plan->ops; op < end; op++) {
+		uint8_t *addr = (uint8_t *)base + op->off;
+
+		switch (op->code) {
+		case PLAN_COPY:
+			err = __plan_get_bytes (r, addr, op->n);
+			break;
+		case PLAN_COND:
+			if (!op->is_have (addr))
+				op += op->n;
+			continue;
+		case PLAN_STRING:
+			err = __plan_get_bytes (r, &bool_val, 1);
+			if (err < 0)
+				break;
+
+			if (!bool_val) {
+				*(void **)addr = NULL;
+				break;
+			}
+
+			ret = SAFE_STRSIZE (r->psb);
+			if (ret < 0)
+				return (int)ret;
+
+			val = (uint16_t)ret;
+			pointer_val = __unmarshal_alloc (r->arena, val);
+			if (pointer_val == NULL)
+				return -AOSL_ENOMEM;
+
+			/* set the pointer first, so it could be freed by fini if failed */
+			*(void **)addr = pointer_val;
+			err = __plan_get_bytes (r, pointer_val, val);
+			break;
+		case PLAN_POINTER:
+			err = __plan_get_bytes (r, &bool_val, 1);
+			if (err < 0)
+				break;
+
+			if (!bool_val) {
+				*(void **)addr = NULL;
+				break;
+			}
+
+			pointer_val = __unmarshal_alloc (r->arena, op->stride);
+			if (pointer_val == NULL)
+				return -AOSL_ENOMEM;
+
+			memset (pointer_val, 0, op->stride);
+			*(void **)addr = pointer_val;
+			err = __plan_unmarshal (op->sub, pointer_val, r);
+			break;
+		case PLAN_VAR_BYTES:
+			err = __plan_get_count (r, &val);
+			if (err < 0)
+				break;
+
+			if (val > op->n)
+				return -AOSL_ENOSPC;
+
+			*(uint16_t *)((uint8_t *)base + op->count_off) = val;
+			err = __plan_get_bytes (r, addr, val);
+			break;
+		case PLAN_BYTES_WITH_NIL:
+			ret = SAFE_STRSIZE (r->psb);
+			if (ret < 0)
+				return (int)ret;
+
+			val = (uint16_t)ret;
+			if (val > op->n)
+				return -AOSL_ENOSPC;
+
+			err = __plan_get_bytes (r, addr, val);
+			break;
+		case PLAN_DYNAMIC_BYTES:
+		case PLAN_DYNAMIC_STRING:
+			err = __plan_get_count (r, &val);
+			if (err < 0)
+				break;
+
+			str = (op->code == PLAN_DYNAMIC_STRING);
+			arr = (aosl_dynamic_array_t *)addr;
+			arr->count = val;
+			arr->allocated = r->arena == NULL ? val + str : 0;
+			if (val + str > 0) {
+				pointer_val = __unmarshal_alloc (r->arena, val + str);
+				if (pointer_val == NULL) {
+					arr->count = 0;
+					arr->allocated = 0;
+					return -AOSL_ENOMEM;
+				}
+
+				arr->values = pointer_val;
+				if (val > 0)
+					err = __plan_get_bytes (r, pointer_val, val);
+
+				if (str)
+					*((char *)pointer_val + val) = '\0';
+			}
+			break;
+		case PLAN_FIXED_ARRAY:
+			err = __plan_unmarshal_elems (op->sub, addr, op->n, op->stride, r);
+			break;
+		case PLAN_VAR_ARRAY:
+			err = __plan_get_count (r, &val);
+			if (err < 0)
+				break;
+
+			if (val > op->n)
+				return -AOSL_ENOSPC;
+
+			*(uint16_t *)((uint8_t *)base + op->count_off) = val;
+			err = __plan_unmarshal_elems (op->sub, addr, val, op->stride, r);
+			break;
+		case PLAN_DYNAMIC_ARRAY:
+			err = __plan_get_count (r, &val);
+			if (err < 0)
+				break;
+
+			arr = (aosl_dynamic_array_t *)addr;
+			arr->count = val;
+			arr->allocated = r->arena == NULL ? val : 0;
+			if (val > 0) {
+				pointer_val = __unmarshal_alloc (r->arena, op->stride * val);
+				if (pointer_val == NULL) {
+					arr->count = 0;
+					arr->allocated = 0;
+					return -AOSL_ENOMEM;
+				}
+
+				/* the elements never decoded on an error are finished too */
+				if (!op->sub->plain)
+					memset (pointer_val, 0, op->stride * val);
+
+				arr->values = pointer_val;
+				err = __plan_unmarshal_elems (op->sub, (uint8_t *)pointer_val, val, op->stride, r);
+			}
+			break;
+		default:
+			return -AOSL_EINVAL;
+		}
+
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+static isize_t plan_unmarshal (const struct type_plan *plan, void *typed_obj_p, const aosl_psb_t *psb, aosl_unmarshal_arena_t *arena)
+{
+	struct plan_reader r;
+	int err;
+
+	r.psb = psb;
+	r.len = 0;
+	r.arena = arena;
+	err = __plan_unmarshal (plan, typed_obj_p, &r);
+	if (err < 0)
+		return err;
+
+	return (isize_t)r.len;
+}
+
+/**
+ * Scanning the sizes of the variable size data with the compiled plan
+ * before the arena decoding, without consuming the psb. Only for checking
+ * the conditional fields, the fixed size fields of the object itself are
+ * decoded in place, but the pointed objects and the dynamic array elements
+ * have no memory yet, so a conditional field in them stops the scanning,
+ * and then the arena grows on demand.
+ **/
+struct arena_scan {
+	const struct ps_buff *psb;
+	size_t off;
+	size_t total;
+};
+
+#define ARENA_SCAN_UNKNOWN 1
+
+static int __scan_bytes (struct arena_scan *sc, void *dst, size_t n)
+{
+	uint8_t *p = (uint8_t *)dst;
+
+	while (n > 0) {
+		size_t copy;
+
+		if (sc->psb == NULL)
+			return -AOSL_EMSGSIZE;
+
+		copy = sc->psb->len - sc->off;
+		if (copy > n)
+			copy = n;
+
+		if (p != NULL) {
+			memcpy (p, (const uint8_t *)sc->psb->data + sc->off, copy);
+			p += copy;
+		}
+
+		sc->off += copy;
+		n -= copy;
+		if (sc->off == sc->psb->len) {
+			sc->psb = sc->psb->next;
+			sc->off = 0;
+		}
+	}
+
+	return 0;
+}
+
+static int __scan_count (struct arena_scan *sc, uint16_t *val_p)
+{
+	uint16_t enc;
+	int err;
+
+	err = __scan_bytes (sc, &enc, sizeof enc);
+	if (err < 0)
+		return err;
+
+	*val_p = __decode_int16 (enc);
+	return 0;
+}
+
+/* the string length including the terminating '\0' */
+static int __scan_strsize (const struct arena_scan *sc, uint16_t *val_p)
+{
+	const struct ps_buff *b = sc->psb;
+	size_t off = sc->off;
+	size_t l = 0;
+
+	while (b != NULL) {
+		if (off == b->len) {
+			b = b->next;
+			off = 0;
+			continue;
+		}
+
+		l++;
+		if (((const uint8_t *)b->data) [off++] == '\0') {
+			*val_p = (uint16_t)l;
+			return 0;
+		}
+	}
+
+	return -AOSL_EMSGSIZE;
+}
+
+static int __plan_scan (const struct type_plan *plan, void *base, struct arena_scan *sc);
+
+static int __plan_scan_elems (const struct type_plan *sub, uint8_t *addr, size_t count, size_t stride, struct arena_scan *sc)
+{
+	size_t i;
+	int err;
+
+	if (addr == NULL && sub->fixed_wire >= 0)
+		return __scan_bytes (sc, NULL, (size_t)sub->fixed_wire * count);
+
+	for (i = 0; i < count; i++) {
+		err = __plan_scan (sub, addr != NULL ? addr + stride * i : NULL, sc);
+		if (err != 0)
+			return err;
+	}
+
+	return 0;
+}
+
+static int __plan_scan (const struct type_plan *plan, void *base, struct arena_scan *sc)
 {
-	return _____unmarshal (obj_type, obj_addr, &psb);
+	const struct plan_op *op;
+	const struct plan_op *end = plan->ops + plan->nops;
+	uint8_t bool_val;
+	uint16_t val;
+	int str;
+	int err = 0;
+
+	for (op = plan->ops; op < end; op++) {
+		uint8_t *addr = base != NULL ? (uint8_t *)base + op->off : NULL;
+
+		switch (op->code) {
+		case PLAN_COPY:
+			err = __scan_bytes (sc, addr, op->n);
+			break;
+		case PLAN_COND:
+			if (addr == NULL)
+				return ARENA_SCAN_UNKNOWN;
+
+			if (!op->is_have (addr))
+				op += op->n;
+			continue;
+		case PLAN_STRING:
+			err = __scan_bytes (sc, &bool_val, 1);
+			if (err < 0 || !bool_val)
+				break;
+
+			err = __scan_strsize (sc, &val);
+			if (err < 0)
+				break;
+
+			sc->total += ARENA_ALIGNED (val);
+			err = __scan_bytes (sc, NULL, val);
+			break;
+		case PLAN_POINTER:
+			err = __scan_bytes (sc, &bool_val, 1);
+			if (err < 0 || !bool_val)
+				break;
+
+			sc->total += ARENA_ALIGNED (op->stride);
+			err = __plan_scan (op->sub, NULL, sc);
+			break;
+		case PLAN_VAR_BYTES:
+			err = __scan_count (sc, &val);
+			if (err < 0)
+				break;
+
+			if (val > op->n)
+				return -AOSL_ENOSPC;
+
+			if (base != NULL)
+				*(uint16_t *)((uint8_t *)base + op->count_off) = val;
+			err = __scan_bytes (sc, addr, val);
+			break;
+		case PLAN_BYTES_WITH_NIL:
+			err = __scan_strsize (sc, &val);
+			if (err < 0)
+				break;
+
+			if (val > op->n)
+				return -AOSL_ENOSPC;
+
+			err = __scan_bytes (sc, addr, val);
+			break;
+		case PLAN_DYNAMIC_BYTES:
+		case PLAN_DYNAMIC_STRING:
+			err = __scan_count (sc, &val);
+			if (err < 0)
+				break;
+
+			str = (op->code == PLAN_DYNAMIC_STRING);
+			sc->total += ARENA_ALIGNED ((size_t)val + str);
+			err = __scan_bytes (sc, NULL, val);
+			break;
+		case PLAN_FIXED_ARRAY:
+			err = __plan_scan_elems (op->sub, addr, op->n, op->stride, sc);
+			break;
+		case PLAN_VAR_ARRAY:
+			err = __scan_count (sc, &val);
+			if (err < 0)
+				break;
+
+			if (val > op->n)
+				return -AOSL_ENOSPC;
+
+			if (base != NULL)
+				*(uint16_t *)((uint8_t *)base + op->count_off) = val;
+			err = __plan_scan_elems (op->sub, addr, val, op->stride, sc);
+			break;
+		case PLAN_DYNAMIC_ARRAY:
+			err = __scan_count (sc, &val);
+			if (err < 0 || val == 0)
+				break;
+
+			sc->total += ARENA_ALIGNED (op->stride * val);
+			err = __plan_scan_elems (op->sub, NULL, val, op->stride, sc);
+			break;
+		default:
+			return -AOSL_EINVAL;
+		}
+
+		if (err != 0)
+			return err;
+	}
+
+	return 0;
+}
+
+static void __plan_init (const struct type_plan *plan, void *base)
+{
+	const struct plan_op *op;
+	const struct plan_op *end = plan->ops + plan->nops;
+	aosl_dynamic_array_t *arr;
+	size_t i;
+
+	for (op = plan->ops; op < end; op++) {
+		uint8_t *addr = (uint8_t *)base + op->off;
+
+		switch (op->code) {
+		case PLAN_COPY:
+			memset (addr, 0, op->n);
+			break;
+		case PLAN_STRING:
+		case PLAN_POINTER:
+			*(void **)addr = NULL;
+			break;
+		case PLAN_VAR_BYTES:
+		case PLAN_VAR_ARRAY:
+			*(uint16_t *)((uint8_t *)base + op->count_off) = 0;
+			break;
+		case PLAN_BYTES_WITH_NIL:
+			*(char *)addr = '\0';
+			break;
+		case PLAN_DYNAMIC_BYTES:
+		case PLAN_DYNAMIC_STRING:
+		case PLAN_DYNAMIC_ARRAY:
+			arr = (aosl_dynamic_array_t *)addr;
+			arr->count = 0;
+			arr->allocated = 0;
+			arr->values = NULL;
+			break;
+		case PLAN_FIXED_ARRAY:
+			for (i = 0; i < op->n; i++)
+				__plan_init (op->sub, addr + op->stride * i);
+			break;
+		default:
+			/* the conditional fields are initialized as well */
+			break;
+		}
+	}
+}
+
+static void __plan_fini (const struct type_plan *plan, void *base)
+{
+	const struct plan_op *op;
+	const struct plan_op *end = plan->ops + plan->nops;
+	aosl_dynamic_array_t *arr;
+	uint16_t *count_p;
+	void *p;
+	size_t i;
+
+	for (op = plan->ops; op < end; op++) {
+		uint8_t *addr = (uint8_t *)base + op->off;
+
+		switch (op->code) {
+		case PLAN_STRING:
+		case PLAN_POINTER:
+			p = *(void **)addr;
+			if (p != NULL) {
+				if (op->code == PLAN_POINTER && !op->sub->plain)
+					__plan_fini (op->sub, p);
+
+				aosl_free (p);
+				*(void **)addr = NULL;
+			}
+			break;
+		case PLAN_FIXED_ARRAY:
+			if (!op->sub->plain) {
+				for (i = 0; i < op->n; i++)
+					__plan_fini (op->sub, addr + op->stride * i);
+			}
+			break;
+		case PLAN_VAR_ARRAY:
+			count_p = (uint16_t *)((uint8_t *)base + op->count_off);
+			if (!op->sub->plain) {
+				for (i = 0; i < (size_t)*count_p; i++)
+					__plan_fini (op->sub, addr + op->stride * i);
+			}
+			*count_p = 0;
+			break;
+		case PLAN_DYNAMIC_BYTES:
+		case PLAN_DYNAMIC_STRING:
+		case PLAN_DYNAMIC_ARRAY:
+			arr = (aosl_dynamic_array_t *)addr;
+			if (arr->allocated > 0) {
+				if (op->code == PLAN_DYNAMIC_ARRAY && !op->sub->plain) {
+					for (i = 0; i < (size_t)arr->count; i++)
+						__plan_fini (op->sub, (uint8_t *)arr->values + op->stride * i);
+				}
+
+				aosl_free (arr->values);
+			}
+			arr->count = 0;
+			arr->allocated = 0;
+			arr->values = NULL;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+void k_marshal_fini (void)
+{
+	int i;
+
+	k_static_lock_lock (&type_plans_lock);
+	for (i = 0; i < TYPE_PLANS_MAX; i++) {
+		if (type_plans [i] != NULL) {
+			__plan_free (type_plans [i]);
+			type_plans [i] = NULL;
+		}
+	}
+	type_plans_count = 0;
+	k_static_lock_unlock (&type_plans_lock);
 }
 
 /*
@@ -1166,30 +2469,173 @@ static void smart_fini_typed_obj (const aosl_type_info_t *type, const void *type
 	}
 }
 
+__export_in_so__ int aosl_type_compile (const aosl_type_info_t *type)
+{
+	struct plan_ctx ctx;
+	const struct type_plan *plan;
+	int err = 0;
+
+	if (type == NULL)
+		return_err (-AOSL_EINVAL);
+
+	ctx.compiled = NULL;
+	ctx.count = 0;
+
+	k_static_lock_lock (&type_plans_lock);
+	if (__plan_find (type) == NULL) {
+		err = __plan_get (&ctx, type, &plan);
+		if (err == 0 && type_plans_count + ctx.count > TYPE_PLANS_LIMIT)
+			err = -AOSL_ENOSPC;
+
+		if (err == 0) {
+			__plans_publish (&ctx);
+		} else {
+			while (ctx.compiled != NULL) {
+				struct type_plan *next = ctx.compiled->next;
+				__plan_free (ctx.compiled);
+				ctx.compiled = next;
+			}
+		}
+	}
+	k_static_lock_unlock (&type_plans_lock);
+
+	return_err (err);
+}
+
+/**
+ * The encoders write to the tailroom got by psb_put directly, so make
+ * the shared segments of a cloned psb list private before encoding.
+ **/
+static int __marshal_unshare (aosl_psb_t *psb)
+{
+	struct ps_buff *b;
+	int err;
+
+	for (b = (struct ps_buff *)psb; b != NULL; b = b->next) {
+		err = psb_unshare (b);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
 __export_in_so__ isize_t aosl_marshal (const aosl_type_info_t *type, const void *typed_obj_p, aosl_psb_t *psb)
 {
+	const struct type_plan *plan = plan_lookup (type);
 	isize_t err;
 
-	err = smart_marshal (type, typed_obj_p, psb);
+	err = __marshal_unshare (psb);
+	if (err < 0)
+		return_err (err);
+
+	if (plan != NULL) {
+		err = plan_marshal (plan, typed_obj_p, psb);
+	} else {
+		err = smart_marshal (type, typed_obj_p, psb);
+	}
 	return_err (err);
 }
 
 __export_in_so__ isize_t aosl_unmarshal (const aosl_type_info_t *type, void *typed_obj_p, const aosl_psb_t *psb)
 {
+	const struct type_plan *plan = plan_lookup (type);
 	isize_t err;
 
-	err = smart_unmarshal (type, typed_obj_p, psb);
+	if (plan != NULL) {
+		err = plan_unmarshal (plan, typed_obj_p, psb, NULL);
+	} else {
+		err = smart_unmarshal (type, typed_obj_p, psb, NULL);
+	}
 	return_err (err);
 }
 
+__export_in_so__ void aosl_unmarshal_arena_init (aosl_unmarshal_arena_t *arena, void *buf, size_t size)
+{
+	uintptr_t pad = 0;
+
+	/* keep all the allocations aligned */
+	if (buf != NULL)
+		pad = (ARENA_ALIGN - ((uintptr_t)buf & (ARENA_ALIGN - 1))) & (ARENA_ALIGN - 1);
+
+	if (buf == NULL || size <= pad) {
+		arena->buf = NULL;
+		arena->size = 0;
+	} else {
+		arena->buf = (uint8_t *)buf + pad;
+		arena->size = size - pad;
+	}
+
+	arena->used = 0;
+	arena->blocks = NULL;
+}
+
+__export_in_so__ isize_t aosl_unmarshal_arena (const aosl_type_info_t *type, void *typed_obj_p, const aosl_psb_t *psb, aosl_unmarshal_arena_t *arena)
+{
+	const struct type_plan *plan;
+	struct arena_scan sc;
+	isize_t err;
+
+	if (arena == NULL)
+		return_err (-AOSL_EINVAL);
+
+	plan = plan_lookup (type);
+	if (plan == NULL) {
+		/* no plan to scan the sizes with, the arena grows on demand */
+		err = smart_unmarshal (type, typed_obj_p, psb, arena);
+		return_err (err);
+	}
+
+	sc.psb = (const struct ps_buff *)psb;
+	sc.off = 0;
+	sc.total = 0;
+	err = __plan_scan (plan, plan->has_cond ? typed_obj_p : NULL, &sc);
+	if (err < 0)
+		return_err (err);
+
+	if (err == 0) {
+		err = __arena_reserve (arena, sc.total);
+		if (err < 0)
+			return_err (err);
+	}
+
+	err = plan_unmarshal (plan, typed_obj_p, psb, arena);
+	return_err (err);
+}
+
+__export_in_so__ void aosl_unmarshal_arena_fini (aosl_unmarshal_arena_t *arena)
+{
+	struct arena_block *block;
+
+	while (arena->blocks != NULL) {
+		block = (struct arena_block *)arena->blocks;
+		arena->blocks = block->next;
+		aosl_free (block);
+	}
+
+	arena->used = 0;
+}
+
 __export_in_so__ void aosl_init_typed_obj (const aosl_type_info_t *type, void *typed_obj_p)
 {
-	smart_init_typed_obj (type, typed_obj_p);
+	const struct type_plan *plan = plan_lookup (type);
+
+	if (plan != NULL) {
+		__plan_init (plan, typed_obj_p);
+	} else {
+		smart_init_typed_obj (type, typed_obj_p);
+	}
 }
 
 __export_in_so__ void aosl_fini_typed_obj (const aosl_type_info_t *type, const void *typed_obj_p)
 {
-	smart_fini_typed_obj (type, typed_obj_p);
+	const struct type_plan *plan = plan_lookup (type);
+
+	if (plan != NULL) {
+		__plan_fini (plan, (void *)typed_obj_p);
+	} else {
+		smart_fini_typed_obj (type, typed_obj_p);
+	}
 }
 
 __export_in_so__ uint16_t aosl_encode_int16 (uint16_t v)
@@ -7,9 +7,12 @@
  * Refer to the "LICENSE" file in the root directory for more information.
  ***************************************************************************/
 
+#include <string.h>
+
 #include <kernel/err.h>
 #include <kernel/kernel.h>
 #include <api/aosl_mm.h>
+#include <kernel/iofd.h>
 #include <kernel/psbuff.h>
 #include <api/aosl_psb.h>
 
@@ -25,6 +28,7 @@ struct ps_buff *alloc_user_psb (void *buf, size_t bufsz)
 
 		psb->size = bufsz;
 		psb->flags = PSB_USER_BUFFER;
+		psb->seg = NULL;
 
 		psb->data = psb->head;
 		psb->len = 0;
@@ -38,49 +42,213 @@ struct ps_buff *alloc_user_psb (void *buf, size_t bufsz)
 
 #define MAX_SPB_SIZE (8 << 20)
 
+/**
+ * The smallest class of the queue buffer pool is 2KB, so only the blocks
+ * not much smaller than that go to the pool, the small ones are just from
+ * the heap to avoid wasting most of a pooled buffer.
+ **/
+#define PSB_POOL_MIN_SIZE (1 << 10)
+
+static void *__psb_block_alloc (size_t size, uintptr_t *seg_flags_p)
+{
+	void *block;
+
+	if (size >= PSB_POOL_MIN_SIZE) {
+		block = mpq_buf_alloc (size);
+		if (block != NULL) {
+			*seg_flags_p = PSB_SEG_POOLED;
+			return block;
+		}
+	}
+
+	*seg_flags_p = 0;
+	return aosl_malloc (size);
+}
+
+static void __psb_seg_put (struct psb_seg *seg)
+{
+	if (atomic_dec_and_test (&seg->refs)) {
+		void *block;
+
+		if (seg->flags & PSB_SEG_EMBEDDED) {
+			block = (struct ps_buff *)seg - 1;
+		} else {
+			block = seg;
+		}
+
+		if (seg->flags & PSB_SEG_POOLED) {
+			mpq_buf_free (block);
+		} else {
+			aosl_free (block);
+		}
+	}
+}
+
+static __inline__ struct psb_seg *__psb_own_seg (const struct ps_buff *psb)
+{
+	if (psb->flags & PSB_EMBEDDED)
+		return (struct psb_seg *)(psb + 1);
+
+	return NULL;
+}
+
+/**
+ * Stop using the current buffer of the psb. An embedded header keeps the
+ * reference of its own block until the header itself is freed, and a not
+ * refcounted buffer which is not a user buffer was attached by the caller
+ * with the ownership.
+ **/
+static void __psb_release_buf (struct ps_buff *psb)
+{
+	if (psb->seg != NULL) {
+		if (psb->seg != __psb_own_seg (psb))
+			__psb_seg_put (psb->seg);
+
+		psb->seg = NULL;
+	} else if (!(psb->flags & PSB_USER_BUFFER) && psb->head != NULL) {
+		aosl_free (psb->head);
+	}
+}
+
 struct ps_buff *alloc_psb (size_t size)
 {
 	struct ps_buff *psb;
+	struct psb_seg *seg;
+	uintptr_t seg_flags;
 
 	if (size > MAX_SPB_SIZE)
 		return ERR_PTR (-AOSL_E2BIG);
 
-	psb = aosl_malloc (sizeof (struct ps_buff));
-	if (psb != NULL) {
-		if (size > 0) {
-			psb->head = aosl_malloc (size);
-			if (!psb->head) {
-				aosl_free (psb);
-				return ERR_PTR (-AOSL_ENOMEM);
-			}
-		} else {
-			psb->head = NULL;
-		}
+	psb = __psb_block_alloc (sizeof (struct ps_buff) + sizeof (struct psb_seg) + size, &seg_flags);
+	if (psb == NULL)
+		return ERR_PTR (-AOSL_ENOMEM);
 
-		psb->size = size;
-		psb->flags = 0;
+	seg = (struct psb_seg *)(psb + 1);
+	atomic_set (&seg->refs, 1);
+	seg->flags = seg_flags | PSB_SEG_EMBEDDED;
 
-		psb->data = psb->head;
-		psb->len = 0;
-		psb->next = NULL;
-		return psb;
+	if (size > 0) {
+		psb->head = seg + 1;
+		psb->seg = seg;
+	} else {
+		psb->head = NULL;
+		psb->seg = NULL;
 	}
 
-	return ERR_PTR (-AOSL_ENOMEM);
+	psb->size = size;
+	psb->flags = PSB_EMBEDDED;
+
+	psb->data = psb->head;
+	psb->len = 0;
+	psb->next = NULL;
+	return psb;
 }
 
 void free_psb (struct ps_buff *psb)
 {
-	if (!(psb->flags & PSB_USER_BUFFER) && psb->head != NULL)
-		aosl_free (psb->head);
+	__psb_release_buf (psb);
 
-	aosl_free (psb);
+	if (psb->flags & PSB_EMBEDDED) {
+		__psb_seg_put (__psb_own_seg (psb));
+	} else {
+		aosl_free (psb);
+	}
+}
+
+static void __free_psb_list (struct ps_buff *psb)
+{
+	while (psb) {
+		struct ps_buff *next = psb->next;
+		free_psb (psb);
+		psb = next;
+	}
+}
+
+static struct ps_buff *__psb_clone_one (const struct ps_buff *psb)
+{
+	struct ps_buff *clone;
+
+	if (psb->seg == NULL) {
+		/* a user or attached buffer is not refcounted, so copy it */
+		clone = alloc_psb (psb->size);
+		if (!IS_ERR (clone) && psb->size > 0) {
+			clone->data = (uint8_t *)clone->head + ((uint8_t *)psb->data - (uint8_t *)psb->head);
+			memcpy (clone->data, psb->data, psb->len);
+			clone->len = psb->len;
+		}
+
+		return clone;
+	}
+
+	clone = aosl_malloc (sizeof (struct ps_buff));
+	if (clone == NULL)
+		return ERR_PTR (-AOSL_ENOMEM);
+
+	atomic_inc (&psb->seg->refs);
+	clone->seg = psb->seg;
+	clone->head = psb->head;
+	clone->size = psb->size;
+	clone->flags = 0;
+
+	clone->data = psb->data;
+	clone->len = psb->len;
+	clone->next = NULL;
+	return clone;
+}
+
+struct ps_buff *psb_clone (const struct ps_buff *psb)
+{
+	struct ps_buff *first = NULL;
+	struct ps_buff **pp = &first;
+
+	if (psb == NULL)
+		return ERR_PTR (-AOSL_EINVAL);
+
+	while (psb != NULL) {
+		struct ps_buff *clone = __psb_clone_one (psb);
+		if (IS_ERR (clone)) {
+			__free_psb_list (first);
+			return clone;
+		}
+
+		*pp = clone;
+		pp = &clone->next;
+		psb = psb->next;
+	}
+
+	return first;
+}
+
+int psb_unshare (struct ps_buff *psb)
+{
+	struct psb_seg *seg;
+	uintptr_t seg_flags;
+	size_t off;
+
+	if (!psb_shared (psb))
+		return 0;
+
+	seg = __psb_block_alloc (sizeof (struct psb_seg) + psb->size, &seg_flags);
+	if (seg == NULL)
+		return -AOSL_ENOMEM;
+
+	atomic_set (&seg->refs, 1);
+	seg->flags = seg_flags;
+
+	/* keep the headroom, only the current data is worth copying */
+	off = (uint8_t *)psb->data - (uint8_t *)psb->head;
+	memcpy ((uint8_t *)(seg + 1) + off, psb->data, psb->len);
+
+	__psb_release_buf (psb);
+	psb->seg = seg;
+	psb->head = seg + 1;
+	psb->data = (uint8_t *)psb->head + off;
+	return 0;
 }
 
 void psb_attach_buf (struct ps_buff *psb, void *buf, size_t bufsz)
 {
-	if (psb->size > 0 && !(psb->flags & PSB_USER_BUFFER))
-		aosl_free (psb->head);
+	__psb_release_buf (psb);
 
 	if (bufsz > 0) {
 		psb->head = buf;
@@ -96,8 +264,7 @@ void psb_attach_buf (struct ps_buff *psb, void *buf, size_t bufsz)
 
 static __inline__ void __psb_detach_buf (struct ps_buff *psb)
 {
-	if (!(psb->flags & PSB_USER_BUFFER))
-		aosl_free (psb->head);
+	__psb_release_buf (psb);
 
 	psb->head = NULL;
 	psb->size = 0;
@@ -131,6 +298,16 @@ __export_in_so__ void aosl_psb_detach_buf (aosl_psb_t *psb)
 	psb_detach_buf ((struct ps_buff *)psb);
 }
 
+__export_in_so__ aosl_psb_t *aosl_psb_clone (const aosl_psb_t *psb)
+{
+	return_ptr_err (psb_clone ((const struct ps_buff *)psb));
+}
+
+__export_in_so__ int aosl_psb_unshare (aosl_psb_t *psb)
+{
+	return_err (psb_unshare ((struct ps_buff *)psb));
+}
+
 __export_in_so__ size_t aosl_psb_headroom (const aosl_psb_t *psb)
 {
 	return psb_headroom ((struct ps_buff *)psb);
@@ -210,10 +387,5 @@ __export_in_so__ void aosl_psb_reset (aosl_psb_t *psb)
 
 __export_in_so__ void aosl_free_psb_list (aosl_psb_t *aosl_psb)
 {
-	struct ps_buff *psb = (struct ps_buff *)aosl_psb;
-	while (psb) {
-		struct ps_buff *next = psb->next;
-		free_psb (psb);
-		psb = next;
-	}
+	__free_psb_list ((struct ps_buff *)aosl_psb);
 }
\ No newline at end of file
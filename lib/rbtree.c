@@ -83,7 +83,7 @@ static void __rb_rotate_right (struct aosl_rb_node *node, struct aosl_rb_root *r
 	rb_set_parent (node, left);
 }
 
-void aosl_rb_insert_color (struct aosl_rb_node *node, struct aosl_rb_root *root)
+__export_in_so__ void aosl_rb_insert_color (struct aosl_rb_node *node, struct aosl_rb_root *root)
 {
 	struct aosl_rb_node *parent, *gparent;
 
@@ -1,11 +1,12 @@
 /***************************************************************************
- * Module:	AOSL RB tree based TLS implementation
+ * Module:	AOSL hash table based TLS implementation
  *
  * Copyright © 2025 Agora
  * This file is part of AOSL, an open source project.
  * Licensed under the Apache License, Version 2.0, with certain conditions.
  * Refer to the "LICENSE" file in the root directory for more information.
  ***************************************************************************/
+#include <stdlib.h>
 #include <string.h>
 
 #include <kernel/types.h>
@@ -15,7 +16,7 @@
 #include <kernel/bitmap.h>
 #include <api/aosl_mm.h>
 #include <api/aosl_thread.h>
-#include <api/aosl_rbtree.h>
+#include <api/aosl_hash.h>
 
 struct k_tls_slot {
 	uintptr_t seq;
@@ -24,13 +25,23 @@ struct k_tls_slot {
 
 #define STATIC_TLS_KEY_ID_SIZE 16
 
+/* The max simultaneous TLS key count we supported */
+#define TLS_KEY_ID_MAX_SIZE 512
+
 static k_rwlock_t tls_key_id_lock;
 static bitmap_t *tls_key_id_bits = NULL;
-static struct k_tls_slot *tls_slot_table = NULL;
 static int tls_key_id_size = 0;
 
-/* The max simultaneous TLS key count we supported */
-#define TLS_KEY_ID_MAX_SIZE 512
+/**
+ * The slot table is never reallocated, so the lookups just read the
+ * sequence of a key without any lock, only the key id bitmap grows.
+ **/
+static struct k_tls_slot tls_slot_table [TLS_KEY_ID_MAX_SIZE];
+
+static __inline__ uintptr_t __tls_key_seq (int key)
+{
+	return *(volatile uintptr_t *)&tls_slot_table [key].seq;
+}
 
 static int alloc_tls_key (void)
 {
@@ -41,7 +52,6 @@ static int alloc_tls_key (void)
 	if (key < 0) {
 		int new_size;
 		bitmap_t *new_bits;
-		struct k_tls_slot *new_table;
 
 		if (tls_key_id_size >= TLS_KEY_ID_MAX_SIZE) {
 			k_rwlock_wrunlock (&tls_key_id_lock);
@@ -56,22 +66,10 @@ static int alloc_tls_key (void)
 			return -AOSL_ENOMEM;
 		}
 
-		new_table = (struct k_tls_slot *)aosl_malloc (sizeof (struct k_tls_slot) * new_size);
-		if (!new_table) {
-			k_rwlock_wrunlock (&tls_key_id_lock);
-			bitmap_destroy (new_bits);
-			return -AOSL_ENOMEM;
-		}
-
 		bitmap_copy (new_bits, tls_key_id_bits);
-		memcpy (new_table, tls_slot_table, sizeof (struct k_tls_slot) * tls_key_id_size);
-		memset (new_table + tls_key_id_size, 0, (new_size - tls_key_id_size) * sizeof (struct k_tls_slot));
-
 		bitmap_destroy (tls_key_id_bits);
-		aosl_free (tls_slot_table);
 
 		tls_key_id_bits = new_bits;
-		tls_slot_table = new_table;
 		tls_key_id_size = new_size;
 
 		key = bitmap_find_first_zero_bit (tls_key_id_bits);
@@ -111,10 +109,10 @@ int k_tls_key_create (k_tls_key_t *key)
 	return 0;
 }
 
-static struct aosl_rb_root thread_tree;
-static k_rwlock_t thread_tree_lock;
+static struct aosl_hash_table thread_hash;
+static k_rwlock_t thread_hash_lock;
 
-#define __KEY_USED(k) (((k).seq & 1) != 0)
+#define __KEY_USED(seq) (((seq) & 1) != 0)
 /**
  * Check whether a key is usable.  We cannot reuse an allocated key if
  * the sequence counter would overflow after the next destroy call.
@@ -131,31 +129,51 @@ struct k_tls_value {
 	void *val;
 };
 
+/**
+ * The TLS table of a thread, all of them are in the thread hash, so
+ * they could be freed at last even for the threads which were not
+ * created by us and exited without calling k_tls_thread_exit.
+ **/
 struct tls_thread_node {
-	struct aosl_rb_node rb_node;
+	struct aosl_hash_node hash_node;
 	k_thread_t thread_id;
 	size_t tls_key_table_size;
 	struct k_tls_value *tls_key_table;
+#if !defined(K_THREAD_LOCAL)
+	int err;
+#endif
 };
 
-static int cmp_thread (struct aosl_rb_node *rb_node, struct aosl_rb_node *node, va_list args)
-{
-	struct tls_thread_node *rb_entry = aosl_rb_entry (rb_node, struct tls_thread_node, rb_node);
-	k_thread_t thread_id;
+#if defined(K_THREAD_LOCAL)
+/**
+ * The nodes are all freed in rb_tls_fini, including the ones of the
+ * threads not created by us and still alive, so the node of a thread
+ * is only valid with the same generation.
+ **/
+static uintptr_t tls_gen = 1;
+static K_THREAD_LOCAL struct tls_thread_node *__this_tls;
+static K_THREAD_LOCAL uintptr_t __this_tls_gen;
+#endif
 
-	if (node != NULL) {
-		thread_id = aosl_rb_entry (node, struct tls_thread_node, rb_node)->thread_id;
-	} else {
-		thread_id = va_arg (args, k_thread_t);
-	}
+static __inline__ uintptr_t __thread_hash (k_thread_t thread_id)
+{
+	return aosl_hash_uintptr ((uintptr_t)thread_id);
+}
 
-	if (rb_entry->thread_id > thread_id)
-		return 1;
+/* the caller must hold thread_hash_lock */
+static struct tls_thread_node *__tls_thread_lookup (k_thread_t thread_id)
+{
+	uintptr_t hash = __thread_hash (thread_id);
+	struct aosl_hash_node *node;
+	struct tls_thread_node *thread_node;
 
-	if (rb_entry->thread_id < thread_id)
-		return -1;
+	aosl_hash_for_each_possible (&thread_hash, node, hash) {
+		thread_node = aosl_hash_entry (node, struct tls_thread_node, hash_node);
+		if (thread_node->thread_id == thread_id)
+			return thread_node;
+	}
 
-	return 0;
+	return NULL;
 }
 
 static void tls_thread_node_destory(struct tls_thread_node *node)
@@ -168,40 +186,86 @@ static void tls_thread_node_destory(struct tls_thread_node *node)
 	}
 }
 
-void *k_tls_key_get (k_tls_key_t key)
+static int __tls_thread_node_free (struct aosl_hash_node *node, void *arg)
 {
-	k_thread_t this_thread;
-	struct aosl_rb_node *node;
-	struct tls_thread_node *thread_node;
-	struct k_tls_value *tls_val;
-	struct k_tls_slot key_slot;
+	tls_thread_node_destory (aosl_hash_entry (node, struct tls_thread_node, hash_node));
+	return 0;
+}
 
-	if (key < 0 || key >= tls_key_id_size)
+static __inline__ struct tls_thread_node *__tls_this_node (void)
+{
+#if defined(K_THREAD_LOCAL)
+	if (__this_tls_gen != tls_gen)
 		return NULL;
 
-	k_rwlock_rdlock (&tls_key_id_lock);
-	key_slot = tls_slot_table [key];
-	k_rwlock_rdunlock (&tls_key_id_lock);
+	return __this_tls;
+#else
+	struct tls_thread_node *thread_node;
+
+	k_rwlock_rdlock (&thread_hash_lock);
+	thread_node = __tls_thread_lookup (k_thread_self ());
+	k_rwlock_rdunlock (&thread_hash_lock);
 
-	if (!__KEY_USED (key_slot))
-		return NULL;
+	return thread_node;
+#endif
+}
+
+static struct tls_thread_node *__tls_this_node_create (void)
+{
+	k_thread_t this_thread;
+	struct tls_thread_node *thread_node;
+
+	thread_node = __tls_this_node ();
+	if (thread_node != NULL)
+		return thread_node;
 
 	this_thread = k_thread_self ();
-	k_rwlock_rdlock (&thread_tree_lock);
-	node = aosl_find_rb_node (&thread_tree, NULL, this_thread);
-	if (node != NULL) {
-		thread_node = aosl_rb_entry (node, struct tls_thread_node, rb_node);
+	k_rwlock_wrlock (&thread_hash_lock);
+	/**
+	 * Only the thread itself creates its node, so no racing here, but
+	 * an exited thread which did not call k_tls_thread_exit might have
+	 * left its node with the same thread id, just take it over.
+	 **/
+	thread_node = __tls_thread_lookup (this_thread);
+	if (thread_node != NULL) {
+		memset (thread_node->tls_key_table, 0, sizeof (struct k_tls_value) * thread_node->tls_key_table_size);
 	} else {
-		thread_node = NULL;
+		thread_node = (struct tls_thread_node *)aosl_malloc (sizeof *thread_node);
+		if (thread_node == NULL)
+			abort ();
+
+		thread_node->thread_id = this_thread;
+		thread_node->tls_key_table = NULL;
+		thread_node->tls_key_table_size = 0;
+		aosl_hash_add (&thread_hash, &thread_node->hash_node, __thread_hash (this_thread));
 	}
-	k_rwlock_rdunlock (&thread_tree_lock);
+	k_rwlock_wrunlock (&thread_hash_lock);
+
+#if defined(K_THREAD_LOCAL)
+	__this_tls = thread_node;
+	__this_tls_gen = tls_gen;
+#else
+	thread_node->err = 0;
+#endif
+	return thread_node;
+}
+
+void *k_tls_key_get (k_tls_key_t key)
+{
+	struct tls_thread_node *thread_node;
+	struct k_tls_value *tls_val;
 
+	if (key < 0 || key >= TLS_KEY_ID_MAX_SIZE)
+		return NULL;
+
+	thread_node = __tls_this_node ();
 	if (thread_node == NULL || key >= (int)thread_node->tls_key_table_size)
 		return NULL;
 
 	tls_val = &thread_node->tls_key_table [key];
 	if (tls_val->val != NULL) {
-		if (tls_val->seq != key_slot.seq) {
+		/* the key was deleted after the value was set */
+		if (tls_val->seq != __tls_key_seq (key)) {
 			tls_val->val = NULL;
 			return NULL;
 		}
@@ -212,55 +276,17 @@ void *k_tls_key_get (k_tls_key_t key)
 
 int k_tls_key_set (k_tls_key_t key, void *value)
 {
-	k_thread_t this_thread;
-	struct aosl_rb_node *node;
 	struct tls_thread_node *thread_node;
-	struct k_tls_slot key_slot;
+	uintptr_t seq;
 
-	if (key < 0 || key >= tls_key_id_size)
+	if (key < 0 || key >= TLS_KEY_ID_MAX_SIZE)
 		return -AOSL_EINVAL;
 
-	k_rwlock_rdlock (&tls_key_id_lock);
-	key_slot = tls_slot_table [key];
-	k_rwlock_rdunlock (&tls_key_id_lock);
-
-	if (!__KEY_USED (key_slot))
+	seq = __tls_key_seq (key);
+	if (!__KEY_USED (seq))
 		return -AOSL_EINVAL;
 
-	this_thread = k_thread_self ();
-	k_rwlock_rdlock (&thread_tree_lock);
-	node = aosl_find_rb_node (&thread_tree, NULL, this_thread);
-	if (node != NULL) {
-		thread_node = aosl_rb_entry (node, struct tls_thread_node, rb_node);
-	} else {
-		thread_node = NULL;
-	}
-	k_rwlock_rdunlock (&thread_tree_lock);
-
-	if (thread_node == NULL) {
-		thread_node = (struct tls_thread_node *)aosl_malloc (sizeof *thread_node);
-		if (thread_node == NULL)
-			abort ();
-
-		thread_node->thread_id = this_thread;
-		thread_node->tls_key_table = (struct k_tls_value *)aosl_malloc (sizeof (struct k_tls_value) * tls_key_id_size);
-		if (thread_node->tls_key_table == NULL)
-			abort ();
-
-		memset (thread_node->tls_key_table, 0, sizeof (struct k_tls_value) * tls_key_id_size);
-		thread_node->tls_key_table_size = tls_key_id_size;
-
-		k_rwlock_wrlock (&thread_tree_lock);
-		/**
-		 * No find the thread node again when we get the write lock,
-		 * because the thread node can only be created by the thread
-		 * itself, so no racing condition after we released the read
-		 * lock and before the write lock.
-		 **/
-		aosl_rb_insert_node (&thread_tree, &thread_node->rb_node);
-		k_rwlock_wrunlock (&thread_tree_lock);
-	}
-
+	thread_node = __tls_this_node_create ();
 	if (key >= (int)thread_node->tls_key_table_size) {
 		size_t new_size = (size_t)tls_key_id_size;
 		struct k_tls_value *new_table = (struct k_tls_value *)aosl_malloc (sizeof (struct k_tls_value) * new_size);
@@ -269,20 +295,20 @@ int k_tls_key_set (k_tls_key_t key, void *value)
 			return -AOSL_ENOMEM;
 		}
 
+		BUG_ON (thread_node->tls_key_table_size > new_size);
 		if (thread_node->tls_key_table_size > 0) {
-			BUG_ON (thread_node->tls_key_table_size > new_size);
 			memcpy (new_table, thread_node->tls_key_table, sizeof (struct k_tls_value) * thread_node->tls_key_table_size);
-			memset (new_table + thread_node->tls_key_table_size, 0, sizeof (struct k_tls_value) * (new_size - thread_node->tls_key_table_size));
 			aosl_free (thread_node->tls_key_table);
 		}
 
+		memset (new_table + thread_node->tls_key_table_size, 0, sizeof (struct k_tls_value) * (new_size - thread_node->tls_key_table_size));
 		thread_node->tls_key_table = new_table;
 		thread_node->tls_key_table_size = new_size;
 	}
 
 	BUG_ON (key >= (int)thread_node->tls_key_table_size);
 	thread_node->tls_key_table [key].val = value;
-	thread_node->tls_key_table [key].seq = key_slot.seq;
+	thread_node->tls_key_table [key].seq = seq;
 	return 0;
 }
 
@@ -291,32 +317,57 @@ int k_tls_key_delete (k_tls_key_t key)
 	return free_tls_key ((int)key);
 }
 
+#if !defined(K_THREAD_LOCAL)
+int *k_tls_errno_ptr (void)
+{
+	return &__tls_this_node_create ()->err;
+}
+#endif
+
+void k_tls_thread_exit (void)
+{
+	struct tls_thread_node *thread_node = __tls_this_node ();
+
+	if (thread_node == NULL)
+		return;
+
+	k_rwlock_wrlock (&thread_hash_lock);
+	aosl_hash_del (&thread_hash, &thread_node->hash_node);
+	k_rwlock_wrunlock (&thread_hash_lock);
+
+#if defined(K_THREAD_LOCAL)
+	__this_tls = NULL;
+#endif
+	tls_thread_node_destory (thread_node);
+}
+
 void rb_tls_init (void)
 {
 	k_rwlock_init (&tls_key_id_lock);
 
 	tls_key_id_bits = bitmap_create (STATIC_TLS_KEY_ID_SIZE);
-	tls_slot_table = (struct k_tls_slot *)aosl_malloc (sizeof (struct k_tls_slot) * STATIC_TLS_KEY_ID_SIZE);
 	tls_key_id_size = STATIC_TLS_KEY_ID_SIZE;
-	for (int i = 0; i < tls_key_id_size; i++) {
+	for (int i = 0; i < TLS_KEY_ID_MAX_SIZE; i++) {
 		tls_slot_table [i].seq = 0;
 		/* tls_slot_table [i].dtor = NULL; */
 	}
 
-	aosl_rb_root_init (&thread_tree, cmp_thread);
-	k_rwlock_init (&thread_tree_lock);
+	/* the lookups are under the read lock */
+	aosl_hash_init (&thread_hash, AOSL_HASH_F_CONCURRENT_READ);
+	k_rwlock_init (&thread_hash_lock);
 }
 
 void rb_tls_fini()
 {
-	aosl_rb_clear(&thread_tree, struct tls_thread_node, rb_node, tls_thread_node_destory);
+	aosl_hash_fini (&thread_hash, __tls_thread_node_free, NULL);
+#if defined(K_THREAD_LOCAL)
+	tls_gen++;
+#endif
 
 	bitmap_destroy(tls_key_id_bits);
-	aosl_free(tls_slot_table);
 	tls_key_id_bits = NULL;
-	tls_slot_table = NULL;
 	tls_key_id_size = 0;
 
 	k_rwlock_destroy (&tls_key_id_lock);
-	k_rwlock_destroy (&thread_tree_lock);
-}
\ No newline at end of file
+	k_rwlock_destroy (&thread_hash_lock);
+}
@@ -49,25 +49,9 @@ struct mm_ptr_node {
 	}                                                                            \
 }
 
-static int __mm_ptr_cmp (struct aosl_rb_node *node1, struct aosl_rb_node *node2, va_list args)
-{
-	struct mm_ptr_node *rb_entry = aosl_rb_entry (node1, struct mm_ptr_node, node);
-	void *ptr;
-
-	if (node2 != NULL) {
-		ptr = aosl_rb_entry (node2, struct mm_ptr_node, node)->ptr;
-	} else {
-		ptr = va_arg (args, void *);
-	}
-
-	if (rb_entry->ptr > ptr)
-		return 1;
+#define mm_ptr_key(ptr_node) ((uintptr_t)(ptr_node)->ptr)
 
-	if (rb_entry->ptr < ptr)
-		return -1;
-
-	return 0;
-}
+AOSL_RB_DEFINE (mm_ptr_rb, struct mm_ptr_node, node, uintptr_t, mm_ptr_key, AOSL_RB_CMP)
 
 static int __mm_ptr_walk (struct aosl_rb_node *node, void *arg)
 {
@@ -100,35 +84,20 @@ struct mm_walk_arg {
 	int len;
 };
 
-static int __mm_pos_cmp (struct aosl_rb_node *node1, struct aosl_rb_node *node2, va_list args)
+static __inline__ int __mm_pos_cmp (const struct mm_pos_node *pos_node1, const struct mm_pos_node *pos_node2)
 {
-	struct mm_pos_node tmp_node;
-	struct mm_pos_node *pos_node1 = aosl_rb_entry (node1, struct mm_pos_node, node);
-	struct mm_pos_node *pos_node2 = NULL;
-
-	// get node2
-	if (node2) {
-		pos_node2 = aosl_rb_entry (node2, struct mm_pos_node, node);
-	} else {
-		tmp_node.func = va_arg (args, const char*);
-		tmp_node.line = va_arg (args, int);
-		pos_node2 = &tmp_node;
-	}
+	int cmp_func = strcmp (pos_node1->func, pos_node2->func);
 
-	// cmp
-	int cmp_func = strcmp(pos_node1->func, pos_node2->func);
-	if (cmp_func != 0) {
-		return cmp_func > 0 ? 1 : -1;
-	}
-	if (pos_node1->line == pos_node2->line) {
-		return 0;
-	}
-	if (pos_node1->line > pos_node2->line)
-		return 1;
-	else
-		return -1;
+	if (cmp_func != 0)
+		return cmp_func;
+
+	return AOSL_RB_CMP (pos_node1->line, pos_node2->line);
 }
 
+#define mm_pos_key(pos_node) ((const struct mm_pos_node *)(pos_node))
+
+AOSL_RB_DEFINE (mm_pos_rb, struct mm_pos_node, node, const struct mm_pos_node *, mm_pos_key, __mm_pos_cmp)
+
 static int __mm_pos_walk (struct aosl_rb_node *node, void *arg)
 {
 	uint32_t *index = (uint32_t *)arg;
@@ -164,10 +133,10 @@ static int __mm_pos_walk_r (struct aosl_rb_node *node, void *arg)
 	return 0;
 }
 
-static struct aosl_rb_root __mm_pos_tree = {NULL, __mm_pos_cmp, 0};
+static struct aosl_rb_root __mm_pos_tree = {NULL, NULL, 0};
 #endif
 
-static struct aosl_rb_root __mm_ptr_tree = {NULL, __mm_ptr_cmp, 0};
+static struct aosl_rb_root __mm_ptr_tree = {NULL, NULL, 0};
 static k_lock_t __lock = {0};
 
 static int __mem_check_inited = 0;
@@ -197,22 +166,20 @@ static void mm_insert_ptr (void *ptr, size_t size)
 	k_lock_lock (&__lock);
 	__mem_used += size + sizeof(struct mm_ptr_node);
 	// insert ptr node
-	aosl_rb_insert_node (&__mm_ptr_tree, &ptr_node->node);
+	mm_ptr_rb_add (&__mm_ptr_tree, ptr_node);
 
 	// insert or update pos node
 #ifdef CONFIG_AOSL_MEM_DUMP
 	if (func != NULL && line != 0) {
-		struct mm_pos_node *pos_node = NULL;
-		struct aosl_rb_node *rb_node = aosl_find_rb_node(&__mm_pos_tree, NULL, func, line);
-		if (rb_node) {
-			pos_node = aosl_rb_entry(rb_node, struct mm_pos_node, node);
-		} else {
+		struct mm_pos_node key = { .func = func, .line = line };
+		struct mm_pos_node *pos_node = mm_pos_rb_find (&__mm_pos_tree, &key);
+		if (pos_node == NULL) {
 			pos_node = (struct mm_pos_node *)MALLOC (sizeof(struct mm_pos_node));
 			pos_node->func = func;
 			pos_node->line = line;
 			pos_node->cnts = 0;
 			pos_node->size = 0;
-			aosl_rb_insert_node(&__mm_pos_tree, &pos_node->node);
+			mm_pos_rb_add (&__mm_pos_tree, pos_node);
 			__mem_used += sizeof(struct mm_pos_node);
 		}
 		pos_node->cnts++;
@@ -240,7 +207,6 @@ static void *mm_remove_ptr (void *ptr)
 		return ptr;
 	}
 
-	struct aosl_rb_node *rb_node = NULL;
 	struct mm_ptr_node *ptr_node = NULL;
 #ifdef CONFIG_AOSL_MEM_DUMP
 	struct mm_pos_node *pos_node = NULL;
@@ -249,22 +215,21 @@ static void *mm_remove_ptr (void *ptr)
 	k_lock_lock (&__lock);
 
 	// get ptr node
-	rb_node = aosl_rb_remove (&__mm_ptr_tree, NULL, ptr);
-	if (rb_node != NULL) {
-		ptr_node = aosl_rb_entry (rb_node, struct mm_ptr_node, node);
+	ptr_node = mm_ptr_rb_remove (&__mm_ptr_tree, (uintptr_t)ptr);
+	if (ptr_node != NULL) {
 		__mem_used -= ptr_node->size + sizeof(struct mm_ptr_node);
 	}
 
 	// get pos node
 #ifdef CONFIG_AOSL_MEM_DUMP
 if (ptr_node && ptr_node->func && ptr_node->line) {
-	rb_node = aosl_find_rb_node(&__mm_pos_tree, NULL, ptr_node->func, ptr_node->line);
-	if (rb_node != NULL) {
-		pos_node = aosl_rb_entry(rb_node, struct mm_pos_node, node);
+	struct mm_pos_node key = { .func = ptr_node->func, .line = ptr_node->line };
+	pos_node = mm_pos_rb_find (&__mm_pos_tree, &key);
+	if (pos_node != NULL) {
 		pos_node->cnts--;
 		pos_node->size -= ptr_node->size;
 		if (pos_node->cnts == 0) {
-			aosl_rb_remove(&__mm_pos_tree, rb_node);
+			aosl_rb_erase (&__mm_pos_tree, &pos_node->node);
 			__mem_used -= sizeof(struct mm_pos_node);
 		}
 	}
@@ -14,10 +14,17 @@
 #include <api/aosl_types.h>
 #include <api/aosl_alloca.h>
 #include <api/aosl_time.h>
+#include <api/aosl_mm.h>
+#include <api/aosl_list.h>
+#include <api/aosl_rbtree.h>
+#include <api/aosl_file.h>
+#include <api/aosl_utils.h>
+#include <api/aosl_mpq_timer.h>
 #include <api/aosl_mpqp.h>
 #include <api/aosl_mpq_net.h>
 #include <kernel/kernel.h>
 #include <kernel/err.h>
+#include <kernel/thread.h>
 #include <hal/aosl_hal_socket.h>
 
 #define UNUSED(expr) (void)(expr)
@@ -162,12 +169,1054 @@ static void ____dns_resolve_host (const aosl_ts_t *queued_ts_p, aosl_refobj_t ro
 	__queue_resolve_async_reply (q, AOSL_REF_INVALID, f, f_argc, &argv [9], hostname, count, addrs);
 }
 
+/**
+ * The native asynchronous stub resolver. All the resolver states are only
+ * accessed in the resolver queue, the requests are queued to it, the A and
+ * AAAA queries of a name are sent in parallel via a datagram socket added
+ * to the same queue, and the results are cached according to the TTL of
+ * the answers, or the SOA minimum for the negative answers. The requests
+ * for a name being resolved wait for the same queries instead of sending
+ * new ones. The hosts file is searched first, and we fall back to the
+ * blocking way in the LTWP if no name server is configured.
+ **/
+#define DNS_SERVERS_MAX 3
+#define DNS_PORT 53
+#define DNS_TIMEOUT_MS 5000
+#define DNS_ATTEMPTS 2
+#define DNS_CONF_CHECK_MS 5000
+#define DNS_CACHE_MAX 256
+#define DNS_TTL_MAX 3600
+#define DNS_NEG_TTL_DEFAULT 30
+#define DNS_NEG_TTL_MAX 300
+#define DNS_NAME_MAX 253
+#define DNS_PKT_MAX 1500
+#define DNS_PORT_MIN 1024
+#define DNS_BIND_TRIES 8
+#define DNS_FILE_MAX (16 << 10)
+#define DNS_RESOLV_CONF "/etc/resolv.conf"
+#define DNS_HOSTS "/etc/hosts"
+
+#define DNS_HDR_LEN 12
+#define DNS_T_A 1
+#define DNS_T_SOA 6
+#define DNS_T_AAAA 28
+#define DNS_C_IN 1
+#define DNS_RCODE_NXDOMAIN 3
+
+#define DNS_QUERY_A 0
+#define DNS_QUERY_AAAA 1
+#ifdef CONFIG_AOSL_IPV6
+#define DNS_QUERIES 2
+#else
+#define DNS_QUERIES 1
+#endif
+
+static const uint16_t dns_qtypes [2] = { DNS_T_A, DNS_T_AAAA };
+
+struct dns_waiter {
+	struct aosl_list_head node;
+	const char *hostname;
+	unsigned short port;
+	int sk_type;
+	int sk_prot;
+	aosl_sk_addrinfo_t *addrs;
+	size_t addr_count;
+	aosl_mpq_t q;
+	aosl_mpq_func_argv_t f;
+	uintptr_t argc;
+	uintptr_t argv [0];
+};
+
+struct dns_entry {
+	struct aosl_rb_node rb_node;
+	struct aosl_list_head lru_node; /* the recently used first */
+	struct aosl_list_head node; /* in the resolving list */
+	struct aosl_list_head waiters;
+	int resolving;
+	aosl_ts_t expire_time;
+	aosl_ts_t deadline;
+	int attempt;
+	/* the socket of the current attempt, on a random port */
+	aosl_fd_t fd;
+	uint16_t ids [DNS_QUERIES];
+	uint32_t pending; /* bits of the queries without answer */
+	uint32_t failed; /* bits of the queries failed */
+	uint32_t ttl;
+	uint32_t neg_ttl;
+	size_t count;
+	aosl_sockaddr_t addrs [MAX_DNS_RES_CNT];
+	char name [0];
+};
+
+static k_lock_t dns_lock;
+static aosl_mpq_t dns_q = AOSL_MPQ_INVALID;
+
+/* The following ones are only accessed in the resolver queue */
+static aosl_sk_addr_t dns_servers [DNS_SERVERS_MAX];
+static int dns_server_count;
+static int dns_servers_fixed;
+static uintptr_t dns_timeout;
+static int dns_attempts;
+static char *dns_hosts;
+static aosl_ts_t dns_conf_time;
+static int dns_conf_loaded;
+static struct aosl_rb_root dns_cache;
+static struct aosl_list_head dns_lru;
+static struct aosl_list_head dns_resolving;
+static aosl_timer_t dns_timer;
+/* the random bytes from the CSPRNG for the ids and ports, refilled when used up */
+static uint8_t dns_rand_pool [64];
+static size_t dns_rand_pos;
+/* the weak fallback on the platforms without a CSPRNG */
+static uint32_t dns_rand;
+
+static int cmp_dns_entry (struct aosl_rb_node *rb_node, struct aosl_rb_node *node, va_list args)
+{
+	struct dns_entry *rb_entry = aosl_rb_entry (rb_node, struct dns_entry, rb_node);
+	const char *name;
+
+	if (node != NULL) {
+		name = aosl_rb_entry (node, struct dns_entry, rb_node)->name;
+	} else {
+		name = va_arg (args, const char *);
+	}
+
+	return strcmp (rb_entry->name, name);
+}
+
+static uint16_t __dns_rand16 (void)
+{
+	uint16_t v;
+
+	if (dns_rand_pos + sizeof v > sizeof dns_rand_pool) {
+		if (aosl_rand_bytes (dns_rand_pool, sizeof dns_rand_pool) < 0) {
+			/* xorshift32 */
+			dns_rand ^= dns_rand << 13;
+			dns_rand ^= dns_rand >> 17;
+			dns_rand ^= dns_rand << 5;
+			return (uint16_t)(dns_rand >> 8);
+		}
+
+		dns_rand_pos = 0;
+	}
+
+	memcpy (&v, &dns_rand_pool [dns_rand_pos], sizeof v);
+	dns_rand_pos += sizeof v;
+	return v;
+}
+
+static int __dns_lower (char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A' + 'a';
+
+	return c;
+}
+
+/**
+ * Normalize the name to lower case without the trailing dot,
+ * and check the labels. Returns the name length, <0 for error.
+ **/
+static int __dns_name_normalize (char *dst, const char *name)
+{
+	size_t len = strlen (name);
+	size_t i, label = 0;
+
+	if (len > 0 && name [len - 1] == '.')
+		len--;
+
+	if (len == 0 || len > DNS_NAME_MAX)
+		return -AOSL_EINVAL;
+
+	for (i = 0; i < len; i++) {
+		if (name [i] == '.') {
+			if (label == 0)
+				return -AOSL_EINVAL;
+
+			label = 0;
+		} else if (++label > 63) {
+			return -AOSL_EINVAL;
+		}
+
+		dst [i] = (char)__dns_lower (name [i]);
+	}
+
+	dst [len] = '\0';
+	return (int)len;
+}
+
+static char *__dns_read_file (const char *file)
+{
+	aosl_fs_t fs;
+	char *buf;
+	int len;
+
+	fs = aosl_fopen (file, "r");
+	if (fs == NULL)
+		return NULL;
+
+	buf = (char *)aosl_malloc (DNS_FILE_MAX + 1);
+	if (buf != NULL) {
+		len = aosl_fread (fs, buf, DNS_FILE_MAX);
+		if (len < 0)
+			len = 0;
+
+		buf [len] = '\0';
+	}
+
+	aosl_fclose (fs);
+	return buf;
+}
+
+/**
+ * Get the next token of a line split by __dns_next_line, returns
+ * NULL at the line end or a comment.
+ **/
+static char *__dns_token (char **pp)
+{
+	char *p = *pp;
+	char *tok;
+
+	while (*p == ' ' || *p == '\t' || *p == '\r')
+		p++;
+
+	if (*p == '\0' || *p == '#' || *p == ';') {
+		*pp = p;
+		return NULL;
+	}
+
+	tok = p;
+	while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '#' && *p != ';')
+		p++;
+
+	if (*p == '#' || *p == ';') {
+		/* the comment ends the line */
+		*p = '\0';
+	} else if (*p != '\0') {
+		*p++ = '\0';
+	}
+
+	*pp = p;
+	return tok;
+}
+
+static char *__dns_next_line (char *p)
+{
+	while (*p != '\0' && *p != '\n')
+		p++;
+
+	if (*p == '\n')
+		*p++ = '\0';
+
+	return p;
+}
+
+static void __dns_parse_resolv_conf (char *buf)
+{
+	char *p = buf;
+
+	while (*p != '\0') {
+		char *line = p;
+		char *tok;
+
+		p = __dns_next_line (p);
+		tok = __dns_token (&line);
+		if (tok == NULL)
+			continue;
+
+		if (strcmp (tok, "nameserver") == 0) {
+			tok = __dns_token (&line);
+			if (tok != NULL && dns_server_count < DNS_SERVERS_MAX
+					&& aosl_ip_sk_addr_from_string (&dns_servers [dns_server_count], tok, DNS_PORT) > 0)
+				dns_server_count++;
+		} else if (strcmp (tok, "options") == 0) {
+			while ((tok = __dns_token (&line)) != NULL) {
+				if (strncmp (tok, "timeout:", 8) == 0 && atoi (tok + 8) > 0) {
+					dns_timeout = (uintptr_t)atoi (tok + 8) * 1000;
+				} else if (strncmp (tok, "attempts:", 9) == 0 && atoi (tok + 9) > 0) {
+					dns_attempts = atoi (tok + 9);
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Compile the hosts file to the records of "ip\0name\0...name\0\0", the
+ * names are normalized, and the records end with an empty string.
+ **/
+static char *__dns_hosts_compile (char *buf)
+{
+	char *hosts = (char *)aosl_malloc (strlen (buf) * 2 + 2);
+	char *out = hosts;
+	char *p = buf;
+
+	if (hosts == NULL)
+		return NULL;
+
+	while (*p != '\0') {
+		char *line = p;
+		char *rec = out;
+		char *ip;
+		char *tok;
+
+		p = __dns_next_line (p);
+		ip = __dns_token (&line);
+		if (ip == NULL)
+			continue;
+
+		strcpy (out, ip);
+		out += strlen (ip) + 1;
+		while ((tok = __dns_token (&line)) != NULL) {
+			if (__dns_name_normalize (out, tok) > 0)
+				out += strlen (out) + 1;
+		}
+
+		if (out == rec + strlen (ip) + 1) {
+			/* no names */
+			out = rec;
+		} else {
+			*out++ = '\0';
+		}
+	}
+
+	*out = '\0';
+	return hosts;
+}
+
+static void __dns_conf_check (void)
+{
+	aosl_ts_t now = aosl_tick_now ();
+	char *buf;
+
+	if (dns_conf_loaded && (int64_t)(now - dns_conf_time) < DNS_CONF_CHECK_MS)
+		return;
+
+	dns_conf_loaded = 1;
+	dns_conf_time = now;
+
+	if (!dns_servers_fixed) {
+		dns_server_count = 0;
+		dns_timeout = DNS_TIMEOUT_MS;
+		dns_attempts = DNS_ATTEMPTS;
+		buf = __dns_read_file (DNS_RESOLV_CONF);
+		if (buf != NULL) {
+			__dns_parse_resolv_conf (buf);
+			aosl_free (buf);
+		}
+	}
+
+	if (dns_hosts != NULL) {
+		aosl_free (dns_hosts);
+		dns_hosts = NULL;
+	}
+
+	buf = __dns_read_file (DNS_HOSTS);
+	if (buf != NULL) {
+		dns_hosts = __dns_hosts_compile (buf);
+		aosl_free (buf);
+	}
+}
+
+static size_t __dns_hosts_lookup (const char *name, aosl_sockaddr_t *addrs)
+{
+	const char *p = dns_hosts;
+	size_t count = 0;
+
+	if (p == NULL)
+		return 0;
+
+	while (*p != '\0' && count < MAX_DNS_RES_CNT) {
+		const char *ip = p;
+		int found = 0;
+
+		for (p += strlen (p) + 1; *p != '\0'; p += strlen (p) + 1) {
+			if (strcmp (p, name) == 0)
+				found = 1;
+		}
+
+		p++;
+		if (found) {
+			aosl_sk_addr_t addr;
+
+			if (aosl_ip_sk_addr_from_string (&addr, ip, 0) > 0)
+				memcpy (&addrs [count++], &addr.sa, sizeof (aosl_sockaddr_t));
+		}
+	}
+
+	return count;
+}
+
+static void __dns_reply (struct dns_waiter *w, const aosl_sockaddr_t *addrs, size_t count)
+{
+	size_t n = 0;
+	size_t i;
+	int pass;
+
+	/* the IPv4 addresses first */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < count && n < w->addr_count; i++) {
+			aosl_sk_addrinfo_t *sai;
+
+			if ((addrs [i].sa_family == AOSL_AF_INET) != (pass == 0))
+				continue;
+
+			sai = &w->addrs [n++];
+			sai->sk_af = addrs [i].sa_family;
+			sai->sk_type = w->sk_type;
+			sai->sk_prot = w->sk_prot;
+			memcpy (&sai->sk_addr, &addrs [i], sizeof (aosl_sockaddr_t));
+			sai->sk_addr.sa.sa_port = aosl_htons (w->port);
+		}
+	}
+
+	__queue_resolve_async_reply (w->q, AOSL_REF_INVALID, w->f, w->argc, w->argv, w->hostname, n, w->addrs);
+	aosl_free (w);
+}
+
+static void __dns_entry_free (struct dns_entry *e)
+{
+	aosl_rb_erase (&dns_cache, &e->rb_node);
+	aosl_list_del (&e->lru_node);
+	aosl_free (e);
+}
+
+static struct dns_entry *__dns_entry_get (const char *name)
+{
+	struct aosl_rb_node *node;
+	struct dns_entry *e;
+	size_t len;
+
+	node = aosl_find_rb_node (&dns_cache, NULL, name);
+	if (node != NULL) {
+		e = aosl_rb_entry (node, struct dns_entry, rb_node);
+		aosl_list_move (&e->lru_node, &dns_lru);
+		return e;
+	}
+
+	if (dns_cache.count >= DNS_CACHE_MAX) {
+		/* evict the least recently used one which is not resolving */
+		aosl_list_for_each_entry_reverse_t (struct dns_entry, e, &dns_lru, lru_node) {
+			if (!e->resolving) {
+				__dns_entry_free (e);
+				break;
+			}
+		}
+	}
+
+	len = strlen (name);
+	e = (struct dns_entry *)aosl_malloc (sizeof (struct dns_entry) + len + 1);
+	if (e == NULL)
+		return NULL;
+
+	memset (e, 0, sizeof *e);
+	e->fd = AOSL_INVALID_FD;
+	aosl_list_head_init (&e->node);
+	aosl_list_head_init (&e->waiters);
+	memcpy (e->name, name, len + 1);
+	aosl_rb_insert_node (&dns_cache, &e->rb_node);
+	aosl_list_add (&e->lru_node, &dns_lru);
+	return e;
+}
+
+static void __dns_timer_arm (void)
+{
+	struct dns_entry *e;
+	aosl_ts_t deadline = 0;
+	int found = 0;
+
+	aosl_list_for_each_entry_t (struct dns_entry, e, &dns_resolving, node) {
+		if (!found || (int64_t)(e->deadline - deadline) < 0)
+			deadline = e->deadline;
+
+		found = 1;
+	}
+
+	if (found)
+		aosl_mpq_resched_oneshot_timer (dns_timer, deadline);
+}
+
+static int __dns_build_query (uint8_t *pkt, uint16_t id, const char *name, uint16_t qtype)
+{
+	size_t off = DNS_HDR_LEN;
+	const char *label = name;
+
+	memset (pkt, 0, DNS_HDR_LEN);
+	pkt [0] = (uint8_t)(id >> 8);
+	pkt [1] = (uint8_t)id;
+	pkt [2] = 0x01; /* RD */
+	pkt [5] = 1; /* QDCOUNT */
+
+	/* the name has been checked by __dns_name_normalize */
+	while (*label != '\0') {
+		const char *dot = strchr (label, '.');
+		size_t len = (dot != NULL) ? (size_t)(dot - label) : strlen (label);
+
+		pkt [off++] = (uint8_t)len;
+		memcpy (&pkt [off], label, len);
+		off += len;
+		label += len;
+		if (*label == '.')
+			label++;
+	}
+
+	pkt [off++] = 0;
+	pkt [off++] = (uint8_t)(qtype >> 8);
+	pkt [off++] = (uint8_t)qtype;
+	pkt [off++] = 0;
+	pkt [off++] = DNS_C_IN;
+	return (int)off;
+}
+
+static void __dns_on_data (void *data, size_t len, uintptr_t argc, uintptr_t argv [], const aosl_sk_addr_t *addr);
+static void __dns_on_event (aosl_fd_t fd, int event, uintptr_t argc, uintptr_t argv []);
+
+/**
+ * Every attempt of a name goes out on a new socket bound to a random
+ * port, so an off-path attacker has to guess the port besides the id
+ * to spoof an answer. The system chooses the port if all tries failed.
+ **/
+static aosl_fd_t __dns_fd_open (int af)
+{
+	aosl_fd_t fd;
+	int i;
+
+	fd = aosl_socket (af, AOSL_SOCK_DGRAM, AOSL_IPPROTO_UDP);
+	if (aosl_fd_invalid (fd))
+		return fd;
+
+	for (i = 0; i < DNS_BIND_TRIES; i++) {
+		unsigned short port = (unsigned short)(DNS_PORT_MIN + __dns_rand16 () % (65536 - DNS_PORT_MIN));
+		if (aosl_bind_port_only (fd, (uint16_t)af, port) == 0)
+			break;
+	}
+
+	if (aosl_mpq_add_dgram_socket (fd, DNS_PKT_MAX, __dns_on_data, __dns_on_event, 1, (uintptr_t)fd) < 0) {
+		aosl_close (fd);
+		return AOSL_INVALID_FD;
+	}
+
+	return fd;
+}
+
+static void __dns_fd_close (struct dns_entry *e)
+{
+	if (!aosl_fd_invalid (e->fd)) {
+		aosl_close (e->fd);
+		e->fd = AOSL_INVALID_FD;
+	}
+}
+
+static void __dns_send_queries (struct dns_entry *e)
+{
+	const aosl_sk_addr_t *server = &dns_servers [e->attempt % dns_server_count];
+	uint8_t pkt [DNS_HDR_LEN + DNS_NAME_MAX + 2 + 4];
+	aosl_fd_t fd;
+	int i;
+
+	/* the late answers to the last attempt are dropped with its socket */
+	__dns_fd_close (e);
+	fd = __dns_fd_open (server->sa.sa_family);
+	e->fd = fd;
+	for (i = 0; i < DNS_QUERIES; i++) {
+		if ((e->pending & (1 << i)) != 0 && !aosl_fd_invalid (fd)) {
+			int pkt_len;
+
+			e->ids [i] = __dns_rand16 ();
+			pkt_len = __dns_build_query (pkt, e->ids [i], e->name, dns_qtypes [i]);
+			aosl_sendto (fd, pkt, (size_t)pkt_len, 0, &server->sa);
+		}
+	}
+
+	/* just let it time out for the sending failures */
+	e->deadline = aosl_tick_now () + dns_timeout;
+	__dns_timer_arm ();
+}
+
+static void __dns_start (struct dns_entry *e)
+{
+	e->resolving = 1;
+	e->attempt = 0;
+	e->pending = (1 << DNS_QUERIES) - 1;
+	e->failed = 0;
+	e->ttl = DNS_TTL_MAX;
+	e->neg_ttl = DNS_NEG_TTL_DEFAULT;
+	e->count = 0;
+	aosl_list_add_tail (&e->node, &dns_resolving);
+	__dns_send_queries (e);
+}
+
+static void __dns_finish (struct dns_entry *e)
+{
+	struct aosl_list_head *node;
+	aosl_ts_t now = aosl_tick_now ();
+	uint32_t ttl;
+
+	aosl_list_del_init (&e->node);
+	e->resolving = 0;
+	__dns_fd_close (e);
+
+	if (e->count > 0) {
+		ttl = e->ttl;
+	} else if (e->failed == 0 && e->pending == 0) {
+		ttl = e->neg_ttl;
+	} else {
+		/* do not cache the failures */
+		ttl = 0;
+	}
+
+	e->expire_time = now + (aosl_ts_t)ttl * 1000;
+
+	while ((node = aosl_list_head (&e->waiters)) != NULL) {
+		aosl_list_del (node);
+		__dns_reply (aosl_list_entry (node, struct dns_waiter, node), e->addrs, e->count);
+	}
+
+	if (ttl == 0)
+		__dns_entry_free (e);
+}
+
+static void __dns_timeout (aosl_timer_t timer_id, const aosl_ts_t *now_p, uintptr_t argc, uintptr_t argv [])
+{
+	struct dns_entry *e;
+	struct dns_entry *n;
+
+	UNUSED (timer_id);
+	UNUSED (argc);
+	UNUSED (argv);
+
+	aosl_list_for_each_entry_safe_t (struct dns_entry, e, n, &dns_resolving, node) {
+		if ((int64_t)(*now_p - e->deadline) < 0)
+			continue;
+
+		e->attempt++;
+		if (dns_server_count == 0 || e->attempt >= dns_attempts * dns_server_count) {
+			__dns_finish (e);
+		} else {
+			__dns_send_queries (e);
+		}
+	}
+
+	__dns_timer_arm ();
+}
+
+static int __dns_read_u16 (const uint8_t *p)
+{
+	return ((int)p [0] << 8) | p [1];
+}
+
+static uint32_t __dns_read_u32 (const uint8_t *p)
+{
+	return ((uint32_t)p [0] << 24) | ((uint32_t)p [1] << 16) | ((uint32_t)p [2] << 8) | p [3];
+}
+
+/**
+ * Read a possibly compressed name at off, the name is stored in lower case
+ * if out is not NULL. Returns the offset after the name, <0 for error.
+ **/
+static int __dns_read_name (const uint8_t *pkt, size_t len, size_t off, char *out)
+{
+	size_t end = 0;
+	size_t n = 0;
+	int jumps = 0;
+
+	for (;;) {
+		uint8_t l;
+
+		if (off >= len)
+			return -1;
+
+		l = pkt [off];
+		if ((l & 0xc0) == 0xc0) {
+			if (off + 1 >= len || ++jumps > 16)
+				return -1;
+
+			if (end == 0)
+				end = off + 2;
+
+			off = ((size_t)(l & 0x3f) << 8) | pkt [off + 1];
+			continue;
+		}
+
+		if (l == 0)
+			break;
+
+		/* out holds DNS_NAME_MAX chars plus the terminator, the dot included */
+		if ((l & 0xc0) != 0 || off + 1 + l > len || n + l + 1 > DNS_NAME_MAX)
+			return -1;
+
+		if (out != NULL) {
+			size_t i;
+
+			if (n > 0)
+				out [n++] = '.';
+
+			for (i = 0; i < l; i++)
+				out [n++] = (char)__dns_lower ((char)pkt [off + 1 + i]);
+		}
+
+		off += 1 + l;
+	}
+
+	if (out != NULL)
+		out [n] = '\0';
+
+	return (int)(end != 0 ? end : off + 1);
+}
+
+static void __dns_add_addr (struct dns_entry *e, int af, const uint8_t *rdata, uint32_t ttl)
+{
+	aosl_sockaddr_t *addr;
+
+	if (e->count >= MAX_DNS_RES_CNT)
+		return;
+
+	addr = &e->addrs [e->count++];
+	memset (addr, 0, sizeof *addr);
+	addr->sa_family = (uint16_t)af;
+	if (af == AOSL_AF_INET) {
+		memcpy (&addr->sin_addr, rdata, 4);
+	} else {
+		memcpy (addr->sin6_addr, rdata, 16);
+	}
+
+	if (ttl < e->ttl)
+		e->ttl = ttl;
+}
+
+static void __dns_on_data (void *data, size_t len, uintptr_t argc, uintptr_t argv [], const aosl_sk_addr_t *addr)
+{
+	const uint8_t *pkt = (const uint8_t *)data;
+	aosl_fd_t fd = (aosl_fd_t)argv [0];
+	char name [DNS_NAME_MAX + 1];
+	struct dns_entry *e;
+	int i, q = -1;
+	int qdcount, ancount, nscount, rcode;
+	int off;
+
+	UNUSED (argc);
+
+	for (i = 0; i < dns_server_count; i++) {
+		if (aosl_sk_addr_ip_equal (&addr->sa, &dns_servers [i].sa) && addr->sa.sa_port == dns_servers [i].sa.sa_port)
+			break;
+	}
+
+	/* not from the name servers */
+	if (i == dns_server_count || len < DNS_HDR_LEN || (pkt [2] & 0x80) == 0)
+		return;
+
+	/* only the entry sending on this socket */
+	aosl_list_for_each_entry_t (struct dns_entry, e, &dns_resolving, node) {
+		if (e->fd != fd)
+			continue;
+
+		for (i = 0; i < DNS_QUERIES; i++) {
+			if ((e->pending & (1 << i)) != 0 && e->ids [i] == __dns_read_u16 (pkt)) {
+				q = i;
+				break;
+			}
+		}
+
+		if (q >= 0)
+			break;
+	}
+
+	if (q < 0)
+		return;
+
+	qdcount = __dns_read_u16 (pkt + 4);
+	ancount = __dns_read_u16 (pkt + 6);
+	nscount = __dns_read_u16 (pkt + 8);
+	rcode = pkt [3] & 0x0f;
+
+	/* the question must be ours */
+	off = __dns_read_name (pkt, len, DNS_HDR_LEN, name);
+	if (qdcount != 1 || off < 0 || (size_t)off + 4 > len || strcmp (name, e->name) != 0
+			|| __dns_read_u16 (pkt + off) != dns_qtypes [q] || __dns_read_u16 (pkt + off + 2) != DNS_C_IN)
+		return;
+
+	off += 4;
+	e->pending &= ~(1 << q);
+	if (rcode != 0 && rcode != DNS_RCODE_NXDOMAIN) {
+		e->failed |= 1 << q;
+		goto __check_done;
+	}
+
+	for (i = 0; i < ancount + nscount; i++) {
+		int type, rdlen;
+		uint32_t ttl;
+
+		off = __dns_read_name (pkt, len, (size_t)off, NULL);
+		if (off < 0 || (size_t)off + 10 > len)
+			break;
+
+		type = __dns_read_u16 (pkt + off);
+		ttl = __dns_read_u32 (pkt + off + 4);
+		rdlen = __dns_read_u16 (pkt + off + 8);
+		off += 10;
+		if ((size_t)off + rdlen > len)
+			break;
+
+		if (ttl > DNS_TTL_MAX)
+			ttl = DNS_TTL_MAX;
+
+		if (i < ancount) {
+			if (type == DNS_T_A && q == DNS_QUERY_A && rdlen == 4)
+				__dns_add_addr (e, AOSL_AF_INET, pkt + off, ttl);
+#ifdef CONFIG_AOSL_IPV6
+			if (type == DNS_T_AAAA && q == DNS_QUERY_AAAA && rdlen == 16)
+				__dns_add_addr (e, AOSL_AF_INET6, pkt + off, ttl);
+#endif
+		} else if (type == DNS_T_SOA) {
+			/* the negative caching TTL is the min of the SOA TTL and MINIMUM */
+			int soa = __dns_read_name (pkt, len, (size_t)off, NULL);
+			if (soa > 0)
+				soa = __dns_read_name (pkt, len, (size_t)soa, NULL);
+
+			if (soa > 0 && soa + 20 <= off + rdlen) {
+				uint32_t minimum = __dns_read_u32 (pkt + soa + 16);
+				if (minimum < ttl)
+					ttl = minimum;
+			}
+
+			e->neg_ttl = ttl < DNS_NEG_TTL_MAX ? ttl : DNS_NEG_TTL_MAX;
+		}
+
+		off += rdlen;
+	}
+
+__check_done:
+	if (e->pending == 0)
+		__dns_finish (e);
+}
+
+static void __dns_on_event (aosl_fd_t fd, int event, uintptr_t argc, uintptr_t argv [])
+{
+	struct dns_entry *e;
+
+	UNUSED (argc);
+	UNUSED (argv);
+
+	if (event >= 0)
+		return;
+
+	/* the fd would be closed, the entry just times out and sends on a new one */
+	aosl_list_for_each_entry_t (struct dns_entry, e, &dns_resolving, node) {
+		if (e->fd == fd)
+			e->fd = AOSL_INVALID_FD;
+	}
+}
+
+static void ____dns_resolve_host_native (const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv [])
+{
+	char name [DNS_NAME_MAX + 1];
+	aosl_sockaddr_t addrs [MAX_DNS_RES_CNT];
+	aosl_sk_addr_t numeric;
+	struct dns_waiter *w;
+	struct dns_entry *e;
+	uintptr_t f_argc = argv [8];
+	size_t count;
+
+	UNUSED (queued_ts_p);
+	UNUSED (robj);
+
+	w = (struct dns_waiter *)aosl_malloc (sizeof (struct dns_waiter) + sizeof (uintptr_t) * f_argc);
+	if (w == NULL) {
+		__queue_resolve_async_reply ((aosl_mpq_t)argv [6], AOSL_REF_INVALID, (aosl_mpq_func_argv_t)argv [7],
+						f_argc, &argv [9], (const char *)argv [0], 0, (aosl_sk_addrinfo_t *)argv [4]);
+		return;
+	}
+
+	w->hostname = (const char *)argv [0];
+	w->port = (unsigned short)argv [1];
+	w->sk_type = (int)argv [2];
+	w->sk_prot = (int)argv [3];
+	w->addrs = (aosl_sk_addrinfo_t *)argv [4];
+	w->addr_count = (size_t)argv [5];
+	w->q = (aosl_mpq_t)argv [6];
+	w->f = (aosl_mpq_func_argv_t)argv [7];
+	w->argc = f_argc;
+	memcpy (w->argv, &argv [9], sizeof (uintptr_t) * f_argc);
+
+	if (aosl_ip_sk_addr_from_string (&numeric, w->hostname, 0) > 0) {
+		__dns_reply (w, &numeric.sa, 1);
+		return;
+	}
+
+	if (strlen (w->hostname) > DNS_NAME_MAX + 1 || __dns_name_normalize (name, w->hostname) < 0) {
+		__dns_reply (w, NULL, 0);
+		return;
+	}
+
+	__dns_conf_check ();
+	count = __dns_hosts_lookup (name, addrs);
+	if (count > 0) {
+		__dns_reply (w, addrs, count);
+		return;
+	}
+
+	if (dns_server_count == 0) {
+		/* no name server, so resolve it in the blocking way */
+		aosl_free (w);
+		if (aosl_mpq_invalid (aosl_mpqp_queue_argv (aosl_ltwp (), AOSL_MPQ_INVALID, AOSL_REF_INVALID,
+								"____dns_resolve_host", ____dns_resolve_host, argc, argv)))
+			__queue_resolve_async_reply ((aosl_mpq_t)argv [6], AOSL_REF_INVALID, (aosl_mpq_func_argv_t)argv [7],
+							f_argc, &argv [9], (const char *)argv [0], 0, (aosl_sk_addrinfo_t *)argv [4]);
+		return;
+	}
+
+	e = __dns_entry_get (name);
+	if (e == NULL) {
+		__dns_reply (w, NULL, 0);
+		return;
+	}
+
+	if (!e->resolving && (int64_t)(aosl_tick_now () - e->expire_time) < 0) {
+		__dns_reply (w, e->addrs, e->count);
+		return;
+	}
+
+	aosl_list_add_tail (&w->node, &e->waiters);
+	if (!e->resolving)
+		__dns_start (e);
+}
+
+static void __dns_cache_flush (void)
+{
+	struct dns_entry *e;
+	struct dns_entry *n;
+
+	aosl_list_for_each_entry_safe_t (struct dns_entry, e, n, &dns_lru, lru_node) {
+		if (!e->resolving)
+			__dns_entry_free (e);
+	}
+}
+
+static int __dns_q_init (void *arg)
+{
+	UNUSED (arg);
+
+	aosl_rb_root_init (&dns_cache, cmp_dns_entry);
+	aosl_list_head_init (&dns_lru);
+	aosl_list_head_init (&dns_resolving);
+	dns_timeout = DNS_TIMEOUT_MS;
+	dns_attempts = DNS_ATTEMPTS;
+	dns_conf_loaded = 0;
+	dns_rand_pos = sizeof dns_rand_pool;
+	dns_rand = (uint32_t)aosl_tick_us () | 1;
+
+	dns_timer = aosl_mpq_create_oneshot_timer (__dns_timeout, NULL, 0);
+	if (aosl_mpq_timer_invalid (dns_timer))
+		return -1;
+
+	return 0;
+}
+
+static void __dns_q_fini (void *arg)
+{
+	struct dns_entry *e;
+	struct dns_entry *n;
+
+	UNUSED (arg);
+
+	/* reply the waiting requests with nothing resolved */
+	aosl_list_for_each_entry_safe_t (struct dns_entry, e, n, &dns_resolving, node) {
+		e->failed = 1;
+		__dns_finish (e);
+	}
+
+	__dns_cache_flush ();
+	aosl_mpq_kill_timer (dns_timer);
+
+	if (dns_hosts != NULL) {
+		aosl_free (dns_hosts);
+		dns_hosts = NULL;
+	}
+}
+
+static aosl_mpq_t __dns_q_get (void)
+{
+	aosl_mpq_t q;
+
+	k_lock_lock (&dns_lock);
+	if (aosl_mpq_invalid (dns_q))
+		dns_q = aosl_mpq_create (AOSL_THRD_PRI_DEFAULT, 0, 1000, "DNS", __dns_q_init, __dns_q_fini, NULL);
+
+	q = dns_q;
+	k_lock_unlock (&dns_lock);
+	return q;
+}
+
+static void ____dns_set_servers (const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv [])
+{
+	const aosl_sk_addr_t *servers = (const aosl_sk_addr_t *)argv [0];
+	size_t count = (size_t)argv [1];
+	size_t i;
+
+	UNUSED (queued_ts_p);
+	UNUSED (robj);
+	UNUSED (argc);
+
+	dns_server_count = 0;
+	for (i = 0; i < count && i < DNS_SERVERS_MAX; i++) {
+		aosl_sk_addr_t *server = &dns_servers [dns_server_count++];
+
+		memcpy (server, &servers [i], sizeof (aosl_sk_addr_t));
+		if (server->sa.sa_port == 0)
+			server->sa.sa_port = aosl_htons (DNS_PORT);
+	}
+
+	dns_servers_fixed = (servers != NULL);
+	dns_timeout = DNS_TIMEOUT_MS;
+	dns_attempts = DNS_ATTEMPTS;
+	dns_conf_loaded = 0;
+	__dns_cache_flush ();
+}
+
+__export_in_so__ int aosl_dns_set_servers (const aosl_sk_addr_t *servers, size_t count)
+{
+	aosl_mpq_t q;
+
+	if (servers != NULL && count == 0) {
+		aosl_errno = AOSL_EINVAL;
+		return -1;
+	}
+
+	q = __dns_q_get ();
+	if (aosl_mpq_invalid (q))
+		return -1;
+
+	return aosl_mpq_call (q, AOSL_REF_INVALID, "____dns_set_servers", ____dns_set_servers, 2, (uintptr_t)servers, (uintptr_t)count);
+}
+
+void k_dns_init (void)
+{
+	k_lock_init (&dns_lock);
+	dns_q = AOSL_MPQ_INVALID;
+}
+
+void k_dns_fini (void)
+{
+	aosl_mpq_t q;
+
+	k_lock_lock (&dns_lock);
+	q = dns_q;
+	dns_q = AOSL_MPQ_INVALID;
+	k_lock_unlock (&dns_lock);
+
+	if (!aosl_mpq_invalid (q))
+		aosl_mpq_destroy_wait (q);
+
+	k_lock_destroy (&dns_lock);
+}
+
 static int __prot_resolve_host_async_args (const char *hostname, unsigned short port, int sk_type, int sk_prot,
 			aosl_sk_addrinfo_t *addrs, size_t addr_count, aosl_mpq_t q, aosl_mpq_func_argv_t f, uintptr_t argc, va_list args)
 {
 	uintptr_t *argv;
 	uintptr_t l;
 	aosl_mpq_t qid;
+	aosl_mpq_t dq;
 
 	if (argc > AOSL_VAR_ARGS_MAX) {
 		aosl_errno = AOSL_EPERM;
@@ -187,6 +1236,10 @@ static int __prot_resolve_host_async_args (const char *hostname, unsigned short
 	for (l = 0; l < argc; l++)
 		argv [9 + l] = va_arg (args, uintptr_t);
 
+	dq = __dns_q_get ();
+	if (!aosl_mpq_invalid (dq))
+		return aosl_mpq_queue_argv (dq, AOSL_MPQ_INVALID, AOSL_REF_INVALID, "____dns_resolve_host_native", ____dns_resolve_host_native, 9 + argc, argv);
+
 	qid = aosl_mpqp_queue_argv (aosl_ltwp (), AOSL_MPQ_INVALID, AOSL_REF_INVALID, "____dns_resolve_host", ____dns_resolve_host, 9 + argc, argv);
 	if (aosl_mpq_invalid (qid))
 		return -1;
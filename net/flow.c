@@ -0,0 +1,459 @@
+/***************************************************************************
+ * Module:	Peer address flow table implementation file
+ *
+ * Copyright © 2025 Agora
+ * This file is part of AOSL, an open source project.
+ * Licensed under the Apache License, Version 2.0, with certain conditions.
+ * Refer to the "LICENSE" file in the root directory for more information.
+ ***************************************************************************/
+
+#include <string.h>
+
+#include <api/aosl_types.h>
+#include <api/aosl_mm.h>
+#include <api/aosl_time.h>
+#include <api/aosl_mpq.h>
+#include <api/aosl_mpq_timer.h>
+#include <api/aosl_mpq_net.h>
+#include <kernel/kernel.h>
+#include <kernel/err.h>
+#include <kernel/ipv6.h>
+
+
+/**
+ * The peer address normalised to 16 address bytes plus the port and
+ * the family, an IPv4 address is kept in the last 4 address bytes, so
+ * an IPv4-mapped IPv6 address folds into the same key as the IPv4 one.
+ **/
+struct flow_key {
+	uint32_t addr [4];
+	uint32_t port_af;
+};
+
+/**
+ * Open addressing with linear probing, the key lives in the slot, so
+ * a lookup hitting the first probed slot touches one cache line only.
+ * An empty slot has a NULL data, the flow data never moves while the
+ * slots get shifted by removing or rehashed by growing.
+ **/
+struct flow_slot {
+	struct flow_key key;
+	/* the coarse tick in ms the flow was last looked up at */
+	uint32_t active;
+	void *data;
+};
+
+#define FLOW_MIN_SLOTS 64
+#define FLOW_CHUNK_FLOWS 1024
+
+/* a data chunk, the flow data are carved out of it and recycled by a free list */
+struct flow_chunk {
+	struct flow_chunk *next;
+};
+
+struct aosl_flow_table {
+	struct flow_slot *slots;
+	uint32_t mask;
+	size_t count;
+
+	size_t data_size;
+	struct flow_chunk *chunks;
+	void *free_data;
+
+	aosl_timer_t timer;
+	uint32_t idle_ms;
+	/* the idle time checked, with the lag of the coarse tick */
+	uint32_t expire_ms;
+	uint32_t now;
+	uint32_t sweep_pos;
+
+	aosl_flow_dtor_t dtor;
+	void *arg;
+};
+
+static __inline__ int __flow_key (struct flow_key *key, const aosl_sk_addr_t *addr)
+{
+	switch (addr->sa.sa_family) {
+	case AOSL_AF_INET:
+		key->addr [0] = 0;
+		key->addr [1] = 0;
+		key->addr [2] = 0;
+		key->addr [3] = addr->in.sin_addr.s_addr;
+		key->port_af = ((uint32_t)AOSL_AF_INET << 16) | addr->in.sin_port;
+		return 0;
+	case AOSL_AF_INET6:
+		if (ipv6_addr_v4mapped (&addr->in6.sin6_addr)) {
+			key->addr [0] = 0;
+			key->addr [1] = 0;
+			key->addr [2] = 0;
+			key->addr [3] = addr->in6.sin6_addr.s6_addr32_v [3];
+			key->port_af = ((uint32_t)AOSL_AF_INET << 16) | addr->in6.sin6_port;
+			return 0;
+		}
+
+		memcpy (key->addr, &addr->in6.sin6_addr, sizeof key->addr);
+		key->port_af = ((uint32_t)AOSL_AF_INET6 << 16) | addr->in6.sin6_port;
+		return 0;
+	default:
+		break;
+	}
+
+	return -AOSL_EAFNOSUPPORT;
+}
+
+static void __flow_addr (aosl_sk_addr_t *addr, const struct flow_key *key)
+{
+	memset (addr, 0, sizeof *addr);
+	if ((key->port_af >> 16) == AOSL_AF_INET) {
+		addr->in.sin_family = AOSL_AF_INET;
+		addr->in.sin_port = (uint16_t)key->port_af;
+		addr->in.sin_addr.s_addr = key->addr [3];
+	} else {
+		addr->in6.sin6_family = AOSL_AF_INET6;
+		addr->in6.sin6_port = (uint16_t)key->port_af;
+		memcpy (&addr->in6.sin6_addr, key->addr, sizeof key->addr);
+	}
+}
+
+static __inline__ uint32_t __flow_hash (const struct flow_key *key)
+{
+	uint64_t h;
+
+	h = ((uint64_t)key->addr [0] << 32 | key->addr [1]) * 0x9e3779b97f4a7c15ull;
+	h ^= ((uint64_t)key->addr [2] << 32 | key->addr [3]) * 0xc2b2ae3d27d4eb4full;
+	h ^= (uint64_t)key->port_af * 0x165667b19e3779f9ull;
+	h ^= h >> 29;
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+static __inline__ int __flow_key_equal (const struct flow_key *k1, const struct flow_key *k2)
+{
+	return ((k1->addr [0] ^ k2->addr [0]) | (k1->addr [1] ^ k2->addr [1]) | (k1->addr [2] ^ k2->addr [2]) |
+			(k1->addr [3] ^ k2->addr [3]) | (k1->port_af ^ k2->port_af)) == 0;
+}
+
+/* the slot holding the key, or the empty slot it would be inserted at */
+static __inline__ struct flow_slot *__flow_slot (struct aosl_flow_table *ft, const struct flow_key *key)
+{
+	uint32_t i = __flow_hash (key) & ft->mask;
+	struct flow_slot *slot;
+
+	for (;;) {
+		slot = &ft->slots [i];
+		if (slot->data == NULL || __flow_key_equal (&slot->key, key))
+			return slot;
+
+		i = (i + 1) & ft->mask;
+	}
+}
+
+static void *__flow_data_alloc (struct aosl_flow_table *ft)
+{
+	struct flow_chunk *chunk;
+	char *p;
+	void *data;
+	int i;
+
+	if (ft->free_data == NULL) {
+		chunk = aosl_malloc (sizeof (struct flow_chunk) + ft->data_size * FLOW_CHUNK_FLOWS);
+		if (chunk == NULL)
+			return NULL;
+
+		chunk->next = ft->chunks;
+		ft->chunks = chunk;
+
+		p = (char *)(chunk + 1);
+		for (i = FLOW_CHUNK_FLOWS - 1; i >= 0; i--) {
+			*(void **)(p + ft->data_size * i) = ft->free_data;
+			ft->free_data = p + ft->data_size * i;
+		}
+	}
+
+	data = ft->free_data;
+	ft->free_data = *(void **)data;
+	memset (data, 0, ft->data_size);
+	return data;
+}
+
+static void __flow_data_free (struct aosl_flow_table *ft, void *data)
+{
+	*(void **)data = ft->free_data;
+	ft->free_data = data;
+}
+
+static int __flow_resize (struct aosl_flow_table *ft, uint32_t nslots)
+{
+	struct flow_slot *old_slots = ft->slots;
+	uint32_t old_nslots = ft->mask + 1;
+	struct flow_slot *slot;
+	uint32_t i;
+
+	ft->slots = aosl_calloc (nslots, sizeof (struct flow_slot));
+	if (ft->slots == NULL) {
+		ft->slots = old_slots;
+		return -AOSL_ENOMEM;
+	}
+
+	ft->mask = nslots - 1;
+	ft->sweep_pos = 0;
+	if (old_slots != NULL) {
+		for (i = 0; i < old_nslots; i++) {
+			if (old_slots [i].data != NULL) {
+				slot = __flow_slot (ft, &old_slots [i].key);
+				*slot = old_slots [i];
+			}
+		}
+
+		aosl_free (old_slots);
+	}
+
+	return 0;
+}
+
+/**
+ * Remove the flow in slot i by shifting the following ones of the probe
+ * cluster backward, so no tombstone is needed for linear probing.
+ **/
+static void __flow_slot_remove (struct aosl_flow_table *ft, uint32_t i)
+{
+	uint32_t j = i;
+	uint32_t home;
+
+	for (;;) {
+		ft->slots [i].data = NULL;
+		for (;;) {
+			j = (j + 1) & ft->mask;
+			if (ft->slots [j].data == NULL)
+				goto __removed;
+
+			home = __flow_hash (&ft->slots [j].key) & ft->mask;
+			/* could the flow in j be moved to i, which is cyclically in [home, j) */
+			if (((j - home) & ft->mask) >= ((j - i) & ft->mask))
+				break;
+		}
+
+		ft->slots [i] = ft->slots [j];
+		i = j;
+	}
+
+__removed:
+	ft->count--;
+}
+
+static void __flow_release (struct aosl_flow_table *ft, uint32_t i)
+{
+	struct flow_slot *slot = &ft->slots [i];
+	void *data = slot->data;
+	aosl_sk_addr_t addr;
+
+	if (ft->dtor != NULL)
+		__flow_addr (&addr, &slot->key);
+
+	__flow_slot_remove (ft, i);
+
+	if (ft->dtor != NULL)
+		ft->dtor (&addr, data, ft->arg);
+
+	__flow_data_free (ft, data);
+}
+
+/**
+ * Sweep a quarter of the slots per tick, which fires 4 times per idle
+ * period. The lookups only store the coarse tick of the table, which is
+ * behind the real time by up to one tick, so a flow is only expired when
+ * idle for one tick more than the idle period, which makes an idle flow
+ * expired in about one to two and a half idle periods.
+ **/
+static void __flow_sweep (aosl_timer_t timer_id, const aosl_ts_t *now_p, uintptr_t argc, uintptr_t argv [])
+{
+	struct aosl_flow_table *ft = (struct aosl_flow_table *)argv [0];
+	uint32_t n = (ft->mask + 1) / 4;
+	uint32_t i;
+
+	ft->now = (uint32_t)aosl_tick_ms ();
+	while (n-- > 0) {
+		i = ft->sweep_pos;
+		if (ft->slots [i].data != NULL && ft->now - ft->slots [i].active >= ft->expire_ms) {
+			/* the slot is refilled by the shifted flows, so check it again */
+			__flow_release (ft, i);
+			continue;
+		}
+
+		ft->sweep_pos = (i + 1) & ft->mask;
+	}
+}
+
+__export_in_so__ aosl_flow_table_t aosl_flow_table_create (size_t data_size, size_t init_flows, uintptr_t idle_ms, aosl_flow_dtor_t dtor, void *arg)
+{
+	struct aosl_flow_table *ft;
+	uint32_t nslots = FLOW_MIN_SLOTS;
+	int err;
+
+	if (data_size == 0 || idle_ms > 0x7fffffff) {
+		err = -AOSL_EINVAL;
+		goto __out;
+	}
+
+	ft = aosl_calloc (1, sizeof *ft);
+	if (ft == NULL) {
+		err = -AOSL_ENOMEM;
+		goto __out;
+	}
+
+	/* keep the load factor at most 1/2 */
+	while (nslots < init_flows * 2 && nslots < 0x80000000u)
+		nslots <<= 1;
+
+	/* a free flow data holds the free list link */
+	ft->data_size = (data_size + sizeof (void *) - 1) & ~(sizeof (void *) - 1);
+	ft->timer = AOSL_MPQ_TIMER_INVALID;
+	ft->idle_ms = (uint32_t)idle_ms;
+	ft->expire_ms = ft->idle_ms + (ft->idle_ms + 3) / 4;
+	ft->now = (uint32_t)aosl_tick_ms ();
+	ft->dtor = dtor;
+	ft->arg = arg;
+
+	err = __flow_resize (ft, nslots);
+	if (err < 0)
+		goto __free_ft;
+
+	if (idle_ms > 0) {
+		if (aosl_mpq_invalid (aosl_mpq_this ())) {
+			err = -AOSL_EPERM;
+			goto __free_slots;
+		}
+
+		ft->timer = aosl_mpq_set_timer ((idle_ms + 3) / 4, __flow_sweep, NULL, 1, ft);
+		if (aosl_mpq_timer_invalid (ft->timer)) {
+			err = -AOSL_ENOMEM;
+			goto __free_slots;
+		}
+	}
+
+	return ft;
+
+__free_slots:
+	aosl_free (ft->slots);
+__free_ft:
+	aosl_free (ft);
+__out:
+	return_ptr_err (err);
+}
+
+__export_in_so__ void aosl_flow_table_destroy (aosl_flow_table_t ft)
+{
+	struct flow_chunk *chunk;
+	aosl_sk_addr_t addr;
+	uint32_t i;
+
+	if (!aosl_mpq_timer_invalid (ft->timer))
+		aosl_mpq_kill_timer (ft->timer);
+
+	if (ft->dtor != NULL) {
+		for (i = 0; i <= ft->mask; i++) {
+			if (ft->slots [i].data != NULL) {
+				__flow_addr (&addr, &ft->slots [i].key);
+				ft->dtor (&addr, ft->slots [i].data, ft->arg);
+			}
+		}
+	}
+
+	while (ft->chunks != NULL) {
+		chunk = ft->chunks;
+		ft->chunks = chunk->next;
+		aosl_free (chunk);
+	}
+
+	aosl_free (ft->slots);
+	aosl_free (ft);
+}
+
+__export_in_so__ void *aosl_flow_find (aosl_flow_table_t ft, const aosl_sk_addr_t *addr)
+{
+	struct flow_key key;
+	struct flow_slot *slot;
+
+	if (__flow_key (&key, addr) < 0)
+		return NULL;
+
+	slot = __flow_slot (ft, &key);
+	if (slot->data == NULL)
+		return NULL;
+
+	/* do not dirty the cache line if not needed */
+	if (slot->active != ft->now)
+		slot->active = ft->now;
+
+	return slot->data;
+}
+
+__export_in_so__ void *aosl_flow_get (aosl_flow_table_t ft, const aosl_sk_addr_t *addr, int *created_p)
+{
+	struct flow_key key;
+	struct flow_slot *slot;
+	void *data;
+	int err;
+
+	if (created_p != NULL)
+		*created_p = 0;
+
+	err = __flow_key (&key, addr);
+	if (err < 0)
+		return_ptr_err (err);
+
+	slot = __flow_slot (ft, &key);
+	if (slot->data != NULL) {
+		if (slot->active != ft->now)
+			slot->active = ft->now;
+
+		return slot->data;
+	}
+
+	if ((ft->count + 1) * 2 > (size_t)ft->mask + 1) {
+		if (ft->mask + 1 >= 0x80000000u)
+			return_ptr_err (-AOSL_ENOSPC);
+
+		err = __flow_resize (ft, (ft->mask + 1) * 2);
+		if (err < 0)
+			return_ptr_err (err);
+
+		slot = __flow_slot (ft, &key);
+	}
+
+	data = __flow_data_alloc (ft);
+	if (data == NULL)
+		return_ptr_err (-AOSL_ENOMEM);
+
+	slot->key = key;
+	slot->active = ft->now;
+	slot->data = data;
+	ft->count++;
+
+	if (created_p != NULL)
+		*created_p = 1;
+
+	return data;
+}
+
+__export_in_so__ int aosl_flow_del (aosl_flow_table_t ft, const aosl_sk_addr_t *addr)
+{
+	struct flow_key key;
+	struct flow_slot *slot;
+	int err;
+
+	err = __flow_key (&key, addr);
+	if (err < 0)
+		return_err (err);
+
+	slot = __flow_slot (ft, &key);
+	if (slot->data == NULL)
+		return_err (-AOSL_ENOENT);
+
+	__flow_release (ft, (uint32_t)(slot - ft->slots));
+	return 0;
+}
+
+__export_in_so__ size_t aosl_flow_count (aosl_flow_table_t ft)
+{
+	return ft->count;
+}
@@ -15,28 +15,43 @@
 #include <api/aosl_mm.h>
 #include <kernel/err.h>
 #include <kernel/list.h>
+#include <kernel/thread.h>
+#include <api/aosl_hash.h>
 #include <api/aosl_mpq_net.h>
 #include <api/aosl_route.h>
 
 
 struct netif_node {
+	struct aosl_hash_node hash_node;
+	/* links the free nodes */
 	struct aosl_list_head node;
 
 	aosl_netif_t netif;
+
+	/* the probed link attributes, valid until the link is renamed or retyped */
+	int attrs_valid;
+	int if_wireless;
+	int if_cellnet;
 };
 
-#define IFINFO_HASH_SIZE 16
-static struct aosl_list_head __netifs_hash [IFINFO_HASH_SIZE];
+/**
+ * The table is updated on the net events subscriber queue, but the
+ * default route could be got on any thread, so the lookups are under
+ * the read lock and the updates under the write one.
+ **/
+static k_rwlock_t __netifs_lock;
+static struct aosl_hash_table __netifs_hash = AOSL_HASH_TABLE_INIT (__netifs_hash, AOSL_HASH_F_CONCURRENT_READ);
 static struct aosl_list_head __free_netifs = AOSL_LIST_HEAD_INIT (__free_netifs);
 
 
 static __inline__ struct netif_node *__netif_node_by_index (unsigned int idx)
 {
-	int hash;
-	struct netif_node *netif = NULL;
+	uintptr_t hash = aosl_hash_uintptr (idx);
+	struct aosl_hash_node *node;
+	struct netif_node *netif;
 
-	hash = idx & (IFINFO_HASH_SIZE - 1);
-	aosl_list_for_each_entry_t (struct netif_node, netif, &__netifs_hash [hash], node) {
+	aosl_hash_for_each_possible (&__netifs_hash, node, hash) {
+		netif = aosl_hash_entry (node, struct netif_node, hash_node);
 		if (netif->netif.if_index == (int)idx)
 			return netif;
 	}
@@ -44,36 +59,33 @@ static __inline__ struct netif_node *__netif_node_by_index (unsigned int idx)
 	return NULL;
 }
 
-aosl_netif_t *netif_by_index (int idx)
+int netif_get (int idx, aosl_netif_t *netif)
 {
-	struct netif_node *netif;
+	struct netif_node *node;
+	int err = -AOSL_ENOENT;
 
 	if (idx < 0)
-		return NULL;
-
-	netif = __netif_node_by_index (idx);
-	if (netif != NULL)
-		return &netif->netif;
+		return -AOSL_EINVAL;
 
-	return NULL;
+	k_rwlock_rdlock (&__netifs_lock);
+	node = __netif_node_by_index (idx);
+	if (node != NULL) {
+		*netif = node->netif;
+		err = 0;
+	}
+	k_rwlock_rdunlock (&__netifs_lock);
+	return err;
 }
 
-int update_netifs (int del, int ifindex, ...)
+static int __update_netif (int del, int ifindex, const char *ifname, int iftype)
 {
-	int hash;
 	struct netif_node *node;
-	va_list args;
-	const char *ifname;
-	int iftype;
-
-	if (ifindex < 0)
-		return -AOSL_EINVAL;
 
 	node = __netif_node_by_index (ifindex);
 
 	if (del) {
 		if (node != NULL) {
-			aosl_list_del (&node->node);
+			aosl_hash_del (&__netifs_hash, &node->hash_node);
 			aosl_list_add_tail (&node->node, &__free_netifs);
 			return 0;
 		}
@@ -81,19 +93,20 @@ int update_netifs (int del, int ifindex, ...)
 		return -AOSL_ENOENT;
 	}
 
-	va_start (args, ifindex);
-	ifname = va_arg (args, const char *);
-	iftype = va_arg (args, int);
-	va_end (args);
-
 	if (node != NULL) {
-		node->netif.if_type = iftype;
+		if (node->netif.if_type != iftype) {
+			node->netif.if_type = iftype;
+			node->attrs_valid = 0;
+		}
 
 		if (ifname != NULL) {
-			if (strcmp (node->netif.if_name, ifname))
+			if (strcmp (node->netif.if_name, ifname)) {
 				snprintf (node->netif.if_name, sizeof node->netif.if_name, "%s", ifname);
-		} else {
+				node->attrs_valid = 0;
+			}
+		} else if (node->netif.if_name [0] != '\0') {
 			node->netif.if_name [0] = '\0';
+			node->attrs_valid = 0;
 		}
 
 		return 0;
@@ -108,39 +121,101 @@ int update_netifs (int del, int ifindex, ...)
 
 	node->netif.if_index = ifindex;
 	node->netif.if_type = iftype;
+	node->attrs_valid = 0;
 	if (ifname != NULL) {
 		snprintf (node->netif.if_name, sizeof node->netif.if_name, "%s", ifname);
 	} else {
 		node->netif.if_name [0] = '\0';
 	}
 
-	hash = ifindex & (IFINFO_HASH_SIZE - 1);
-	aosl_list_add_tail (&node->node, &__netifs_hash [hash]);
+	aosl_hash_add (&__netifs_hash, &node->hash_node, aosl_hash_uintptr ((unsigned int)ifindex));
 	return 0;
 }
 
-void netifs_hash_init (void)
+int update_netifs (int del, int ifindex, ...)
 {
-	int i;
-	for (i = 0; i < IFINFO_HASH_SIZE; i++) {
-		aosl_list_head_init (&__netifs_hash [i]);
+	va_list args;
+	const char *ifname = NULL;
+	int iftype = 0;
+	int err;
+
+	if (ifindex < 0)
+		return -AOSL_EINVAL;
+
+	if (!del) {
+		va_start (args, ifindex);
+		ifname = va_arg (args, const char *);
+		iftype = va_arg (args, int);
+		va_end (args);
 	}
+
+	k_rwlock_wrlock (&__netifs_lock);
+	err = __update_netif (del, ifindex, ifname, iftype);
+	k_rwlock_wrunlock (&__netifs_lock);
+	return err;
 }
 
-void netifs_hash_fini (void)
+int netif_get_attrs (int idx, int *wireless_p, int *cellnet_p)
 {
-	int i;
 	struct netif_node *node;
+	int err;
 
-	for (i = 0; i < IFINFO_HASH_SIZE; i++) {
-		for (;;) {
-			node = aosl_list_remove_head_entry (&__netifs_hash [i], struct netif_node, node);
-			if (node == NULL)
-				break;
+	if (idx < 0)
+		return -AOSL_EINVAL;
 
-			aosl_free (node);
-		}
+	k_rwlock_rdlock (&__netifs_lock);
+	node = __netif_node_by_index (idx);
+	if (node == NULL) {
+		err = -AOSL_ENOENT;
+	} else if (!node->attrs_valid) {
+		err = -AOSL_EAGAIN;
+	} else {
+		*wireless_p = node->if_wireless;
+		*cellnet_p = node->if_cellnet;
+		err = 0;
+	}
+	k_rwlock_rdunlock (&__netifs_lock);
+	return err;
+}
+
+int netif_set_attrs (int idx, int wireless, int cellnet)
+{
+	struct netif_node *node;
+	int err = -AOSL_ENOENT;
+
+	if (idx < 0)
+		return -AOSL_EINVAL;
+
+	k_rwlock_wrlock (&__netifs_lock);
+	node = __netif_node_by_index (idx);
+	if (node != NULL) {
+		node->if_wireless = wireless;
+		node->if_cellnet = cellnet;
+		node->attrs_valid = 1;
+		err = 0;
 	}
+	k_rwlock_wrunlock (&__netifs_lock);
+	return err;
+}
+
+void netifs_init (void)
+{
+	k_rwlock_init (&__netifs_lock);
+	aosl_hash_init (&__netifs_hash, AOSL_HASH_F_CONCURRENT_READ);
+}
+
+static int __netif_node_free (struct aosl_hash_node *node, void *arg)
+{
+	aosl_free (aosl_hash_entry (node, struct netif_node, hash_node));
+	return 0;
+}
+
+void netifs_hash_fini (void)
+{
+	struct netif_node *node;
+
+	k_rwlock_wrlock (&__netifs_lock);
+	aosl_hash_fini (&__netifs_hash, __netif_node_free, NULL);
 
 	for (;;) {
 		node = aosl_list_remove_head_entry (&__free_netifs, struct netif_node, node);
@@ -149,4 +224,11 @@ void netifs_hash_fini (void)
 
 		aosl_free (node);
 	}
+	k_rwlock_wrunlock (&__netifs_lock);
+}
+
+void netifs_fini (void)
+{
+	netifs_hash_fini ();
+	k_rwlock_destroy (&__netifs_lock);
 }
\ No newline at end of file
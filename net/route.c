@@ -15,7 +15,9 @@
 #include <kernel/net.h>
 #include <kernel/netifs.h>
 #include <kernel/thread.h>
+#include <kernel/atomic.h>
 #include <api/aosl_mpq.h>
+#include <api/aosl_atomic.h>
 #include <api/aosl_route.h>
 #include <kernel/rt_monitor.h>
 
@@ -24,26 +26,6 @@ static aosl_net_ev_func_t netev_f = NULL;
 static void *netev_f_arg = NULL;
 static k_rwlock_t netev_subscriber_lock;
 
-static aosl_def_rt_t def_rts [2];
-static aosl_def_rt_t last_valid_def_rt;
-
-static int __curr = 0;
-
-static aosl_def_rt_t *get_curr_def_rt (void)
-{
-	return &def_rts [__curr];
-}
-
-static aosl_def_rt_t *get_new_def_rt (void)
-{
-	return &def_rts [!__curr];
-}
-
-static void switch_new_to_curr (void)
-{
-	__curr = !__curr;
-}
-
 static int __rt_valid (const aosl_rt_t *rt)
 {
 	if (rt->netif.if_index < 0)
@@ -82,6 +64,91 @@ static int __same_rt (const aosl_rt_t *rt1, const aosl_rt_t *rt2)
 	return aosl_sk_addr_ip_equal (&rt1->gw.sa, &rt2->gw.sa);
 }
 
+/**
+ * The default route state is published as immutable snapshots in a ring,
+ * the readers copy the latest one out without any lock, and retry only
+ * if the writer reused its slot meanwhile. The slot of a generation is
+ * not written again before RT_SNAPS - 1 newer generations got published,
+ * so the generation read after the copy tells whether the copy is intact.
+ * The writers are serialized by netev_subscriber_lock.
+ *
+ * The few bits the hot queries need are also published in one atomic
+ * word, which is read with a single load.
+ **/
+#define RT_SNAPS 4
+
+#define RT_F_V4_VALID 0x1
+#define RT_F_V6_VALID 0x2
+#define RT_F_V4_EXIST 0x4
+#define RT_F_V6_EXIST 0x8
+#define RT_F_V4_CELLNET 0x10
+#define RT_F_V6_CELLNET 0x20
+
+struct def_rt_snap {
+	aosl_def_rt_t def_rt;
+	int count;
+	/* the state is from the route monitor, rather than the initial one */
+	int monitored;
+};
+
+static struct def_rt_snap rt_snaps [RT_SNAPS];
+static atomic_t rt_snap_gen = 0;
+static atomic_t rt_snap_flags = 0;
+static aosl_def_rt_t last_valid_def_rt;
+
+static uintptr_t __def_rt_snap_get (struct def_rt_snap *snap)
+{
+	uintptr_t gen;
+
+	for (;;) {
+		gen = (uintptr_t)atomic_read (&rt_snap_gen);
+		aosl_rmb ();
+		memcpy (snap, &rt_snaps [gen % RT_SNAPS], sizeof *snap);
+		aosl_rmb ();
+		if ((uintptr_t)atomic_read (&rt_snap_gen) - gen < RT_SNAPS - 1)
+			return gen;
+	}
+}
+
+/* the latest snapshot, only for the writers */
+static const struct def_rt_snap *__def_rt_snap_curr (void)
+{
+	return &rt_snaps [(uintptr_t)atomic_read (&rt_snap_gen) % RT_SNAPS];
+}
+
+static int __rt_flags (const aosl_rt_t *rt, int valid_f, int exist_f, int cellnet_f)
+{
+	int flags = 0;
+
+	if (__rt_valid (rt))
+		flags |= valid_f;
+
+	if (rt->gw.sa.sa_family != AOSL_AF_UNSPEC) {
+		flags |= exist_f;
+		if (rt->if_cellnet)
+			flags |= cellnet_f;
+	}
+
+	return flags;
+}
+
+static void __def_rt_snap_publish (const aosl_def_rt_t *def_rt, int count, int monitored)
+{
+	uintptr_t gen = (uintptr_t)atomic_read (&rt_snap_gen) + 1;
+	struct def_rt_snap *snap = &rt_snaps [gen % RT_SNAPS];
+
+	/* the last generation must be visible before its successor's slot gets written */
+	aosl_wmb ();
+	memcpy (&snap->def_rt, def_rt, sizeof snap->def_rt);
+	snap->count = count;
+	snap->monitored = monitored;
+	atomic_set (&rt_snap_flags, __rt_flags (&def_rt->IPv4, RT_F_V4_VALID, RT_F_V4_EXIST, RT_F_V4_CELLNET) |
+			__rt_flags (&def_rt->IPv6, RT_F_V6_VALID, RT_F_V6_EXIST, RT_F_V6_CELLNET));
+	/* the slot and the flags must be visible before the generation bumps */
+	aosl_wmb ();
+	atomic_set (&rt_snap_gen, (intptr_t)gen);
+}
+
 static int __same_def_rt (const aosl_def_rt_t *def_rt1, const aosl_def_rt_t *def_rt2)
 {
 	if (!__same_rt (&def_rt1->IPv4, &def_rt2->IPv4))
@@ -102,6 +169,13 @@ static int __same_def_rt_cnt (const aosl_def_rt_t *def_rt1, const aosl_def_rt_t
 	       def_rt1->IPv6.def_rt_cnt == def_rt2->IPv6.def_rt_cnt;
 }
 
+static int __same_rt_state (const aosl_rt_t *rt1, const aosl_rt_t *rt2)
+{
+	return __same_rt (rt1, rt2) && rt1->def_rt_cnt == rt2->def_rt_cnt &&
+	       rt1->if_cellnet == rt2->if_cellnet && rt1->if_wireless == rt2->if_wireless &&
+	       strcmp (rt1->netif.if_name, rt2->netif.if_name) == 0;
+}
+
 static void __invalidate_rt (aosl_rt_t *rt)
 {
 	rt->netif.if_index = -1; /* invalidate the if_index to indicate none */
@@ -116,8 +190,10 @@ static void __invalidate_def_rt (aosl_def_rt_t *def_rt)
 
 void check_report_def_rt_change_event (aosl_net_ev_func_t f, void *arg)
 {
-	aosl_def_rt_t *curr_def_rt;
-	aosl_def_rt_t *new_def_rt;
+	const struct def_rt_snap *curr;
+	const aosl_def_rt_t *curr_def_rt;
+	aosl_def_rt_t new_def_rt;
+	int new_count;
 	int curr_rt_valid;
 	aosl_net_ev_func_t call_fn = NULL;
 	aosl_net_ev_t ev = AOSL_NET_EV_NONE;
@@ -127,40 +203,45 @@ void check_report_def_rt_change_event (aosl_net_ev_func_t f, void *arg)
 	__invalidate_def_rt (&def_rt1);
 	__invalidate_def_rt (&def_rt2);
 
+	/* the route monitor is only touched on the subscriber queue, so get it without the lock */
+	aosl_init_def_rt (&new_def_rt);
+	new_count = os_get_monitored_def_rt (&new_def_rt);
+
 	k_rwlock_wrlock (&netev_subscriber_lock);
-	curr_def_rt = get_curr_def_rt ();
-	new_def_rt = get_new_def_rt ();
+	curr = __def_rt_snap_curr ();
+	curr_def_rt = &curr->def_rt;
 	curr_rt_valid = __def_rt_valid (curr_def_rt);
-	if (os_get_def_rt (new_def_rt) > 0) {
+	if (new_count > 0) {
 		if (f != NULL) {
 			if (curr_rt_valid) {
-				if (!__same_def_rt (new_def_rt, curr_def_rt)) {
+				if (!__same_def_rt (&new_def_rt, curr_def_rt)) {
 					call_fn = f;
 					ev = AOSL_NET_EV_NET_SWITCH;
 					memcpy (&def_rt1, curr_def_rt, sizeof def_rt1);
-					memcpy (&def_rt2, new_def_rt, sizeof def_rt2);
-				} else if (!__same_def_rt_cnt(new_def_rt, curr_def_rt)) {
+					memcpy (&def_rt2, &new_def_rt, sizeof def_rt2);
+				} else if (!__same_def_rt_cnt(&new_def_rt, curr_def_rt)) {
 					call_fn = f;
 					ev = AOSL_NET_EV_RT_CNT_CHANGED;
 					memcpy (&def_rt1, curr_def_rt, sizeof def_rt1);
-					memcpy (&def_rt2, new_def_rt, sizeof def_rt2);
+					memcpy (&def_rt2, &new_def_rt, sizeof def_rt2);
 				}
 			} else {
-				if (__def_rt_valid (&last_valid_def_rt) && !__same_def_rt (new_def_rt, &last_valid_def_rt)) {
+				if (__def_rt_valid (&last_valid_def_rt) && !__same_def_rt (&new_def_rt, &last_valid_def_rt)) {
 					call_fn = f;
 					ev = AOSL_NET_EV_NET_UP_CHANGED;
 					memcpy (&def_rt1, &last_valid_def_rt, sizeof def_rt1);
-					memcpy (&def_rt2, new_def_rt, sizeof def_rt2);
+					memcpy (&def_rt2, &new_def_rt, sizeof def_rt2);
 				} else {
 					call_fn = f;
 					ev = AOSL_NET_EV_NET_UP;
-					memcpy (&def_rt1, new_def_rt, sizeof def_rt1);
+					memcpy (&def_rt1, &new_def_rt, sizeof def_rt1);
 				}
 			}
 		}
 
-		memcpy (&last_valid_def_rt, new_def_rt, sizeof last_valid_def_rt);
+		memcpy (&last_valid_def_rt, &new_def_rt, sizeof last_valid_def_rt);
 	} else {
+		new_count = 0;
 		if (f != NULL) {
 			if (curr_rt_valid) {
 				call_fn = f;
@@ -168,7 +249,12 @@ void check_report_def_rt_change_event (aosl_net_ev_func_t f, void *arg)
 			}
 		}
 	}
-	switch_new_to_curr ();
+
+	/* a new generation only if anything changed, so the readers could cache on it */
+	if (!curr->monitored || curr->count != new_count ||
+		!__same_rt_state (&curr_def_rt->IPv4, &new_def_rt.IPv4) ||
+		!__same_rt_state (&curr_def_rt->IPv6, &new_def_rt.IPv6))
+		__def_rt_snap_publish (&new_def_rt, new_count, 1);
 	k_rwlock_wrunlock (&netev_subscriber_lock);
 
 	if (call_fn != NULL)
@@ -198,9 +284,22 @@ __export_in_so__ void aosl_init_def_rt (aosl_def_rt_t *def_rt)
 
 __export_in_so__ int aosl_get_default_rt (aosl_def_rt_t *def_rt)
 {
+	struct def_rt_snap snap;
+
+	__def_rt_snap_get (&snap);
+	if (snap.monitored) {
+		memcpy (def_rt, &snap.def_rt, sizeof *def_rt);
+		return snap.count;
+	}
+
 	return os_get_def_rt (def_rt);
 }
 
+__export_in_so__ uint32_t aosl_def_rt_generation (void)
+{
+	return (uint32_t)(uintptr_t)atomic_read (&rt_snap_gen);
+}
+
 __export_in_so__ void aosl_invalidate_rt (aosl_rt_t *rt)
 {
 	__invalidate_rt (rt);
@@ -223,15 +322,7 @@ __export_in_so__ int aosl_def_rt_valid (const aosl_def_rt_t *def_rt)
 
 __export_in_so__ int aosl_network_is_down ()
 {
-	const aosl_def_rt_t *def_rt;
-	int invalid;
-
-	k_rwlock_rdlock (&netev_subscriber_lock);
-	def_rt = get_curr_def_rt ();
-	invalid = !__def_rt_valid (def_rt);
-	k_rwlock_rdunlock (&netev_subscriber_lock);
-
-	return invalid;
+	return !(atomic_read (&rt_snap_flags) & (RT_F_V4_VALID | RT_F_V6_VALID));
 }
 
 __export_in_so__ int aosl_same_rt (const aosl_rt_t *rt1, const aosl_rt_t *rt2)
@@ -294,39 +385,30 @@ __export_in_so__ const char *aosl_def_rt_str (const aosl_def_rt_t *def_rt, char
 
 __export_in_so__ int aosl_is_mobile_net (uint16_t af)
 {
-	aosl_def_rt_t *def_rt;
-	aosl_rt_t *rt;
+	int flags = (int)atomic_read (&rt_snap_flags);
 
-	k_rwlock_rdlock (&netev_subscriber_lock);
-	def_rt = get_curr_def_rt ();
 	switch (af) {
 	case AOSL_AF_INET:
-		rt = &def_rt->IPv4;
+		if (flags & RT_F_V4_EXIST)
+			return !!(flags & RT_F_V4_CELLNET);
 		break;
 #if defined(CONFIG_AOSL_IPV6)
 	case AOSL_AF_INET6:
-		rt = &def_rt->IPv6;
+		if (flags & RT_F_V6_EXIST)
+			return !!(flags & RT_F_V6_CELLNET);
 		break;
 #endif
 	default:
-		goto __einval;
-	}
-
-	if (rt->gw.sa.sa_family != AOSL_AF_UNSPEC) {
-		int is_mobile_net = rt->if_cellnet;
-		k_rwlock_rdunlock (&netev_subscriber_lock);
-		return is_mobile_net;
+		break;
 	}
 
-__einval:
-	k_rwlock_rdunlock (&netev_subscriber_lock);
 	aosl_errno = AOSL_EINVAL;
 	return -1;
 }
 
 __export_in_so__ int aosl_ip_sk_create (aosl_ip_sk_t *sk, int type, int protocol)
 {
-	aosl_def_rt_t *def_rt;
+	int flags;
 	int v4_def_rt_valid;
 #if defined(CONFIG_AOSL_IPV6)
 	int v6_def_rt_valid;
@@ -334,13 +416,11 @@ __export_in_so__ int aosl_ip_sk_create (aosl_ip_sk_t *sk, int type, int protocol
 	aosl_fd_t fd;
 	int created;
 
-	k_rwlock_rdlock (&netev_subscriber_lock);
-	def_rt = get_curr_def_rt ();
-	v4_def_rt_valid = __rt_valid (&def_rt->IPv4);
+	flags = (int)atomic_read (&rt_snap_flags);
+	v4_def_rt_valid = !!(flags & RT_F_V4_VALID);
 #if defined(CONFIG_AOSL_IPV6)
-	v6_def_rt_valid = __rt_valid (&def_rt->IPv6);
+	v6_def_rt_valid = !!(flags & RT_F_V6_VALID);
 #endif
-	k_rwlock_rdunlock (&netev_subscriber_lock);
 
 	sk->v4 = AOSL_INVALID_FD;
 	sk->v6 = AOSL_INVALID_FD;
@@ -372,8 +452,10 @@ __export_in_so__ int aosl_ip_sk_create (aosl_ip_sk_t *sk, int type, int protocol
 
 void route_clear (void)
 {
-	aosl_init_def_rt (&def_rts [0]);
-	aosl_init_def_rt (&def_rts [1]);
+	aosl_def_rt_t def_rt;
+
+	aosl_init_def_rt (&def_rt);
+	__def_rt_snap_publish (&def_rt, 0, 0);
 	aosl_init_def_rt (&last_valid_def_rt);
 }
 
@@ -439,12 +521,12 @@ void k_route_init (void)
 {
 	k_rwlock_init (&netev_subscriber_lock);
 	route_clear ();
-	netifs_hash_init ();
+	netifs_init ();
 }
 
 void k_route_fini (void)
 {
 	k_rwlock_destroy (&netev_subscriber_lock);
 	route_clear ();
-	netifs_hash_init ();
+	netifs_fini ();
 }
@@ -20,6 +20,7 @@
 #include <kernel/err.h>
 #include <kernel/mp_queue.h>
 #include <kernel/iofd.h>
+#include <kernel/mpq_pool.h>
 #include <kernel/byteorder/generic.h>
 #include <kernel/net.h>
 
@@ -112,18 +113,30 @@ struct sendto_args {
 static isize_t __default_accept (aosl_fd_t fd, void *buf, size_t len, size_t extra, uintptr_t argc, uintptr_t argv [])
 {
 	aosl_accept_data_t *accept_data = (aosl_accept_data_t *)buf;
+	int err;
 
 	UNUSED (len);
 	UNUSED (extra);
 	UNUSED (argc);
 	UNUSED (argv);
 
-	accept_data->newsk = aosl_hal_sk_accept (fd, &accept_data->addr.sa);
-	if (aosl_fd_invalid (accept_data->newsk)) {
-		return aosl_hal_set_error(AOSL_HAL_RET_EHAL);
+	for (;;) {
+		err = AOSL_HAL_RET_EHAL;
+		accept_data->newsk = aosl_hal_sk_accept (fd, &accept_data->addr.sa, &err);
+		if (!aosl_fd_invalid (accept_data->newsk))
+			return sizeof (aosl_accept_data_t);
+
+		/* a pending connection reset before being accepted, try the next one */
+		if (err != AOSL_HAL_RET_ECONNABORTED && err != AOSL_HAL_RET_EINTR)
+			break;
 	}
 
-	return sizeof (aosl_accept_data_t);
+	/**
+	 * Anything other than -AOSL_EAGAIN, such as running out of fds, does
+	 * not close the listening fd, the iofd layer stops polling it for a
+	 * while instead, see __iofd_listen_pause.
+	 **/
+	return aosl_hal_set_error (err);
 }
 
 static isize_t __default_recv (aosl_fd_t fd, void *buf, size_t len, size_t extra, uintptr_t argc, uintptr_t argv [])
@@ -235,7 +248,7 @@ static int __this_q_connect_argv (struct mp_queue *q, aosl_fd_t fd, const aosl_s
 {
 	int err;
 
-	err = __mpq_add_fd_argv (q, fd, timeo, max_pkt_size, 0, IOFD_NOT_READY, __default_recv, __default_send, chk_pkt_f, NULL, data_f, event_f, argc, argv);
+	err = __mpq_add_fd_argv (q, fd, timeo, max_pkt_size, 0, IOFD_NOT_READY | IOFD_STREAM, __default_recv, __default_send, chk_pkt_f, NULL, data_f, event_f, argc, argv);
 	if (err < 0)
 		return err;
 
@@ -297,7 +310,7 @@ static void ____target_q_connect (const aosl_ts_t *queued_ts_p, aosl_refobj_t ro
 	UNUSED (queued_ts_p);
 	UNUSED (robj);
 
-	*err_p = __this_q_connect_argv (THIS_MPQ (), fd, dest_addr, timeo, max_pkt_size, chk_pkt_f, data_f, event_f, argc - 9, &argv [9]);
+	*err_p = __this_q_connect_argv (THIS_MPQ (), fd, dest_addr, timeo, max_pkt_size, chk_pkt_f, data_f, event_f, argc - 8, &argv [8]);
 }
 
 static int __mpq_connect_on_q_args (aosl_mpq_t qid, aosl_fd_t fd, const aosl_sockaddr_t *dest_addr,
@@ -316,7 +329,7 @@ static int __mpq_connect_on_q_args (aosl_mpq_t qid, aosl_fd_t fd, const aosl_soc
 	if (q == NULL)
 		return -AOSL_EINVAL;
 
-	argv = aosl_alloca (sizeof (uintptr_t) * (9 + argc));
+	argv = aosl_alloca (sizeof (uintptr_t) * (8 + argc));
 	argv [0] = (uintptr_t)&err;
 	argv [1] = (uintptr_t)fd;
 	argv [2] = (uintptr_t)dest_addr;
@@ -326,7 +339,7 @@ static int __mpq_connect_on_q_args (aosl_mpq_t qid, aosl_fd_t fd, const aosl_soc
 	argv [6] = (uintptr_t)data_f;
 	argv [7] = (uintptr_t)event_f;
 	for (l = 0; l < argc; l++)
-		argv [9 + l] = va_arg (args, uintptr_t);
+		argv [8 + l] = va_arg (args, uintptr_t);
 
 	if (__mpq_call_argv (q, -1, "____target_q_connect", ____target_q_connect, 8 + argc, argv) < 0)
 		err = -aosl_errno;
@@ -409,34 +422,364 @@ static void ____target_q_listen (const aosl_ts_t *queued_ts_p, aosl_refobj_t rob
 	*err_p = __this_q_listen_argv (THIS_MPQ (), fd, backlog, accepted_f, event_f, argc - 5, &argv [5]);
 }
 
+static int __mpq_listen_on_q_argv (aosl_mpq_t qid, aosl_fd_t fd, int backlog,
+		aosl_sk_accepted_t accepted_f, aosl_fd_event_t event_f, uintptr_t argc, uintptr_t *argv)
+{
+	struct mp_queue *q;
+	uintptr_t l;
+	uintptr_t *q_argv;
+	int err;
+
+	if (argc > MPQ_ARGC_MAX)
+		return -AOSL_E2BIG;
+
+	q = __mpq_get (qid);
+	if (q == NULL)
+		return -AOSL_EINVAL;
+
+	q_argv = aosl_alloca (sizeof (uintptr_t) * (5 + argc));
+	q_argv [0] = (uintptr_t)&err;
+	q_argv [1] = (uintptr_t)fd;
+	q_argv [2] = (uintptr_t)backlog;
+	q_argv [3] = (uintptr_t)accepted_f;
+	q_argv [4] = (uintptr_t)event_f;
+	for (l = 0; l < argc; l++)
+		q_argv [5 + l] = argv [l];
+
+	if (__mpq_call_argv (q, -1, "____target_q_listen", ____target_q_listen, 5 + argc, q_argv) < 0)
+		err = -aosl_errno;
+
+	__mpq_put (q);
+
+	return err;
+}
+
 __export_in_so__ int aosl_mpq_listen_on_q (aosl_mpq_t qid, aosl_fd_t fd, int backlog,
 		aosl_sk_accepted_t accepted_f, aosl_fd_event_t event_f, uintptr_t argc, ...)
 {
-	struct mp_queue *q;
 	va_list args;
 	uintptr_t l;
 	uintptr_t *argv;
+
+	if (argc > MPQ_ARGC_MAX)
+		return_err (-AOSL_E2BIG);
+
+	argv = aosl_alloca (sizeof (uintptr_t) * argc);
+	va_start (args, argc);
+	for (l = 0; l < argc; l++)
+		argv [l] = va_arg (args, uintptr_t);
+	va_end (args);
+
+	return_err (__mpq_listen_on_q_argv (qid, fd, backlog, accepted_f, event_f, argc, argv));
+}
+
+/**
+ * The listeners added with the listen options carry these private args
+ * ahead of the user ones, the user callbacks only get the user ones.
+ **/
+#define LISTEN_ARGV_ACCEPTED_F 0
+#define LISTEN_ARGV_EVENT_F 1
+#define LISTEN_ARGV_PLACE_QP 2
+#define LISTEN_ARGV_MAX_PKT_SIZE 3
+#define LISTEN_ARGV_CHK_PKT_F 4
+#define LISTEN_ARGV_DATA_F 5
+#define LISTEN_ARGC 6
+
+/* the placing handoff args ahead of the listener args */
+#define PLACE_ARGC 3
+
+static isize_t __batch_accept (aosl_fd_t fd, void *buf, size_t len, size_t extra, uintptr_t argc, uintptr_t argv [])
+{
+	aosl_accept_data_t *accept_data = (aosl_accept_data_t *)buf;
+	size_t count = len / sizeof (aosl_accept_data_t);
+	size_t i;
+	int err;
+
+	UNUSED (extra);
+	UNUSED (argc);
+	UNUSED (argv);
+
+	i = 0;
+	while (i < count) {
+		err = AOSL_HAL_RET_EHAL;
+		accept_data [i].newsk = aosl_hal_sk_accept_nb (fd, &accept_data [i].addr.sa, &err);
+		if (!aosl_fd_invalid (accept_data [i].newsk)) {
+			i++;
+			continue;
+		}
+
+		/* a pending connection reset before being accepted, try the next one */
+		if (err != AOSL_HAL_RET_ECONNABORTED && err != AOSL_HAL_RET_EINTR)
+			break;
+	}
+
+	/**
+	 * Hand the accepted ones over first, the error comes again with the
+	 * next read, which the iofd layer keeps doing until -AOSL_EAGAIN, see
+	 * __default_accept for the other errors.
+	 **/
+	if (i == 0)
+		return aosl_hal_set_error (err);
+
+	return (isize_t)(i * sizeof (aosl_accept_data_t));
+}
+
+static void __close_accepted (aosl_accept_data_t *accept_data, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		aosl_hal_sk_close (accept_data [i].newsk);
+}
+
+static void ____target_q_place_accepted (const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv [])
+{
+	aosl_mpq_t qid = (aosl_mpq_t)argv [0];
+	size_t count = (size_t)argv [1];
+	aosl_accept_data_t *accept_data = (aosl_accept_data_t *)argv [2];
+	uintptr_t *l_argv = &argv [PLACE_ARGC];
+	uintptr_t user_argc = argc - PLACE_ARGC - LISTEN_ARGC;
+	uintptr_t *user_argv = &l_argv [LISTEN_ARGC];
+	aosl_sk_accepted_t accepted_f = (aosl_sk_accepted_t)l_argv [LISTEN_ARGV_ACCEPTED_F];
+	size_t i;
+	int err;
+
+	UNUSED (queued_ts_p);
+
+	for (i = 0; i < count; i++) {
+		if (aosl_is_free_only (robj)) {
+			aosl_hal_sk_close (accept_data [i].newsk);
+		} else {
+			err = __mpq_add_fd_argv (THIS_MPQ (), accept_data [i].newsk, -1, (size_t)l_argv [LISTEN_ARGV_MAX_PKT_SIZE], 0,
+						IOFD_STREAM | IOFD_NONBLOCK, __default_recv, __default_send, (aosl_check_packet_t)l_argv [LISTEN_ARGV_CHK_PKT_F],
+						NULL, (aosl_fd_data_t)l_argv [LISTEN_ARGV_DATA_F], (aosl_fd_event_t)l_argv [LISTEN_ARGV_EVENT_F], user_argc, user_argv);
+			if (err < 0) {
+				AOSL_LOG (AOSL_LOG_ERROR, "add the accepted fd %d failed, err=%d", (int)accept_data [i].newsk, err);
+				aosl_hal_sk_close (accept_data [i].newsk);
+			} else {
+				accepted_f (&accept_data [i], sizeof (aosl_accept_data_t), user_argc, user_argv);
+			}
+		}
+
+		/* the fd is counted in the queue load now */
+		mpqp_best_q_put (qid);
+	}
+
+	aosl_free (accept_data);
+}
+
+static void __place_accepted (aosl_mpqp_t qp, aosl_accept_data_t *accept_data, size_t count, uintptr_t argc, uintptr_t argv [])
+{
+	aosl_mpq_t *qids = aosl_alloca (sizeof (aosl_mpq_t) * count);
+	uintptr_t *place_argv = aosl_alloca (sizeof (uintptr_t) * (PLACE_ARGC + argc));
+	aosl_accept_data_t *group;
+	struct mp_queue *q;
+	size_t i, l, n;
 	int err;
 
+	err = mpqp_fd_best_qs_get (qp, qids, (int)count);
+	if (err < 0) {
+		AOSL_LOG (AOSL_LOG_ERROR, "no queue for the accepted fds, err=%d", err);
+		__close_accepted (accept_data, count);
+		return;
+	}
+
+	for (l = 0; l < argc; l++)
+		place_argv [PLACE_ARGC + l] = argv [l];
+
+	/* one handoff for all the fds going to the same queue */
+	for (i = 0; i < count; i++) {
+		aosl_mpq_t qid = qids [i];
+
+		if (aosl_mpq_invalid (qid))
+			continue;
+
+		n = 0;
+		for (l = i; l < count; l++) {
+			if (qids [l] == qid)
+				n++;
+		}
+
+		group = (aosl_accept_data_t *)aosl_malloc (sizeof (aosl_accept_data_t) * n);
+		n = 0;
+		for (l = i; l < count; l++) {
+			if (qids [l] == qid) {
+				if (group != NULL)
+					group [n] = accept_data [l];
+				else
+					aosl_hal_sk_close (accept_data [l].newsk);
+
+				n++;
+				qids [l] = AOSL_MPQ_INVALID;
+			}
+		}
+
+		err = -AOSL_ENOMEM;
+		if (group != NULL) {
+			place_argv [0] = (uintptr_t)qid;
+			place_argv [1] = (uintptr_t)n;
+			place_argv [2] = (uintptr_t)group;
+			q = __mpq_get (qid);
+			if (q != NULL) {
+				err = __mpq_queue_no_fail_argv (q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, "____target_q_place_accepted",
+															____target_q_place_accepted, PLACE_ARGC + argc, place_argv);
+				__mpq_put (q);
+			} else {
+				err = -AOSL_EINVAL;
+			}
+
+			if (err < 0) {
+				__close_accepted (group, n);
+				aosl_free (group);
+			}
+		}
+
+		if (err < 0) {
+			for (l = 0; l < n; l++)
+				mpqp_best_q_put (qid);
+		}
+	}
+}
+
+static void __listen_accepted (void *data, size_t len, uintptr_t argc, uintptr_t argv [])
+{
+	aosl_accept_data_t *accept_data = (aosl_accept_data_t *)data;
+	size_t count = len / sizeof (aosl_accept_data_t);
+	aosl_sk_accepted_t accepted_f = (aosl_sk_accepted_t)argv [LISTEN_ARGV_ACCEPTED_F];
+	aosl_mpqp_t place_qp = (aosl_mpqp_t)argv [LISTEN_ARGV_PLACE_QP];
+	size_t i;
+
+	if (place_qp != NULL) {
+		__place_accepted (place_qp, accept_data, count, argc, argv);
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+		accepted_f (&accept_data [i], sizeof (aosl_accept_data_t), argc - LISTEN_ARGC, &argv [LISTEN_ARGC]);
+}
+
+static void __listen_event (aosl_fd_t fd, int event, uintptr_t argc, uintptr_t argv [])
+{
+	aosl_fd_event_t event_f = (aosl_fd_event_t)argv [LISTEN_ARGV_EVENT_F];
+
+	if (event_f != NULL)
+		event_f (fd, event, argc - LISTEN_ARGC, &argv [LISTEN_ARGC]);
+}
+
+static int __this_q_listen_opts_argv (struct mp_queue *q, aosl_fd_t fd, int backlog, const aosl_listen_opts_t *opts,
+				aosl_sk_accepted_t accepted_f, aosl_fd_event_t event_f, uintptr_t argc, uintptr_t *argv)
+{
+	uintptr_t *l_argv;
+	uintptr_t l;
+	int batch;
+	int err;
+
+	if (opts == NULL || accepted_f == NULL)
+		return -AOSL_EINVAL;
+
+	if (opts->place_qp != NULL) {
+		if (opts->data_f == NULL || opts->max_pkt_size > FD_MAX_PACKET_SIZE_MAX
+					|| (opts->chk_pkt_f != NULL && opts->max_pkt_size < FD_MAX_PACKET_SIZE_MIN))
+			return -AOSL_EINVAL;
+	}
+
+	/* the placing handoff carries all the args */
+	if (argc > MPQ_ARGC_MAX - LISTEN_ARGC - PLACE_ARGC)
+		return -AOSL_E2BIG;
+
+	batch = opts->batch;
+	if (batch < 1)
+		batch = 1;
+
+	if (batch > AOSL_LISTEN_BATCH_MAX)
+		batch = AOSL_LISTEN_BATCH_MAX;
+
+	err = aosl_hal_sk_listen (fd, backlog);
+	if (err < 0)
+		return aosl_hal_set_error (err);
+
+	l_argv = aosl_alloca (sizeof (uintptr_t) * (LISTEN_ARGC + argc));
+	l_argv [LISTEN_ARGV_ACCEPTED_F] = (uintptr_t)accepted_f;
+	l_argv [LISTEN_ARGV_EVENT_F] = (uintptr_t)event_f;
+	l_argv [LISTEN_ARGV_PLACE_QP] = (uintptr_t)opts->place_qp;
+	l_argv [LISTEN_ARGV_MAX_PKT_SIZE] = (uintptr_t)opts->max_pkt_size;
+	l_argv [LISTEN_ARGV_CHK_PKT_F] = (uintptr_t)opts->chk_pkt_f;
+	l_argv [LISTEN_ARGV_DATA_F] = (uintptr_t)opts->data_f;
+	for (l = 0; l < argc; l++)
+		l_argv [LISTEN_ARGC + l] = argv [l];
+
+	return __mpq_add_fd_argv (q, fd, -1, batch * sizeof (aosl_accept_data_t), 0, IOFD_SOCK_LISTEN, __batch_accept, NULL, NULL, NULL,
+														__listen_accepted, __listen_event, LISTEN_ARGC + argc, l_argv);
+}
+
+__export_in_so__ int aosl_mpq_listen_opts (aosl_fd_t fd, int backlog, const aosl_listen_opts_t *opts,
+				aosl_sk_accepted_t accepted_f, aosl_fd_event_t event_f, uintptr_t argc, ...)
+{
+	struct mp_queue *q;
+	va_list args;
+	uintptr_t l;
+	uintptr_t *argv;
+
 	if (argc > MPQ_ARGC_MAX)
 		return_err (-AOSL_E2BIG);
 
+	q = __get_or_create_current ();
+	if (q == NULL)
+		return_err (-AOSL_EINVAL);
+
+	argv = aosl_alloca (sizeof (uintptr_t) * argc);
+	va_start (args, argc);
+	for (l = 0; l < argc; l++)
+		argv [l] = va_arg (args, uintptr_t);
+	va_end (args);
+
+	return_err (__this_q_listen_opts_argv (q, fd, backlog, opts, accepted_f, event_f, argc, argv));
+}
+
+static void ____target_q_listen_opts (const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv [])
+{
+	int *err_p = (int *)argv [0];
+	aosl_fd_t fd = (aosl_fd_t)argv [1];
+	int backlog = (int)argv [2];
+	const aosl_listen_opts_t *opts = (const aosl_listen_opts_t *)argv [3];
+	aosl_sk_accepted_t accepted_f = (aosl_sk_accepted_t)argv [4];
+	aosl_fd_event_t event_f = (aosl_fd_event_t)argv [5];
+
+	UNUSED (queued_ts_p);
+	UNUSED (robj);
+
+	*err_p = __this_q_listen_opts_argv (THIS_MPQ (), fd, backlog, opts, accepted_f, event_f, argc - 6, &argv [6]);
+}
+
+__export_in_so__ int aosl_mpq_listen_opts_on_q (aosl_mpq_t qid, aosl_fd_t fd, int backlog, const aosl_listen_opts_t *opts,
+				aosl_sk_accepted_t accepted_f, aosl_fd_event_t event_f, uintptr_t argc, ...)
+{
+	struct mp_queue *q;
+	va_list args;
+	uintptr_t l;
+	uintptr_t *argv;
+	int err;
+
+	if (argc > MPQ_ARGC_MAX - 6)
+		return_err (-AOSL_E2BIG);
+
 	q = __mpq_get (qid);
 	if (q == NULL)
 		return_err (-AOSL_EINVAL);
 
-	argv = aosl_alloca (sizeof (uintptr_t) * (5 + argc));
+	argv = aosl_alloca (sizeof (uintptr_t) * (6 + argc));
 	argv [0] = (uintptr_t)&err;
 	argv [1] = (uintptr_t)fd;
 	argv [2] = (uintptr_t)backlog;
-	argv [3] = (uintptr_t)accepted_f;
-	argv [4] = (uintptr_t)event_f;
+	argv [3] = (uintptr_t)opts;
+	argv [4] = (uintptr_t)accepted_f;
+	argv [5] = (uintptr_t)event_f;
 	va_start (args, argc);
 	for (l = 0; l < argc; l++)
-		argv [5 + l] = va_arg (args, uintptr_t);
+		argv [6 + l] = va_arg (args, uintptr_t);
 	va_end (args);
 
-	if (__mpq_call_argv (q, -1, "____target_q_listen", ____target_q_listen, 5 + argc, argv) < 0)
+	if (__mpq_call_argv (q, -1, "____target_q_listen_opts", ____target_q_listen_opts, 6 + argc, argv) < 0)
 		err = -aosl_errno;
 
 	__mpq_put (q);
@@ -444,6 +787,169 @@ __export_in_so__ int aosl_mpq_listen_on_q (aosl_mpq_t qid, aosl_fd_t fd, int bac
 	return_err (err);
 }
 
+static int __shard_listen (aosl_mpq_t qid, const aosl_sockaddr_t *addr, int reuseport, int backlog, aosl_fd_t *fd_p,
+		aosl_sk_accepted_t accepted_f, aosl_fd_event_t event_f, uintptr_t argc, uintptr_t *argv)
+{
+	aosl_fd_t fd;
+	int err;
+
+	fd = aosl_hal_sk_socket ((enum aosl_socket_domain)addr->sa_family, AOSL_SOCK_STREAM, AOSL_IPPROTO_TCP);
+	if (aosl_fd_invalid (fd))
+		return -AOSL_EHAL;
+
+	if (reuseport) {
+		err = aosl_hal_sk_set_reuseport (fd);
+		if (err < 0) {
+			/* tell the caller the balancing is not available */
+			err = (err == AOSL_HAL_RET_EHAL) ? -AOSL_EOPNOTSUPP : -AOSL_EHAL;
+			goto __close;
+		}
+	}
+
+	err = aosl_hal_sk_bind (fd, addr);
+	if (err < 0) {
+		err = -AOSL_EHAL;
+		goto __close;
+	}
+
+	err = __mpq_listen_on_q_argv (qid, fd, backlog, accepted_f, event_f, argc, argv);
+	if (err < 0)
+		goto __close;
+
+	*fd_p = fd;
+	return 0;
+
+__close:
+	aosl_hal_sk_close (fd);
+	return err;
+}
+
+static int __mpqp_listen_argv (aosl_mpqp_t qp, const aosl_sockaddr_t *addr, int backlog, aosl_fd_t fds [], int max_fds,
+		aosl_sk_accepted_t accepted_f, aosl_fd_event_t event_f, uintptr_t argc, uintptr_t *argv)
+{
+	aosl_sockaddr_t bind_addr;
+	aosl_mpq_t *qids;
+	int q_count;
+	int sharded;
+	int count;
+	int i;
+	int err;
+
+	if (qp == NULL || addr == NULL || fds == NULL || max_fds < 1)
+		return -AOSL_EINVAL;
+
+	if (max_fds > MPQP_MAX_SIZE)
+		max_fds = MPQP_MAX_SIZE;
+
+	qids = (aosl_mpq_t *)aosl_malloc (sizeof (aosl_mpq_t) * max_fds);
+	if (qids == NULL)
+		return -AOSL_ENOMEM;
+
+	q_count = mpqp_pin_qs (qp, qids, max_fds);
+	if (q_count < 0) {
+		err = q_count;
+		goto __free_qids;
+	}
+
+	/**
+	 * Without the balancing, more listening sockets on the same port
+	 * would not share the connections, so fall back to one listener.
+	 **/
+	bind_addr = *addr;
+	sharded = q_count > 1;
+	err = __shard_listen (qids [0], &bind_addr, sharded, backlog, &fds [0], accepted_f, event_f, argc, argv);
+	if (err == -AOSL_EOPNOTSUPP) {
+		sharded = 0;
+		err = __shard_listen (qids [0], &bind_addr, 0, backlog, &fds [0], accepted_f, event_f, argc, argv);
+	}
+
+	if (err < 0) {
+		count = 0;
+		goto __unpin;
+	}
+
+	count = 1;
+	if (sharded) {
+		/* the other shards must bind the port just picked by the first one */
+		if (aosl_hal_sk_get_sockname (fds [0], &bind_addr) < 0) {
+			err = -AOSL_EHAL;
+			goto __unpin;
+		}
+
+		while (count < q_count) {
+			err = __shard_listen (qids [count], &bind_addr, 1, backlog, &fds [count], accepted_f, event_f, argc, argv);
+			if (err < 0)
+				goto __unpin;
+
+			count++;
+		}
+	}
+
+	err = count;
+
+__unpin:
+	if (err < 0) {
+		for (i = 0; i < count; i++)
+			__iofd_close (fds [i]);
+
+		count = 0;
+	}
+
+	/* the queues without a listener */
+	for (i = count; i < q_count; i++)
+		mpqp_unpin_q (qp, qids [i]);
+
+__free_qids:
+	aosl_free (qids);
+	return err;
+}
+
+__export_in_so__ int aosl_mpqp_listen (aosl_mpqp_t qp, const aosl_sockaddr_t *addr, int backlog, aosl_fd_t fds [], int max_fds,
+		aosl_sk_accepted_t accepted_f, aosl_fd_event_t event_f, uintptr_t argc, ...)
+{
+	va_list args;
+	uintptr_t l;
+	uintptr_t *argv;
+
+	if (argc > MPQ_ARGC_MAX)
+		return_err (-AOSL_E2BIG);
+
+	argv = aosl_alloca (sizeof (uintptr_t) * argc);
+	va_start (args, argc);
+	for (l = 0; l < argc; l++)
+		argv [l] = va_arg (args, uintptr_t);
+	va_end (args);
+
+	return_err (__mpqp_listen_argv (qp, addr, backlog, fds, max_fds, accepted_f, event_f, argc, argv));
+}
+
+__export_in_so__ int aosl_mpqp_listen_close (aosl_mpqp_t qp, const aosl_fd_t fds [], int count)
+{
+	struct iofd *f;
+	aosl_mpq_t qid;
+	int err = 0;
+	int i;
+
+	if (qp == NULL || fds == NULL || count < 0)
+		return_err (-AOSL_EINVAL);
+
+	for (i = 0; i < count; i++) {
+		f = iofd_get (fds [i]);
+		if (f == NULL) {
+			err = -AOSL_EBADF;
+			continue;
+		}
+
+		qid = f->q;
+		iofd_put (f);
+
+		__iofd_close (fds [i]);
+		mpqp_unpin_q (qp, qid);
+	}
+
+	return_err (err);
+}
+
 static __inline__ int __this_q_add_dgram_sk_argv (struct mp_queue *q, aosl_fd_t fd, size_t max_pkt_size,
 				aosl_dgram_sk_data_t data_f, aosl_fd_event_t event_f, uintptr_t argc, uintptr_t *argv)
 {
@@ -537,7 +1043,7 @@ static __inline__ int __this_q_add_stream_sk_argv (struct mp_queue *q, aosl_fd_t
 									aosl_fd_data_t data_f, aosl_fd_event_t event_f,
 													uintptr_t argc, uintptr_t *argv)
 {
-	return __mpq_add_fd_argv (q, fd, -1, max_pkt_size, 0, 0, __default_recv, __default_send, chk_pkt_f, NULL, data_f, event_f, argc, argv);
+	return __mpq_add_fd_argv (q, fd, -1, max_pkt_size, 0, IOFD_STREAM, __default_recv, __default_send, chk_pkt_f, NULL, data_f, event_f, argc, argv);
 }
 
 static int __mpq_add_stream_sk_args (aosl_fd_t fd, size_t max_pkt_size, aosl_check_packet_t chk_pkt_f,
@@ -628,8 +1134,6 @@ __export_in_so__ int aosl_mpq_add_stream_socket_on_q (aosl_mpq_t qid, aosl_fd_t
 
 static isize_t ____send (struct iofd *f, const void *buf, size_t len, int flags)
 {
-	w_buffer_t *node;
-	int *flags_p;
 	isize_t err;
 
 	if (len > FD_MAX_WBUF_SIZE)
@@ -650,21 +1154,14 @@ static isize_t ____send (struct iofd *f, const void *buf, size_t len, int flags)
 
 	if ((size_t)err < len) {
 __queue_it:
-		node = (w_buffer_t *)aosl_malloc (sizeof (w_buffer_t) + AOSL_I_ALIGN_PTR (len - err) + sizeof (flags));
-		if (node == NULL)
-			return -AOSL_ENOMEM;
+		err = w_queue_append (THIS_MPQ (), f, (char *)buf + err, len - err, &flags, sizeof (flags));
+		if (err < 0)
+			return err;
 
-		memcpy (node + 1, (char *)buf + err, len - err);
-		node->w_data = node + 1;
-		node->w_tail = (char *)(node + 1) + (len - err);
-		node->w_extra_size = sizeof (flags);
-
-		flags_p = AOSL_P_ALIGN_PTR (node->w_tail);
-		*flags_p = flags;
-
-		w_queue_add (&f->w_q, node);
+		os_rearm_event_fd (THIS_MPQ (), f, AOSL_POLLOUT);
 	}
 
+	mpq_stats_tx (THIS_MPQ (), len);
 	return len;
 }
 
@@ -718,8 +1215,7 @@ __export_in_so__ isize_t aosl_send (aosl_fd_t fd, const void *buf, size_t len, i
 static isize_t ____sendto (struct iofd *f, const void *buf, size_t len, int flags,
 							const aosl_sockaddr_t *dest_addr)
 {
-	w_buffer_t *node;
-	struct sendto_args *args;
+	struct sendto_args args;
 	isize_t err;
 
 	if (len > FD_MAX_WBUF_SIZE)
@@ -739,21 +1235,16 @@ static isize_t ____sendto (struct iofd *f, const void *buf, size_t len, int flag
 
 	if ((size_t)err < len) {
 __queue_it:
-		node = (w_buffer_t *)aosl_malloc (sizeof (w_buffer_t) + AOSL_I_ALIGN_PTR (len - err) + sizeof (struct sendto_args));
-		if (node == NULL)
-			return -AOSL_ENOMEM;
-
-		memcpy (node + 1, (char *)buf + err, len - err);
-		node->w_data = node + 1;
-		node->w_tail = (char *)(node + 1) + (len - err);
-		node->w_extra_size = sizeof (struct sendto_args);
-
-		args = (struct sendto_args *)AOSL_P_ALIGN_PTR (node->w_tail);
-		args->flags = flags;
-		memcpy (&args->addr, dest_addr, sizeof(args->addr));
-		w_queue_add (&f->w_q, node);
+		args.flags = flags;
+		memcpy (&args.addr, dest_addr, sizeof (args.addr));
+		err = w_queue_append (THIS_MPQ (), f, (char *)buf + err, len - err, &args, sizeof (args));
+		if (err < 0)
+			return err;
+
+		os_rearm_event_fd (THIS_MPQ (), f, AOSL_POLLOUT);
 	}
 
+	mpq_stats_tx (THIS_MPQ (), len);
 	return len;
 }
 
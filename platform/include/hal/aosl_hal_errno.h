@@ -19,6 +19,7 @@ extern "C" {
 #define AOSL_HAL_RET_EAGAIN          -2001
 #define AOSL_HAL_RET_EINTR           -2002
 #define AOSL_HAL_RET_EINPROGRESS     -2003
+#define AOSL_HAL_RET_ECONNABORTED    -2004
 
 /**
  * @brief Convert standard errno to AOSL HAL error codes
@@ -86,6 +86,15 @@ int aosl_hal_sk_bind_device(aosl_fd_t sockfd, const char *if_name);
  */
 int aosl_hal_sk_set_dscp(aosl_fd_t sockfd, enum aosl_socket_domain domain, uint8_t dscp);
 
+/**
+ * @brief   allow several sockets to bind the same address and port, with the
+ *          incoming connections load balanced among the listening ones
+ * @param [in] sockfd socket file descriptor, must be called before bind
+ * @return 0 on success, AOSL_HAL_RET_EHAL if the platform could not balance
+ *         the connections, other < 0 on error. should use aosl_hal_errno_convert to get error code
+ */
+int aosl_hal_sk_set_reuseport(aosl_fd_t sockfd);
+
 /**
  * @brief   listen for incoming connections
  * @param [in] sockfd socket file descriptor
@@ -98,9 +107,22 @@ int aosl_hal_sk_listen(aosl_fd_t sockfd, int backlog);
  * @brief   accept an incoming connection
  * @param [in] sockfd socket file descriptor
  * @param [out] addr address of the connecting peer
+ * @param [out] err the error code on error, AOSL_HAL_RET_EAGAIN for no pending
+ *                  connection, AOSL_HAL_RET_ECONNABORTED for a pending one
+ *                  dropped before being accepted, see aosl_hal_errno_convert
  * @return socket file descriptor on success, AOSL_INVALID_FD on error
  */
-aosl_fd_t aosl_hal_sk_accept(aosl_fd_t sockfd, aosl_sockaddr_t *addr);
+aosl_fd_t aosl_hal_sk_accept(aosl_fd_t sockfd, aosl_sockaddr_t *addr, int *err);
+
+/**
+ * @brief   accept an incoming connection as a non-blocking socket, in one
+ *          call (such as accept4) when the platform supports it
+ * @param [in] sockfd socket file descriptor
+ * @param [out] addr address of the connecting peer
+ * @param [out] err the error code on error, same as aosl_hal_sk_accept
+ * @return non-blocking socket file descriptor on success, AOSL_INVALID_FD on error
+ */
+aosl_fd_t aosl_hal_sk_accept_nb(aosl_fd_t sockfd, aosl_sockaddr_t *addr, int *err);
 
 /**
  * @brief   connect to a remote address
@@ -286,6 +286,24 @@ int aosl_hal_sem_wait(aosl_sem_t sem);
  */
 int aosl_hal_sem_timedwait(aosl_sem_t sem, intptr_t timeout_ms);
 
+/**
+ * @brief wait on a futex word while it still holds the expected value,
+ *        only needed when AOSL_HAL_HAVE_FUTEX is defined
+ * @param [in] uaddr the futex word
+ * @param [in] val the expected value
+ * @return 0 on wakeup or value changed, < 0 on error
+ */
+int aosl_hal_futex_wait(volatile int *uaddr, int val);
+
+/**
+ * @brief wake the waiters on a futex word,
+ *        only needed when AOSL_HAL_HAVE_FUTEX is defined
+ * @param [in] uaddr the futex word
+ * @param [in] count the max number of the waiters to wake
+ * @return the number of the woken waiters, < 0 on error
+ */
+int aosl_hal_futex_wake(volatile int *uaddr, int count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -21,6 +21,13 @@ extern "C" {
  */
 uint64_t aosl_hal_get_tick_ms (void);
 
+/**
+ * @brief get current monotonic tick in microseconds for measuring intervals,
+ * returns the milliseconds tick * 1000 if no finer tick source available
+ * @return current tick in microseconds
+ */
+uint64_t aosl_hal_get_tick_us (void);
+
 /**
  * @brief get current time in milliseconds since epoch
  * @return current time in milliseconds since epoch
@@ -96,20 +96,35 @@ int aosl_hal_sk_listen(int sockfd, int backlog)
 	return 0;
 }
 
-int aosl_hal_sk_accept(int sockfd, aosl_sockaddr_t *addr)
+int aosl_hal_sk_accept(int sockfd, aosl_sockaddr_t *addr, int *err)
 {
 	struct sockaddr_in com_addr = {0};
 	struct sockaddr *n_addr = (struct sockaddr *)&com_addr;
 	socklen_t addrlen = sizeof(com_addr);
 	int ret = accept(sockfd, n_addr, &addrlen);
 	if (ret < 0) {
-		return aosl_hal_errno_convert(errno);
+		*err = aosl_hal_errno_convert(errno);
+		return AOSL_INVALID_FD;
 	} else {
 		conv_addr_to_aosl(n_addr, addr);
 	}
 	return ret;
 }
 
+aosl_fd_t aosl_hal_sk_accept_nb(aosl_fd_t sockfd, aosl_sockaddr_t *addr, int *err)
+{
+	aosl_fd_t fd = aosl_hal_sk_accept(sockfd, addr, err);
+	if (fd < 0)
+		return AOSL_INVALID_FD;
+
+	*err = aosl_hal_sk_set_nonblock(fd);
+	if (*err < 0) {
+		aosl_hal_sk_close(fd);
+		return AOSL_INVALID_FD;
+	}
+	return fd;
+}
+
 int aosl_hal_sk_connect(int sockfd, const aosl_sockaddr_t *addr)
 {
 	struct sockaddr_in com_addr = {0};
@@ -185,6 +200,12 @@ int aosl_hal_sk_set_dscp(aosl_fd_t sockfd, enum aosl_socket_domain domain, uint8
     (void)dscp;
     return 0;
 }
+
+int aosl_hal_sk_set_reuseport(aosl_fd_t sockfd)
+{
+    (void)sockfd;
+    return AOSL_HAL_RET_EHAL;
+}
 
 #include "lwip.h"
 
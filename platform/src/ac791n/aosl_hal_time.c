@@ -15,6 +15,12 @@ uint64_t aosl_hal_get_tick_ms(void)
     return aosl_hal_get_time_ms();
 }
 
+uint64_t aosl_hal_get_tick_us(void)
+{
+    /* no sub millisecond tick source */
+    return aosl_hal_get_tick_ms() * 1000;
+}
+
 // Match header: void aosl_hal_msleep(uint64_t ms);
 void aosl_hal_msleep(uint64_t ms)
 {
@@ -10,6 +10,12 @@ uint64_t aosl_hal_get_tick_ms(void)
   return (uint64_t)ql_rtos_get_systicks() * 5;
 }
 
+uint64_t aosl_hal_get_tick_us(void)
+{
+  /* no sub millisecond tick source */
+  return aosl_hal_get_tick_ms() * 1000;
+}
+
 uint64_t aosl_hal_get_time_ms(void)
 {
   /* No RTC wall-clock easily available, use monotonic tick */
@@ -9,6 +9,12 @@ uint64_t aosl_hal_get_tick_ms(void)
   return (uint64_t)rtos_get_time();
 }
 
+uint64_t aosl_hal_get_tick_us(void)
+{
+  /* no sub millisecond tick source */
+  return aosl_hal_get_tick_ms() * 1000;
+}
+
 uint64_t aosl_hal_get_time_ms(void)
 {
   return (uint64_t)rtos_get_time();
@@ -13,6 +13,8 @@ int aosl_hal_errno_convert(int errnum)
 			return AOSL_HAL_RET_EINTR;
 		case EINPROGRESS:
 			return AOSL_HAL_RET_EINPROGRESS;
+		case ECONNABORTED:
+			return AOSL_HAL_RET_ECONNABORTED;
 		default:
 			return AOSL_HAL_RET_EHAL;
 	}
@@ -206,6 +206,16 @@ int aosl_hal_sk_set_dscp(aosl_fd_t sockfd, enum aosl_socket_domain domain, uint8
 	return 0;
 }
 
+int aosl_hal_sk_set_reuseport(aosl_fd_t sockfd)
+{
+	/**
+	 * SO_REUSEPORT on BSD lets the sockets share the port, but all the
+	 * connections go to one of them, so there is nothing to balance.
+	 **/
+	(void)sockfd;
+	return AOSL_HAL_RET_EHAL;
+}
+
 int aosl_hal_sk_listen(int sockfd, int backlog)
 {
 	int ret = listen(sockfd, backlog);
@@ -220,7 +230,7 @@ int aosl_hal_sk_listen(int sockfd, int backlog)
 	return 0;
 }
 
-aosl_fd_t aosl_hal_sk_accept(aosl_fd_t sockfd, aosl_sockaddr_t *addr)
+aosl_fd_t aosl_hal_sk_accept(aosl_fd_t sockfd, aosl_sockaddr_t *addr, int *err)
 {
 	struct sockaddr_in6 com_addr = {0};
 	struct sockaddr *n_addr = (struct sockaddr *)&com_addr;
@@ -229,6 +239,7 @@ aosl_fd_t aosl_hal_sk_accept(aosl_fd_t sockfd, aosl_sockaddr_t *addr)
 	if (ret < 0) {
 		int orig_errno = errno;
 		int hal_err = aosl_hal_errno_convert(orig_errno);
+		*err = hal_err;
 		if (hal_err == AOSL_HAL_RET_EHAL) {
 			AOSL_LOG_ERR("accept errno convert: %d -> %d", orig_errno, hal_err);
 		}
@@ -239,6 +250,20 @@ aosl_fd_t aosl_hal_sk_accept(aosl_fd_t sockfd, aosl_sockaddr_t *addr)
 	return (aosl_fd_t)ret;
 }
 
+aosl_fd_t aosl_hal_sk_accept_nb(aosl_fd_t sockfd, aosl_sockaddr_t *addr, int *err)
+{
+	aosl_fd_t fd = aosl_hal_sk_accept(sockfd, addr, err);
+	if (fd < 0)
+		return AOSL_INVALID_FD;
+
+	*err = aosl_hal_sk_set_nonblock(fd);
+	if (*err < 0) {
+		aosl_hal_sk_close(fd);
+		return AOSL_INVALID_FD;
+	}
+	return fd;
+}
+
 int aosl_hal_sk_connect(int sockfd, const aosl_sockaddr_t *addr)
 {
 	struct sockaddr_in6 com_addr = {0};
@@ -25,6 +25,13 @@ uint64_t aosl_hal_get_tick_ms(void)
 	return ns / 1000000;
 }
 
+uint64_t aosl_hal_get_tick_us(void)
+{
+	ensure_timebase_info();
+	uint64_t abs_time = mach_absolute_time();
+	return abs_time * s_timebase_info.numer / s_timebase_info.denom / 1000;
+}
+
 uint64_t aosl_hal_get_time_ms(void)
 {
 	struct timeval tv;
@@ -14,6 +14,17 @@ uint64_t aosl_hal_get_tick_ms(void)
 	return (((uint64_t)ts.tv_sec * (uint64_t)1000) + ts.tv_nsec / 1000000);
 }
 
+uint64_t aosl_hal_get_tick_us(void)
+{
+	struct timespec ts;
+	if (clock_gettime (CLOCK_MONOTONIC, &ts) < 0) {
+		perror ("retrieve the time info");
+		return 0;
+	}
+
+	return (((uint64_t)ts.tv_sec * (uint64_t)1000000) + ts.tv_nsec / 1000);
+}
+
 uint64_t aosl_hal_get_time_ms(void)
 {
 	struct timeval tv;
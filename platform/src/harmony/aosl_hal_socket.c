@@ -1,3 +1,6 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* accept4 */
+#endif
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -189,6 +192,24 @@ int aosl_hal_sk_set_dscp(aosl_fd_t sockfd, enum aosl_socket_domain domain, uint8
 	return 0;
 }
 
+int aosl_hal_sk_set_reuseport(aosl_fd_t sockfd)
+{
+#ifdef SO_REUSEPORT
+	int on = 1;
+	int ret = setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+	if (ret < 0) {
+		int orig_errno = errno;
+		ret = aosl_hal_errno_convert(orig_errno);
+		AOSL_LOG_ERR("setsockopt(SO_REUSEPORT) errno convert: %d -> %d", orig_errno, ret);
+		return ret;
+	}
+	return 0;
+#else
+	(void)sockfd;
+	return AOSL_HAL_RET_EHAL;
+#endif
+}
+
 int aosl_hal_sk_listen(int sockfd, int backlog)
 {
 	int ret = listen(sockfd, backlog);
@@ -203,7 +224,7 @@ int aosl_hal_sk_listen(int sockfd, int backlog)
 	return 0;
 }
 
-aosl_fd_t aosl_hal_sk_accept(aosl_fd_t sockfd, aosl_sockaddr_t *addr)
+aosl_fd_t aosl_hal_sk_accept(aosl_fd_t sockfd, aosl_sockaddr_t *addr, int *err)
 {
 	struct sockaddr_in6 com_addr = {0};
 	struct sockaddr *n_addr = (struct sockaddr *)&com_addr;
@@ -212,6 +233,7 @@ aosl_fd_t aosl_hal_sk_accept(aosl_fd_t sockfd, aosl_sockaddr_t *addr)
 	if (ret < 0) {
 		int orig_errno = errno;
 		int hal_err = aosl_hal_errno_convert(orig_errno);
+		*err = hal_err;
 		if (hal_err == AOSL_HAL_RET_EHAL) {
 			AOSL_LOG_ERR("accept errno convert: %d -> %d", orig_errno, hal_err);
 		}
@@ -222,6 +244,38 @@ aosl_fd_t aosl_hal_sk_accept(aosl_fd_t sockfd, aosl_sockaddr_t *addr)
 	return (aosl_fd_t)ret;
 }
 
+aosl_fd_t aosl_hal_sk_accept_nb(aosl_fd_t sockfd, aosl_sockaddr_t *addr, int *err)
+{
+#if defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+	struct sockaddr_in6 com_addr = {0};
+	struct sockaddr *n_addr = (struct sockaddr *)&com_addr;
+	socklen_t addrlen = sizeof(com_addr);
+	int ret = accept4(sockfd, n_addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (ret < 0) {
+		int orig_errno = errno;
+		int hal_err = aosl_hal_errno_convert(orig_errno);
+		*err = hal_err;
+		if (hal_err == AOSL_HAL_RET_EHAL) {
+			AOSL_LOG_ERR("accept4 errno convert: %d -> %d", orig_errno, hal_err);
+		}
+		return AOSL_INVALID_FD;
+	}
+	conv_addr_to_aosl(n_addr, addr);
+	return (aosl_fd_t)ret;
+#else
+	aosl_fd_t fd = aosl_hal_sk_accept(sockfd, addr, err);
+	if (aosl_fd_invalid(fd))
+		return AOSL_INVALID_FD;
+
+	*err = aosl_hal_sk_set_nonblock(fd);
+	if (*err < 0) {
+		aosl_hal_sk_close(fd);
+		return AOSL_INVALID_FD;
+	}
+	return fd;
+#endif
+}
+
 int aosl_hal_sk_connect(int sockfd, const aosl_sockaddr_t *addr)
 {
 	struct sockaddr_in6 com_addr = {0};
@@ -10,6 +10,12 @@ uint64_t aosl_hal_get_tick_ms(void)
   return (uint64_t)ipro_osal_get_time_ms();
 }
 
+uint64_t aosl_hal_get_tick_us(void)
+{
+  /* no sub millisecond tick source */
+  return aosl_hal_get_tick_ms() * 1000;
+}
+
 uint64_t aosl_hal_get_time_ms(void)
 {
   return (uint64_t)ipro_osal_get_time_ms();
@@ -85,6 +85,7 @@ int aosl_hal_epoll_wait(int epfd, aosl_poll_event_t *evlist, int maxevents, int
 
 	for (int i = 0; i < err; i++) {
 		evlist[i].fd = n_events[i].data.fd;
+		evlist[i].events = 0;
 		if (n_events[i].events & EPOLLIN)
 			evlist[i].events |= AOSL_POLLIN;
 		if (n_events[i].events & EPOLLOUT)
@@ -111,6 +112,7 @@ int aosl_hal_poll(aosl_poll_event_t fds[], int nfds, int timeout_ms)
 	for (int i = 0; i < nfds; i++) {
 		n_fds[i].fd = fds[i].fd;
 		n_fds[i].revents = 0;
+		n_fds[i].events = 0;
 		if (fds[i].events & AOSL_POLLIN)
 			n_fds[i].events |= POLLIN;
 		if (fds[i].events & AOSL_POLLOUT)
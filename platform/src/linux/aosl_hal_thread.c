@@ -6,6 +6,9 @@
 #include <sys/time.h>
 #include <sys/prctl.h>
 #include <sys/errno.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <unistd.h>
 #include <api/aosl_mm.h>
 #include <api/aosl_log.h>
 #include <api/aosl_defs.h>
@@ -357,3 +360,13 @@ int aosl_hal_sem_timedwait(aosl_sem_t sem, intptr_t timeout_ms)
 	}
 	return sem_timedwait((sem_t *)sem, &timeo);
 }
+
+int aosl_hal_futex_wait(volatile int *uaddr, int val)
+{
+	return (int)syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+int aosl_hal_futex_wake(volatile int *uaddr, int count)
+{
+	return (int)syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
@@ -7,6 +7,7 @@
 
 #define AOSL_HAL_HAVE_COND 1
 #define AOSL_HAL_HAVE_SEM 1
+#define AOSL_HAL_HAVE_FUTEX 1
 
 #define AOSL_HAL_HAVE_HWRNG 1
 
@@ -156,13 +156,13 @@ int aosl_hal_sk_listen(int sockfd, int backlog)
   return 0;
 }
 
-aosl_fd_t aosl_hal_sk_accept(aosl_fd_t sockfd, aosl_sockaddr_t *addr)
+aosl_fd_t aosl_hal_sk_accept(aosl_fd_t sockfd, aosl_sockaddr_t *addr, int *err)
 {
   struct sci_sockaddrext ext = {0};
   int addr_len = sizeof(ext);
   int ret = sci_sock_accept(sockfd, &ext, &addr_len);
   if (ret < 0) {
-    (void)aosl_hal_errno_convert(sci_sock_errno(sockfd));
+    *err = aosl_hal_errno_convert(sci_sock_errno(sockfd));
     return AOSL_INVALID_FD;
   }
   if (addr) {
@@ -171,6 +171,20 @@ aosl_fd_t aosl_hal_sk_accept(aosl_fd_t sockfd, aosl_sockaddr_t *addr)
   return (aosl_fd_t)ret;
 }
 
+aosl_fd_t aosl_hal_sk_accept_nb(aosl_fd_t sockfd, aosl_sockaddr_t *addr, int *err)
+{
+  aosl_fd_t fd = aosl_hal_sk_accept(sockfd, addr, err);
+  if (fd < 0)
+    return AOSL_INVALID_FD;
+
+  *err = aosl_hal_sk_set_nonblock(fd);
+  if (*err < 0) {
+    aosl_hal_sk_close(fd);
+    return AOSL_INVALID_FD;
+  }
+  return fd;
+}
+
 int aosl_hal_sk_connect(int sockfd, const aosl_sockaddr_t *addr)
 {
   struct sci_sockaddrext ext = {0};
@@ -292,6 +306,12 @@ int aosl_hal_sk_set_dscp(aosl_fd_t sockfd, enum aosl_socket_domain domain,
   return 0;
 }
 
+int aosl_hal_sk_set_reuseport(aosl_fd_t sockfd)
+{
+  (void)sockfd;
+  return AOSL_HAL_RET_EHAL;
+}
+
 int aosl_hal_gethostbyname(const char *hostname, aosl_sockaddr_t *addrs, int addr_count)
 {
   struct sci_hostent *hostent;
@@ -171,6 +171,12 @@ int aosl_hal_sk_set_dscp(aosl_fd_t sockfd, enum aosl_socket_domain domain, uint8
 	return 0;
 }
 
+int aosl_hal_sk_set_reuseport(aosl_fd_t sockfd)
+{
+	(void)sockfd;
+	return AOSL_HAL_RET_EHAL;
+}
+
 int aosl_hal_sk_listen(int sockfd, int backlog)
 {
   int ret = listen(sockfd, backlog);
@@ -185,7 +191,7 @@ int aosl_hal_sk_listen(int sockfd, int backlog)
   return 0;
 }
 
-int aosl_hal_sk_accept(int sockfd, aosl_sockaddr_t *addr)
+int aosl_hal_sk_accept(int sockfd, aosl_sockaddr_t *addr, int *err)
 {
 #if LWIP_IPV6
   struct sockaddr_in6 com_addr = {0};
@@ -197,17 +203,31 @@ int aosl_hal_sk_accept(int sockfd, aosl_sockaddr_t *addr)
   int ret = accept(sockfd, n_addr, &addrlen);
   if (ret < 0) {
     int orig_errno = errno;
-    ret = aosl_hal_errno_convert(orig_errno);
-    if (ret == AOSL_HAL_RET_EHAL) {
-      AOSL_LOG_ERR("accept errno convert: %d -> %d", orig_errno, ret);
+    *err = aosl_hal_errno_convert(orig_errno);
+    if (*err == AOSL_HAL_RET_EHAL) {
+      AOSL_LOG_ERR("accept errno convert: %d -> %d", orig_errno, *err);
     }
-    return ret;
+    return AOSL_INVALID_FD;
   } else {
     conv_addr_to_aosl(n_addr, addr);
   }
   return ret;
 }
 
+aosl_fd_t aosl_hal_sk_accept_nb(aosl_fd_t sockfd, aosl_sockaddr_t *addr, int *err)
+{
+  aosl_fd_t fd = aosl_hal_sk_accept(sockfd, addr, err);
+  if (fd < 0)
+    return AOSL_INVALID_FD;
+
+  *err = aosl_hal_sk_set_nonblock(fd);
+  if (*err < 0) {
+    aosl_hal_sk_close(fd);
+    return AOSL_INVALID_FD;
+  }
+  return fd;
+}
+
 int aosl_hal_sk_connect(int sockfd, const aosl_sockaddr_t *addr)
 {
 #if LWIP_IPV6
@@ -7,6 +7,12 @@ uint64_t aosl_hal_get_tick_ms (void)
 	return os_mseconds();
 }
 
+uint64_t aosl_hal_get_tick_us (void)
+{
+	/* no sub millisecond tick source */
+	return aosl_hal_get_tick_ms () * 1000;
+}
+
 uint64_t aosl_hal_get_time_ms (void)
 {
 	struct timeval tv;
@@ -19,6 +19,9 @@ int aosl_hal_errno_convert(int errnum)
     case WSAEINPROGRESS:
     case WSAEALREADY:
         return AOSL_HAL_RET_EINPROGRESS;
+    case ECONNABORTED:
+    case WSAECONNABORTED:
+        return AOSL_HAL_RET_ECONNABORTED;
     default:
         return AOSL_HAL_RET_EHAL;
     }
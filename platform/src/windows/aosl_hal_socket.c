@@ -211,6 +211,12 @@ int aosl_hal_sk_set_dscp(aosl_fd_t sockfd, enum aosl_socket_domain domain, uint8
   return 0;
 }
 
+int aosl_hal_sk_set_reuseport(aosl_fd_t sockfd) {
+  /* no load balancing port reuse on windows */
+  (void)sockfd;
+  return AOSL_HAL_RET_EHAL;
+}
+
 int aosl_hal_sk_listen(aosl_fd_t sockfd, int backlog) {
   SOCKET sock;
 
@@ -226,7 +232,7 @@ int aosl_hal_sk_listen(aosl_fd_t sockfd, int backlog) {
   return 0;
 }
 
-aosl_fd_t aosl_hal_sk_accept(aosl_fd_t sockfd, aosl_sockaddr_t *addr) {
+aosl_fd_t aosl_hal_sk_accept(aosl_fd_t sockfd, aosl_sockaddr_t *addr, int *err) {
   struct sockaddr_storage storage;
   int addrlen = (int)sizeof(storage);
   SOCKET sk;
@@ -234,12 +240,14 @@ aosl_fd_t aosl_hal_sk_accept(aosl_fd_t sockfd, aosl_sockaddr_t *addr) {
 
   memset(&storage, 0, sizeof(storage));
   if (aosl_fd_invalid(sockfd)) {
+    *err = AOSL_HAL_RET_EHAL;
     return AOSL_INVALID_FD;
   }
   listen_sock = (SOCKET)sockfd;
 
   sk = accept(listen_sock, (struct sockaddr *)&storage, &addrlen);
   if (sk == INVALID_SOCKET) {
+    *err = convert_socket_error(WSAGetLastError());
     return AOSL_INVALID_FD;
   }
 
@@ -247,6 +255,20 @@ aosl_fd_t aosl_hal_sk_accept(aosl_fd_t sockfd, aosl_sockaddr_t *addr) {
   return (aosl_fd_t)sk;
 }
 
+aosl_fd_t aosl_hal_sk_accept_nb(aosl_fd_t sockfd, aosl_sockaddr_t *addr, int *err) {
+  aosl_fd_t fd = aosl_hal_sk_accept(sockfd, addr, err);
+  if (aosl_fd_invalid(fd)) {
+    return AOSL_INVALID_FD;
+  }
+
+  *err = aosl_hal_sk_set_nonblock(fd);
+  if (*err < 0) {
+    aosl_hal_sk_close(fd);
+    return AOSL_INVALID_FD;
+  }
+  return fd;
+}
+
 int aosl_hal_sk_connect(aosl_fd_t sockfd, const aosl_sockaddr_t *addr) {
   struct sockaddr_storage storage;
   struct sockaddr *os_addr = (struct sockaddr *)&storage;
@@ -11,6 +11,18 @@ uint64_t aosl_hal_get_tick_ms(void)
     return (uint64_t)GetTickCount64();
 }
 
+uint64_t aosl_hal_get_tick_us(void)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+
+    QueryPerformanceCounter(&now);
+    return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000 + (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+}
+
 uint64_t aosl_hal_get_time_ms(void)
 {
     FILETIME ft;
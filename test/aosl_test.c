@@ -26,6 +26,10 @@
 #include "api/aosl_socket.h"
 #include "api/aosl_mpq_net.h"
 #include "api/aosl_thread.h"
+#include "api/aosl_psb.h"
+#include "api/aosl_marshalling.h"
+#include "api/aosl_hash.h"
+#include "api/aosl_rbtree.h"
 
 #define UNUSED(expr) (void)(expr)
 #define CAST_INT64(val)  ((long long)val)
@@ -2330,6 +2334,10 @@ static void test_mpq_tcp_server_fini(void *arg)
 }
 
 // TCP client init/fini
+#define TCP_BURST_CNT 32
+static void test_mpq_tcp_client_send_func(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc,
+                                          uintptr_t argv[]);
+
 static int test_mpq_tcp_client_init(void *arg)
 {
   UNUSED(arg);
@@ -2352,6 +2360,12 @@ static int test_mpq_tcp_client_init(void *arg)
   EXPECT_EQ(ret, 0);
   
   mpq_client_res.sk = fd;
+
+  // The connection is not ready yet, so these packets are queued and merged in the write queue
+  for (int i = 0; i < TCP_BURST_CNT; i++) {
+    uintptr_t send_arg = (uintptr_t)&mpq_client_res;
+    test_mpq_tcp_client_send_func(NULL, NULL, 1, &send_arg);
+  }
   return 0;
 }
 
@@ -2415,7 +2429,7 @@ static int aosl_test_mpq_api_tcp(void)
   // client async send msg
   int cnt_cycs = 20;
   int cnt_pers = 50;
-  int cnt_alls = cnt_cycs * cnt_pers * 2;
+  int cnt_alls = cnt_cycs * cnt_pers * 2 + TCP_BURST_CNT;
   for (int i = 0; i < cnt_cycs; i++) {
     for (int j = 0; j < cnt_pers; j++) {
       aosl_mpq_queue(q_client, AOSL_MPQ_INVALID, AOSL_REF_INVALID, "test_mpq_tcp_client_send_func",
@@ -2446,6 +2460,1076 @@ static int aosl_test_mpq_api_tcp(void)
   return 0;
 }
 
+// Sharded listeners: one listening socket on each queue of a pool
+#define TEST_MPQP_LISTEN_QS 4
+#define TEST_MPQP_LISTEN_CONNS 64
+
+struct test_mpqp_listen_res {
+  aosl_atomic_t accepted;
+  aosl_atomic_t qids[TEST_MPQP_LISTEN_QS]; // the accepting queues, -1 for a free slot
+};
+
+static void test_mpqp_on_accepted(aosl_accept_data_t *accept_data, size_t len, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(len);
+  UNUSED(argc);
+  struct test_mpqp_listen_res *res = (struct test_mpqp_listen_res *)argv[0];
+  intptr_t this_q = (intptr_t)aosl_mpq_this();
+  int i;
+
+  for (i = 0; i < TEST_MPQP_LISTEN_QS; i++) {
+    intptr_t old = aosl_atomic_cmpxchg(&res->qids[i], -1, this_q);
+    if (old == -1 || old == this_q)
+      break;
+  }
+
+  aosl_hal_sk_close(accept_data->newsk);
+  aosl_atomic_inc(&res->accepted);
+}
+
+static int aosl_test_mpqp_listen(void)
+{
+  static struct test_mpqp_listen_res res;
+  aosl_fd_t fds[TEST_MPQP_LISTEN_QS];
+  aosl_fd_t fd;
+  aosl_sockaddr_t addr = { 0 };
+  aosl_mpqp_t qp;
+  aosl_ts_t start_ts;
+  int count, used, i;
+
+  memset(&res, 0, sizeof(res));
+  for (i = 0; i < TEST_MPQP_LISTEN_QS; i++)
+    aosl_atomic_set(&res.qids[i], -1);
+
+  qp = aosl_mpqp_create(TEST_MPQP_LISTEN_QS, AOSL_THRD_PRI_DEFAULT, 0, 1000, -1, 0, "listen", NULL, NULL, NULL);
+  CHECK(qp != NULL);
+
+  addr.sa_family = AOSL_AF_INET;
+  aosl_inet_addr_from_string(&addr.sin_addr, "127.0.0.1");
+  count = aosl_mpqp_listen(qp, &addr, 64, fds, TEST_MPQP_LISTEN_QS, test_mpqp_on_accepted, mpq_tcp_server_on_event, 1, &res);
+  CHECK(count >= 1 && count <= TEST_MPQP_LISTEN_QS);
+  LOG_FMT("mpqp listen got %d listeners", count);
+
+  CHECK(aosl_hal_sk_get_sockname(fds[0], &addr) == 0);
+  for (i = 0; i < count; i++) {
+    aosl_sockaddr_t shard_addr;
+    CHECK(aosl_hal_sk_get_sockname(fds[i], &shard_addr) == 0);
+    EXPECT_EQ(shard_addr.sa_port, addr.sa_port);
+  }
+
+  for (i = 0; i < TEST_MPQP_LISTEN_CONNS; i++) {
+    fd = aosl_socket(AOSL_AF_INET, AOSL_SOCK_STREAM, AOSL_IPPROTO_TCP);
+    CHECK(!aosl_fd_invalid(fd));
+    EXPECT_EQ(aosl_hal_sk_connect(fd, &addr), 0);
+    aosl_hal_sk_close(fd);
+  }
+
+  start_ts = aosl_tick_ms();
+  while (aosl_atomic_read(&res.accepted) < TEST_MPQP_LISTEN_CONNS && (aosl_tick_ms() - start_ts) < 5000)
+    aosl_msleep(10);
+
+  EXPECT_EQ(aosl_atomic_read(&res.accepted), TEST_MPQP_LISTEN_CONNS);
+
+  // the connections are balanced to all the listeners, and accepted on their own queues
+  for (used = 0; used < TEST_MPQP_LISTEN_QS; used++) {
+    if (aosl_atomic_read(&res.qids[used]) == -1)
+      break;
+  }
+  LOG_FMT("mpqp listen accepted on %d queues", used);
+  EXPECT_EQ(used, count);
+
+  EXPECT_EQ(aosl_mpqp_listen_close(qp, fds, count), 0);
+  aosl_mpqp_destroy(qp, 1);
+  LOG_FMT("mpqp listen test success");
+  return 0;
+}
+
+// Batched accepting with the accepted sockets placed onto the queues of a pool
+#define TEST_LISTEN_OPTS_QS 4
+#define TEST_LISTEN_OPTS_CONNS 32
+
+struct test_listen_opts_res {
+  aosl_mpq_t listen_q;
+  aosl_atomic_t accepted;
+  aosl_atomic_t on_listen_q; // accepted_f invoked on the listening queue
+  aosl_atomic_t bytes;
+  aosl_atomic_t qids[TEST_LISTEN_OPTS_QS]; // the placed queues, -1 for a free slot
+};
+
+static void test_listen_opts_on_accepted(aosl_accept_data_t *accept_data, size_t len, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(accept_data);
+  UNUSED(len);
+  UNUSED(argc);
+  struct test_listen_opts_res *res = (struct test_listen_opts_res *)argv[0];
+  intptr_t this_q = (intptr_t)aosl_mpq_this();
+  int i;
+
+  if (aosl_mpq_this() == res->listen_q)
+    aosl_atomic_inc(&res->on_listen_q);
+
+  for (i = 0; i < TEST_LISTEN_OPTS_QS; i++) {
+    intptr_t old = aosl_atomic_cmpxchg(&res->qids[i], -1, this_q);
+    if (old == -1 || old == this_q)
+      break;
+  }
+
+  // the socket is owned by the target queue now
+  aosl_atomic_inc(&res->accepted);
+}
+
+static void test_listen_opts_on_data(void *data, size_t len, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(data);
+  UNUSED(argc);
+  struct test_listen_opts_res *res = (struct test_listen_opts_res *)argv[0];
+  aosl_atomic_add_return((intptr_t)len, &res->bytes);
+}
+
+static int aosl_test_mpq_listen_opts(void)
+{
+  static struct test_listen_opts_res res;
+  aosl_fd_t clients[TEST_LISTEN_OPTS_CONNS];
+  aosl_listen_opts_t opts = { 0 };
+  aosl_sockaddr_t addr = { 0 };
+  aosl_fd_t fd;
+  aosl_mpqp_t qp;
+  aosl_ts_t start_ts;
+  int used, i;
+
+  memset(&res, 0, sizeof(res));
+  for (i = 0; i < TEST_LISTEN_OPTS_QS; i++)
+    aosl_atomic_set(&res.qids[i], -1);
+
+  // the placed sockets live on the pool queues, so no idle shrinking
+  qp = aosl_mpqp_create(TEST_LISTEN_OPTS_QS, AOSL_THRD_PRI_DEFAULT, 0, 1000, -1, 0, "placed", NULL, NULL, NULL);
+  CHECK(qp != NULL);
+  res.listen_q = aosl_mpq_create(AOSL_THRD_PRI_DEFAULT, 0, 1000, "listen-opts", NULL, NULL, NULL);
+  CHECK(!aosl_mpq_invalid(res.listen_q));
+
+  addr.sa_family = AOSL_AF_INET;
+  aosl_inet_addr_from_string(&addr.sin_addr, "127.0.0.1");
+  fd = aosl_socket(AOSL_AF_INET, AOSL_SOCK_STREAM, AOSL_IPPROTO_TCP);
+  CHECK(!aosl_fd_invalid(fd));
+  CHECK(aosl_bind(fd, &addr) == 0);
+  CHECK(aosl_hal_sk_get_sockname(fd, &addr) == 0);
+
+  // placing needs the data callback of the placed sockets
+  opts.batch = 16;
+  opts.place_qp = qp;
+  opts.max_pkt_size = 1024;
+  CHECK(aosl_mpq_listen_opts_on_q(res.listen_q, fd, 64, &opts, test_listen_opts_on_accepted,
+                                  mpq_tcp_server_on_event, 1, &res) < 0);
+
+  opts.data_f = test_listen_opts_on_data;
+  CHECK(aosl_mpq_listen_opts_on_q(res.listen_q, fd, 64, &opts, test_listen_opts_on_accepted,
+                                  mpq_tcp_server_on_event, 1, &res) == 0);
+
+  for (i = 0; i < TEST_LISTEN_OPTS_CONNS; i++) {
+    clients[i] = aosl_socket(AOSL_AF_INET, AOSL_SOCK_STREAM, AOSL_IPPROTO_TCP);
+    CHECK(!aosl_fd_invalid(clients[i]));
+    EXPECT_EQ(aosl_hal_sk_connect(clients[i], &addr), 0);
+    EXPECT_EQ(aosl_hal_sk_send(clients[i], "ping", 4, 0), 4);
+  }
+
+  start_ts = aosl_tick_ms();
+  while ((aosl_atomic_read(&res.accepted) < TEST_LISTEN_OPTS_CONNS ||
+          aosl_atomic_read(&res.bytes) < TEST_LISTEN_OPTS_CONNS * 4) && (aosl_tick_ms() - start_ts) < 5000)
+    aosl_msleep(10);
+
+  EXPECT_EQ(aosl_atomic_read(&res.accepted), TEST_LISTEN_OPTS_CONNS);
+  EXPECT_EQ(aosl_atomic_read(&res.bytes), TEST_LISTEN_OPTS_CONNS * 4);
+  EXPECT_EQ(aosl_atomic_read(&res.on_listen_q), 0);
+
+  // the least loaded placing spreads the sockets to all the pool queues
+  for (used = 0; used < TEST_LISTEN_OPTS_QS; used++) {
+    if (aosl_atomic_read(&res.qids[used]) == -1)
+      break;
+  }
+  LOG_FMT("listen opts placed on %d queues", used);
+  EXPECT_EQ(used, TEST_LISTEN_OPTS_QS);
+
+  // the listening fd is closed with its queue, the placed ones with the pool
+  aosl_mpq_destroy_wait(res.listen_q);
+  aosl_mpqp_destroy(qp, 1);
+  for (i = 0; i < TEST_LISTEN_OPTS_CONNS; i++)
+    aosl_hal_sk_close(clients[i]);
+
+  LOG_FMT("mpq listen opts test success");
+  return 0;
+}
+
+static void test_mpq_flags_count_func(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc,
+                                      uintptr_t argv[])
+{
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+  (*(int *)argv[0])++;
+}
+
+static int aosl_test_mpq_flags(void)
+{
+  int flags = AOSL_MPQ_FLAG_ADAPTIVE_EVENTS | AOSL_MPQ_FLAG_EVENTS(1) | AOSL_MPQ_FLAG_BUSY_POLL(2);
+  int count = 0;
+  int i;
+
+  // the reserved high bits must be rejected
+  aosl_mpq_t q = aosl_mpq_create_flags(0x10000, AOSL_THRD_PRI_DEFAULT, 0, 10000, "flags-test", NULL, NULL, NULL);
+  CHECK(aosl_mpq_invalid(q));
+
+  q = aosl_mpq_create_flags(flags, AOSL_THRD_PRI_DEFAULT, 0, 10000, "flags-test", NULL, NULL, NULL);
+  CHECK(!aosl_mpq_invalid(q));
+  EXPECT_EQ(aosl_mpq_get_flags(q), flags);
+
+  for (i = 0; i < 1000; i++) {
+    aosl_mpq_queue(q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, "test_mpq_flags_count_func",
+                   test_mpq_flags_count_func, 1, &count);
+    if (i % 100 == 0)
+      aosl_msleep(1);
+  }
+
+  // a sync call after the spinning budget ran out must still wake the queue up
+  aosl_msleep(10);
+  CHECK(aosl_mpq_call(q, AOSL_REF_INVALID, "test_mpq_flags_count_func",
+                      test_mpq_flags_count_func, 1, &count) == 0);
+  EXPECT_EQ(count, 1001);
+
+  aosl_mpq_destroy_wait(q);
+  LOG_FMT("mpq flags test success");
+  return 0;
+}
+
+// Recycling the parked queues
+struct test_mpq_park_res {
+  aosl_tls_key_t key;
+  int lives;
+  int tls_leaked;
+  aosl_thread_t thrds[2];
+};
+
+static int test_mpq_park_init(void *arg)
+{
+  struct test_mpq_park_res *res = (struct test_mpq_park_res *)arg;
+
+  // the per thread data of the last life must be gone
+  if (aosl_tls_key_get(res->key) != NULL)
+    res->tls_leaked++;
+
+  aosl_tls_key_set(res->key, res);
+  if (res->lives < 2)
+    res->thrds[res->lives] = aosl_hal_thread_self();
+  res->lives++;
+  return 0;
+}
+
+static int aosl_test_mpq_park(void)
+{
+  static struct test_mpq_park_res res;
+  int old_max = aosl_mpq_set_park_max(-1);
+  int count = 0;
+  aosl_mpq_t q1, q2;
+
+  memset(&res, 0, sizeof(res));
+  CHECK(aosl_tls_key_create(&res.key) == 0);
+  aosl_mpq_set_park_max(4);
+
+  q1 = aosl_mpq_create(AOSL_THRD_PRI_DEFAULT, 0, 1000, "park-1", test_mpq_park_init, NULL, &res);
+  CHECK(!aosl_mpq_invalid(q1));
+  CHECK(aosl_mpq_call(q1, AOSL_REF_INVALID, "test_mpq_flags_count_func", test_mpq_flags_count_func, 1, &count) == 0);
+  aosl_mpq_destroy_wait(q1);
+
+  // the same priority and stack size takes the parked thread over
+  q2 = aosl_mpq_create(AOSL_THRD_PRI_DEFAULT, 0, 1000, "park-2", test_mpq_park_init, NULL, &res);
+  CHECK(!aosl_mpq_invalid(q2));
+  CHECK(q2 != q1);
+  CHECK(aosl_mpq_call(q1, AOSL_REF_INVALID, "test_mpq_flags_count_func", test_mpq_flags_count_func, 1, &count) < 0);
+  CHECK(aosl_mpq_call(q2, AOSL_REF_INVALID, "test_mpq_flags_count_func", test_mpq_flags_count_func, 1, &count) == 0);
+  EXPECT_EQ(res.lives, 2);
+  EXPECT_EQ(res.thrds[1], res.thrds[0]);
+  EXPECT_EQ(res.tls_leaked, 0);
+  EXPECT_EQ(count, 2);
+  aosl_mpq_destroy_wait(q2);
+
+  EXPECT_EQ(aosl_mpq_set_park_max(old_max), 4);
+  aosl_tls_key_delete(res.key);
+  LOG_FMT("mpq park test success");
+  return 0;
+}
+
+static void test_mpq_stats_timer_func(aosl_timer_t timer_id, const aosl_ts_t *now_p, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(timer_id);
+  UNUSED(now_p);
+  UNUSED(argc);
+  (*(int *)argv[0])++;
+}
+
+static int aosl_test_mpq_stats(void)
+{
+  aosl_mpq_stats_t stats;
+  aosl_timer_t timer;
+  int count = 0;
+  int fired = 0;
+  int i;
+
+  aosl_mpq_t q = aosl_mpq_create(AOSL_THRD_PRI_DEFAULT, 0, 10000, "stats-test", NULL, NULL, NULL);
+  CHECK(!aosl_mpq_invalid(q));
+
+  timer = aosl_mpq_set_oneshot_timer_on_q(q, aosl_tick_now(), test_mpq_stats_timer_func, NULL, 1, &fired);
+  CHECK(!aosl_mpq_timer_invalid(timer));
+  for (i = 0; i < 100; i++)
+    aosl_mpq_queue(q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, "test_mpq_stats_f", test_mpq_flags_count_func, 1, &count);
+
+  CHECK(aosl_mpq_call(q, AOSL_REF_INVALID, "test_mpq_stats_f", test_mpq_flags_count_func, 1, &count) == 0);
+  // the stats of a sync call are recorded just after the caller was woken up
+  for (i = 0; i < 100; i++) {
+    CHECK(aosl_mpq_stats_get(q, &stats) == 0);
+    if (fired != 0 && stats.funcs >= 101)
+      break;
+    aosl_msleep(1);
+  }
+
+  EXPECT_EQ(fired, 1);
+  EXPECT_EQ(stats.timers, 1);
+  CHECK(stats.funcs >= 101);
+  CHECK(stats.depth_max >= 1);
+  CHECK(stats.funcs_stats_count >= 1);
+  for (i = 0; i < (int)stats.funcs_stats_count; i++) {
+    if (strcmp(stats.funcs_stats[i].f_name, "test_mpq_stats_f") == 0)
+      break;
+  }
+  CHECK(i < (int)stats.funcs_stats_count);
+  EXPECT_EQ(stats.funcs_stats[i].calls, 101);
+
+  // the reset is done by the queue thread before it runs the next function
+  CHECK(aosl_mpq_stats_reset(q) == 0);
+  CHECK(aosl_mpq_call(q, AOSL_REF_INVALID, "test_mpq_stats_f", test_mpq_flags_count_func, 1, &count) == 0);
+  for (i = 0; i < 100; i++) {
+    CHECK(aosl_mpq_stats_get(q, &stats) == 0);
+    if (stats.funcs >= 1)
+      break;
+    aosl_msleep(1);
+  }
+
+  EXPECT_EQ(stats.funcs, 1);
+  EXPECT_EQ(stats.timers, 0);
+  EXPECT_EQ(stats.funcs_stats_count, 1);
+
+  aosl_mpq_kill_timer(timer);
+  aosl_mpq_destroy_wait(q);
+  LOG_FMT("mpq stats test success");
+  return 0;
+}
+
+struct test_mpq_pri_res {
+  volatile int blocked;
+  volatile int release;
+  int order[16];
+  int count;
+};
+
+static void test_mpq_pri_block_func(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc,
+                                    uintptr_t argv[])
+{
+  struct test_mpq_pri_res *res = (struct test_mpq_pri_res *)argv[0];
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+  res->blocked = 1;
+  while (!res->release)
+    aosl_msleep(1);
+}
+
+static void test_mpq_pri_record_func(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc,
+                                     uintptr_t argv[])
+{
+  struct test_mpq_pri_res *res = (struct test_mpq_pri_res *)argv[0];
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+  res->order[res->count++] = (int)argv[1];
+}
+
+// block the queue, then queue 3 functions to both the low and urgent lanes
+static int test_mpq_pri_run(aosl_mpq_t q, struct test_mpq_pri_res *res)
+{
+  int i;
+
+  memset(res, 0, sizeof *res);
+  CHECK(aosl_mpq_queue(q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, "test_mpq_pri_block_func", test_mpq_pri_block_func, 1,
+                       res) == 0);
+  while (!res->blocked)
+    aosl_msleep(1);
+
+  for (i = 0; i < 3; i++) {
+    CHECK(aosl_mpq_queue_pri(q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, AOSL_MPQ_PRI_LOW, "test_mpq_pri_record_func",
+                             test_mpq_pri_record_func, 2, res, AOSL_MPQ_PRI_LOW) == 0);
+  }
+
+  for (i = 0; i < 3; i++) {
+    CHECK(aosl_mpq_queue_pri(q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, AOSL_MPQ_PRI_URGENT, "test_mpq_pri_record_func",
+                             test_mpq_pri_record_func, 2, res, AOSL_MPQ_PRI_URGENT) == 0);
+  }
+
+  EXPECT_EQ(aosl_mpq_queued_count_pri(q, AOSL_MPQ_PRI_LOW), 3);
+  EXPECT_EQ(aosl_mpq_queued_count_pri(q, AOSL_MPQ_PRI_URGENT), 3);
+  EXPECT_EQ(aosl_mpq_queued_count_pri(q, AOSL_MPQ_PRI_NORMAL), 0);
+  EXPECT_EQ(aosl_mpq_queued_count(q), 7);
+
+  res->release = 1;
+  CHECK(aosl_mpq_call_pri(q, AOSL_REF_INVALID, AOSL_MPQ_PRI_LOW, "test_mpq_pri_record_func", test_mpq_pri_record_func,
+                          2, res, AOSL_MPQ_PRI_COUNT) == 0);
+  EXPECT_EQ(res->count, 7);
+  return 0;
+}
+
+static int aosl_test_mpq_pri(void)
+{
+  const int even_weights[AOSL_MPQ_PRI_COUNT] = {1, 1, 1, 1};
+  const int bad_weights[AOSL_MPQ_PRI_COUNT] = {1, 0, 1, 1};
+  struct test_mpq_pri_res res;
+
+  aosl_mpq_t q = aosl_mpq_create(AOSL_THRD_PRI_DEFAULT, 0, 10000, "pri-test", NULL, NULL, NULL);
+  CHECK(!aosl_mpq_invalid(q));
+  CHECK(aosl_mpq_queue_pri(q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, AOSL_MPQ_PRI_COUNT, "test_mpq_pri_record_func",
+                           test_mpq_pri_record_func, 2, &res, 0) < 0);
+  CHECK(aosl_mpq_set_pri_weights(q, bad_weights) < 0);
+
+  // the urgent lane is served first with the default weights
+  CHECK(test_mpq_pri_run(q, &res) == 0);
+  EXPECT_EQ(res.order[0], AOSL_MPQ_PRI_URGENT);
+  EXPECT_EQ(res.order[2], AOSL_MPQ_PRI_URGENT);
+  EXPECT_EQ(res.order[3], AOSL_MPQ_PRI_LOW);
+
+  // the lanes take turns with even weights
+  CHECK(aosl_mpq_set_pri_weights(q, even_weights) == 0);
+  CHECK(test_mpq_pri_run(q, &res) == 0);
+  EXPECT_EQ(res.order[0], AOSL_MPQ_PRI_URGENT);
+  EXPECT_EQ(res.order[1], AOSL_MPQ_PRI_LOW);
+  EXPECT_EQ(res.order[2], AOSL_MPQ_PRI_URGENT);
+  EXPECT_EQ(res.order[3], AOSL_MPQ_PRI_LOW);
+
+  aosl_mpq_destroy_wait(q);
+  LOG_FMT("mpq pri test success");
+  return 0;
+}
+
+static int aosl_test_mpq_budget(void)
+{
+  struct test_mpq_pri_res res;
+  aosl_mpq_stats_t stats;
+  int count = 0;
+  int i;
+
+  aosl_mpq_t q = aosl_mpq_create(AOSL_THRD_PRI_DEFAULT, 0, 10000, "budget-test", NULL, NULL, NULL);
+  CHECK(!aosl_mpq_invalid(q));
+  CHECK(aosl_mpq_set_budget(q, -1, 0, 0) < 0);
+  CHECK(aosl_mpq_set_budget(q, 10, 1000, 16) == 0);
+
+  memset(&res, 0, sizeof res);
+  CHECK(aosl_mpq_queue(q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, "test_mpq_pri_block_func", test_mpq_pri_block_func, 1,
+                       &res) == 0);
+  while (!res.blocked)
+    aosl_msleep(1);
+
+  for (i = 0; i < 100; i++)
+    aosl_mpq_queue(q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, "test_mpq_budget_f", test_mpq_flags_count_func, 1, &count);
+
+  // the 100 functions queued while blocked take more than one iteration
+  res.release = 1;
+  CHECK(aosl_mpq_call(q, AOSL_REF_INVALID, "test_mpq_budget_f", test_mpq_flags_count_func, 1, &count) == 0);
+  EXPECT_EQ(count, 101);
+  CHECK(aosl_mpq_stats_get(q, &stats) == 0);
+  CHECK(stats.budget_hits[AOSL_MPQ_SRC_FUNCS] >= 1);
+
+  aosl_mpq_destroy_wait(q);
+  LOG_FMT("mpq budget test success");
+  return 0;
+}
+
+static void test_mpq_deadline_func(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(queued_ts_p);
+  UNUSED(argc);
+  if (aosl_is_free_only(robj)) {
+    (*(int *)argv[1])++;
+  } else {
+    (*(int *)argv[0])++;
+  }
+}
+
+static int aosl_test_mpq_deadline(void)
+{
+  struct test_mpq_pri_res res;
+  aosl_mpq_stats_t stats;
+  int ran = 0;
+  int freed = 0;
+  int i;
+
+  aosl_mpq_t q = aosl_mpq_create(AOSL_THRD_PRI_DEFAULT, 0, 10000, "deadline-test", NULL, NULL, NULL);
+  CHECK(!aosl_mpq_invalid(q));
+
+  memset(&res, 0, sizeof res);
+  CHECK(aosl_mpq_queue(q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, "test_mpq_pri_block_func", test_mpq_pri_block_func, 1,
+                       &res) == 0);
+  while (!res.blocked)
+    aosl_msleep(1);
+
+  for (i = 0; i < 3; i++) {
+    CHECK(aosl_mpq_queue_deadline(q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, aosl_tick_now() + 5, "test_mpq_deadline_func",
+                                  test_mpq_deadline_func, 2, &ran, &freed) == 0);
+  }
+
+  CHECK(aosl_mpq_queue_deadline(q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, aosl_tick_now() + 60000,
+                                "test_mpq_deadline_func", test_mpq_deadline_func, 2, &ran, &freed) == 0);
+
+  // the 3 functions expire while the queue is blocked
+  aosl_msleep(20);
+  res.release = 1;
+  CHECK(aosl_mpq_call(q, AOSL_REF_INVALID, "test_mpq_deadline_func", test_mpq_deadline_func, 2, &ran, &freed) == 0);
+  EXPECT_EQ(ran, 2);
+  EXPECT_EQ(freed, 3);
+  CHECK(aosl_mpq_stats_get(q, &stats) == 0);
+  EXPECT_EQ(stats.funcs_expired, 3);
+
+  aosl_mpq_destroy_wait(q);
+  LOG_FMT("mpq deadline test success");
+  return 0;
+}
+
+struct test_mpq_coalesce_res {
+  int ran;
+  int freed;
+  int value;
+};
+
+static void test_mpq_coalesce_func(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  struct test_mpq_coalesce_res *res = (struct test_mpq_coalesce_res *)argv[0];
+  UNUSED(queued_ts_p);
+  UNUSED(argc);
+  if (aosl_is_free_only(robj)) {
+    res->freed++;
+  } else {
+    res->ran++;
+    res->value = (int)argv[1];
+  }
+}
+
+static int aosl_test_mpq_coalesce(void)
+{
+  struct test_mpq_pri_res block;
+  struct test_mpq_coalesce_res res;
+  aosl_mpq_stats_t stats;
+  int other_ran = 0;
+  int other_freed = 0;
+  int i;
+
+  aosl_mpq_t q = aosl_mpq_create(AOSL_THRD_PRI_DEFAULT, 0, 10000, "coalesce-test", NULL, NULL, NULL);
+  CHECK(!aosl_mpq_invalid(q));
+
+  memset(&block, 0, sizeof block);
+  memset(&res, 0, sizeof res);
+  CHECK(aosl_mpq_queue(q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, "test_mpq_pri_block_func", test_mpq_pri_block_func, 1,
+                       &block) == 0);
+  while (!block.blocked)
+    aosl_msleep(1);
+
+  // the same function replaces the args of the pending one in place
+  for (i = 1; i <= 5; i++) {
+    CHECK(aosl_mpq_queue_coalesce(q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, 1, "test_mpq_coalesce_func",
+                                  test_mpq_coalesce_func, 2, &res, i) == 0);
+  }
+  EXPECT_EQ(aosl_mpq_queued_count(q), 2);
+
+  // a different function with the same key supersedes the pending one
+  CHECK(aosl_mpq_queue_coalesce(q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, 2, "test_mpq_deadline_func",
+                                test_mpq_deadline_func, 2, &other_ran, &other_freed) == 0);
+  CHECK(aosl_mpq_queue_coalesce(q, AOSL_MPQ_INVALID, AOSL_REF_INVALID, 2, "test_mpq_coalesce_func",
+                                test_mpq_coalesce_func, 2, &res, 100) == 0);
+
+  block.release = 1;
+  CHECK(aosl_mpq_call(q, AOSL_REF_INVALID, "test_mpq_deadline_func", test_mpq_deadline_func, 2, &other_ran,
+                      &other_freed) == 0);
+  EXPECT_EQ(other_ran, 1);
+  EXPECT_EQ(other_freed, 1);
+  EXPECT_EQ(res.ran, 2);
+  EXPECT_EQ(res.freed, 4);
+  EXPECT_EQ(res.value, 100);
+  CHECK(aosl_mpq_stats_get(q, &stats) == 0);
+  EXPECT_EQ(stats.funcs_coalesced, 5);
+
+  aosl_mpq_destroy_wait(q);
+  LOG_FMT("mpq coalesce test success");
+  return 0;
+}
+
+// A fake DNS server on the loopback for the async resolver
+struct test_dns_server_res {
+  aosl_fd_t sk;
+  aosl_sockaddr_t addr;
+  int a_queries;
+};
+
+struct test_dns_result {
+  int done;
+  int count;
+  aosl_sockaddr_t addr;
+};
+
+static struct test_dns_server_res dns_server_res = { 0 };
+
+static void test_dns_server_on_data(void *data, size_t len, uintptr_t argc, uintptr_t argv[], const aosl_sk_addr_t *addr)
+{
+  UNUSED(argc);
+  UNUSED(argv);
+  const uint8_t *query = (const uint8_t *)data;
+  uint8_t resp[512];
+  size_t qend = 12;
+  size_t last = 12;
+  uint32_t ttl = 60;
+  int rcode = 0;
+  int answer = 0;
+
+  if (len < 12 || len > 300)
+    return;
+
+  // the question name ends with a 0 length label, followed by type and class
+  while (qend < len && query[qend] != 0) {
+    last = qend;
+    qend += query[qend] + 1;
+  }
+  qend += 5;
+  if (qend > len)
+    return;
+
+  int qtype = (query[qend - 4] << 8) | query[qend - 3];
+  if (qtype == 1)
+    dns_server_res.a_queries++;
+
+  if (memcmp(query + 13, "fake", 4) == 0) {
+    answer = (qtype == 1);
+  } else if (memcmp(query + 13, "long", 4) == 0) {
+    // a reply with the question one byte longer than the max length first
+    size_t l = query[last];
+    memcpy(resp, query, last);
+    resp[2] = 0x81;
+    resp[3] = 0x80;
+    resp[6] = 0;
+    resp[7] = 0;
+    resp[last] = (uint8_t)(l + 1);
+    memcpy(resp + last + 1, query + last + 1, l);
+    resp[last + 1 + l] = 'a';
+    memcpy(resp + last + 2 + l, query + last + 1 + l, 5);
+    aosl_sendto(dns_server_res.sk, resp, qend + 1, 0, &addr->sa);
+    answer = (qtype == 1);
+  } else if (memcmp(query + 13, "ttl0", 4) == 0) {
+    answer = (qtype == 1);
+    ttl = 0;
+  } else {
+    rcode = 3; // NXDOMAIN
+  }
+
+  memcpy(resp, query, qend);
+  resp[2] = 0x81; // QR, RD
+  resp[3] = 0x80 | rcode; // RA
+  resp[6] = 0;
+  resp[7] = answer;
+  size_t off = qend;
+  if (answer) {
+    const uint8_t rr[] = { 0xc0, 0x0c, 0, 1, 0, 1, (uint8_t)(ttl >> 24), (uint8_t)(ttl >> 16), (uint8_t)(ttl >> 8),
+                           (uint8_t)ttl, 0, 4, 10, 1, 2, 3 };
+    memcpy(resp + off, rr, sizeof(rr));
+    off += sizeof(rr);
+  }
+
+  aosl_sendto(dns_server_res.sk, resp, off, 0, &addr->sa);
+}
+
+static void test_dns_server_on_event(aosl_fd_t fd, int event, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(argc);
+  UNUSED(argv);
+  if (event >= 0) {
+    return;
+  }
+  LOG_FMT("fd=%d event=%d\n", fd, event);
+}
+
+static int test_dns_server_init(void *arg)
+{
+  UNUSED(arg);
+  aosl_fd_t fd = aosl_socket(AOSL_AF_INET, AOSL_SOCK_DGRAM, AOSL_IPPROTO_UDP);
+  CHECK(!aosl_fd_invalid(fd));
+
+  memset(&dns_server_res.addr, 0, sizeof(dns_server_res.addr));
+  dns_server_res.addr.sa_family = AOSL_AF_INET;
+  aosl_inet_addr_from_string(&dns_server_res.addr.sin_addr, "127.0.0.1");
+  EXPECT_EQ(aosl_bind(fd, &dns_server_res.addr), 0);
+  EXPECT_EQ(aosl_hal_sk_get_sockname(fd, &dns_server_res.addr), 0);
+  EXPECT_EQ(aosl_mpq_add_dgram_socket(fd, 512, test_dns_server_on_data, test_dns_server_on_event, 0), 0);
+  dns_server_res.sk = fd;
+  return 0;
+}
+
+static void test_dns_resolved(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+  struct test_dns_result *result = (struct test_dns_result *)argv[3];
+  aosl_sk_addrinfo_t *addrs = (aosl_sk_addrinfo_t *)argv[2];
+
+  result->count = (int)argv[1];
+  if (result->count > 0)
+    result->addr = addrs[0].sk_addr.sa;
+  result->done = 1;
+}
+
+static int test_dns_resolve(aosl_mpq_t q, const char *name, struct test_dns_result *result, aosl_sk_addrinfo_t *addrs)
+{
+  memset(result, 0, sizeof(*result));
+  return aosl_tcp_resolve_host_async(name, 8080, addrs, 4, q, test_dns_resolved, 1, result);
+}
+
+static int test_dns_wait(struct test_dns_result *result)
+{
+  aosl_ts_t start_ts = aosl_tick_ms();
+  while (!result->done && (aosl_tick_ms() - start_ts) < 5000) {
+    aosl_msleep(1);
+  }
+  return result->done ? 0 : -1;
+}
+
+// a name of the max length 253: 4 + 3 * (1 + 63) + 1 + 56
+static void test_dns_max_name(char *buf, const char *first)
+{
+  size_t off = 4;
+  int i;
+
+  memcpy(buf, first, 4);
+  for (i = 0; i < 4; i++) {
+    size_t l = (i < 3) ? 63 : 56;
+    buf[off++] = '.';
+    memset(buf + off, 'a', l);
+    off += l;
+  }
+  buf[off] = '\0';
+}
+
+static int aosl_test_mpq_dns(void)
+{
+  struct test_dns_result r1, r2;
+  aosl_sk_addrinfo_t addrs1[4], addrs2[4];
+  aosl_sk_addr_t server;
+  uint32_t expect_addr;
+  char max_name[256];
+
+  memset(&dns_server_res, 0, sizeof(dns_server_res));
+  aosl_mpq_t q = aosl_mpq_create(AOSL_THRD_PRI_DEFAULT, 0, 10000, "dns-server", test_dns_server_init, NULL, NULL);
+  CHECK(!aosl_mpq_invalid(q));
+
+  memset(&server, 0, sizeof(server));
+  server.sa = dns_server_res.addr;
+  CHECK(aosl_dns_set_servers(&server, 1) == 0);
+  aosl_inet_addr_from_string(&expect_addr, "10.1.2.3");
+
+  // the concurrent lookups of the same name share the queries
+  CHECK(test_dns_resolve(q, "fake.aosl.test", &r1, addrs1) == 0);
+  CHECK(test_dns_resolve(q, "FAKE.aosl.test.", &r2, addrs2) == 0);
+  CHECK(test_dns_wait(&r1) == 0 && test_dns_wait(&r2) == 0);
+  EXPECT_EQ(r1.count, 1);
+  EXPECT_EQ(r2.count, 1);
+  EXPECT_EQ(r1.addr.sin_addr, expect_addr);
+  EXPECT_EQ(aosl_ntohs(r1.addr.sa_port), 8080);
+  EXPECT_EQ(dns_server_res.a_queries, 1);
+
+  // cached positive answer
+  CHECK(test_dns_resolve(q, "fake.aosl.test", &r1, addrs1) == 0);
+  CHECK(test_dns_wait(&r1) == 0);
+  EXPECT_EQ(r1.count, 1);
+  EXPECT_EQ(dns_server_res.a_queries, 1);
+
+  // cached negative answer
+  CHECK(test_dns_resolve(q, "nx.aosl.test", &r1, addrs1) == 0);
+  CHECK(test_dns_wait(&r1) == 0);
+  CHECK(test_dns_resolve(q, "nx.aosl.test", &r2, addrs2) == 0);
+  CHECK(test_dns_wait(&r2) == 0);
+  EXPECT_EQ(r1.count, 0);
+  EXPECT_EQ(r2.count, 0);
+  EXPECT_EQ(dns_server_res.a_queries, 2);
+
+  // a zero TTL answer is not cached
+  CHECK(test_dns_resolve(q, "ttl0.aosl.test", &r1, addrs1) == 0);
+  CHECK(test_dns_wait(&r1) == 0);
+  CHECK(test_dns_resolve(q, "ttl0.aosl.test", &r2, addrs2) == 0);
+  CHECK(test_dns_wait(&r2) == 0);
+  EXPECT_EQ(r2.count, 1);
+  EXPECT_EQ(dns_server_res.a_queries, 4);
+
+  // numeric addresses are not sent to the server
+  CHECK(test_dns_resolve(q, "127.0.0.1", &r1, addrs1) == 0);
+  CHECK(test_dns_wait(&r1) == 0);
+  EXPECT_EQ(r1.count, 1);
+  EXPECT_EQ(dns_server_res.a_queries, 4);
+
+  // the max length names, and a reply of a longer name is dropped
+  test_dns_max_name(max_name, "fake");
+  EXPECT_EQ(strlen(max_name), 253);
+  CHECK(test_dns_resolve(q, max_name, &r1, addrs1) == 0);
+  CHECK(test_dns_wait(&r1) == 0);
+  EXPECT_EQ(r1.count, 1);
+  test_dns_max_name(max_name, "long");
+  CHECK(test_dns_resolve(q, max_name, &r1, addrs1) == 0);
+  CHECK(test_dns_wait(&r1) == 0);
+  EXPECT_EQ(r1.count, 1);
+  EXPECT_EQ(r1.addr.sin_addr, expect_addr);
+  EXPECT_EQ(dns_server_res.a_queries, 6);
+
+  CHECK(aosl_dns_set_servers(NULL, 0) == 0);
+  aosl_mpq_destroy_wait(q);
+  LOG_FMT("mpq dns test success");
+  return 0;
+}
+
+struct test_route_res {
+  int events;
+  aosl_net_ev_t ev;
+  aosl_def_rt_t def_rt;
+  int subscribed;
+};
+
+static void test_route_ev_func(aosl_net_ev_t ev, void *arg, ...)
+{
+  struct test_route_res *res = (struct test_route_res *)arg;
+  const aosl_def_rt_t *def_rt1;
+  va_list args;
+
+  va_start(args, arg);
+  def_rt1 = va_arg(args, const aosl_def_rt_t *);
+  va_end(args);
+
+  res->events++;
+  res->ev = ev;
+  memcpy(&res->def_rt, def_rt1, sizeof(res->def_rt));
+}
+
+static void test_route_subscribe_func(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  struct test_route_res *res = (struct test_route_res *)argv[0];
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+
+  if (argv[1]) {
+    res->subscribed = (aosl_subscribe_net_events(test_route_ev_func, res) == 0);
+  } else {
+    aosl_subscribe_net_events(NULL, NULL);
+  }
+}
+
+static int aosl_test_mpq_route(void)
+{
+  static struct test_route_res res;
+  aosl_def_rt_t def_rt;
+  int got;
+  uint32_t gen;
+
+  memset(&res, 0, sizeof(res));
+  aosl_mpq_t q = aosl_mpq_create(AOSL_THRD_PRI_DEFAULT, 0, 1000, "route-test", NULL, NULL, NULL);
+  CHECK(!aosl_mpq_invalid(q));
+
+  gen = aosl_def_rt_generation();
+  CHECK(aosl_mpq_call(q, AOSL_REF_INVALID, "test_route_subscribe_func", test_route_subscribe_func, 2, &res, 1) == 0);
+  if (!res.subscribed) {
+    LOG_FMT("mpq route test skipped, net events not supported");
+    aosl_mpq_destroy_wait(q);
+    return 0;
+  }
+
+  // the default route from the route cache is the same as from a dump
+  aosl_init_def_rt(&def_rt);
+  got = aosl_get_default_rt(&def_rt);
+  if (got > 0) {
+    EXPECT_EQ(res.events, 1);
+    EXPECT_EQ(res.ev, AOSL_NET_EV_NET_UP);
+    EXPECT_EQ(aosl_same_def_rt(&res.def_rt, &def_rt), 1);
+    EXPECT_EQ(res.def_rt.IPv4.if_wireless, def_rt.IPv4.if_wireless);
+    EXPECT_EQ(res.def_rt.IPv4.def_rt_cnt, def_rt.IPv4.def_rt_cnt);
+  } else {
+    EXPECT_EQ(res.events, 0);
+  }
+
+  // the monitored state is published as a new generation, and is stable while unchanged
+  CHECK(aosl_def_rt_generation() != gen);
+  gen = aosl_def_rt_generation();
+  EXPECT_EQ(aosl_network_is_down(), (got <= 0));
+  EXPECT_EQ(aosl_get_default_rt(&def_rt), got);
+  EXPECT_EQ(aosl_def_rt_generation(), gen);
+
+  CHECK(aosl_mpq_call(q, AOSL_REF_INVALID, "test_route_subscribe_func", test_route_subscribe_func, 2, &res, 0) == 0);
+  CHECK(aosl_def_rt_generation() != gen);
+  aosl_mpq_destroy_wait(q);
+  LOG_FMT("mpq route test success");
+  return 0;
+}
+
+struct test_flow_res {
+  aosl_flow_table_t ft;
+  int dtors;
+  int result;
+  // read on the queue
+  size_t count;
+  int count_dtors;
+};
+
+static void test_flow_dtor(const aosl_sk_addr_t *addr, void *data, void *arg)
+{
+  struct test_flow_res *res = (struct test_flow_res *)arg;
+  UNUSED(addr);
+  UNUSED(data);
+  res->dtors++;
+}
+
+static void test_flow_addr(aosl_sk_addr_t *addr, uint32_t ip, uint16_t port)
+{
+  memset(addr, 0, sizeof(*addr));
+  addr->in.sin_family = AOSL_AF_INET;
+  addr->in.sin_port = aosl_htons(port);
+  addr->in.sin_addr.s_addr = aosl_htonl(ip);
+}
+
+static int test_flow_ops(struct test_flow_res *res)
+{
+  aosl_sk_addr_t v4, v6, mapped;
+  int *data, *data2;
+  int created;
+  int i;
+
+  res->ft = aosl_flow_table_create(sizeof(int), 16, 50, test_flow_dtor, res);
+  CHECK(res->ft != NULL);
+
+  test_flow_addr(&v4, 0x0a000001, 5000);
+  memset(&v6, 0, sizeof(v6));
+  v6.in6.sin6_family = AOSL_AF_INET6;
+  v6.in6.sin6_port = aosl_htons(5000);
+  v6.in6.sin6_addr.s6_addr_v[0] = 0x20;
+  v6.in6.sin6_addr.s6_addr_v[1] = 0x01;
+  v6.in6.sin6_addr.s6_addr_v[15] = 1;
+  memset(&mapped, 0, sizeof(mapped));
+  mapped.in6.sin6_family = AOSL_AF_INET6;
+  mapped.in6.sin6_port = aosl_htons(5000);
+  mapped.in6.sin6_addr.s6_addr_v[10] = 0xff;
+  mapped.in6.sin6_addr.s6_addr_v[11] = 0xff;
+  mapped.in6.sin6_addr.s6_addr32_v[3] = aosl_htonl(0x0a000001);
+
+  CHECK(aosl_flow_find(res->ft, &v4) == NULL);
+  data = (int *)aosl_flow_get(res->ft, &v4, &created);
+  CHECK(data != NULL && created == 1 && *data == 0);
+  *data = 4;
+
+  // the IPv4-mapped address is the same peer as the IPv4 one
+  data2 = (int *)aosl_flow_get(res->ft, &mapped, &created);
+  CHECK(data2 == data && created == 0);
+  data2 = (int *)aosl_flow_get(res->ft, &v6, &created);
+  CHECK(data2 != NULL && data2 != data && created == 1);
+  *data2 = 6;
+  EXPECT_EQ(aosl_flow_count(res->ft), 2);
+
+  // growing keeps the flow data in place
+  for (i = 0; i < 1000; i++) {
+    test_flow_addr(&v6, 0x0b000000 + i, (uint16_t)(1000 + i));
+    CHECK(aosl_flow_get(res->ft, &v6, NULL) != NULL);
+  }
+  EXPECT_EQ(aosl_flow_count(res->ft), 1002);
+  CHECK(aosl_flow_find(res->ft, &mapped) == data);
+  EXPECT_EQ(*data, 4);
+
+  for (i = 0; i < 1000; i += 2) {
+    test_flow_addr(&v6, 0x0b000000 + i, (uint16_t)(1000 + i));
+    CHECK(aosl_flow_del(res->ft, &v6) == 0);
+  }
+  CHECK(aosl_flow_del(res->ft, &v6) < 0);
+  EXPECT_EQ(res->dtors, 500);
+  for (i = 0; i < 1000; i++) {
+    test_flow_addr(&v6, 0x0b000000 + i, (uint16_t)(1000 + i));
+    CHECK((aosl_flow_find(res->ft, &v6) != NULL) == (i & 1));
+  }
+  EXPECT_EQ(aosl_flow_count(res->ft), 502);
+  return 0;
+}
+
+static void test_flow_ops_func(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  struct test_flow_res *res = (struct test_flow_res *)argv[0];
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+  res->result = test_flow_ops(res);
+}
+
+static void test_flow_keep_func(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  struct test_flow_res *res = (struct test_flow_res *)argv[0];
+  aosl_sk_addr_t v4;
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+
+  test_flow_addr(&v4, 0x0a000001, 5000);
+  res->result = (aosl_flow_find(res->ft, &v4) != NULL) ? 0 : -1;
+}
+
+// the table and the dtors counter are only touched on the queue, as the sweep timer runs there
+static void test_flow_count_func(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  struct test_flow_res *res = (struct test_flow_res *)argv[0];
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+  res->count = aosl_flow_count(res->ft);
+  res->count_dtors = res->dtors;
+}
+
+static void test_flow_destroy_func(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc, uintptr_t argv[])
+{
+  struct test_flow_res *res = (struct test_flow_res *)argv[0];
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+  aosl_flow_table_destroy(res->ft);
+}
+
+static int aosl_test_mpq_flow(void)
+{
+  static struct test_flow_res res;
+  int i;
+
+  memset(&res, 0, sizeof(res));
+  aosl_mpq_t q = aosl_mpq_create(AOSL_THRD_PRI_DEFAULT, 0, 1000, "flow-test", NULL, NULL, NULL);
+  CHECK(!aosl_mpq_invalid(q));
+
+  CHECK(aosl_mpq_call(q, AOSL_REF_INVALID, "test_flow_ops_func", test_flow_ops_func, 1, &res) == 0);
+  CHECK(res.result == 0);
+
+  // the idle flows expire in 1 to 2.5 idle periods, except the one kept looked up
+  for (i = 0; i < 30; i++) {
+    CHECK(aosl_mpq_call(q, AOSL_REF_INVALID, "test_flow_keep_func", test_flow_keep_func, 1, &res) == 0);
+    CHECK(res.result == 0);
+    aosl_msleep(10);
+  }
+  CHECK(aosl_mpq_call(q, AOSL_REF_INVALID, "test_flow_count_func", test_flow_count_func, 1, &res) == 0);
+  EXPECT_EQ(res.count, 1);
+  EXPECT_EQ(res.count_dtors, 1001);
+
+  CHECK(aosl_mpq_call(q, AOSL_REF_INVALID, "test_flow_destroy_func", test_flow_destroy_func, 1, &res) == 0);
+  EXPECT_EQ(res.dtors, 1002);
+  aosl_mpq_destroy_wait(q);
+  LOG_FMT("mpq flow test success");
+  return 0;
+}
+
 static int aosl_test_mpq_max()
 {
   int priority = AOSL_THRD_PRI_DEFAULT; // default
@@ -2468,11 +3552,733 @@ static int aosl_test_mpq(void)
 {
   CHECK(aosl_test_mpq_api_udp() == 0);
   CHECK(aosl_test_mpq_api_tcp() == 0);
+  CHECK(aosl_test_mpqp_listen() == 0);
+  CHECK(aosl_test_mpq_listen_opts() == 0);
+  CHECK(aosl_test_mpq_flags() == 0);
+  CHECK(aosl_test_mpq_park() == 0);
+  CHECK(aosl_test_mpq_stats() == 0);
+  CHECK(aosl_test_mpq_pri() == 0);
+  CHECK(aosl_test_mpq_budget() == 0);
+  CHECK(aosl_test_mpq_deadline() == 0);
+  CHECK(aosl_test_mpq_coalesce() == 0);
+  CHECK(aosl_test_mpq_dns() == 0);
+  CHECK(aosl_test_mpq_route() == 0);
+  CHECK(aosl_test_mpq_flow() == 0);
   //CHECK(aosl_test_mpq_max() == 0);
   LOG_FMT("test success");
   return 0;
 }
 
+// Marshalling test types, with the padding, the conditional fields, the
+// nested structs and arrays, and a recursive pointer
+typedef struct test_marshal_rect {
+  int16_t x;
+  int16_t y;
+  int32_t w;
+  int32_t h;
+} test_marshal_rect_t;
+
+typedef struct test_marshal_node {
+  int32_t value;
+  struct test_marshal_node *next;
+} test_marshal_node_t;
+
+typedef struct {
+  uint8_t ver;
+  int64_t ts;
+  double ratio;
+  int32_t have;
+  int32_t have_not;
+  test_marshal_rect_t rects[3];
+  uint16_t ids_count;
+  int32_t ids[8];
+  uint16_t blob_len;
+  uint8_t blob[16];
+  char tag[12];
+  char *note;
+  aosl_dynamic_string_t name;
+  aosl_dynamic_array_t samples;
+  aosl_dynamic_array_t rect_list;
+  test_marshal_node_t *list;
+} test_marshal_msg_t;
+
+static int8_t test_marshal_have(const void *obj_addr)
+{
+  UNUSED(obj_addr);
+  return 1;
+}
+
+static int8_t test_marshal_have_not(const void *obj_addr)
+{
+  UNUSED(obj_addr);
+  return 0;
+}
+
+static const aosl_type_info_t test_marshal_rect_fields[] = {
+  { .type_id = AOSL_TYPE_INT16, .obj_addr = aosl_rela_addr(test_marshal_rect_t, x) },
+  { .type_id = AOSL_TYPE_INT16, .obj_addr = aosl_rela_addr(test_marshal_rect_t, y) },
+  { .type_id = AOSL_TYPE_INT32, .obj_addr = aosl_rela_addr(test_marshal_rect_t, w) },
+  { .type_id = AOSL_TYPE_INT32, .obj_addr = aosl_rela_addr(test_marshal_rect_t, h) },
+  AOSL_TYPE_STRUCT_END,
+};
+
+static const aosl_type_info_t test_marshal_rect_type = {
+  .type_id = AOSL_TYPE_STRUCT,
+  .obj_size = sizeof(test_marshal_rect_t),
+  .child = test_marshal_rect_fields,
+};
+
+static const aosl_type_info_t test_marshal_node_type;
+
+static const aosl_type_info_t test_marshal_node_fields[] = {
+  { .type_id = AOSL_TYPE_INT32, .obj_addr = aosl_rela_addr(test_marshal_node_t, value) },
+  { .type_id = AOSL_TYPE_POINTER, .obj_addr = aosl_rela_addr(test_marshal_node_t, next), .child = &test_marshal_node_type },
+  AOSL_TYPE_STRUCT_END,
+};
+
+static const aosl_type_info_t test_marshal_node_type = {
+  .type_id = AOSL_TYPE_STRUCT,
+  .obj_size = sizeof(test_marshal_node_t),
+  .child = test_marshal_node_fields,
+};
+
+static const aosl_type_info_t test_marshal_msg_fields[] = {
+  { .type_id = AOSL_TYPE_INT8, .obj_addr = aosl_rela_addr(test_marshal_msg_t, ver) },
+  { .type_id = AOSL_TYPE_INT64, .obj_addr = aosl_rela_addr(test_marshal_msg_t, ts) },
+  { .type_id = AOSL_TYPE_DOUBLE, .obj_addr = aosl_rela_addr(test_marshal_msg_t, ratio) },
+  { .type_id = AOSL_TYPE_INT32, .obj_addr = aosl_rela_addr(test_marshal_msg_t, have), .is_have = test_marshal_have },
+  { .type_id = AOSL_TYPE_INT32, .obj_addr = aosl_rela_addr(test_marshal_msg_t, have_not), .is_have = test_marshal_have_not },
+  { .type_id = AOSL_TYPE_FIXED_ARRAY, .obj_addr = aosl_rela_addr(test_marshal_msg_t, rects), .array_size = 3,
+    .child = &test_marshal_rect_type },
+  { .type_id = AOSL_TYPE_VAR_ARRAY, .obj_addr = aosl_rela_addr(test_marshal_msg_t, ids), .array_size = 8,
+    .count_var_addr = aosl_rela_addr(test_marshal_msg_t, ids_count), .child = &aosl_int32_type },
+  { .type_id = AOSL_TYPE_VAR_BYTES, .obj_addr = aosl_rela_addr(test_marshal_msg_t, blob), .array_size = 16,
+    .count_var_addr = aosl_rela_addr(test_marshal_msg_t, blob_len) },
+  { .type_id = AOSL_TYPE_BYTES_WITH_NIL, .obj_addr = aosl_rela_addr(test_marshal_msg_t, tag), .array_size = 12 },
+  { .type_id = AOSL_TYPE_STRING, .obj_addr = aosl_rela_addr(test_marshal_msg_t, note) },
+  { .type_id = AOSL_TYPE_DYNAMIC_STRING, .obj_addr = aosl_rela_addr(test_marshal_msg_t, name) },
+  { .type_id = AOSL_TYPE_DYNAMIC_ARRAY, .obj_addr = aosl_rela_addr(test_marshal_msg_t, samples),
+    .child = &aosl_int16_type },
+  { .type_id = AOSL_TYPE_DYNAMIC_ARRAY, .obj_addr = aosl_rela_addr(test_marshal_msg_t, rect_list),
+    .child = &test_marshal_rect_type },
+  { .type_id = AOSL_TYPE_POINTER, .obj_addr = aosl_rela_addr(test_marshal_msg_t, list), .child = &test_marshal_node_type },
+  AOSL_TYPE_STRUCT_END,
+};
+
+static const aosl_type_info_t test_marshal_msg_type = {
+  .type_id = AOSL_TYPE_STRUCT,
+  .obj_size = sizeof(test_marshal_msg_t),
+  .child = test_marshal_msg_fields,
+};
+
+// a dynamic array of the elements holding pointers
+typedef struct {
+  aosl_dynamic_array_t nodes;
+} test_marshal_nodes_t;
+
+static const aosl_type_info_t test_marshal_nodes_fields[] = {
+  { .type_id = AOSL_TYPE_DYNAMIC_ARRAY, .obj_addr = aosl_rela_addr(test_marshal_nodes_t, nodes),
+    .child = &test_marshal_node_type },
+  AOSL_TYPE_STRUCT_END,
+};
+
+static const aosl_type_info_t test_marshal_nodes_type = {
+  .type_id = AOSL_TYPE_STRUCT,
+  .obj_size = sizeof(test_marshal_nodes_t),
+  .child = test_marshal_nodes_fields,
+};
+
+// every truncated message fails, and finishing the half decoded object frees nothing else
+static int test_marshal_nodes_cut(void)
+{
+  test_marshal_node_t nodes[4];
+  test_marshal_nodes_t in;
+  test_marshal_nodes_t out;
+  aosl_psb_t *psb;
+  aosl_psb_t *cut;
+  isize_t len;
+  isize_t n;
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    nodes[i].value = i;
+    nodes[i].next = &nodes[3];
+  }
+  nodes[3].value = 3;
+  nodes[3].next = NULL;
+  aosl_dynamic_array_init_with(&in.nodes, nodes, 3);
+
+  psb = aosl_alloc_psb(256);
+  CHECK(psb != NULL);
+  len = aosl_marshal(&test_marshal_nodes_type, &in, psb);
+  CHECK(len > 0 && psb->next == NULL);
+  for (n = 1; n < len; n++) {
+    cut = aosl_alloc_psb(256);
+    CHECK(cut != NULL);
+    memcpy(aosl_psb_put(cut, (size_t)n), psb->data, (size_t)n);
+    aosl_init_typed_obj(&test_marshal_nodes_type, &out);
+    CHECK(aosl_unmarshal(&test_marshal_nodes_type, &out, cut) < 0);
+    aosl_fini_typed_obj(&test_marshal_nodes_type, &out);
+    aosl_free_psb_list(cut);
+  }
+
+  aosl_free_psb_list(psb);
+  return 0;
+}
+
+// marshal into a chain of small psbs, and flatten the chain into out
+static isize_t test_marshal_to(const test_marshal_msg_t *msg, uint8_t *out, size_t out_size)
+{
+  uint8_t buf[40];
+  aosl_psb_t *psb;
+  aosl_psb_t *p;
+  isize_t len;
+  size_t off = 0;
+
+  psb = aosl_alloc_user_psb(buf, sizeof buf);
+  if (psb == NULL)
+    return -1;
+
+  len = aosl_marshal(&test_marshal_msg_type, msg, psb);
+  for (p = psb; p != NULL && len > 0; p = p->next) {
+    if (off + p->len > out_size) {
+      len = -1;
+      break;
+    }
+
+    memcpy(out + off, p->data, p->len);
+    off += p->len;
+  }
+
+  aosl_free_psb_list(psb);
+  if (len > 0 && (size_t)len != off)
+    return -1;
+
+  return len;
+}
+
+// unmarshal from a chain of psbs holding chunk bytes each, into the arena if not NULL
+static isize_t test_marshal_from(test_marshal_msg_t *msg, const uint8_t *data, size_t len, size_t chunk,
+                                 aosl_unmarshal_arena_t *arena)
+{
+  aosl_psb_t *head = NULL;
+  aosl_psb_t **pp = &head;
+  size_t off;
+  isize_t ret = -1;
+
+  for (off = 0; off < len; off += chunk) {
+    size_t n = len - off < chunk ? len - off : chunk;
+    aosl_psb_t *psb = aosl_alloc_psb(chunk);
+    if (psb == NULL)
+      goto __out;
+
+    *pp = psb;
+    pp = &psb->next;
+    memcpy(aosl_psb_put(psb, n), data + off, n);
+  }
+
+  aosl_init_typed_obj(&test_marshal_msg_type, msg);
+  if (arena != NULL) {
+    ret = aosl_unmarshal_arena(&test_marshal_msg_type, msg, head, arena);
+  } else {
+    ret = aosl_unmarshal(&test_marshal_msg_type, msg, head);
+  }
+
+__out:
+  if (head != NULL)
+    aosl_free_psb_list(head);
+
+  return ret;
+}
+
+static int test_marshal_check(const test_marshal_msg_t *out, const test_marshal_msg_t *msg)
+{
+  EXPECT_EQ(out->ver, 3);
+  CHECK(out->ts == msg->ts && out->ratio == msg->ratio);
+  EXPECT_EQ(out->have, 7);
+  EXPECT_EQ(out->have_not, 0);
+  CHECK(memcmp(out->rects, msg->rects, sizeof msg->rects) == 0);
+  EXPECT_EQ(out->ids_count, 5);
+  CHECK(memcmp(out->ids, msg->ids, sizeof(int32_t) * 5) == 0);
+  EXPECT_EQ(out->blob_len, 4);
+  CHECK(memcmp(out->blob, msg->blob, 4) == 0);
+  CHECK(strcmp(out->tag, "marshal") == 0);
+  CHECK(out->note != NULL && strcmp(out->note, "a note") == 0);
+  CHECK(strcmp(aosl_dynamic_string_c_str(out->name), "compiled plan") == 0);
+  EXPECT_EQ(out->samples.count, 100);
+  CHECK(memcmp(out->samples.values, msg->samples.values, sizeof(int16_t) * 100) == 0);
+  EXPECT_EQ(out->rect_list.count, 2);
+  CHECK(memcmp(out->rect_list.values, msg->rect_list.values, sizeof(test_marshal_rect_t) * 2) == 0);
+  CHECK(out->list != NULL && out->list->value == 1);
+  CHECK(out->list->next != NULL && out->list->next->value == 2);
+  CHECK(out->list->next->next != NULL && out->list->next->next->value == 3);
+  CHECK(out->list->next->next->next == NULL);
+  return 0;
+}
+
+static int aosl_test_marshal(void)
+{
+  test_marshal_msg_t msg;
+  test_marshal_msg_t out;
+  test_marshal_node_t nodes[3];
+  test_marshal_rect_t rect_list[2];
+  int16_t samples[100];
+  uint64_t arena_buf[256];
+  aosl_unmarshal_arena_t arena;
+  uint8_t *wire1;
+  uint8_t *wire2;
+  isize_t len1;
+  isize_t len2;
+  int i;
+
+  memset(&msg, 0, sizeof msg);
+  msg.ver = 3;
+  msg.ts = 0x0102030405060708ll;
+  msg.ratio = 0.25;
+  msg.have = 7;
+  msg.have_not = 9;
+  for (i = 0; i < 3; i++) {
+    msg.rects[i].x = (int16_t)i;
+    msg.rects[i].y = (int16_t)-i;
+    msg.rects[i].w = 100 * i;
+    msg.rects[i].h = 200 * i;
+  }
+  msg.ids_count = 5;
+  for (i = 0; i < 5; i++)
+    msg.ids[i] = 1000 + i;
+  msg.blob_len = 4;
+  memcpy(msg.blob, "\x01\x02\x03\x04", 4);
+  strcpy(msg.tag, "marshal");
+  msg.note = "a note";
+  aosl_dynamic_string_init(&msg.name);
+  CHECK(aosl_dynamic_string_strcpy(&msg.name, "compiled plan") == 0);
+  for (i = 0; i < 100; i++)
+    samples[i] = (int16_t)(i * 3 - 150);
+  aosl_dynamic_array_init_with(&msg.samples, samples, 100);
+  for (i = 0; i < 2; i++) {
+    rect_list[i].x = 10;
+    rect_list[i].y = 20;
+    rect_list[i].w = 30 + i;
+    rect_list[i].h = 40 + i;
+  }
+  aosl_dynamic_array_init_with(&msg.rect_list, rect_list, 2);
+  for (i = 0; i < 3; i++) {
+    nodes[i].value = i + 1;
+    nodes[i].next = i < 2 ? &nodes[i + 1] : NULL;
+  }
+  msg.list = &nodes[0];
+
+  wire1 = aosl_malloc(1024);
+  wire2 = aosl_malloc(1024);
+  CHECK(wire1 != NULL && wire2 != NULL);
+
+  // the interpreted encoding first, then the compiled one must be identical
+  len1 = test_marshal_to(&msg, wire1, 1024);
+  CHECK(len1 > 0);
+  CHECK(test_marshal_from(&out, wire1, (size_t)len1, 5, NULL) == len1);
+  CHECK(test_marshal_check(&out, &msg) == 0);
+  aosl_fini_typed_obj(&test_marshal_msg_type, &out);
+  CHECK(test_marshal_from(&out, wire1, (size_t)len1 - 3, 5, NULL) < 0);
+  aosl_fini_typed_obj(&test_marshal_msg_type, &out);
+
+  // without a plan the arena grows on demand
+  aosl_unmarshal_arena_init(&arena, arena_buf, 64);
+  CHECK(test_marshal_from(&out, wire1, (size_t)len1, 5, &arena) == len1);
+  CHECK(test_marshal_check(&out, &msg) == 0);
+  CHECK(arena.blocks != NULL);
+  aosl_unmarshal_arena_fini(&arena);
+  CHECK(arena.blocks == NULL);
+  CHECK(aosl_type_compile(&test_marshal_msg_type) == 0);
+  CHECK(aosl_type_compile(&test_marshal_msg_type) == 0);
+  len2 = test_marshal_to(&msg, wire2, 1024);
+  EXPECT_EQ(len2, len1);
+  CHECK(memcmp(wire1, wire2, (size_t)len1) == 0);
+
+  // decode across the psb boundaries
+  CHECK(test_marshal_from(&out, wire2, (size_t)len2, 7, NULL) == len2);
+  CHECK(test_marshal_check(&out, &msg) == 0);
+  aosl_fini_typed_obj(&test_marshal_msg_type, &out);
+
+  // a truncated message must fail
+  CHECK(test_marshal_from(&out, wire2, (size_t)len2 - 3, 16, NULL) < 0);
+  aosl_fini_typed_obj(&test_marshal_msg_type, &out);
+  CHECK(test_marshal_nodes_cut() == 0);
+  CHECK(aosl_type_compile(&test_marshal_nodes_type) == 0);
+  CHECK(test_marshal_nodes_cut() == 0);
+
+  // the scanned sizes fit in the buffer, or in exactly one block
+  aosl_unmarshal_arena_init(&arena, arena_buf, sizeof arena_buf);
+  CHECK(test_marshal_from(&out, wire2, (size_t)len2, 7, &arena) == len2);
+  CHECK(test_marshal_check(&out, &msg) == 0);
+  CHECK(arena.blocks == NULL && arena.used > 0);
+  EXPECT_EQ(out.samples.allocated, 0);
+  aosl_unmarshal_arena_fini(&arena);
+
+  aosl_unmarshal_arena_init(&arena, NULL, 0);
+  CHECK(test_marshal_from(&out, wire2, (size_t)len2, 7, &arena) == len2);
+  CHECK(test_marshal_check(&out, &msg) == 0);
+  // only one block, whose first field links the next one
+  CHECK(arena.blocks != NULL && *(void **)arena.blocks == NULL);
+  CHECK(test_marshal_from(&out, wire2, (size_t)len2 - 3, 16, &arena) < 0);
+  aosl_unmarshal_arena_fini(&arena);
+
+  aosl_dynamic_string_fini(&msg.name);
+  aosl_free(wire1);
+  aosl_free(wire2);
+  LOG_FMT("marshal test success");
+  return 0;
+}
+
+static void test_psb_alloc_on_q(const aosl_ts_t *queued_ts_p, aosl_refobj_t robj, uintptr_t argc,
+                                uintptr_t argv[])
+{
+  aosl_psb_t *psb = (aosl_psb_t *)argv[0];
+  aosl_psb_t **clone_p = (aosl_psb_t **)argv[1];
+  aosl_psb_t *tmp;
+  UNUSED(queued_ts_p);
+  UNUSED(robj);
+  UNUSED(argc);
+
+  // the blocks come from the queue pool, and a recycled one is reused
+  tmp = aosl_alloc_psb(4096);
+  if (tmp != NULL)
+    aosl_free_psb_list(tmp);
+  *clone_p = aosl_psb_clone(psb);
+}
+
+static int aosl_test_psb(void)
+{
+  aosl_psb_t *psb;
+  aosl_psb_t *c1;
+  aosl_psb_t *c2;
+  aosl_psb_t *user;
+  char user_buf[32];
+  uint8_t *p;
+  aosl_mpq_t q;
+
+  psb = aosl_alloc_psb(4096);
+  CHECK(psb != NULL);
+  CHECK(aosl_psb_reserve(psb, 16) == 0);
+  p = (uint8_t *)aosl_psb_put(psb, 5);
+  CHECK(p != NULL);
+  memcpy(p, "hello", 5);
+  psb->next = aosl_alloc_psb(64);
+  CHECK(psb->next != NULL);
+  memcpy(aosl_psb_put(psb->next, 3), "abc", 3);
+
+  // the clones share the data without copying
+  c1 = aosl_psb_clone(psb);
+  c2 = aosl_psb_clone(psb);
+  CHECK(c1 != NULL && c2 != NULL);
+  CHECK(c1->data == psb->data && c2->data == psb->data);
+  CHECK(c1->next != NULL && c1->next->data == psb->next->data);
+  EXPECT_EQ(aosl_psb_total_len(c1), 8);
+  EXPECT_EQ(aosl_psb_headroom(c1), 16);
+
+  // writing a shared segment copies it first
+  p = (uint8_t *)aosl_psb_put(c1, 1);
+  CHECK(p != NULL);
+  *p = '!';
+  CHECK(c1->data != psb->data);
+  EXPECT_EQ(aosl_psb_len(c1), 6);
+  EXPECT_EQ(aosl_psb_len(psb), 5);
+  CHECK(memcmp(c1->data, "hello!", 6) == 0);
+  p = (uint8_t *)aosl_psb_push(c2, 2);
+  CHECK(p != NULL);
+  memcpy(p, "<<", 2);
+  CHECK(c2->data != psb->data);
+  CHECK(memcmp(c2->data, "<<hello", 7) == 0);
+  CHECK(memcmp(psb->data, "hello", 5) == 0);
+
+  // the original could go first, the clones keep the data alive
+  aosl_free_psb_list(psb);
+  CHECK(memcmp(c1->next->data, "abc", 3) == 0);
+  CHECK(aosl_psb_unshare(c1->next) == 0);
+  CHECK(memcmp(c1->next->data, "abc", 3) == 0);
+  aosl_free_psb_list(c2);
+  aosl_free_psb_list(c1);
+
+  // a user buffer is copied
+  user = aosl_alloc_user_psb(user_buf, sizeof user_buf);
+  CHECK(user != NULL);
+  memcpy(aosl_psb_put(user, 4), "user", 4);
+  c1 = aosl_psb_clone(user);
+  CHECK(c1 != NULL && c1->data != user->data);
+  CHECK(memcmp(c1->data, "user", 4) == 0);
+  aosl_free_psb_list(user);
+  aosl_free_psb_list(c1);
+
+  // cloned on a queue thread, freed in this thread
+  psb = aosl_alloc_psb(2048);
+  CHECK(psb != NULL);
+  memcpy(aosl_psb_put(psb, 4), "pool", 4);
+  q = aosl_mpq_create(AOSL_THRD_PRI_DEFAULT, 0, 100, "psb-test", NULL, NULL, NULL);
+  CHECK(!aosl_mpq_invalid(q));
+  c1 = NULL;
+  CHECK(aosl_mpq_call(q, AOSL_REF_INVALID, "test_psb_alloc_on_q", test_psb_alloc_on_q, 2, psb, &c1) == 0);
+  aosl_mpq_destroy_wait(q);
+  CHECK(c1 != NULL && c1->data == psb->data);
+  aosl_free_psb_list(psb);
+  CHECK(memcmp(c1->data, "pool", 4) == 0);
+  aosl_free_psb_list(c1);
+
+  LOG_FMT("psb test success");
+  return 0;
+}
+
+static char test_log_last[1024];
+static int test_log_count;
+
+static void test_log_sink(int level, const char *fmt, va_list args)
+{
+  UNUSED(level);
+  vsnprintf(test_log_last, sizeof test_log_last, fmt, args);
+  test_log_count++;
+}
+
+static void test_log_expect(char *buf, size_t size, const char *fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(buf, size, fmt, args);
+  va_end(args);
+}
+
+static int aosl_test_log(void)
+{
+  static const char *fmt = "%d|%5.2f|%s|%-4s|%x|%hhd|%lld|%zu|%c|%%|%*d|%.*s|%08.3e|%p|%s";
+  char expect[1024];
+  char big[600];
+  char unterminated[4];
+  // volatile, or the compiler warns about the NULL passed to %s
+  const char *volatile null_str = NULL;
+  aosl_log_stats_t stats;
+  int old_level = aosl_get_log_level();
+  int i;
+
+  test_log_expect(expect, sizeof expect, fmt, -42, 3.14159, "str", "ab", 0xbeefu, (signed char)-3, -1234567890123ll,
+                  (size_t)77, 'z', 6, 9, 3, "abcdef", 12345.678, (void *)expect, "tail");
+  aosl_set_log_level(AOSL_LOG_DEBUG);
+  aosl_set_vlog_func(test_log_sink);
+  CHECK(aosl_log_set_async(1) == 0);
+
+  // the args are captured, and formatted later by the drainer
+  aosl_log(AOSL_LOG_INFO, fmt, -42, 3.14159, "str", "ab", 0xbeefu, (signed char)-3, -1234567890123ll,
+           (size_t)77, 'z', 6, 9, 3, "abcdef", 12345.678, (void *)expect, "tail");
+  aosl_log_flush();
+  EXPECT_EQ(test_log_count, 1);
+  CHECK(strcmp(test_log_last, expect) == 0);
+  aosl_log(AOSL_LOG_INFO, "null %s", null_str);
+  aosl_log_flush();
+  CHECK(strcmp(test_log_last, "null (null)") == 0);
+
+  // a string with the precision need not be terminated
+  memcpy(unterminated, "abcd", sizeof unterminated);
+  aosl_log(AOSL_LOG_INFO, "%.3s|%.*s|%-3.1s|", unterminated, 2, unterminated, unterminated);
+  aosl_log_flush();
+  CHECK(strcmp(test_log_last, "abc|ab|a  |") == 0);
+
+  // the unsupported specs are formatted in place
+  aosl_log(AOSL_LOG_INFO, "%ls|%d", L"w", 5);
+  aosl_log_flush();
+  CHECK(strcmp(test_log_last, "w|5") == 0);
+
+  // the long strings are cut, and a full ring drops the messages
+  memset(big, 'b', sizeof big - 1);
+  big[sizeof big - 1] = '\0';
+  for (i = 0; i < 200; i++)
+    aosl_log(AOSL_LOG_INFO, "%s", big);
+  aosl_log_get_stats(&stats);
+  CHECK(stats.overflow >= 1 && stats.dropped >= 1);
+  EXPECT_EQ(stats.queued + stats.dropped, 204);
+
+  // the queued messages are all out after disabling
+  test_log_count = 0;
+  aosl_log(AOSL_LOG_INFO, "last %d", 1);
+  CHECK(aosl_log_set_async(0) == 0);
+  CHECK(strcmp(test_log_last, "last 1") == 0);
+  aosl_log(AOSL_LOG_INFO, "sync %d", 2);
+  CHECK(strcmp(test_log_last, "sync 2") == 0);
+
+  aosl_set_vlog_func(NULL);
+  aosl_set_log_level(old_level);
+  LOG_FMT("log test success");
+  return 0;
+}
+
+struct test_hash_entry {
+  struct aosl_hash_node node;
+  uintptr_t key;
+};
+
+#define TEST_HASH_COUNT 10000
+
+// only 3 hash values for the colliding keys, the keys are compared anyway
+static uintptr_t test_hash_of(uintptr_t key, int collide)
+{
+  return collide ? key % 3 : aosl_hash_uintptr(key);
+}
+
+static struct test_hash_entry *test_hash_find(struct aosl_hash_table *ht, uintptr_t key, int collide)
+{
+  struct aosl_hash_node *node;
+  struct test_hash_entry *e;
+
+  aosl_hash_for_each_possible(ht, node, test_hash_of(key, collide)) {
+    e = aosl_hash_entry(node, struct test_hash_entry, node);
+    if (e->key == key)
+      return e;
+  }
+
+  return NULL;
+}
+
+static int test_hash_count_func(struct aosl_hash_node *node, void *arg)
+{
+  UNUSED(node);
+  (*(int *)arg)++;
+  return 0;
+}
+
+static int test_hash_run(uint32_t flags, int count, int collide)
+{
+  static struct test_hash_entry entries[TEST_HASH_COUNT];
+  struct aosl_hash_table ht;
+  int walked;
+  int i;
+
+  aosl_hash_init(&ht, flags);
+  for (i = 0; i < count; i++) {
+    entries[i].key = (uintptr_t)i * 7;
+    aosl_hash_add(&ht, &entries[i].node, test_hash_of(entries[i].key, collide));
+    // the earlier ones are still found while the table is being resized
+    CHECK(test_hash_find(&ht, entries[i / 2].key, collide) == &entries[i / 2]);
+  }
+  EXPECT_EQ(ht.count, count);
+
+  for (i = 0; i < count; i++)
+    CHECK(test_hash_find(&ht, entries[i].key, collide) == &entries[i]);
+  CHECK(test_hash_find(&ht, 1, collide) == NULL);
+
+  for (i = 0; i < count; i += 2)
+    aosl_hash_del(&ht, &entries[i].node);
+  EXPECT_EQ(ht.count, count / 2);
+
+  walked = 0;
+  aosl_hash_traverse(&ht, test_hash_count_func, &walked);
+  EXPECT_EQ(walked, count / 2);
+
+  for (i = 0; i < count; i++)
+    CHECK(test_hash_find(&ht, entries[i].key, collide) == ((i & 1) ? &entries[i] : NULL));
+
+  // shrinks as the nodes go, the remaining ones are still found
+  for (i = 1; i < count - 2; i += 2)
+    aosl_hash_del(&ht, &entries[i].node);
+  CHECK(ht.mask < 64);
+  CHECK(test_hash_find(&ht, entries[count - 1].key, collide) == &entries[count - 1]);
+
+  walked = 0;
+  aosl_hash_fini(&ht, test_hash_count_func, &walked);
+  EXPECT_EQ(walked, 1);
+  EXPECT_EQ(ht.count, 0);
+  CHECK(test_hash_find(&ht, entries[count - 1].key, collide) == NULL);
+  return 0;
+}
+
+static int aosl_test_hash(void)
+{
+  CHECK(test_hash_run(0, TEST_HASH_COUNT, 0) == 0);
+  CHECK(test_hash_run(AOSL_HASH_F_CONCURRENT_READ, TEST_HASH_COUNT, 0) == 0);
+  CHECK(test_hash_run(0, 300, 1) == 0);
+  LOG_FMT("hash test success");
+  return 0;
+}
+
+struct test_rb_entry {
+  struct aosl_rb_node node;
+  int key;
+  int seq;
+};
+
+#define test_rb_key(e) ((e)->key)
+
+AOSL_RB_DEFINE(test_rb, struct test_rb_entry, node, int, test_rb_key, AOSL_RB_CMP)
+
+#define TEST_RB_COUNT 1000
+
+static int aosl_test_rbtree(void)
+{
+  static struct test_rb_entry entries[TEST_RB_COUNT];
+  static struct test_rb_entry dups[3];
+  struct aosl_rb_root root;
+  struct aosl_rb_root_cached croot;
+  struct aosl_rb_node *node;
+  struct test_rb_entry *e;
+  int i, prev;
+
+  // unique keys in a scrambled order
+  aosl_rb_root_init(&root, NULL);
+  for (i = 0; i < TEST_RB_COUNT; i++) {
+    entries[i].key = (i * 7919) % TEST_RB_COUNT;
+    CHECK(test_rb_insert(&root, &entries[i]) == NULL);
+  }
+  EXPECT_EQ(root.count, TEST_RB_COUNT);
+  dups[0].key = entries[10].key;
+  CHECK(test_rb_insert(&root, &dups[0]) == &entries[10]);
+  EXPECT_EQ(root.count, TEST_RB_COUNT);
+
+  for (i = 0; i < TEST_RB_COUNT; i++)
+    CHECK(test_rb_find(&root, entries[i].key) == &entries[i]);
+  CHECK(test_rb_find(&root, TEST_RB_COUNT) == NULL);
+
+  prev = -1;
+  for (node = aosl_rb_first(&root); node != NULL; node = aosl_rb_next(node)) {
+    e = aosl_rb_entry(node, struct test_rb_entry, node);
+    EXPECT_EQ(e->key, prev + 1);
+    prev = e->key;
+  }
+  EXPECT_EQ(prev, TEST_RB_COUNT - 1);
+
+  for (i = 0; i < TEST_RB_COUNT; i += 2)
+    CHECK(test_rb_remove(&root, entries[i].key) == &entries[i]);
+  CHECK(test_rb_remove(&root, entries[0].key) == NULL);
+  EXPECT_EQ(root.count, TEST_RB_COUNT / 2);
+  for (i = 1; i < TEST_RB_COUNT; i += 2)
+    CHECK(test_rb_find(&root, entries[i].key) == &entries[i]);
+
+  // the equal keys are kept in the insertion order, the leftmost is cached
+  aosl_rb_root_cached_init(&croot);
+  CHECK(aosl_rb_first_cached(&croot) == NULL);
+  for (i = 0; i < 3; i++) {
+    dups[i].key = 5;
+    dups[i].seq = i;
+    test_rb_add_cached(&croot, &dups[i]);
+  }
+  for (i = 0; i < 20; i++) {
+    entries[i].key = 20 - i;
+    aosl_rb_clear_node(&entries[i].node);
+    CHECK(aosl_rb_node_empty(&entries[i].node));
+    test_rb_add_cached(&croot, &entries[i]);
+    CHECK(!aosl_rb_node_empty(&entries[i].node));
+  }
+  for (i = 1; i <= 20; i++) {
+    if (i == 5) {
+      for (prev = 0; prev < 3; prev++) {
+        e = aosl_rb_entry(aosl_rb_first_cached(&croot), struct test_rb_entry, node);
+        CHECK(e == &dups[prev]);
+        aosl_rb_erase_cached(&croot, &e->node);
+      }
+    }
+    e = aosl_rb_entry(aosl_rb_first_cached(&croot), struct test_rb_entry, node);
+    EXPECT_EQ(e->key, i);
+    aosl_rb_erase_cached(&croot, &e->node);
+  }
+  CHECK(aosl_rb_first_cached(&croot) == NULL);
+  EXPECT_EQ(croot.rb_root.count, 0);
+  LOG_FMT("rbtree test success");
+  return 0;
+}
+
 __export_in_so__ void aosl_test(void)
 {
   LOG_FMT("Start AOSL test...");
@@ -2481,6 +4287,11 @@ __export_in_so__ void aosl_test(void)
 
   aosl_test_hal();
   aosl_test_mpq();
+  aosl_test_marshal();
+  aosl_test_psb();
+  aosl_test_log();
+  aosl_test_hash();
+  aosl_test_rbtree();
 
   aosl_dtor();
 